@@ -1,100 +1,96 @@
 #include "buffer.hpp"
 
-void Buffer::create(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties) {
+VkBuffer Buffer::createHandle() {
     VkBufferCreateInfo bufferCreateInfo = {};
     bufferCreateInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-    bufferCreateInfo.size = size;
-    bufferCreateInfo.usage = usage;
-    bufferCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    bufferCreateInfo.size = _size;
+    bufferCreateInfo.usage = _usage;
+
+    // Buffers are shared with the dedicated transfer queue (if there is one) to avoid ownership transfers
+    const QueueFamilyIndices& queueFamilyIndices = _physicaldevice->queuefamilies;
+    uint32_t queueFamilyIndexValues[] = {queueFamilyIndices.graphicsComputeFamily.value(), queueFamilyIndices.transferFamily.value_or(0)};
+
+    if (queueFamilyIndices.transferFamily.has_value()) {
+        bufferCreateInfo.sharingMode = VK_SHARING_MODE_CONCURRENT;
+        bufferCreateInfo.queueFamilyIndexCount = 2;
+        bufferCreateInfo.pQueueFamilyIndices = queueFamilyIndexValues;
+    } else {
+        bufferCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    }
 
-    VkResult create_vertex_buffer_result = vkCreateBuffer(_device, &bufferCreateInfo, nullptr, &buffer);
-    if (create_vertex_buffer_result != VK_SUCCESS) {
-        throw vulkan_error("Failed to create vertex buffer!", create_vertex_buffer_result);
+    VkBuffer handle;
+    VkResult create_buffer_result = vkCreateBuffer(_device, &bufferCreateInfo, nullptr, &handle);
+    if (create_buffer_result != VK_SUCCESS) {
+        throw vulkan_error("Failed to create buffer!", create_buffer_result);
     }
+    return handle;
+}
+
+void Buffer::create(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties) {
+    _size = size;
+    _usage = usage;
+    buffer = createHandle();
 
     VkMemoryRequirements bufferMemoryRequirements = {};
     vkGetBufferMemoryRequirements(_device, buffer, &bufferMemoryRequirements);
 
-    VkMemoryAllocateInfo bufferMemoryAllocationInfo = {};
-    bufferMemoryAllocationInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-    bufferMemoryAllocationInfo.allocationSize = bufferMemoryRequirements.size;
-    bufferMemoryAllocationInfo.memoryTypeIndex = _physicaldevice->findMemoryType(bufferMemoryRequirements.memoryTypeBits,
-                                                                properties);
-
-    VkResult buffer_memory_allocation_result = vkAllocateMemory(_device, &bufferMemoryAllocationInfo, nullptr, &memory);
-    if (buffer_memory_allocation_result != VK_SUCCESS) {
-        throw vulkan_error("Failed to allocate buffer memory!", buffer_memory_allocation_result);
-    }
+    allocation = _allocator->allocate(bufferMemoryRequirements, properties, ResourceKind::Buffer);
+    mapping = allocation.mapping;
 
-    VkResult vertex_memory_bind_result = vkBindBufferMemory(_device, buffer, memory, 0);
-    if (vertex_memory_bind_result != VK_SUCCESS) {
-        throw vulkan_error("Failed to bind buffer memory to buffer!", vertex_memory_bind_result);
+    VkResult buffer_memory_bind_result = vkBindBufferMemory(_device, buffer, allocation.memory, allocation.offset);
+    if (buffer_memory_bind_result != VK_SUCCESS) {
+        throw vulkan_error("Failed to bind buffer memory to buffer!", buffer_memory_bind_result);
     }
 }
 
-void Buffer::copy(VkBuffer targetBuffer, VkDeviceSize size, VkCommandPool commandPool, VkQueue copyQueue) {
-    VkCommandBufferAllocateInfo allocationInfo{};
-    allocationInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-    allocationInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-    allocationInfo.commandPool = commandPool;
-    allocationInfo.commandBufferCount = 1;
-
-    VkCommandBuffer commandBuffer;
-    vkAllocateCommandBuffers(_device, &allocationInfo, &commandBuffer);
-
-    VkCommandBufferBeginInfo beginInfo{};
-    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
-
-    vkBeginCommandBuffer(commandBuffer, &beginInfo);
-
-    VkBufferCopy copyRegion = {};
-    copyRegion.srcOffset = 0;
-    copyRegion.dstOffset = 0;
-    copyRegion.size = size;
-    vkCmdCopyBuffer(commandBuffer, buffer, targetBuffer, 1, &copyRegion);
-
-    vkEndCommandBuffer(commandBuffer);
-
-    VkSubmitInfo submitInfo{};
-    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-    submitInfo.commandBufferCount = 1;
-    submitInfo.pCommandBuffers = &commandBuffer;
+void Buffer::createOnDevice(VkDeviceSize size, VkBufferUsageFlags usage, bool relocatable) {
+    VkBufferUsageFlags relocationUsage = relocatable ? VK_BUFFER_USAGE_TRANSFER_SRC_BIT : 0;
+    this->create(size, VK_BUFFER_USAGE_TRANSFER_DST_BIT | relocationUsage | usage, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
 
-    vkQueueSubmit(copyQueue, 1, &submitInfo, VK_NULL_HANDLE);
-    vkQueueWaitIdle(copyQueue);
-
-    vkFreeCommandBuffers(_device, commandPool, 1, &commandBuffer);
+    if (relocatable) {
+        _allocator->setRelocatable(allocation, this);
+    }
 }
 
+// Host visible memory is persistently mapped by the allocator
+void Buffer::createOnHost(VkDeviceSize size, VkBufferUsageFlags usage) {
+    this->create(size, usage, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+}
 
-void Buffer::createOnDevice(VkDeviceSize size, void* data, VkBufferUsageFlags usage, VkCommandPool commandPool, VkQueue copyQueue) {
+void Buffer::createForReadback(VkDeviceSize size) {
+    this->create(size, VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_CACHED_BIT);
+}
 
-    Buffer stagingBuffer(_device, _physicaldevice);
-    stagingBuffer.create(size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-                         VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+void Buffer::invalidate(VkDeviceSize offset, VkDeviceSize size) {
+    _allocator->invalidate(allocation, offset, size);
+}
 
-    vkMapMemory(_device, stagingBuffer.memory, 0, size, 0, &mapping);
-    memcpy(mapping, data, (size_t) size);
-    vkUnmapMemory(_device, stagingBuffer.memory);
-    mapping = nullptr;
+// Moves the contents into a new buffer bound to the destination. The old buffer and its memory stay
+// valid until the caller has made sure the copy and every earlier use of it have finished.
+VkBuffer Buffer::relocate(const Allocation& destination, VkCommandBuffer commandBuffer) {
+    VkBuffer oldBuffer = buffer;
 
-    this->create(size, VK_BUFFER_USAGE_TRANSFER_DST_BIT | usage,VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    buffer = createHandle();
+    VkResult buffer_memory_bind_result = vkBindBufferMemory(_device, buffer, destination.memory, destination.offset);
+    if (buffer_memory_bind_result != VK_SUCCESS) {
+        throw vulkan_error("Failed to bind buffer memory to buffer!", buffer_memory_bind_result);
+    }
 
-    stagingBuffer.copy(buffer, size, commandPool, copyQueue);
-}
+    VkBufferCopy copyRegion = {};
+    copyRegion.size = _size;
+    vkCmdCopyBuffer(commandBuffer, oldBuffer, buffer, 1, &copyRegion);
 
-void Buffer::createOnHost(VkDeviceSize size, VkBufferUsageFlags usage) {
-    this->create(size, usage, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+    allocation = destination;
+    mapping = allocation.mapping;
 
-    vkMapMemory(_device, memory, 0, size, 0, &mapping);
+    return oldBuffer;
 }
 
 
-Buffer::Buffer(VkDevice device, PhysicalDevice* physicalDevice)
-: _device(device), _physicaldevice(physicalDevice), mapping(nullptr), buffer(nullptr), memory(nullptr) {}
+Buffer::Buffer(VkDevice device, PhysicalDevice* physicalDevice, MemoryAllocator* allocator)
+: _device(device), _physicaldevice(physicalDevice), _allocator(allocator), _size(0), _usage(0), buffer(nullptr), mapping(nullptr) {}
 
 Buffer::~Buffer() {
     vkDestroyBuffer(_device, buffer, nullptr);
-    vkFreeMemory(_device, memory, nullptr);
-}
\ No newline at end of file
+    _allocator->free(allocation);
+}
@@ -2,22 +2,36 @@
 
 #include "vulkan_tools.hpp"
 #include "physicaldevice.hpp"
+#include "memory.hpp"
 
-class Buffer {
+// A VkBuffer bound to a range of memory sub-allocated from the MemoryAllocator
+class Buffer : public Relocatable {
 private:
     VkDevice _device;
     PhysicalDevice* _physicaldevice;
+    MemoryAllocator* _allocator;
 
+    VkDeviceSize _size;
+    VkBufferUsageFlags _usage;
+
+    VkBuffer createHandle();
     void create(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties);
-    void copy(VkBuffer targetBuffer, VkDeviceSize size, VkCommandPool commandPool, VkQueue queue);
 public:
     VkBuffer buffer;
-    VkDeviceMemory memory;
+    Allocation allocation;
     void* mapping;
 
-    void createOnDevice(VkDeviceSize size, void* data, VkBufferUsageFlags usage, VkCommandPool commandPool, VkQueue copyQueue);
+    // Device local buffers are filled through the UploadManager.
+    // Relocatable buffers may be moved by defragmentation, so their handle must not be kept in descriptor sets.
+    void createOnDevice(VkDeviceSize size, VkBufferUsageFlags usage, bool relocatable = false);
     void createOnHost(VkDeviceSize size, VkBufferUsageFlags usage);
+    // Host cached memory for data copied back from the device, reads need invalidate() first
+    void createForReadback(VkDeviceSize size);
+
+    void invalidate(VkDeviceSize offset, VkDeviceSize size);
+
+    VkBuffer relocate(const Allocation& destination, VkCommandBuffer commandBuffer) override;
 
-    Buffer(VkDevice device, PhysicalDevice* physicalDevice);
+    Buffer(VkDevice device, PhysicalDevice* physicalDevice, MemoryAllocator* allocator);
     ~Buffer();
 };
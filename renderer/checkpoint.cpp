@@ -0,0 +1,81 @@
+#include "checkpoint.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdio>
+#include <fstream>
+
+using std::string;
+
+Checkpoint::Checkpoint(const string& path, bool writable): _file(path, writable), header(), particles(nullptr), writableparticles(nullptr) {
+    // Every version has the fields before the field state
+    if (_file.size < offsetof(CheckpointHeader, field)) {
+        throw std::runtime_error(path + " is not a checkpoint!");
+    }
+    memcpy(&header, _file.data, offsetof(CheckpointHeader, field));
+
+    if (memcmp(header.magic, CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC)) != 0) {
+        throw std::runtime_error(path + " is not a checkpoint!");
+    }
+    if (header.version > CHECKPOINT_VERSION) {
+        throw std::runtime_error(path + " was written by a newer version (" + std::to_string(header.version) + ")!");
+    }
+    if (header.byteordermark != CHECKPOINT_BYTE_ORDER_MARK) {
+        throw std::runtime_error(path + " was written on a machine with a different byte order!");
+    }
+    if (header.headersize < offsetof(CheckpointHeader, field) || header.headersize > _file.size) {
+        throw std::runtime_error(path + " is truncated or corrupt!");
+    }
+    // Older headers are shorter, fields they don't have stay zero
+    memcpy(&header, _file.data, std::min<size_t>(header.headersize, sizeof(CheckpointHeader)));
+    if (header.particlesize != sizeof(Particle)) {
+        throw std::runtime_error(path + " stores particles of a different layout!");
+    }
+    if (header.payloadsize != header.particlecount * header.particlesize
+        || header.payloadoffset % CHECKPOINT_PAYLOAD_ALIGNMENT != 0
+        || header.payloadoffset + header.payloadsize > _file.size) {
+        throw std::runtime_error(path + " is truncated or corrupt!");
+    }
+
+    particles = reinterpret_cast<const Particle*>(_file.data + header.payloadoffset);
+    if (writable) {
+        writableparticles = reinterpret_cast<Particle*>(_file.writabledata + header.payloadoffset);
+    }
+}
+
+void writeCheckpoint(const string& path, const FieldState& field, const void* particles, uint64_t particleCount) {
+    CheckpointHeader header = {};
+    memcpy(header.magic, CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC));
+    header.version = CHECKPOINT_VERSION;
+    header.headersize = sizeof(CheckpointHeader);
+    header.byteordermark = CHECKPOINT_BYTE_ORDER_MARK;
+    header.particlesize = sizeof(Particle);
+    header.particlecount = particleCount;
+    header.payloadoffset = (sizeof(CheckpointHeader) + CHECKPOINT_PAYLOAD_ALIGNMENT - 1) / CHECKPOINT_PAYLOAD_ALIGNMENT * CHECKPOINT_PAYLOAD_ALIGNMENT;
+    header.payloadsize = particleCount * sizeof(Particle);
+    header.field = field;
+
+    string temporaryPath = path + ".tmp";
+    std::ofstream file(temporaryPath, std::ios::binary | std::ios::trunc);
+    if (!file.is_open()) {
+        throw std::runtime_error("Failed to open " + temporaryPath + "!");
+    }
+
+    std::vector<char> headerPage(header.payloadoffset, 0);
+    memcpy(headerPage.data(), &header, sizeof(header));
+    file.write(headerPage.data(), static_cast<std::streamsize>(headerPage.size()));
+    file.write(static_cast<const char*>(particles), static_cast<std::streamsize>(header.payloadsize));
+    file.close();
+
+    if (!file) {
+        throw std::runtime_error("Failed to write " + temporaryPath + "!");
+    }
+
+#ifdef _WIN32
+    // rename() doesn't replace existing files on Windows
+    std::remove(path.c_str());
+#endif
+    if (std::rename(temporaryPath.c_str(), path.c_str()) != 0) {
+        throw std::runtime_error("Failed to move " + temporaryPath + " to " + path + "!");
+    }
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include "vulkan_tools.hpp"
+#include "pipeline.hpp"
+#include "mappedfile.hpp"
+
+#include <type_traits>
+
+const char CHECKPOINT_MAGIC[8] = {'A', 'F', 'C', 'C', 'K', 'P', 'T', '\0'};
+// Fields are only ever appended to the header, older versions stay readable
+const uint32_t CHECKPOINT_VERSION = 1;
+const uint32_t CHECKPOINT_BYTE_ORDER_MARK = 0x01020304;
+// The particle payload starts on a page boundary so the mapping can be handed to copies directly
+const uint64_t CHECKPOINT_PAYLOAD_ALIGNMENT = 4096;
+
+// Field and control state needed to continue a run where it left off
+struct FieldState {
+    uint64_t framenumber;
+    double simulationtime;
+    float lastframetime;
+    float gravityangle;
+    float gravitypoint[4];
+};
+
+struct CheckpointHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t headersize;
+    uint32_t byteordermark;
+    uint32_t particlesize;
+    uint64_t particlecount;
+    uint64_t payloadoffset;
+    uint64_t payloadsize;
+    FieldState field;
+};
+
+static_assert(std::is_trivially_copyable<CheckpointHeader>::value, "Checkpoint header is written as raw bytes");
+
+// A checkpoint file mapped into memory. The particles point straight into the mapping.
+class Checkpoint {
+private:
+    MappedFile _file;
+public:
+    CheckpointHeader header;
+    const Particle* particles;
+    // Same as particles when opened writable, changes are written into the file in place
+    Particle* writableparticles;
+
+    Checkpoint(const std::string& path, bool writable = false);
+};
+
+// Writes to a temporary file first, so an interrupted save never replaces a good checkpoint
+void writeCheckpoint(const std::string& path, const FieldState& field, const void* particles, uint64_t particleCount);
@@ -0,0 +1,176 @@
+#include "control.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+static_assert((CONTROL_RING_CAPACITY & (CONTROL_RING_CAPACITY - 1)) == 0, "The ring capacity has to be a power of two");
+
+void LatencyStatistics::add(double milliseconds) {
+    total += milliseconds;
+    maximum = std::max(maximum, milliseconds);
+    samples++;
+}
+
+double LatencyStatistics::average() const {
+    return samples > 0 ? total / static_cast<double>(samples) : 0.0;
+}
+
+uint64_t controlClock() {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+#ifdef _WIN32
+
+ControlRing::ControlRing(const std::string& name, bool create)
+: _mapping(nullptr), _size(sizeof(ControlRingHeader) + sizeof(ControlMessage) * CONTROL_RING_CAPACITY),
+  _header(nullptr), _messages(nullptr) {
+    std::string objectName = "Local\\" + name;
+    if (create) {
+        _mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE, 0, static_cast<DWORD>(_size), objectName.c_str());
+    } else {
+        _mapping = OpenFileMappingA(FILE_MAP_ALL_ACCESS, FALSE, objectName.c_str());
+    }
+    if (!_mapping) {
+        throw std::runtime_error("Failed to open control channel " + name + "!");
+    }
+
+    void* view = MapViewOfFile(_mapping, FILE_MAP_ALL_ACCESS, 0, 0, _size);
+    if (!view) {
+        CloseHandle(_mapping);
+        throw std::runtime_error("Failed to map control channel " + name + "!");
+    }
+    _header = static_cast<ControlRingHeader*>(view);
+    _messages = reinterpret_cast<ControlMessage*>(_header + 1);
+}
+
+ControlRing::~ControlRing() {
+    UnmapViewOfFile(_header);
+    CloseHandle(_mapping);
+}
+
+#else
+
+ControlRing::ControlRing(const std::string& name, bool create)
+: _name("/" + name), _owner(create), _size(sizeof(ControlRingHeader) + sizeof(ControlMessage) * CONTROL_RING_CAPACITY),
+  _header(nullptr), _messages(nullptr) {
+    int descriptor;
+    if (create) {
+        shm_unlink(_name.c_str());
+        descriptor = shm_open(_name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+        if (descriptor >= 0 && ftruncate(descriptor, static_cast<off_t>(_size)) != 0) {
+            close(descriptor);
+            shm_unlink(_name.c_str());
+            descriptor = -1;
+        }
+    } else {
+        descriptor = shm_open(_name.c_str(), O_RDWR, 0);
+    }
+    if (descriptor < 0) {
+        throw std::runtime_error("Failed to open control channel " + name + "!");
+    }
+
+    void* mapping = mmap(nullptr, _size, PROT_READ | PROT_WRITE, MAP_SHARED, descriptor, 0);
+    close(descriptor);
+    if (mapping == MAP_FAILED) {
+        if (_owner) {
+            shm_unlink(_name.c_str());
+        }
+        throw std::runtime_error("Failed to map control channel " + name + "!");
+    }
+    _header = static_cast<ControlRingHeader*>(mapping);
+    _messages = reinterpret_cast<ControlMessage*>(_header + 1);
+}
+
+ControlRing::~ControlRing() {
+    munmap(_header, _size);
+    if (_owner) {
+        shm_unlink(_name.c_str());
+    }
+}
+
+#endif
+
+ControlChannel::ControlChannel(const std::string& name) : ControlRing(name, true) {
+    new (&_header->head) std::atomic<uint64_t>(0);
+    new (&_header->tail) std::atomic<uint64_t>(0);
+    _header->version = CONTROL_VERSION;
+    _header->capacity = CONTROL_RING_CAPACITY;
+    _header->messagesize = sizeof(ControlMessage);
+
+    // Producers check the magic first, so it is published last
+    std::atomic_thread_fence(std::memory_order_release);
+    memcpy(_header->magic, CONTROL_MAGIC, sizeof(CONTROL_MAGIC));
+}
+
+uint32_t ControlChannel::drain(ControlState& state) {
+    uint64_t tail = _header->tail.load(std::memory_order_relaxed);
+    uint64_t head = _header->head.load(std::memory_order_acquire);
+    // A producer that overran the ring lost the oldest messages
+    if (head - tail > CONTROL_RING_CAPACITY) {
+        tail = head - CONTROL_RING_CAPACITY;
+    }
+
+    uint64_t now = controlClock();
+    uint32_t count = static_cast<uint32_t>(head - tail);
+    for (; tail != head; tail++) {
+        ControlMessage message = _messages[tail & (CONTROL_RING_CAPACITY - 1)];
+
+        if (message.fields & CONTROL_GRAVITY_POINT) {
+            memcpy(state.gravitypoint, message.gravitypoint, sizeof(state.gravitypoint));
+        }
+        if (message.fields & CONTROL_FIELD_STRENGTH) {
+            state.fieldstrength = message.fieldstrength;
+        }
+        if (message.fields & CONTROL_PM_GRAVITY_STRENGTH) {
+            state.pmgravitystrength = message.pmgravitystrength;
+        }
+        if (message.fields & CONTROL_FLUID_COUPLING) {
+            state.fluidcoupling = message.fluidcoupling;
+        }
+        state.fields |= message.fields;
+        state.timestamp = message.timestamp;
+
+        if (message.timestamp <= now) {
+            ingestlatency.add(static_cast<double>(now - message.timestamp) * 1e-6);
+        }
+    }
+
+    _header->tail.store(head, std::memory_order_release);
+    return count;
+}
+
+ControlProducer::ControlProducer(const std::string& name) : ControlRing(name, false) {
+    if (memcmp(_header->magic, CONTROL_MAGIC, sizeof(CONTROL_MAGIC)) != 0 || _header->version != CONTROL_VERSION
+        || _header->capacity != CONTROL_RING_CAPACITY || _header->messagesize != sizeof(ControlMessage)) {
+        throw std::runtime_error("Control channel " + name + " was not created by a compatible engine!");
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+}
+
+bool ControlProducer::send(ControlMessage message) {
+    uint64_t head = _header->head.load(std::memory_order_relaxed);
+    uint64_t tail = _header->tail.load(std::memory_order_acquire);
+    if (head - tail >= CONTROL_RING_CAPACITY) {
+        droppedmessages++;
+        return false;
+    }
+
+    message.timestamp = controlClock();
+    _messages[head & (CONTROL_RING_CAPACITY - 1)] = message;
+    _header->head.store(head + 1, std::memory_order_release);
+    return true;
+}
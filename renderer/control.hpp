@@ -0,0 +1,125 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <type_traits>
+
+const char CONTROL_MAGIC[8] = {'A', 'F', 'C', 'C', 'T', 'R', 'L', '\0'};
+const uint32_t CONTROL_VERSION = 1;
+// Messages the ring holds, a power of two. At 1 kHz input and 60 fps about 17 arrive per frame.
+const uint32_t CONTROL_RING_CAPACITY = 1024;
+
+// Fields of a ControlMessage that are set, the others keep their previous value
+const uint32_t CONTROL_GRAVITY_POINT = 1 << 0;
+const uint32_t CONTROL_FIELD_STRENGTH = 1 << 1;
+const uint32_t CONTROL_PM_GRAVITY_STRENGTH = 1 << 2;
+const uint32_t CONTROL_FLUID_COUPLING = 1 << 3;
+
+// One update of the simulation parameters, following ComputeUniformBufferObject
+struct ControlMessage {
+    // controlClock() when the producer sent it, for the latency measurement
+    uint64_t timestamp;
+    uint32_t fields;
+    uint32_t padding;
+    float gravitypoint[4];
+    float fieldstrength;
+    float pmgravitystrength;
+    float fluidcoupling;
+    float reserved;
+};
+
+static_assert(std::is_trivially_copyable<ControlMessage>::value, "Control messages are copied through shared memory");
+
+// Start of the shared memory, the message slots follow. Head and tail sit on their own cache lines so producer
+// and consumer do not invalidate each other's line on every message.
+struct ControlRingHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t capacity;
+    uint32_t messagesize;
+    // Next message the producer writes, only the producer stores it
+    alignas(64) std::atomic<uint64_t> head;
+    // Next message the consumer reads, only the consumer stores it
+    alignas(64) std::atomic<uint64_t> tail;
+};
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "The ring's counters are shared between processes");
+
+// Latest value of every field received so far
+struct ControlState {
+    uint32_t fields = 0;
+    float gravitypoint[4] = {0.0f, 0.0f, 0.0f, 1.0f};
+    float fieldstrength = 0.0f;
+    float pmgravitystrength = 0.0f;
+    float fluidcoupling = 0.0f;
+    // Send time of the newest message applied, 0 before the first one
+    uint64_t timestamp = 0;
+};
+
+struct LatencyStatistics {
+    double total = 0.0;
+    double maximum = 0.0;
+    uint64_t samples = 0;
+
+    void add(double milliseconds);
+    double average() const;
+};
+
+struct ControlLatency {
+    // From sending a message to writing it into the uniform buffer
+    LatencyStatistics ingest;
+    // From sending a message to the completion of the first simulation step using it, as the host observes it
+    LatencyStatistics gpu;
+};
+
+// Monotonic nanoseconds, comparable between processes on the same machine (CLOCK_MONOTONIC, QueryPerformanceCounter)
+uint64_t controlClock();
+
+// Shared memory mapping of a control ring, created by the engine or opened by a controller
+class ControlRing {
+private:
+#ifdef _WIN32
+    void* _mapping;
+#else
+    std::string _name;
+    bool _owner;
+#endif
+    size_t _size;
+protected:
+    ControlRingHeader* _header;
+    ControlMessage* _messages;
+
+    ControlRing(const std::string& name, bool create);
+    ~ControlRing();
+public:
+    ControlRing(const ControlRing&) = delete;
+    ControlRing& operator=(const ControlRing&) = delete;
+};
+
+// Consumer side, owned by the engine. Drained once per frame on the render thread with atomics and copies only,
+// no locks or system calls.
+class ControlChannel : public ControlRing {
+public:
+    // Messages that arrived after the previous drain, time between sending and draining them
+    LatencyStatistics ingestlatency;
+
+    // Applies every waiting message to the state in order, returns how many there were
+    uint32_t drain(ControlState& state);
+
+    // Creates the shared memory, replacing a stale one of the same name
+    ControlChannel(const std::string& name);
+};
+
+// Producer side, for controllers in other processes. Never blocks, a full ring drops the message.
+class ControlProducer : public ControlRing {
+public:
+    uint64_t droppedmessages = 0;
+
+    // Stamps the message with controlClock() and publishes it, false when the ring is full
+    bool send(ControlMessage message);
+
+    // Opens the shared memory the engine created
+    ControlProducer(const std::string& name);
+};
@@ -0,0 +1,293 @@
+#include "cpusimulation.hpp"
+
+#include <algorithm>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define CPU_SIMULATION_X86
+#include <immintrin.h>
+
+// The vector kernels are compiled for their instruction set regardless of the target flags, they only run
+// after detectSimdLevel() confirmed the CPU supports it
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#define TARGET_AVX2
+#define TARGET_AVX512
+#else
+#define TARGET_AVX2 __attribute__((target("avx2,fma")))
+#define TARGET_AVX512 __attribute__((target("avx512f")))
+#endif
+#endif
+
+struct ParticleArrays {
+    float* positionx;
+    float* positiony;
+    float* positionz;
+    float* velocityx;
+    float* velocityy;
+    float* velocityz;
+    float* colorr;
+    float* colorg;
+    float* colorb;
+};
+
+SimdLevel detectSimdLevel() {
+#if defined(CPU_SIMULATION_X86)
+#if defined(_MSC_VER) && !defined(__clang__)
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7) {
+        return SimdLevel::Scalar;
+    }
+
+    __cpuid(info, 1);
+    bool osxsave = (info[2] & (1 << 27)) != 0;
+    bool fma = (info[2] & (1 << 12)) != 0;
+    if (!osxsave) {
+        return SimdLevel::Scalar;
+    }
+    // The OS has to save the vector registers on context switches as well
+    unsigned long long enabledState = _xgetbv(0);
+
+    __cpuidex(info, 7, 0);
+    bool avx2 = (info[1] & (1 << 5)) != 0;
+    bool avx512 = (info[1] & (1 << 16)) != 0;
+
+    if (avx512 && (enabledState & 0xe6) == 0xe6) {
+        return SimdLevel::AVX512;
+    }
+    if (avx2 && fma && (enabledState & 0x6) == 0x6) {
+        return SimdLevel::AVX2;
+    }
+#else
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) {
+        return SimdLevel::AVX512;
+    }
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+        return SimdLevel::AVX2;
+    }
+#endif
+#endif
+    return SimdLevel::Scalar;
+}
+
+const char* getSimdLevelName(SimdLevel level) {
+    switch (level) {
+        case SimdLevel::AVX512:
+            return "AVX-512";
+        case SimdLevel::AVX2:
+            return "AVX2";
+        default:
+            return "scalar";
+    }
+}
+
+static void stepScalar(const ParticleArrays& particles, size_t first, size_t last, const glm::vec4& gravityPoint, float deltaTime) {
+    for (size_t i = first; i < last; i++) {
+        glm::vec3 position(particles.positionx[i], particles.positiony[i], particles.positionz[i]);
+        glm::vec3 velocity(particles.velocityx[i], particles.velocityy[i], particles.velocityz[i]);
+
+        glm::vec3 newPosition = position + velocity * deltaTime;
+
+        glm::vec3 forceDirection = glm::vec3(gravityPoint) - position;
+        float distanceSquared = std::max(glm::dot(forceDirection, forceDirection), PARTICLE_MIN_ATTRACTION_DISTANCE);
+        glm::vec3 force = (PARTICLE_ATTRACTION_STRENGTH * glm::normalize(forceDirection)) / distanceSquared;
+
+        glm::vec3 newVelocity = velocity + force * deltaTime;
+        glm::vec3 color = Particle::speedColor(newVelocity);
+
+        particles.positionx[i] = newPosition.x;
+        particles.positiony[i] = newPosition.y;
+        particles.positionz[i] = newPosition.z;
+        particles.velocityx[i] = newVelocity.x;
+        particles.velocityy[i] = newVelocity.y;
+        particles.velocityz[i] = newVelocity.z;
+        particles.colorr[i] = color.x;
+        particles.colorg[i] = color.y;
+        particles.colorb[i] = color.z;
+    }
+}
+
+#if defined(CPU_SIMULATION_X86)
+// hsv2rgb at full saturation and value: clamp(|mod(h + offset, 6) - 3| - 1, 0, 1)
+TARGET_AVX2 static __m256 hueChannelAVX2(__m256 h, float offset) {
+    __m256 x = _mm256_add_ps(h, _mm256_set1_ps(offset));
+    x = _mm256_sub_ps(x, _mm256_mul_ps(_mm256_set1_ps(6.0f), _mm256_floor_ps(_mm256_mul_ps(x, _mm256_set1_ps(1.0f / 6.0f)))));
+    x = _mm256_andnot_ps(_mm256_set1_ps(-0.0f), _mm256_sub_ps(x, _mm256_set1_ps(3.0f)));
+    x = _mm256_sub_ps(x, _mm256_set1_ps(1.0f));
+    return _mm256_min_ps(_mm256_max_ps(x, _mm256_setzero_ps()), _mm256_set1_ps(1.0f));
+}
+
+TARGET_AVX2 static void stepAVX2(const ParticleArrays& particles, size_t first, size_t last, const glm::vec4& gravityPoint, float deltaTime) {
+    const __m256 gravityx = _mm256_set1_ps(gravityPoint.x);
+    const __m256 gravityy = _mm256_set1_ps(gravityPoint.y);
+    const __m256 gravityz = _mm256_set1_ps(gravityPoint.z);
+    const __m256 dt = _mm256_set1_ps(deltaTime);
+    const __m256 strength = _mm256_set1_ps(PARTICLE_ATTRACTION_STRENGTH);
+    const __m256 minDistance = _mm256_set1_ps(PARTICLE_MIN_ATTRACTION_DISTANCE);
+    const __m256 minSpeed = _mm256_set1_ps(PARTICLE_MIN_SPEED);
+    const __m256 speedScale = _mm256_set1_ps(1.0f / (PARTICLE_MAX_SPEED - PARTICLE_MIN_SPEED));
+
+    size_t i = first;
+    for (; i + 8 <= last; i += 8) {
+        __m256 px = _mm256_loadu_ps(particles.positionx + i);
+        __m256 py = _mm256_loadu_ps(particles.positiony + i);
+        __m256 pz = _mm256_loadu_ps(particles.positionz + i);
+        __m256 vx = _mm256_loadu_ps(particles.velocityx + i);
+        __m256 vy = _mm256_loadu_ps(particles.velocityy + i);
+        __m256 vz = _mm256_loadu_ps(particles.velocityz + i);
+
+        __m256 dx = _mm256_sub_ps(gravityx, px);
+        __m256 dy = _mm256_sub_ps(gravityy, py);
+        __m256 dz = _mm256_sub_ps(gravityz, pz);
+        __m256 distanceSquared = _mm256_fmadd_ps(dx, dx, _mm256_fmadd_ps(dy, dy, _mm256_mul_ps(dz, dz)));
+
+        // strength * normalize(d) / max(|d|^2, min) as one factor on d
+        __m256 distance = _mm256_sqrt_ps(distanceSquared);
+        __m256 factor = _mm256_div_ps(strength, _mm256_mul_ps(distance, _mm256_max_ps(distanceSquared, minDistance)));
+        __m256 forcedt = _mm256_mul_ps(factor, dt);
+
+        // The position moves with the velocity from before this step
+        _mm256_storeu_ps(particles.positionx + i, _mm256_fmadd_ps(vx, dt, px));
+        _mm256_storeu_ps(particles.positiony + i, _mm256_fmadd_ps(vy, dt, py));
+        _mm256_storeu_ps(particles.positionz + i, _mm256_fmadd_ps(vz, dt, pz));
+
+        vx = _mm256_fmadd_ps(dx, forcedt, vx);
+        vy = _mm256_fmadd_ps(dy, forcedt, vy);
+        vz = _mm256_fmadd_ps(dz, forcedt, vz);
+        _mm256_storeu_ps(particles.velocityx + i, vx);
+        _mm256_storeu_ps(particles.velocityy + i, vy);
+        _mm256_storeu_ps(particles.velocityz + i, vz);
+
+        __m256 speed = _mm256_sqrt_ps(_mm256_fmadd_ps(vx, vx, _mm256_fmadd_ps(vy, vy, _mm256_mul_ps(vz, vz))));
+        __m256 normalizedSpeed = _mm256_mul_ps(_mm256_sub_ps(speed, minSpeed), speedScale);
+        normalizedSpeed = _mm256_min_ps(_mm256_max_ps(normalizedSpeed, _mm256_setzero_ps()), _mm256_set1_ps(1.0f));
+        // mix(0.5, 0.08, normalizedSpeed) * 6
+        __m256 h = _mm256_fmadd_ps(normalizedSpeed, _mm256_set1_ps((0.08f - 0.5f) * 6.0f), _mm256_set1_ps(0.5f * 6.0f));
+
+        _mm256_storeu_ps(particles.colorr + i, hueChannelAVX2(h, 0.0f));
+        _mm256_storeu_ps(particles.colorg + i, hueChannelAVX2(h, 4.0f));
+        _mm256_storeu_ps(particles.colorb + i, hueChannelAVX2(h, 2.0f));
+    }
+
+    stepScalar(particles, i, last, gravityPoint, deltaTime);
+}
+
+TARGET_AVX512 static __m512 hueChannelAVX512(__m512 h, float offset) {
+    __m512 x = _mm512_add_ps(h, _mm512_set1_ps(offset));
+    __m512 wraps = _mm512_roundscale_ps(_mm512_mul_ps(x, _mm512_set1_ps(1.0f / 6.0f)), _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC);
+    x = _mm512_fnmadd_ps(_mm512_set1_ps(6.0f), wraps, x);
+    x = _mm512_sub_ps(_mm512_abs_ps(_mm512_sub_ps(x, _mm512_set1_ps(3.0f))), _mm512_set1_ps(1.0f));
+    return _mm512_min_ps(_mm512_max_ps(x, _mm512_setzero_ps()), _mm512_set1_ps(1.0f));
+}
+
+TARGET_AVX512 static void stepAVX512(const ParticleArrays& particles, size_t first, size_t last, const glm::vec4& gravityPoint, float deltaTime) {
+    const __m512 gravityx = _mm512_set1_ps(gravityPoint.x);
+    const __m512 gravityy = _mm512_set1_ps(gravityPoint.y);
+    const __m512 gravityz = _mm512_set1_ps(gravityPoint.z);
+    const __m512 dt = _mm512_set1_ps(deltaTime);
+    const __m512 strength = _mm512_set1_ps(PARTICLE_ATTRACTION_STRENGTH);
+    const __m512 minDistance = _mm512_set1_ps(PARTICLE_MIN_ATTRACTION_DISTANCE);
+    const __m512 minSpeed = _mm512_set1_ps(PARTICLE_MIN_SPEED);
+    const __m512 speedScale = _mm512_set1_ps(1.0f / (PARTICLE_MAX_SPEED - PARTICLE_MIN_SPEED));
+
+    size_t i = first;
+    for (; i + 16 <= last; i += 16) {
+        __m512 px = _mm512_loadu_ps(particles.positionx + i);
+        __m512 py = _mm512_loadu_ps(particles.positiony + i);
+        __m512 pz = _mm512_loadu_ps(particles.positionz + i);
+        __m512 vx = _mm512_loadu_ps(particles.velocityx + i);
+        __m512 vy = _mm512_loadu_ps(particles.velocityy + i);
+        __m512 vz = _mm512_loadu_ps(particles.velocityz + i);
+
+        __m512 dx = _mm512_sub_ps(gravityx, px);
+        __m512 dy = _mm512_sub_ps(gravityy, py);
+        __m512 dz = _mm512_sub_ps(gravityz, pz);
+        __m512 distanceSquared = _mm512_fmadd_ps(dx, dx, _mm512_fmadd_ps(dy, dy, _mm512_mul_ps(dz, dz)));
+
+        __m512 distance = _mm512_sqrt_ps(distanceSquared);
+        __m512 factor = _mm512_div_ps(strength, _mm512_mul_ps(distance, _mm512_max_ps(distanceSquared, minDistance)));
+        __m512 forcedt = _mm512_mul_ps(factor, dt);
+
+        _mm512_storeu_ps(particles.positionx + i, _mm512_fmadd_ps(vx, dt, px));
+        _mm512_storeu_ps(particles.positiony + i, _mm512_fmadd_ps(vy, dt, py));
+        _mm512_storeu_ps(particles.positionz + i, _mm512_fmadd_ps(vz, dt, pz));
+
+        vx = _mm512_fmadd_ps(dx, forcedt, vx);
+        vy = _mm512_fmadd_ps(dy, forcedt, vy);
+        vz = _mm512_fmadd_ps(dz, forcedt, vz);
+        _mm512_storeu_ps(particles.velocityx + i, vx);
+        _mm512_storeu_ps(particles.velocityy + i, vy);
+        _mm512_storeu_ps(particles.velocityz + i, vz);
+
+        __m512 speed = _mm512_sqrt_ps(_mm512_fmadd_ps(vx, vx, _mm512_fmadd_ps(vy, vy, _mm512_mul_ps(vz, vz))));
+        __m512 normalizedSpeed = _mm512_mul_ps(_mm512_sub_ps(speed, minSpeed), speedScale);
+        normalizedSpeed = _mm512_min_ps(_mm512_max_ps(normalizedSpeed, _mm512_setzero_ps()), _mm512_set1_ps(1.0f));
+        __m512 h = _mm512_fmadd_ps(normalizedSpeed, _mm512_set1_ps((0.08f - 0.5f) * 6.0f), _mm512_set1_ps(0.5f * 6.0f));
+
+        _mm512_storeu_ps(particles.colorr + i, hueChannelAVX512(h, 0.0f));
+        _mm512_storeu_ps(particles.colorg + i, hueChannelAVX512(h, 4.0f));
+        _mm512_storeu_ps(particles.colorb + i, hueChannelAVX512(h, 2.0f));
+    }
+
+    stepScalar(particles, i, last, gravityPoint, deltaTime);
+}
+#endif
+
+CpuSimulation::CpuSimulation(uint64_t particleCount, ThreadPool* threadPool)
+: _threadpool(threadPool), particlecount(particleCount), simdlevel(detectSimdLevel()) {
+    for (std::vector<float>* component: {&_positionx, &_positiony, &_positionz, &_velocityx, &_velocityy, &_velocityz,
+                                         &_colorr, &_colorg, &_colorb}) {
+        component->resize(particlecount);
+    }
+}
+
+void CpuSimulation::load(const Particle* particles) {
+    _threadpool->parallelFor(0, particlecount, CPU_SIMULATION_GRAIN, [this, particles](size_t first, size_t last) {
+        for (size_t i = first; i < last; i++) {
+            _positionx[i] = particles[i].position.x;
+            _positiony[i] = particles[i].position.y;
+            _positionz[i] = particles[i].position.z;
+            _velocityx[i] = particles[i].velocity.x;
+            _velocityy[i] = particles[i].velocity.y;
+            _velocityz[i] = particles[i].velocity.z;
+            _colorr[i] = particles[i].color.x;
+            _colorg[i] = particles[i].color.y;
+            _colorb[i] = particles[i].color.z;
+        }
+    });
+}
+
+void CpuSimulation::store(Particle* particles) {
+    _threadpool->parallelFor(0, particlecount, CPU_SIMULATION_GRAIN, [this, particles](size_t first, size_t last) {
+        for (size_t i = first; i < last; i++) {
+            particles[i].position = glm::vec3(_positionx[i], _positiony[i], _positionz[i]);
+            particles[i].velocity = glm::vec3(_velocityx[i], _velocityy[i], _velocityz[i]);
+            particles[i].color = glm::vec3(_colorr[i], _colorg[i], _colorb[i]);
+        }
+    });
+}
+
+void CpuSimulation::step(const glm::vec4& gravityPoint, float deltaTime) {
+    ParticleArrays particles = {_positionx.data(), _positiony.data(), _positionz.data(),
+                                _velocityx.data(), _velocityy.data(), _velocityz.data(),
+                                _colorr.data(), _colorg.data(), _colorb.data()};
+
+    // Never above what the CPU supports, even if a higher level was selected
+    static const SimdLevel supportedLevel = detectSimdLevel();
+    SimdLevel level = std::min(simdlevel, supportedLevel);
+
+    _threadpool->parallelFor(0, particlecount, CPU_SIMULATION_GRAIN, [&](size_t first, size_t last) {
+#if defined(CPU_SIMULATION_X86)
+        if (level == SimdLevel::AVX512) {
+            stepAVX512(particles, first, last, gravityPoint, deltaTime);
+            return;
+        }
+        if (level == SimdLevel::AVX2) {
+            stepAVX2(particles, first, last, gravityPoint, deltaTime);
+            return;
+        }
+#endif
+        stepScalar(particles, first, last, gravityPoint, deltaTime);
+    });
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include "pipeline.hpp"
+#include "threadpool.hpp"
+
+// Particles handed to one parallelFor chunk, a multiple of every vector width
+const size_t CPU_SIMULATION_GRAIN = 16 * 1024;
+
+enum class SimdLevel {
+    Scalar,
+    AVX2,
+    AVX512
+};
+
+// Widest instruction set both the compiler and the running CPU support
+SimdLevel detectSimdLevel();
+const char* getSimdLevelName(SimdLevel level);
+
+// Host implementation of shaders/shader.comp, for machines without a GPU and for checking GPU results.
+// Particles are kept as structure of arrays so the update vectorizes, load() and store() convert from and
+// to the Particle layout the GPU uses. The scalar kernel follows the shader line by line, the vector kernels
+// compute the same formulas with the color mapping written branch free.
+class CpuSimulation {
+private:
+    ThreadPool* _threadpool;
+
+    std::vector<float> _positionx, _positiony, _positionz;
+    std::vector<float> _velocityx, _velocityy, _velocityz;
+    std::vector<float> _colorr, _colorg, _colorb;
+public:
+    uint64_t particlecount;
+    // Starts at detectSimdLevel(), lower levels can be selected for comparison
+    SimdLevel simdlevel;
+
+    void load(const Particle* particles);
+    void store(Particle* particles);
+    void step(const glm::vec4& gravityPoint, float deltaTime);
+
+    CpuSimulation(uint64_t particleCount, ThreadPool* threadPool);
+};
@@ -0,0 +1,136 @@
+#include "deduplicate.hpp"
+
+#include <cstring>
+
+static const uint32_t EMPTY = ~0u;
+static const size_t SHARD_COUNT = size_t(1) << DEDUPLICATION_SHARD_BITS;
+
+static uint64_t mix(uint64_t value) {
+    value ^= value >> 32;
+    value *= 0xd6e8feb86659fd93ull;
+    value ^= value >> 32;
+    value *= 0xd6e8feb86659fd93ull;
+    value ^= value >> 32;
+    return value;
+}
+
+static uint64_t componentBits(float a, float b) {
+    // Adding 0.0 turns -0.0 into 0.0, which compare equal but differ in their bits
+    a += 0.0f;
+    b += 0.0f;
+
+    uint32_t lower, upper;
+    memcpy(&lower, &a, sizeof(lower));
+    memcpy(&upper, &b, sizeof(upper));
+    return static_cast<uint64_t>(lower) | static_cast<uint64_t>(upper) << 32;
+}
+
+// Only the components are hashed, the bytes of the alignment padding are undefined
+uint64_t hashVertex(const Vertex& vertex) {
+    uint64_t hash = mix(componentBits(vertex.pos.x, vertex.pos.y));
+    hash = mix(hash ^ componentBits(vertex.pos.z, vertex.color.x));
+    hash = mix(hash ^ componentBits(vertex.color.y, vertex.color.z));
+    return hash;
+}
+
+static size_t getShard(uint64_t hash) {
+    return static_cast<size_t>(hash >> (64 - DEDUPLICATION_SHARD_BITS));
+}
+
+void deduplicateVertices(std::vector<Vertex>& vertices, std::vector<uint32_t>& indices, ThreadPool* threadPool) {
+    size_t count = vertices.size();
+    if (count >= EMPTY) {
+        throw std::length_error("Too many vertices to deduplicate!");
+    }
+
+    std::vector<uint64_t> hashes(count);
+    threadPool->parallelFor(0, count, DEDUPLICATION_GRAIN, [&](size_t first, size_t last) {
+        for (size_t i = first; i < last; i++) {
+            hashes[i] = hashVertex(vertices[i]);
+        }
+    });
+
+    // Stable partition of the vertex ids by shard: per chunk histograms, their prefix sums, then a scatter
+    size_t chunkCount = (count + DEDUPLICATION_GRAIN - 1) / DEDUPLICATION_GRAIN;
+    std::vector<size_t> chunkOffsets(chunkCount * SHARD_COUNT, 0);
+    threadPool->parallelFor(0, chunkCount, 1, [&](size_t firstChunk, size_t lastChunk) {
+        for (size_t chunk = firstChunk; chunk < lastChunk; chunk++) {
+            size_t* histogram = &chunkOffsets[chunk * SHARD_COUNT];
+            for (size_t i = chunk * DEDUPLICATION_GRAIN; i < std::min(count, (chunk + 1) * DEDUPLICATION_GRAIN); i++) {
+                histogram[getShard(hashes[i])]++;
+            }
+        }
+    });
+
+    std::vector<size_t> shardOffsets(SHARD_COUNT + 1);
+    size_t offset = 0;
+    for (size_t shard = 0; shard < SHARD_COUNT; shard++) {
+        shardOffsets[shard] = offset;
+        for (size_t chunk = 0; chunk < chunkCount; chunk++) {
+            size_t chunkCountInShard = chunkOffsets[chunk * SHARD_COUNT + shard];
+            chunkOffsets[chunk * SHARD_COUNT + shard] = offset;
+            offset += chunkCountInShard;
+        }
+    }
+    shardOffsets[SHARD_COUNT] = offset;
+
+    std::vector<uint32_t> order(count);
+    threadPool->parallelFor(0, chunkCount, 1, [&](size_t firstChunk, size_t lastChunk) {
+        for (size_t chunk = firstChunk; chunk < lastChunk; chunk++) {
+            size_t* offsets = &chunkOffsets[chunk * SHARD_COUNT];
+            for (size_t i = chunk * DEDUPLICATION_GRAIN; i < std::min(count, (chunk + 1) * DEDUPLICATION_GRAIN); i++) {
+                order[offsets[getShard(hashes[i])]++] = static_cast<uint32_t>(i);
+            }
+        }
+    });
+
+    // Within a shard the vertices are visited in their original order, so every vertex maps to the
+    // first one equal to it. Linear probing on the low hash bits, the shard already used the high ones.
+    std::vector<uint32_t> canonical(count);
+    threadPool->parallelFor(0, SHARD_COUNT, 1, [&](size_t firstShard, size_t lastShard) {
+        std::vector<uint32_t> table;
+        for (size_t shard = firstShard; shard < lastShard; shard++) {
+            size_t shardSize = shardOffsets[shard + 1] - shardOffsets[shard];
+            size_t capacity = 16;
+            while (capacity < 2 * shardSize) {
+                capacity *= 2;
+            }
+            table.assign(capacity, EMPTY);
+
+            for (size_t k = shardOffsets[shard]; k < shardOffsets[shard + 1]; k++) {
+                uint32_t vertex = order[k];
+                size_t slot = hashes[vertex] & (capacity - 1);
+                while (true) {
+                    uint32_t entry = table[slot];
+                    if (entry == EMPTY) {
+                        table[slot] = vertex;
+                        canonical[vertex] = vertex;
+                        break;
+                    }
+                    if (hashes[entry] == hashes[vertex] && vertices[entry] == vertices[vertex]) {
+                        canonical[vertex] = entry;
+                        break;
+                    }
+                    slot = (slot + 1) & (capacity - 1);
+                }
+            }
+        }
+    });
+
+    std::vector<uint32_t> remapped(count, EMPTY);
+    std::vector<Vertex> deduplicatedVertices;
+    for (uint32_t& index: indices) {
+        if (index >= count) {
+            throw std::out_of_range("Mesh index " + std::to_string(index) + " is out of range!");
+        }
+
+        uint32_t vertex = canonical[index];
+        if (remapped[vertex] == EMPTY) {
+            remapped[vertex] = static_cast<uint32_t>(deduplicatedVertices.size());
+            deduplicatedVertices.push_back(vertices[vertex]);
+        }
+        index = remapped[vertex];
+    }
+
+    vertices = std::move(deduplicatedVertices);
+}
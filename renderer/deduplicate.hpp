@@ -0,0 +1,16 @@
+#pragma once
+
+#include "pipeline.hpp"
+#include "threadpool.hpp"
+
+// Vertices are split into this many independent hash tables by the top bits of their hash
+const uint32_t DEDUPLICATION_SHARD_BITS = 6;
+const size_t DEDUPLICATION_GRAIN = 64 * 1024;
+
+// 64 bit hash of the vertex components, equal for vertices that compare equal (0.0 and -0.0 included)
+uint64_t hashVertex(const Vertex& vertex);
+
+// Removes duplicate vertices and the vertices no index refers to. Vertices are ordered by their first use in
+// the index list, the same order the std::unordered_map version produced.
+// Hashing and the hash tables run on the thread pool, only the final remapping of the indices is sequential.
+void deduplicateVertices(std::vector<Vertex>& vertices, std::vector<uint32_t>& indices, ThreadPool* threadPool);
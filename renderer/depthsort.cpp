@@ -0,0 +1,73 @@
+#include "depthsort.hpp"
+
+DepthSort::DepthSort(VkDevice device, PhysicalDevice* physicalDevice, MemoryAllocator* allocator,
+                     const std::vector<Buffer*>& particleBuffers, uint32_t particleCount)
+: _device(device), _physicaldevice(physicalDevice), _allocator(allocator), _particlecount(particleCount) {
+    VkDeviceSize bufferSize = sizeof(uint32_t) * _particlecount;
+    _keybuffer = new Buffer(_device, _physicaldevice, _allocator);
+    _keybuffer->createOnDevice(bufferSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT);
+    indexbuffer = new Buffer(_device, _physicaldevice, _allocator);
+    indexbuffer->createOnDevice(bufferSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT
+                                            | VK_BUFFER_USAGE_INDEX_BUFFER_BIT);
+
+    _sort = new RadixSort(_device, _physicaldevice, _allocator, _keybuffer, indexbuffer, _particlecount);
+
+    createStoragePipeline(_device, "depthkeys.comp", "depth sort", 3, sizeof(PushConstants),
+                          _descriptorsetlayout, _layout, _pipeline);
+    createDescriptorSets(particleBuffers);
+}
+
+bool DepthSort::isSupported(PhysicalDevice* physicalDevice) {
+    return RadixSort::isSupported(physicalDevice);
+}
+
+void DepthSort::createDescriptorSets(const std::vector<Buffer*>& particleBuffers) {
+    uint32_t setCount = static_cast<uint32_t>(particleBuffers.size());
+    _descriptorsets.resize(setCount);
+    allocateStorageDescriptorSets(_device, "depth sort", _descriptorsetlayout, 3, setCount, _descriptorpool,
+                                  _descriptorsets.data());
+
+    for (uint32_t i = 0; i < setCount; i++) {
+        VkDescriptorBufferInfo particles = {particleBuffers[i]->buffer, 0, sizeof(Particle) * _particlecount};
+        writeStorageDescriptors(_device, _descriptorsets[i], {particles, {_keybuffer->buffer, 0, VK_WHOLE_SIZE},
+                                                              {indexbuffer->buffer, 0, VK_WHOLE_SIZE}});
+    }
+}
+
+void DepthSort::record(VkCommandBuffer commandBuffer, uint32_t set, const glm::mat4& view, float nearPlane, float farPlane) {
+    // The previous frame may still draw from the index buffer
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0,
+                         0, nullptr, 0, nullptr, 0, nullptr);
+
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, _pipeline);
+    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, _layout, 0, 1, &_descriptorsets[set], 0, nullptr);
+
+    PushConstants pushConstants = {};
+    pushConstants.view = view;
+    pushConstants.nearplane = nearPlane;
+    pushConstants.farplane = farPlane;
+    pushConstants.particlecount = _particlecount;
+    pushConstants.keymax = (1u << DEPTH_SORT_KEY_BITS) - 1;
+    vkCmdPushConstants(commandBuffer, _layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(PushConstants), &pushConstants);
+    vkCmdDispatch(commandBuffer, (_particlecount + 255) / 256, 1, 1);
+
+    _sort->record(commandBuffer, _particlecount, DEPTH_SORT_KEY_BITS);
+
+    VkMemoryBarrier memoryBarrier = {};
+    memoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    memoryBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+    memoryBarrier.dstAccessMask = VK_ACCESS_INDEX_READ_BIT;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, 0, 1, &memoryBarrier, 0, nullptr, 0, nullptr);
+}
+
+DepthSort::~DepthSort() {
+    vkDestroyDescriptorPool(_device, _descriptorpool, nullptr);
+    vkDestroyPipeline(_device, _pipeline, nullptr);
+    vkDestroyPipelineLayout(_device, _layout, nullptr);
+    vkDestroyDescriptorSetLayout(_device, _descriptorsetlayout, nullptr);
+
+    delete _sort;
+    delete _keybuffer;
+    delete indexbuffer;
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include "vulkan_tools.hpp"
+#include "pipeline.hpp"
+#include "buffer.hpp"
+#include "sort.hpp"
+
+// Bits of the quantized view depth the particles are sorted by, two radix passes
+const uint32_t DEPTH_SORT_KEY_BITS = 16;
+
+// Orders the particles back to front every frame so their alpha blending is correct. A compute pass
+// (depthkeys.comp) writes each particle's quantized view depth as key and its index as value, the RadixSort orders
+// them, and the sorted values are drawn as index buffer. Particles of about the same depth keep their buffer order.
+class DepthSort {
+private:
+    struct PushConstants {
+        glm::mat4 view;
+        float nearplane;
+        float farplane;
+        uint32_t particlecount;
+        uint32_t keymax;
+    };
+
+    VkDevice _device;
+    PhysicalDevice* _physicaldevice;
+    MemoryAllocator* _allocator;
+    uint32_t _particlecount;
+
+    Buffer* _keybuffer;
+    RadixSort* _sort;
+
+    VkDescriptorSetLayout _descriptorsetlayout;
+    VkPipelineLayout _layout;
+    VkPipeline _pipeline;
+    VkDescriptorPool _descriptorpool;
+    // Set i reads particle storage buffer i
+    std::vector<VkDescriptorSet> _descriptorsets;
+
+    void createDescriptorSets(const std::vector<Buffer*>& particleBuffers);
+public:
+    // Particle indices, back to front after record()
+    Buffer* indexbuffer;
+
+    static bool isSupported(PhysicalDevice* physicalDevice);
+
+    // Sorts the particles of storage buffer `set` for the view, between the camera's near and far plane. Goes into
+    // the graphics command buffer before the render pass: waits for earlier draws from the index buffer, and the
+    // indices are ready for the draw after it.
+    void record(VkCommandBuffer commandBuffer, uint32_t set, const glm::mat4& view, float nearPlane, float farPlane);
+
+    DepthSort(VkDevice device, PhysicalDevice* physicalDevice, MemoryAllocator* allocator,
+              const std::vector<Buffer*>& particleBuffers, uint32_t particleCount);
+    ~DepthSort();
+
+    DepthSort(const DepthSort&) = delete;
+    DepthSort& operator=(const DepthSort&) = delete;
+};
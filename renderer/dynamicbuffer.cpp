@@ -0,0 +1,89 @@
+#include "dynamicbuffer.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+DynamicBuffer::DynamicBuffer(VkDevice device, PhysicalDevice* physicalDevice, MemoryAllocator* allocator, VkBufferUsageFlags usage, uint32_t frameCount)
+: _device(device), _physicaldevice(physicalDevice), _allocator(allocator), _usage(usage) {
+    _copies.resize(frameCount, {nullptr, 0, {}});
+}
+
+void DynamicBuffer::markDirty(VkDeviceSize offset, VkDeviceSize size) {
+    if (size == 0) {
+        return;
+    }
+
+    for (Copy& copy: _copies) {
+        if (copy.dirtyranges.size() < DYNAMIC_BUFFER_MAX_DIRTY_RANGES) {
+            copy.dirtyranges.emplace_back(offset, offset + size);
+            continue;
+        }
+
+        VkDeviceSize begin = offset;
+        VkDeviceSize end = offset + size;
+        for (auto& range: copy.dirtyranges) {
+            begin = std::min(begin, range.first);
+            end = std::max(end, range.second);
+        }
+        copy.dirtyranges.assign(1, {begin, end});
+    }
+}
+
+void DynamicBuffer::resize(VkDeviceSize size) {
+    VkDeviceSize oldSize = _contents.size();
+    _contents.resize(size);
+
+    if (size > oldSize) {
+        markDirty(oldSize, size - oldSize);
+    }
+}
+
+void DynamicBuffer::write(VkDeviceSize offset, const void* data, VkDeviceSize size) {
+    if (offset + size > _contents.size()) {
+        throw std::out_of_range("Dynamic buffer write past its size!");
+    }
+
+    memcpy(_contents.data() + offset, data, size);
+    markDirty(offset, size);
+}
+
+VkBuffer DynamicBuffer::prepare(uint32_t frame) {
+    Copy& copy = _copies[frame];
+    VkDeviceSize size = _contents.size();
+    if (size == 0) {
+        copy.dirtyranges.clear();
+        return copy.buffer ? copy.buffer->buffer : VK_NULL_HANDLE;
+    }
+
+    // Nothing but this frame uses the copy, so it can be replaced right away. Capacity grows by half
+    // at least, so a mesh growing a little every frame doesn't reallocate every frame.
+    if (size > copy.capacity) {
+        delete copy.buffer;
+        copy.capacity = std::max(size, copy.capacity + copy.capacity / 2);
+        copy.buffer = new Buffer(_device, _physicaldevice, _allocator);
+        copy.buffer->createOnHost(copy.capacity, _usage);
+
+        copy.dirtyranges.assign(1, {0, size});
+    }
+
+    // Overlapping and adjacent ranges are copied once
+    std::sort(copy.dirtyranges.begin(), copy.dirtyranges.end());
+    VkDeviceSize copiedEnd = 0;
+    for (auto& range: copy.dirtyranges) {
+        VkDeviceSize begin = std::max(range.first, copiedEnd);
+        VkDeviceSize end = std::min(range.second, size);
+        if (begin < end) {
+            memcpy(static_cast<std::byte*>(copy.buffer->mapping) + begin, _contents.data() + begin, end - begin);
+        }
+        copiedEnd = std::max(copiedEnd, end);
+    }
+    copy.dirtyranges.clear();
+
+    return copy.buffer->buffer;
+}
+
+DynamicBuffer::~DynamicBuffer() {
+    for (Copy& copy: _copies) {
+        delete copy.buffer;
+    }
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include "vulkan_tools.hpp"
+#include "buffer.hpp"
+
+// Writes spanning more separate ranges than this are synced as one range covering all of them
+const size_t DYNAMIC_BUFFER_MAX_DIRTY_RANGES = 64;
+
+// Buffer contents that change from frame to frame. Every frame in flight draws from its own persistently
+// mapped host visible copy, so writes never touch memory the device may still be reading. write() only
+// updates the host side contents, prepare() copies the ranges a frame's copy has missed once that frame's
+// previous work has completed. Copies grow on their own when the contents outgrow them.
+class DynamicBuffer {
+private:
+    struct Copy {
+        Buffer* buffer;
+        VkDeviceSize capacity;
+        std::vector<std::pair<VkDeviceSize, VkDeviceSize>> dirtyranges;
+    };
+
+    VkDevice _device;
+    PhysicalDevice* _physicaldevice;
+    MemoryAllocator* _allocator;
+    VkBufferUsageFlags _usage;
+
+    std::vector<std::byte> _contents;
+    std::vector<Copy> _copies;
+
+    void markDirty(VkDeviceSize offset, VkDeviceSize size);
+public:
+    VkDeviceSize size() const {
+        return _contents.size();
+    }
+
+    // Keeps the contents up to the new size
+    void resize(VkDeviceSize size);
+    void write(VkDeviceSize offset, const void* data, VkDeviceSize size);
+    // Brings the frame's copy up to date and returns it, VK_NULL_HANDLE while empty
+    VkBuffer prepare(uint32_t frame);
+
+    DynamicBuffer(VkDevice device, PhysicalDevice* physicalDevice, MemoryAllocator* allocator, VkBufferUsageFlags usage, uint32_t frameCount);
+    ~DynamicBuffer();
+};
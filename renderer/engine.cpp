@@ -7,9 +7,17 @@
 #include <cstring>
 #include <fstream>
 #include <random>
+#include <algorithm>
+#include <cstdio>
 
 using std::string, std::vector, std::set;
 
+// A step overwrites the storage buffer two steps before the previous one, which no frame interpolates from anymore
+static_assert(MAX_FRAMES_IN_FLIGHT >= 3, "Interpolated particles need three storage buffers");
+
+static const float CAMERA_NEAR = 0.1f;
+static const float CAMERA_FAR = 10.0f;
+
 #ifdef NDEBUG
     static const bool enableValidationLayers = false;
 #else
@@ -52,12 +60,9 @@ static void windowResizedCallback(void* selfpointer, int width, int height) {
     }
 }
 
+// Called from the window's event polling inside draw(), which recreates the swap chain after presenting
 void RenderingEngine::framebufferResized() {
     _framebufferResized = true;
-    // Recreates the framebuffer
-    draw();
-    // Redraws
-    draw();
 }
 
 RenderingEngine::RenderingEngine(string name) {
@@ -75,12 +80,36 @@ RenderingEngine::RenderingEngine(string name) {
 
     _graphicsqueue = nullptr;
     _presentqueue = nullptr;
+    _transferqueue = nullptr;
 
     _commandpool = nullptr;
     _graphicsdescriptorpool = nullptr;
+    _computedescriptorpool = nullptr;
+
+    _memoryallocator = nullptr;
+    _uploadmanager = nullptr;
+    _readbackmanager = nullptr;
+    _threadpool = nullptr;
+    _replaysource = nullptr;
+    _loadedmesh = nullptr;
 
     _vertexbuffer = nullptr;
     _indexbuffer = nullptr;
+    _pendingvertexbuffer = nullptr;
+    _pendingindexbuffer = nullptr;
+    _dynamicvertexbuffer = nullptr;
+    _dynamicindexbuffer = nullptr;
+    _instancedmeshes = nullptr;
+    _meshfield = nullptr;
+    _vectorfield = nullptr;
+    _pmgravity = nullptr;
+    _fluid = nullptr;
+    _resolutiongovernor = nullptr;
+    _statistics = nullptr;
+    _depthsort = nullptr;
+    _controlchannel = nullptr;
+    _stream = nullptr;
+    _tracecollector = nullptr;
 }
 
 RenderingEngine::RenderingEngine(string name, int forcedPresentMode) : RenderingEngine(name) {
@@ -100,17 +129,56 @@ void RenderingEngine::init() {
 
     selectPhysicalDevice();
     initLogicalDevice();
+    initMemoryAllocator();
 
     initGraphicsPipeline();
     initComputePipeline();
     initSwapchain();
 
     initCommandPool();
+    initUploadManager();
+    initReadbackManager();
 
     createVertexBuffer();
     createIndexBuffer();
+    delete _loadedmesh;
+    _loadedmesh = nullptr;
     createUniformBuffers();
+    if (_streamingenabled) {
+        // The storage buffers hold one chunk each instead of every particle
+        _stream = new ParticleStream(_device, _physicaldevice, _memoryallocator, _uploadmanager, _streamingpath,
+                                     _streamingcount, VELOCITY_FACTOR);
+        _particlecount = _stream->chunkcapacity;
+    }
     createStorageBuffers();
+    initDynamicMesh();
+    _instancedmeshes = new InstancedMeshes(_device, _physicaldevice, _memoryallocator, MAX_FRAMES_IN_FLIGHT);
+    _meshfield = new SignedDistanceField(_device, _physicaldevice, _memoryallocator, MAX_FRAMES_IN_FLIGHT);
+    _vectorfield = new VectorField(_device, _physicaldevice, _memoryallocator, _uploadmanager, _vectorfieldpath, MAX_FRAMES_IN_FLIGHT);
+    _pmgravity = new ParticleMeshGravity(_device, _physicaldevice, _memoryallocator, _storagebuffers, _particlecount);
+    _fluid = new FluidSolver(_device, _physicaldevice, _memoryallocator, _fluidresolution, MAX_FRAMES_IN_FLIGHT);
+    _resolutiongovernor = new ResolutionGovernor(_device, _physicaldevice, MAX_FRAMES_IN_FLIGHT, _frametimebudget);
+    if (_stream && (_statisticsenabled || _depthsortenabled)) {
+        printf("Simulation statistics and the depth sort cover resident particles only, they are disabled while streaming\n");
+    } else if (_statisticsenabled) {
+        if (_physicaldevice->subgrouparithmeticsupported) {
+            _statistics = new ParticleStatistics(_device, _physicaldevice, _memoryallocator, _storagebuffers,
+                                                 PARTICLE_COUNT, MAX_FRAMES_IN_FLIGHT);
+        } else {
+            printf("The device has no subgroup arithmetic in compute shaders, simulation statistics are disabled\n");
+        }
+    }
+    if (_depthsortenabled && !_stream) {
+        if (DepthSort::isSupported(_physicaldevice)) {
+            _depthsort = new DepthSort(_device, _physicaldevice, _memoryallocator, _storagebuffers, PARTICLE_COUNT);
+        } else {
+            printf("The device cannot run the radix sort, particles are drawn unsorted\n");
+        }
+    }
+
+    // Rendering does not wait on the host for the initial uploads, the first frames wait on the device instead
+    _requireduploadvalue = _uploadmanager->flush();
+    promotePendingMesh();
 
     initGraphicsDescriptorPool();
     initGraphicsDescriptorSets();
@@ -120,18 +188,71 @@ void RenderingEngine::init() {
 
     initGraphicsCommandBuffers();
     initComputeCommandBuffers();
+    if (_stream) {
+        initStreamCommandBuffers();
+    }
 
     initSyncObjects();
 
     _initialized = true;
 }
 
+// The compute side of init() without a window, surface or swap chain, nothing is drawn or presented
+void RenderingEngine::initHeadless(uint32_t particleCount) {
+    if (enableValidationLayers && !checkValidationLayerSupport()) {
+        throw std::runtime_error("Failed to enable vulkan validation layers!");
+    }
+    if (_streamingenabled) {
+        throw std::runtime_error("Particles cannot be streamed headless!");
+    }
+    // The compute shader runs in workgroups of 256 particles
+    if (particleCount == 0 || particleCount % 256 != 0) {
+        throw std::runtime_error("The particle count has to be a multiple of 256!");
+    }
+    _headless = true;
+    _particlecount = particleCount;
+
+    initVulkanInstance();
+
+    selectPhysicalDevice();
+    initLogicalDevice();
+    initMemoryAllocator();
+
+    initComputePipeline();
+
+    initCommandPool();
+    initUploadManager();
+    initReadbackManager();
+
+    // The mesh field is bound by the compute pass even while the mesh is empty
+    createVertexBuffer();
+    createIndexBuffer();
+    delete _loadedmesh;
+    _loadedmesh = nullptr;
+    createUniformBuffers();
+    createStorageBuffers();
+    _meshfield = new SignedDistanceField(_device, _physicaldevice, _memoryallocator, MAX_FRAMES_IN_FLIGHT);
+    _vectorfield = new VectorField(_device, _physicaldevice, _memoryallocator, _uploadmanager, _vectorfieldpath, MAX_FRAMES_IN_FLIGHT);
+    _pmgravity = new ParticleMeshGravity(_device, _physicaldevice, _memoryallocator, _storagebuffers, _particlecount);
+    _fluid = new FluidSolver(_device, _physicaldevice, _memoryallocator, _fluidresolution, MAX_FRAMES_IN_FLIGHT);
+
+    _requireduploadvalue = _uploadmanager->flush();
+    promotePendingMesh();
+
+    initComputeDescriptorPool();
+    initComputeDescriptorSets();
+
+    _initialized = true;
+}
+
 void RenderingEngine::initVulkanInstance() {
     VkApplicationInfo applicationInfo = {};
     applicationInfo.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO;
     applicationInfo.pApplicationName = _name.c_str();
+    applicationInfo.apiVersion = VK_API_VERSION_1_2;
 
-    VkInstanceCreateInfo instanceCreateInfo = _window->getVulkanInstanceCreateInfo();
+    // Headless instances need none of the window system's extensions
+    VkInstanceCreateInfo instanceCreateInfo = _headless ? VkInstanceCreateInfo{} : _window->getVulkanInstanceCreateInfo();
     instanceCreateInfo.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
     instanceCreateInfo.pApplicationInfo = &applicationInfo;
 
@@ -181,8 +302,12 @@ void RenderingEngine::initLogicalDevice() {
     const QueueFamilyIndices& queueFamilyIndices = _physicaldevice->queuefamilies;
 
     float deviceQueuePriority = 1.0f;
+    // Headless devices have no present family
     std::set<uint32_t> uniqueQueueFamilies = {queueFamilyIndices.graphicsComputeFamily.value(),
-                                         queueFamilyIndices.presentFamily.value()};
+                                         queueFamilyIndices.presentFamily.value_or(queueFamilyIndices.graphicsComputeFamily.value())};
+    if (queueFamilyIndices.transferFamily.has_value()) {
+        uniqueQueueFamilies.insert(queueFamilyIndices.transferFamily.value());
+    }
 
     vector<VkDeviceQueueCreateInfo> deviceQueueCreateInfos;
     for (uint32_t queueFamily: uniqueQueueFamilies) {
@@ -197,9 +322,16 @@ void RenderingEngine::initLogicalDevice() {
 
     VkPhysicalDeviceFeatures deviceFeatures = {};
     deviceFeatures.sampleRateShading = VK_TRUE;
+    deviceFeatures.multiDrawIndirect = _physicaldevice->multidrawindirectsupported ? VK_TRUE : VK_FALSE;
+    deviceFeatures.drawIndirectFirstInstance = _physicaldevice->multidrawindirectsupported ? VK_TRUE : VK_FALSE;
+
+    VkPhysicalDeviceVulkan12Features vulkan12Features = {};
+    vulkan12Features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+    vulkan12Features.timelineSemaphore = VK_TRUE;
 
     VkDeviceCreateInfo deviceCreateInfo = {};
     deviceCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+    deviceCreateInfo.pNext = &vulkan12Features;
     deviceCreateInfo.pEnabledFeatures = &deviceFeatures;
 
     deviceCreateInfo.pQueueCreateInfos = deviceQueueCreateInfos.data();
@@ -212,8 +344,8 @@ void RenderingEngine::initLogicalDevice() {
         deviceCreateInfo.enabledLayerCount = 0;
     }
 
-    deviceCreateInfo.enabledExtensionCount = static_cast<uint32_t>(DEVICE_EXTENSIONS.size());
-    deviceCreateInfo.ppEnabledExtensionNames = DEVICE_EXTENSIONS.data();
+    deviceCreateInfo.enabledExtensionCount = static_cast<uint32_t>(_physicaldevice->enabledextensions.size());
+    deviceCreateInfo.ppEnabledExtensionNames = _physicaldevice->enabledextensions.data();
 
     VkResult device_creation_result = vkCreateDevice(_physicaldevice->physicaldevice, &deviceCreateInfo, nullptr, &_device);
     if (device_creation_result != VK_SUCCESS) {
@@ -222,7 +354,14 @@ void RenderingEngine::initLogicalDevice() {
 
     vkGetDeviceQueue(_device, queueFamilyIndices.graphicsComputeFamily.value(), 0, &_graphicsqueue);
     vkGetDeviceQueue(_device, queueFamilyIndices.graphicsComputeFamily.value(), 0, &_computequeue);
-    vkGetDeviceQueue(_device, queueFamilyIndices.presentFamily.value(), 0, &_presentqueue);
+    vkGetDeviceQueue(_device, queueFamilyIndices.presentFamily.value_or(queueFamilyIndices.graphicsComputeFamily.value()),
+                     0, &_presentqueue);
+    vkGetDeviceQueue(_device, queueFamilyIndices.transferFamily.value_or(queueFamilyIndices.graphicsComputeFamily.value()),
+                     0, &_transferqueue);
+}
+
+void RenderingEngine::initMemoryAllocator() {
+    _memoryallocator = new MemoryAllocator(_device, _physicaldevice);
 }
 
 void RenderingEngine::initGraphicsPipeline() {
@@ -244,7 +383,7 @@ void RenderingEngine::initSwapchain() {
     int framebufferwidth, framebufferheight;
     _window->getSizePixels(framebufferwidth, framebufferheight);
 
-    _swapchain = new SwapChain(_device, _surface, _physicaldevice);
+    _swapchain = new SwapChain(_device, _surface, _physicaldevice, _memoryallocator);
     _swapchain->create(_graphicspipeline->renderpass, framebufferwidth, framebufferheight);
 
     _window->setResizeCallback(this, windowResizedCallback);
@@ -262,80 +401,127 @@ void RenderingEngine::initCommandPool() {
     }
 }
 
+void RenderingEngine::initUploadManager() {
+    const QueueFamilyIndices& queueFamilyIndices = _physicaldevice->queuefamilies;
+    uint32_t transferQueueFamily = queueFamilyIndices.transferFamily.value_or(queueFamilyIndices.graphicsComputeFamily.value());
+
+    _uploadmanager = new UploadManager(_device, _physicaldevice, _memoryallocator, _transferqueue, transferQueueFamily);
+}
+
+void RenderingEngine::initReadbackManager() {
+    _readbackmanager = new ReadbackManager(_device, _physicaldevice, _memoryallocator);
+}
+
 void RenderingEngine::createVertexBuffer() {
+    const void* vertexData = _vertices.data();
     VkDeviceSize vertexBufferSize = sizeof(_vertices[0]) * _vertices.size();
-    _vertexbuffer = new Buffer(_device, _physicaldevice);
-    _vertexbuffer->createOnDevice(vertexBufferSize, (void*) _vertices.data(),
-                                  VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
-                                 _commandpool,_graphicsqueue);
+    // Binary mesh files are copied into the staging ring straight from their mapping
+    if (_loadedmesh) {
+        vertexData = _loadedmesh->vertices;
+        vertexBufferSize = _loadedmesh->vertexSize();
+    }
+
+    // The signed distance field reads the vertices as a storage buffer
+    _pendingvertexbuffer = new Buffer(_device, _physicaldevice, _memoryallocator);
+    _pendingvertexbuffer->createOnDevice(vertexBufferSize, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, true);
+
+    _pendingmeshuploadvalue = _uploadmanager->upload(_pendingvertexbuffer->buffer, 0, vertexData, vertexBufferSize);
+    _pendingmeshcompact = _loadedmesh != nullptr;
+
+    _pendingmeshboundsmin = glm::vec3(0.0f);
+    _pendingmeshboundsmax = glm::vec3(0.0f);
+    size_t vertexCount = _loadedmesh ? _loadedmesh->vertexcount : _vertices.size();
+    for (size_t i = 0; i < vertexCount; i++) {
+        const glm::vec3& position = _loadedmesh ? _loadedmesh->vertices[i].pos : _vertices[i].pos;
+        _pendingmeshboundsmin = i == 0 ? position : glm::min(_pendingmeshboundsmin, position);
+        _pendingmeshboundsmax = i == 0 ? position : glm::max(_pendingmeshboundsmax, position);
+    }
 }
 
 void RenderingEngine::createIndexBuffer() {
+    const void* indexData = _indices.data();
     VkDeviceSize indexBufferSize = sizeof(_indices[0]) * _indices.size();
-    _indexbuffer = new Buffer(_device, _physicaldevice);
-    _indexbuffer->createOnDevice(indexBufferSize, (void*) _indices.data(),
-                                 VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
-                                 _commandpool,_graphicsqueue);
+    _pendingmeshindexcount = static_cast<uint32_t>(_indices.size());
+    _pendingmeshindextype = VK_INDEX_TYPE_UINT32;
+    if (_loadedmesh) {
+        indexData = _loadedmesh->indices;
+        indexBufferSize = _loadedmesh->indexSize();
+        _pendingmeshindexcount = _loadedmesh->indexcount;
+        _pendingmeshindextype = _loadedmesh->indextype;
+    }
+
+    // Storage buffers are read in 4 byte words, an odd number of 16 bit indices gets padded
+    _pendingindexbuffer = new Buffer(_device, _physicaldevice, _memoryallocator);
+    _pendingindexbuffer->createOnDevice((indexBufferSize + 3) & ~VkDeviceSize(3),
+                                        VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, true);
+
+    _pendingmeshuploadvalue = _uploadmanager->upload(_pendingindexbuffer->buffer, 0, indexData, indexBufferSize);
 }
 
 void RenderingEngine::createUniformBuffers() {
     VkDeviceSize graphicsUniformBufferSize = sizeof(PerspectiveUniformBufferObject) + sizeof(ModelUniformBufferObject);
     _graphicsuniformbuffers.resize(MAX_FRAMES_IN_FLIGHT);
     for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
-        _graphicsuniformbuffers[i] = new Buffer(_device, _physicaldevice);
+        _graphicsuniformbuffers[i] = new Buffer(_device, _physicaldevice, _memoryallocator);
         _graphicsuniformbuffers[i]->createOnHost(graphicsUniformBufferSize,VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT);
     }
 
     VkDeviceSize computeUniformBufferSize = sizeof(ComputeUniformBufferObject);
     _computeuniformbuffers.resize(MAX_FRAMES_IN_FLIGHT);
     for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
-        _computeuniformbuffers[i] = new Buffer(_device, _physicaldevice);
+        _computeuniformbuffers[i] = new Buffer(_device, _physicaldevice, _memoryallocator);
         _computeuniformbuffers[i]->createOnHost(computeUniformBufferSize,VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT);
     }
 }
 
 void RenderingEngine::createStorageBuffers() {
-    // Initialize particles
-    std::default_random_engine rndEngine((unsigned)time(nullptr));
-    std::uniform_real_distribution<float> rndDist(0.0f, 1.0f);
+    VkDeviceSize bufferSize = sizeof(Particle) * _particlecount;
 
-    // Initial particle positions on a circle
-    std::vector<Particle> particles(PARTICLE_COUNT);
-    for (auto& particle : particles) {
-        float radius = 0.25f * sqrt(rndDist(rndEngine));
+    _storagebuffers.resize(MAX_FRAMES_IN_FLIGHT);
+    _particlebufferindices.resize(MAX_FRAMES_IN_FLIGHT);
+    _previousparticlebufferindices.resize(MAX_FRAMES_IN_FLIGHT);
 
-        float u = rndDist(rndEngine);
-        float v = rndDist(rndEngine);
+    for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+        _storagebuffers[i] = new Buffer(_device, _physicaldevice, _memoryallocator);
+        _storagebuffers[i]->createOnDevice(bufferSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT
+                                                  | VK_BUFFER_USAGE_TRANSFER_SRC_BIT);
+        _particlebufferindices[i] = i;
+        _previousparticlebufferindices[i] = i;
+    }
 
-        float theta = 2.0f * 3.14159265358979323846f * u;
-        float phi = acos(2 * v - 1);
-        float x = (radius * sin(phi) * cos(theta));
-        float y = (radius * sin(phi) * sin(theta));
-        float z = (radius * cos(phi));
+    // Every frame uploads the streamed chunks itself
+    if (_stream) {
+        return;
+    }
 
-        particle.position = glm::vec3(x, y, z);
-        particle.velocity = glm::normalize(glm::vec3(x, y, z)) * VELOCITY_FACTOR;
-//        particle.color = glm::vec3(rndDist(rndEngine), rndDist(rndEngine), rndDist(rndEngine));
-        particle.color = glm::vec3(0.0f, 100, 100) / 255.0f;
+    if (!_initialcheckpointpath.empty()) {
+        loadCheckpoint(_initialcheckpointpath);
+        return;
     }
 
-    VkDeviceSize bufferSize = sizeof(Particle) * PARTICLE_COUNT;
+    // Initial particle positions on a sphere
+    std::vector<Particle> particles(_particlecount);
+    Particle::initializeSphere(particles.data(), particles.size(), VELOCITY_FACTOR, (uint32_t) time(nullptr));
 
-    _storagebuffers.resize(MAX_FRAMES_IN_FLIGHT);
+    uploadParticles(particles.data());
+}
 
+// Every storage buffer starts from the same state, the compute pass reads the previous frame's buffer
+void RenderingEngine::uploadParticles(const Particle* particles) {
+    VkDeviceSize bufferSize = sizeof(Particle) * _particlecount;
     for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
-        _storagebuffers[i] = new Buffer(_device, _physicaldevice);
-        _storagebuffers[i]->createOnDevice(bufferSize, (void*)particles.data(),
-                                           VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
-                                           _commandpool, _computequeue);
+        _uploadmanager->upload(_storagebuffers[i]->buffer, 0, particles, bufferSize);
     }
 }
 
 void RenderingEngine::initGraphicsDescriptorPool() {
-    std::array<VkDescriptorPoolSize, 1> descriptorPoolSizes = {};
+    std::array<VkDescriptorPoolSize, 2> descriptorPoolSizes = {};
     descriptorPoolSizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
     descriptorPoolSizes[0].descriptorCount = 2 * static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
 
+    descriptorPoolSizes[1].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    descriptorPoolSizes[1].descriptorCount = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
+
     VkDescriptorPoolCreateInfo descriptorPoolCreateInfo = {};
     descriptorPoolCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
     descriptorPoolCreateInfo.poolSizeCount = static_cast<uint32_t>(descriptorPoolSizes.size());
@@ -399,15 +585,45 @@ void RenderingEngine::initGraphicsDescriptorSets() {
         vkUpdateDescriptorSets(_device, static_cast<uint32_t>(writeDescriptorSets.size()),
                                writeDescriptorSets.data(), 0, nullptr);
     }
+
+    _instancebufferhandles.resize(MAX_FRAMES_IN_FLIGHT);
+    for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+        writeInstanceDescriptor(i, _instancedmeshes->prepare(i));
+    }
+}
+
+// The instance buffer is replaced when it grows, only while the frame's previous work has completed
+void RenderingEngine::writeInstanceDescriptor(uint32_t frame, VkBuffer instanceBuffer) {
+    VkDescriptorBufferInfo instanceBufferInfo;
+    instanceBufferInfo.buffer = instanceBuffer;
+    instanceBufferInfo.offset = 0;
+    instanceBufferInfo.range = VK_WHOLE_SIZE;
+
+    VkWriteDescriptorSet writeDescriptorSet = {};
+    writeDescriptorSet.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    writeDescriptorSet.dstSet = _graphicsdescriptorsets[frame];
+    writeDescriptorSet.dstBinding = 2;
+    writeDescriptorSet.dstArrayElement = 0;
+    writeDescriptorSet.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    writeDescriptorSet.descriptorCount = 1;
+    writeDescriptorSet.pBufferInfo = &instanceBufferInfo;
+
+    vkUpdateDescriptorSets(_device, 1, &writeDescriptorSet, 0, nullptr);
+    _instancebufferhandles[frame] = instanceBuffer;
 }
 
 void RenderingEngine::initComputeDescriptorPool() {
-    std::array<VkDescriptorPoolSize, 2> descriptorPoolSizes = {};
+    std::array<VkDescriptorPoolSize, 3> descriptorPoolSizes = {};
     descriptorPoolSizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
     descriptorPoolSizes[0].descriptorCount = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
 
+    // Two particle buffers, the particle-mesh forces and the fluid velocity
     descriptorPoolSizes[1].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-    descriptorPoolSizes[1].descriptorCount = 2 * static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
+    descriptorPoolSizes[1].descriptorCount = 4 * static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
+
+    // The mesh's distance field and two frames of the vector field
+    descriptorPoolSizes[2].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    descriptorPoolSizes[2].descriptorCount = 3 * static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
 
     VkDescriptorPoolCreateInfo descriptorPoolCreateInfo = {};
     descriptorPoolCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
@@ -439,7 +655,7 @@ void RenderingEngine::initComputeDescriptorSets() {
 
     for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
 
-        std::array<VkWriteDescriptorSet, 3> writeDescriptorSets = {};
+        std::array<VkWriteDescriptorSet, 5> writeDescriptorSets = {};
 
         VkDescriptorBufferInfo uniformBufferInfo;
         uniformBufferInfo.buffer = _computeuniformbuffers[i]->buffer;
@@ -455,9 +671,9 @@ void RenderingEngine::initComputeDescriptorSets() {
         writeDescriptorSets[0].pBufferInfo = &uniformBufferInfo;
 
         VkDescriptorBufferInfo storageBufferInfoPreviousFrame = {};
-        storageBufferInfoPreviousFrame.buffer = _storagebuffers[(i - 1) % MAX_FRAMES_IN_FLIGHT]->buffer;
+        storageBufferInfoPreviousFrame.buffer = _storagebuffers[(i + MAX_FRAMES_IN_FLIGHT - 1) % MAX_FRAMES_IN_FLIGHT]->buffer;
         storageBufferInfoPreviousFrame.offset = 0;
-        storageBufferInfoPreviousFrame.range = sizeof(Particle) * PARTICLE_COUNT;
+        storageBufferInfoPreviousFrame.range = sizeof(Particle) * _particlecount;
 
         writeDescriptorSets[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
         writeDescriptorSets[1].dstSet = _computedescriptorsets[i];
@@ -470,7 +686,7 @@ void RenderingEngine::initComputeDescriptorSets() {
         VkDescriptorBufferInfo storageBufferInfoCurrentFrame = {};
         storageBufferInfoCurrentFrame.buffer = _storagebuffers[i]->buffer;
         storageBufferInfoCurrentFrame.offset = 0;
-        storageBufferInfoCurrentFrame.range = sizeof(Particle) * PARTICLE_COUNT;
+        storageBufferInfoCurrentFrame.range = sizeof(Particle) * _particlecount;
 
         writeDescriptorSets[2].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
         writeDescriptorSets[2].dstSet = _computedescriptorsets[i];
@@ -480,9 +696,82 @@ void RenderingEngine::initComputeDescriptorSets() {
         writeDescriptorSets[2].descriptorCount = 1;
         writeDescriptorSets[2].pBufferInfo = &storageBufferInfoCurrentFrame;
 
+        VkDescriptorImageInfo meshFieldInfo = {};
+        meshFieldInfo.sampler = _meshfield->sampler;
+        meshFieldInfo.imageView = _meshfield->view;
+        meshFieldInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+        writeDescriptorSets[3].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        writeDescriptorSets[3].dstSet = _computedescriptorsets[i];
+        writeDescriptorSets[3].dstBinding = 3;
+        writeDescriptorSets[3].dstArrayElement = 0;
+        writeDescriptorSets[3].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+        writeDescriptorSets[3].descriptorCount = 1;
+        writeDescriptorSets[3].pImageInfo = &meshFieldInfo;
+
+        VkDescriptorBufferInfo pmForceInfo = {};
+        pmForceInfo.buffer = _pmgravity->forcebuffer->buffer;
+        pmForceInfo.offset = 0;
+        pmForceInfo.range = VK_WHOLE_SIZE;
+
+        writeDescriptorSets[4].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        writeDescriptorSets[4].dstSet = _computedescriptorsets[i];
+        writeDescriptorSets[4].dstBinding = 5;
+        writeDescriptorSets[4].dstArrayElement = 0;
+        writeDescriptorSets[4].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        writeDescriptorSets[4].descriptorCount = 1;
+        writeDescriptorSets[4].pBufferInfo = &pmForceInfo;
+
         vkUpdateDescriptorSets(_device, static_cast<uint32_t>(writeDescriptorSets.size()),
                                writeDescriptorSets.data(), 0, nullptr);
     }
+
+    _vectorfieldviews.resize(MAX_FRAMES_IN_FLIGHT);
+    for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+        writeVectorFieldDescriptor(i);
+        writeFluidDescriptor(i);
+    }
+}
+
+// The sampled frames change as the field streams, only while the frame's previous work has completed
+void RenderingEngine::writeVectorFieldDescriptor(uint32_t frame) {
+    std::array<VkDescriptorImageInfo, 2> frameInfos = {};
+    for (uint32_t i = 0; i < frameInfos.size(); i++) {
+        frameInfos[i].sampler = _vectorfield->sampler;
+        frameInfos[i].imageView = _vectorfield->getView(i);
+        frameInfos[i].imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+        _vectorfieldviews[frame][i] = frameInfos[i].imageView;
+    }
+
+    VkWriteDescriptorSet writeDescriptorSet = {};
+    writeDescriptorSet.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    writeDescriptorSet.dstSet = _computedescriptorsets[frame];
+    writeDescriptorSet.dstBinding = 4;
+    writeDescriptorSet.dstArrayElement = 0;
+    writeDescriptorSet.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    writeDescriptorSet.descriptorCount = static_cast<uint32_t>(frameInfos.size());
+    writeDescriptorSet.pImageInfo = frameInfos.data();
+
+    vkUpdateDescriptorSets(_device, 1, &writeDescriptorSet, 0, nullptr);
+}
+
+// Rewritten when the fluid solver is replaced, only while the frame's previous work has completed
+void RenderingEngine::writeFluidDescriptor(uint32_t frame) {
+    VkDescriptorBufferInfo fluidVelocityInfo = {};
+    fluidVelocityInfo.buffer = _fluid->velocitybuffer->buffer;
+    fluidVelocityInfo.offset = 0;
+    fluidVelocityInfo.range = VK_WHOLE_SIZE;
+
+    VkWriteDescriptorSet writeDescriptorSet = {};
+    writeDescriptorSet.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    writeDescriptorSet.dstSet = _computedescriptorsets[frame];
+    writeDescriptorSet.dstBinding = 6;
+    writeDescriptorSet.dstArrayElement = 0;
+    writeDescriptorSet.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    writeDescriptorSet.descriptorCount = 1;
+    writeDescriptorSet.pBufferInfo = &fluidVelocityInfo;
+
+    vkUpdateDescriptorSets(_device, 1, &writeDescriptorSet, 0, nullptr);
 }
 
 void RenderingEngine::initGraphicsCommandBuffers() {
@@ -515,6 +804,21 @@ void RenderingEngine::initComputeCommandBuffers() {
     }
 }
 
+void RenderingEngine::initStreamCommandBuffers() {
+    _streamcommandbuffers.resize(STREAM_SLOTS);
+
+    VkCommandBufferAllocateInfo allocationInfo = {};
+    allocationInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    allocationInfo.commandPool = _commandpool;
+    allocationInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    allocationInfo.commandBufferCount = (uint32_t) _streamcommandbuffers.size();
+
+    VkResult command_buffer_creation_result = vkAllocateCommandBuffers(_device, &allocationInfo, _streamcommandbuffers.data());
+    if (command_buffer_creation_result != VK_SUCCESS) {
+        throw vulkan_error("Failed to create stream command buffers", command_buffer_creation_result);
+    }
+}
+
 void RenderingEngine::initSyncObjects() {
     _imageAvailableSemaphores.resize(MAX_FRAMES_IN_FLIGHT);
     _renderFinishedSemaphores.resize(MAX_FRAMES_IN_FLIGHT);
@@ -565,7 +869,7 @@ void RenderingEngine::initSyncObjects() {
     }
 }
 
-void RenderingEngine::recordComputeCommandBuffer(VkCommandBuffer commandBuffer) {
+void RenderingEngine::recordComputeCommandBuffer(VkCommandBuffer commandBuffer, bool simulate) {
     VkCommandBufferBeginInfo beginInfo = {};
     beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
 
@@ -574,13 +878,41 @@ void RenderingEngine::recordComputeCommandBuffer(VkCommandBuffer commandBuffer)
         throw vulkan_error("Failed to start recording compute command buffer", begin_command_buffer_result);
     }
 
-    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, _computepipeline->pipeline);
-    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, _computepipeline->layout,
-                            0, 1, &_computedescriptorsets[_currentframe],
-                            0, nullptr);
+    // Rebuilt right after a new mesh has been promoted, before anything samples it
+    _meshfield->record(commandBuffer, _currentframe);
+
+    // Frames without a simulation step (and every frame while replaying) only hold mesh voxelizations and readbacks,
+    // they are still submitted for their semaphores
+    uint32_t step = static_cast<uint32_t>(_simulationsteps % MAX_FRAMES_IN_FLIGHT);
+    if (simulate) {
+        if (_pmgravitystrength > 0.0f) {
+            _pmgravity->record(commandBuffer, step, _pmgravitystrength);
+        }
+        if (_fluidcoupling > 0.0f) {
+            _fluid->record(commandBuffer, step);
+        }
 
-    vkCmdDispatch(commandBuffer, PARTICLE_COUNT / 256, 1, 1);
+        // The previous frames may still be drawing (and depth sorting) the buffer this step writes, they were
+        // submitted to the same queue
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                             VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 0, nullptr);
 
+        vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, _computepipeline->pipeline);
+        vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, _computepipeline->layout,
+                                0, 1, &_computedescriptorsets[step],
+                                0, nullptr);
+
+        vkCmdDispatch(commandBuffer, _particlecount / 256, 1, 1);
+        if (_statistics) {
+            _statistics->record(commandBuffer, step, _currentframe, _framenumber);
+        }
+        step = static_cast<uint32_t>((_simulationsteps + 1) % MAX_FRAMES_IN_FLIGHT);
+    }
+    if (!_replaysource) {
+        size_t latest = (step + MAX_FRAMES_IN_FLIGHT - 1) % MAX_FRAMES_IN_FLIGHT;
+        _readbackmanager->record(commandBuffer, _storagebuffers[latest]->buffer, _framenumber, _computesubmissions + 1);
+        _fieldhistory[_framenumber % FIELD_STATE_HISTORY] = {_framenumber, _fieldstate};
+    }
 
     VkResult command_buffer_end_result = vkEndCommandBuffer(commandBuffer);
     if (command_buffer_end_result != VK_SUCCESS) {
@@ -597,12 +929,50 @@ void RenderingEngine::recordGraphicsCommandBuffer(VkCommandBuffer commandBuffer,
         throw vulkan_error("Failed to start recording graphics command buffer", begin_command_buffer_result);
     }
 
+    if (_replaysource && _replayslots[_currentframe] != ReplaySource::NO_FRAME) {
+        recordReplayCopy(commandBuffer);
+    }
+
+    // Sorts the buffer this frame draws, whichever way it got there, for the frame's camera
+    if (_depthsort) {
+        _depthsort->record(commandBuffer, _particlebufferindices[_currentframe], getViewMatrix(), CAMERA_NEAR, CAMERA_FAR);
+    }
+
+    prepareInstances();
+    _resolutiongovernor->begin(commandBuffer, _currentframe);
+    VkExtent2D renderExtent = _resolutiongovernor->getRenderExtent(_swapchain->extent);
+    beginScenePass(commandBuffer, _graphicspipeline->renderpass, renderExtent);
+    recordMeshes(commandBuffer);
+
+    recordParticles(commandBuffer, _storagebuffers[_particlebufferindices[_currentframe]]->buffer,
+                    _storagebuffers[_previousparticlebufferindices[_currentframe]]->buffer, _particlecount);
+
+    vkCmdEndRenderPass(commandBuffer);
+    _resolutiongovernor->end(commandBuffer, _currentframe);
+
+    _swapchain->recordBlit(commandBuffer, imageIndex, renderExtent);
+
+    VkResult command_buffer_end_result = vkEndCommandBuffer(commandBuffer);
+    if (command_buffer_end_result != VK_SUCCESS) {
+        throw vulkan_error("Failed to finish recording graphics command buffer!", command_buffer_end_result);
+    }
+}
+
+// Descriptor sets can't change once bound, so the instances are brought up to date before the scene pass begins
+void RenderingEngine::prepareInstances() {
+    VkBuffer instanceBuffer = _instancedmeshes->prepare(_currentframe);
+    if (instanceBuffer != _instancebufferhandles[_currentframe]) {
+        writeInstanceDescriptor(_currentframe, instanceBuffer);
+    }
+}
+
+void RenderingEngine::beginScenePass(VkCommandBuffer commandBuffer, VkRenderPass renderPass, VkExtent2D renderExtent) {
     VkRenderPassBeginInfo renderPassBeginInfo = {};
     renderPassBeginInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-    renderPassBeginInfo.renderPass = _graphicspipeline->renderpass;
-    renderPassBeginInfo.framebuffer = _swapchain->framebuffers[imageIndex];
+    renderPassBeginInfo.renderPass = renderPass;
+    renderPassBeginInfo.framebuffer = _swapchain->framebuffer;
     renderPassBeginInfo.renderArea.offset = {0, 0};
-    renderPassBeginInfo.renderArea.extent = _swapchain->extent;
+    renderPassBeginInfo.renderArea.extent = renderExtent;
 
     std::array<VkClearValue, 2> clearValues{};
     clearValues[0].color = {{0.0f, 0.0f, 0.0f, 1.0f}};
@@ -616,14 +986,14 @@ void RenderingEngine::recordGraphicsCommandBuffer(VkCommandBuffer commandBuffer,
     VkViewport viewport = {};
     viewport.x = 0.0f;
     viewport.y = 0.0f;
-    viewport.width = static_cast<float>(_swapchain->extent.width);
-    viewport.height = static_cast<float>(_swapchain->extent.height);
+    viewport.width = static_cast<float>(renderExtent.width);
+    viewport.height = static_cast<float>(renderExtent.height);
     viewport.minDepth = 0.0f;
     viewport.maxDepth = 1.0f;
 
     VkRect2D scissor = {};
     scissor.offset = {0, 0};
-    scissor.extent = _swapchain->extent;
+    scissor.extent = renderExtent;
 
     vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
     vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
@@ -633,27 +1003,60 @@ void RenderingEngine::recordGraphicsCommandBuffer(VkCommandBuffer commandBuffer,
     vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, _graphicspipeline->layout,
                             0, 1, &_graphicsdescriptorsets[_currentframe],
                             0, nullptr);
+}
 
+void RenderingEngine::recordMeshes(VkCommandBuffer commandBuffer) {
     VkDeviceSize offsets[] = {0};
     VkBuffer vertexBuffers[] = {_vertexbuffer->buffer};
+    VkBuffer indexBuffer = _indexbuffer->buffer;
+    uint32_t indexCount = _meshindexcount;
+    VkIndexType indexType = _meshindextype;
+    bool compactVertices = _meshcompact;
+
+    // The frame's previous work has completed, so its copy of the dynamic mesh can take the latest changes
+    if (_dynamicmeshactive) {
+        vertexBuffers[0] = _dynamicvertexbuffer->prepare(_currentframe);
+        indexBuffer = _dynamicindexbuffer->prepare(_currentframe);
+        indexCount = _dynamicindexcount;
+        indexType = VK_INDEX_TYPE_UINT32;
+        compactVertices = false;
+    }
 
-    vkCmdBindVertexBuffers(commandBuffer, 0, 1, vertexBuffers, offsets);
-    vkCmdBindIndexBuffer(commandBuffer, _indexbuffer->buffer, 0, VK_INDEX_TYPE_UINT32);
+    if (indexCount > 0 && vertexBuffers[0] && indexBuffer) {
+        if (compactVertices) {
+            vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, _graphicspipeline->compactpipeline);
+        }
 
-    vkCmdDrawIndexed(commandBuffer, static_cast<uint32_t>(_indices.size()), 1, 0, 0, 0);
+        vkCmdBindVertexBuffers(commandBuffer, 0, 1, vertexBuffers, offsets);
+        vkCmdBindIndexBuffer(commandBuffer, indexBuffer, 0, indexType);
 
-    // Particles
-    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, _graphicspipeline->particlepipeline);
+        vkCmdDrawIndexed(commandBuffer, indexCount, 1, 0, 0, 0);
 
-    vkCmdBindVertexBuffers(commandBuffer, 0, 1, &_storagebuffers[_currentframe]->buffer, offsets);
+        if (compactVertices) {
+            vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, _graphicspipeline->pipeline);
+        }
+    }
 
-    vkCmdDraw(commandBuffer, PARTICLE_COUNT, 1, 0, 0);
+    _instancedmeshes->draw(commandBuffer);
+}
 
-    vkCmdEndRenderPass(commandBuffer);
+void RenderingEngine::recordParticles(VkCommandBuffer commandBuffer, VkBuffer current, VkBuffer previous, uint32_t count) {
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                      _depthsort ? _graphicspipeline->sortedparticlepipeline : _graphicspipeline->particlepipeline);
 
-    VkResult command_buffer_end_result = vkEndCommandBuffer(commandBuffer);
-    if (command_buffer_end_result != VK_SUCCESS) {
-        throw vulkan_error("Failed to finish recording graphics command buffer!", command_buffer_end_result);
+    ParticlePushConstants particlePushConstants = {_interpolation};
+    vkCmdPushConstants(commandBuffer, _graphicspipeline->layout, VK_SHADER_STAGE_VERTEX_BIT, 0,
+                       sizeof(particlePushConstants), &particlePushConstants);
+
+    VkBuffer particleBuffers[] = {current, previous};
+    VkDeviceSize particleOffsets[] = {0, 0};
+    vkCmdBindVertexBuffers(commandBuffer, 0, 2, particleBuffers, particleOffsets);
+
+    if (_depthsort) {
+        vkCmdBindIndexBuffer(commandBuffer, _depthsort->indexbuffer->buffer, 0, VK_INDEX_TYPE_UINT32);
+        vkCmdDrawIndexed(commandBuffer, count, 1, 0, 0, 0);
+    } else {
+        vkCmdDraw(commandBuffer, count, 1, 0, 0);
     }
 }
 
@@ -665,8 +1068,8 @@ void RenderingEngine::updateGraphicsUniformBuffer(uint32_t currentImage) {
     float time = std::chrono::duration<float, std::chrono::seconds::period>(currentTime - startTime).count();
 
     PerspectiveUniformBufferObject perspectiveUBO = {};
-    perspectiveUBO.view = glm::lookAt(glm::vec3(2.0f, 2.0f, 2.0f), glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f));
-    perspectiveUBO.proj = glm::perspective(glm::radians(45.0f), (float) _swapchain->extent.width / (float) _swapchain->extent.height, 0.1f, 10.0f);
+    perspectiveUBO.view = getViewMatrix();
+    perspectiveUBO.proj = glm::perspective(glm::radians(45.0f), (float) _swapchain->extent.width / (float) _swapchain->extent.height, CAMERA_NEAR, CAMERA_FAR);
     // glm is designed for OpenGL, where the y coordinate is flipped the other way around.
     // We compensate for this by flipping the projection matrix.
     perspectiveUBO.proj[1][1] *= -1;
@@ -674,7 +1077,7 @@ void RenderingEngine::updateGraphicsUniformBuffer(uint32_t currentImage) {
     memcpy(_graphicsuniformbuffers[currentImage]->mapping, &perspectiveUBO, sizeof(perspectiveUBO));
 
     ModelUniformBufferObject modelUBO = {};
-    modelUBO.model = glm::rotate(glm::mat4(1.0f), glm::radians(90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
+    modelUBO.model = getMeshModelMatrix();
 
     size_t modelUBOOffset = sizeof(PerspectiveUniformBufferObject);
     void* offsetModelUBOMapping = static_cast<std::byte*>(_graphicsuniformbuffers[currentImage]->mapping) + modelUBOOffset;
@@ -682,6 +1085,14 @@ void RenderingEngine::updateGraphicsUniformBuffer(uint32_t currentImage) {
     memcpy(offsetModelUBOMapping, &modelUBO, sizeof(modelUBO));
 }
 
+glm::mat4 RenderingEngine::getViewMatrix() {
+    return glm::lookAt(glm::vec3(2.0f, 2.0f, 2.0f), glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f));
+}
+
+glm::mat4 RenderingEngine::getMeshModelMatrix() {
+    return glm::rotate(glm::mat4(1.0f), glm::radians(90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
+}
+
 void RenderingEngine::updateComputeUniformBuffer(uint32_t currentImage) {
     static auto startTime = std::chrono::high_resolution_clock::now();
     auto currentTime = std::chrono::high_resolution_clock::now();
@@ -690,7 +1101,9 @@ void RenderingEngine::updateComputeUniformBuffer(uint32_t currentImage) {
     float timeElapsed = std::chrono::duration<float, std::chrono::seconds::period>(currentTime - startTime).count();
 
     ComputeUniformBufferObject ubo{};
-    ubo.deltaTime = _lastframetime * 2000.0f;
+    ubo.deltaTime = (_simulationrate > 0.0f ? 1.0f / _simulationrate : _lastframetime) * 2000.0f;
+
+    applyControlInput();
 
     glm::vec4 gravityPoint = glm::vec4(0.5f, 0.0f, 0.0f, 1.0f);
     glm::vec3 rotationAxis = glm::vec3(0.1f, 0.1f, 1.0f);
@@ -699,81 +1112,234 @@ void RenderingEngine::updateComputeUniformBuffer(uint32_t currentImage) {
     float angle = glm::radians(90.0f) * ubo.deltaTime; // timeElapsed
 
     gravityPoint = gravityPoint * glm::rotate(glm::mat4(1.0f), angle, rotationAxis);
+    if (_controlstate.fields & CONTROL_GRAVITY_POINT) {
+        const float* controlled = _controlstate.gravitypoint;
+        gravityPoint = glm::vec4(controlled[0], controlled[1], controlled[2], controlled[3]);
+    }
     ubo.gravityPoint = gravityPoint;
 
+    _fieldstate.framenumber++;
+    _fieldstate.simulationtime += ubo.deltaTime;
+    _fieldstate.lastframetime = _lastframetime;
+    _fieldstate.gravityangle = angle;
+    memcpy(_fieldstate.gravitypoint, &gravityPoint, sizeof(_fieldstate.gravitypoint));
+
+    _vectorfield->update(_fieldstate.simulationtime, _framenumber);
+    if (_vectorfield->getView(0) != _vectorfieldviews[currentImage][0] || _vectorfield->getView(1) != _vectorfieldviews[currentImage][1]) {
+        writeVectorFieldDescriptor(currentImage);
+    }
+    ubo.fieldOrigin = _vectorfield->fieldorigin;
+    ubo.fieldOrigin.w *= _vectorfieldstrength;
+    ubo.fieldScale = _vectorfield->fieldscale;
+
+    ubo.pmOrigin = _pmgravity->pmorigin;
+    // The particle mesh would only hold the chunk being simulated
+    ubo.pmOrigin.w = _pmgravitystrength > 0.0f && !_stream ? 1.0f : 0.0f;
+    ubo.pmScale = _pmgravity->pmscale;
+
+    glm::vec3 stirPosition = glm::vec3(gravityPoint);
+    bool stirring = _fluidstirred && ubo.deltaTime > 0.0f;
+    glm::vec3 stirVelocity = stirring ? (stirPosition - _fluidstirposition) / glm::vec3(ubo.deltaTime) : glm::vec3(0.0f);
+    _fluidstirposition = stirPosition;
+    _fluidstirred = true;
+    _fluid->update(ubo.deltaTime, stirPosition, stirVelocity);
+    ubo.fluidOrigin = _fluid->fluidorigin;
+    ubo.fluidOrigin.w = _fluidcoupling;
+    ubo.fluidScale = _fluid->fluidscale;
+
+    // The dynamic mesh drawn in place of the static one is not voxelized, particles pass through it
+    if (!_dynamicmeshactive) {
+        ubo.sdfOrigin = _meshfield->sdforigin;
+        ubo.sdfScale = _meshfield->sdfscale;
+    }
+
     memcpy(_computeuniformbuffers[currentImage]->mapping, &ubo, sizeof(ubo));
 }
 
+// No device idle: the frames in flight finish with the old swap chain, which is deleted once they have retired
 void RenderingEngine::recreateSwapChain() {
-    vkDeviceWaitIdle(_device);
-
-    delete _swapchain;
-
     int framebufferwidth, framebufferheight;
     _window->getSizePixels(framebufferwidth, framebufferheight);
 
-    _swapchain = new SwapChain(_device, _surface, _physicaldevice);
-    _swapchain->create(_graphicspipeline->renderpass, framebufferwidth, framebufferheight);
+    SwapChain* swapchain = new SwapChain(_device, _surface, _physicaldevice, _memoryallocator);
+    swapchain->create(_graphicspipeline->renderpass, framebufferwidth, framebufferheight, _swapchain);
+
+    _retiredswapchains.push_back({_swapchain, _framenumber});
+    _swapchain = swapchain;
 }
 
 
 void RenderingEngine::draw() {
+    TraceZone frameZone("frame");
+    TraceZone windowZone("window events");
     _window->update();
+    windowZone.end();
+
+    if (_stream) {
+        drawStreamed();
+    } else {
+        drawResident();
+    }
+
+    // Also after frames dropped for an out of date swap chain. The frame zone ends after this, it shows up in the
+    // next frame's collection.
+    if (_tracecollector) {
+        TraceZone collectZone("collect trace");
+        _tracecollector->collect();
+    }
+}
+
+// The particles stay in device memory, compute and graphics are submitted separately
+void RenderingEngine::drawResident() {
+    recordTrajectoryFrame();
 
     // Compute //
+    TraceZone computeFenceZone("wait compute fence");
     vkWaitForFences(_device, 1, &_computeInFlightFences[_currentframe], VK_TRUE, UINT64_MAX);
+    computeFenceZone.end();
+    if (_statistics) {
+        _statistics->collect(_currentframe);
+    }
 
-    updateComputeUniformBuffer(_currentframe);
+    // A step uses the uniform buffer and descriptor set of the storage buffer it writes. At most one step per frame,
+    // so their previous step belongs to a frame at least MAX_FRAMES_IN_FLIGHT back, whose fence has been waited for.
+    bool simulate = advanceSimulationClock();
+    if (simulate) {
+        TraceZone uniformZone("update compute ubo");
+        updateComputeUniformBuffer(static_cast<uint32_t>(_simulationsteps % MAX_FRAMES_IN_FLIGHT));
+    }
 
     vkResetFences(_device, 1, &_computeInFlightFences[_currentframe]);
 
+    TraceZone computeRecordZone("record compute");
     vkResetCommandBuffer(_computecommandbuffers[_currentframe], 0);
-    recordComputeCommandBuffer(_computecommandbuffers[_currentframe]);
+    recordComputeCommandBuffer(_computecommandbuffers[_currentframe], simulate);
+    computeRecordZone.end();
+    if (simulate) {
+        _simulationsteps++;
+    }
+
+    uint64_t computeWaitValues[] = {_requireduploadvalue};
+    VkSemaphore computeSignalSemaphores[] = {_computeFinishedSemaphores[_currentframe], _readbackmanager->timeline};
+    uint64_t computeSignalValues[] = {0, _computesubmissions + 1};
+
+    VkTimelineSemaphoreSubmitInfo computeTimelineSubmitInfo = {};
+    computeTimelineSubmitInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+    computeTimelineSubmitInfo.waitSemaphoreValueCount = 1;
+    computeTimelineSubmitInfo.pWaitSemaphoreValues = computeWaitValues;
+    computeTimelineSubmitInfo.signalSemaphoreValueCount = 2;
+    computeTimelineSubmitInfo.pSignalSemaphoreValues = computeSignalValues;
+
+    VkPipelineStageFlags computeWaitStages[] = {VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT};
 
     VkSubmitInfo computeSubmitInfo = {};
     computeSubmitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    computeSubmitInfo.pNext = &computeTimelineSubmitInfo;
+    computeSubmitInfo.waitSemaphoreCount = 1;
+    computeSubmitInfo.pWaitSemaphores = &_uploadmanager->timeline;
+    computeSubmitInfo.pWaitDstStageMask = computeWaitStages;
     computeSubmitInfo.commandBufferCount = 1;
     computeSubmitInfo.pCommandBuffers = &_computecommandbuffers[_currentframe];
-    computeSubmitInfo.signalSemaphoreCount = 1;
-    computeSubmitInfo.pSignalSemaphores = &_computeFinishedSemaphores[_currentframe];
+    computeSubmitInfo.signalSemaphoreCount = 2;
+    computeSubmitInfo.pSignalSemaphores = computeSignalSemaphores;
 
+    TraceZone computeSubmitZone("submit compute");
     VkResult compute_queue_submit_result = vkQueueSubmit(_computequeue, 1, &computeSubmitInfo, _computeInFlightFences[_currentframe]);
     if (compute_queue_submit_result != VK_SUCCESS) {
         throw vulkan_error("Failed to submit command buffer to compute queue!", compute_queue_submit_result);
     }
+    _computesubmissions++;
+    computeSubmitZone.end();
 
+    TraceZone frameFenceZone("wait frame fence");
     vkWaitForFences(_device, 1, &_inFlightFences[_currentframe], VK_TRUE, UINT32_MAX);
+    frameFenceZone.end();
+
+    TraceZone upkeepZone("frame upkeep");
+    // The replayed frame this frame copied last time has been read
+    if (_replaysource && _replayslots[_currentframe] != ReplaySource::NO_FRAME) {
+        _replaysource->releaseFrame(_replayslots[_currentframe]);
+        _replayslots[_currentframe] = ReplaySource::NO_FRAME;
+    }
+    releaseRetiredBuffers();
+    updateMesh();
+    defragmentMemory();
+    _readbackmanager->poll();
+    measureControlLatency();
+    upkeepZone.end();
 
     // Graphics
     uint32_t imageIndex;
+    TraceZone acquireZone("acquire");
     VkResult acquire_image_result = vkAcquireNextImageKHR(_device, _swapchain->swapchain, UINT64_MAX,
                                                           _imageAvailableSemaphores[_currentframe],
                                                           VK_NULL_HANDLE, &imageIndex);
+    acquireZone.end();
 
     if (acquire_image_result == VK_ERROR_OUT_OF_DATE_KHR) {
+        // The frame is dropped after its compute submission, which signaled the frame's compute semaphore. A batch
+        // that only waits on it leaves it unsignaled for the frame's next submission.
+        VkPipelineStageFlags computeWaitStage = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+        VkSubmitInfo waitSubmitInfo = {};
+        waitSubmitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+        waitSubmitInfo.waitSemaphoreCount = 1;
+        waitSubmitInfo.pWaitSemaphores = &_computeFinishedSemaphores[_currentframe];
+        waitSubmitInfo.pWaitDstStageMask = &computeWaitStage;
+
+        VkResult wait_submit_result = vkQueueSubmit(_graphicsqueue, 1, &waitSubmitInfo, VK_NULL_HANDLE);
+        if (wait_submit_result != VK_SUCCESS) {
+            throw vulkan_error("Failed to submit compute semaphore wait to graphics queue!", wait_submit_result);
+        }
+
         recreateSwapChain();
         return;
     } else if (acquire_image_result != VK_SUCCESS && acquire_image_result != VK_SUBOPTIMAL_KHR) {
         throw vulkan_error("Failed to acquire next swap chain image!", acquire_image_result);
     }
 
+    // Only once the frame is certain to be drawn, a replayed frame is then copied by its command buffer
+    if (_replaysource) {
+        acquireReplayFrame();
+        _previousparticlebufferindices[_currentframe] = _particlebufferindices[_currentframe];
+    } else {
+        _particlebufferindices[_currentframe] = (_simulationsteps + MAX_FRAMES_IN_FLIGHT - 1) % MAX_FRAMES_IN_FLIGHT;
+        _previousparticlebufferindices[_currentframe] = (_simulationsteps + MAX_FRAMES_IN_FLIGHT - 2) % MAX_FRAMES_IN_FLIGHT;
+    }
+
     vkResetFences(_device, 1, &_inFlightFences[_currentframe]);
 
+    TraceZone graphicsUniformZone("update graphics ubo");
     updateGraphicsUniformBuffer(_currentframe);
+    graphicsUniformZone.end();
 
+    TraceZone graphicsRecordZone("record graphics");
     vkResetCommandBuffer(_graphicscommandbuffers[_currentframe], 0);
     recordGraphicsCommandBuffer(_graphicscommandbuffers[_currentframe], imageIndex);
+    graphicsRecordZone.end();
 
     VkSubmitInfo graphicsSubmitInfo = {};
     graphicsSubmitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
 
-    VkSemaphore waitSemaphores[] = {_computeFinishedSemaphores[_currentframe], _imageAvailableSemaphores[_currentframe]};
-    graphicsSubmitInfo.waitSemaphoreCount = 2;
+    VkSemaphore waitSemaphores[] = {_computeFinishedSemaphores[_currentframe], _imageAvailableSemaphores[_currentframe],
+                                    _uploadmanager->timeline};
+    graphicsSubmitInfo.waitSemaphoreCount = 3;
     graphicsSubmitInfo.pWaitSemaphores = waitSemaphores;
 
-    VkPipelineStageFlags waitStages[] = {VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT};
+    // The swap chain image is only written by the blit at the end, the scene renders before it has been acquired.
+    // The particles are read as vertices, and by the depth sort's compute pass before the render pass.
+    VkPipelineStageFlags particleStages = VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+    VkPipelineStageFlags waitStages[] = {particleStages, VK_PIPELINE_STAGE_TRANSFER_BIT, particleStages};
     graphicsSubmitInfo.pWaitDstStageMask = waitStages;
 
+    // Only the upload timeline semaphore reads its value, the binary semaphores ignore theirs
+    uint64_t graphicsWaitValues[] = {0, 0, _requireduploadvalue};
+
+    VkTimelineSemaphoreSubmitInfo graphicsTimelineSubmitInfo = {};
+    graphicsTimelineSubmitInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+    graphicsTimelineSubmitInfo.waitSemaphoreValueCount = 3;
+    graphicsTimelineSubmitInfo.pWaitSemaphoreValues = graphicsWaitValues;
+    graphicsSubmitInfo.pNext = &graphicsTimelineSubmitInfo;
+
     VkSemaphore signalSemaphores[] = {_renderFinishedSemaphores[_currentframe]};
     graphicsSubmitInfo.signalSemaphoreCount = 1;
     graphicsSubmitInfo.pSignalSemaphores = signalSemaphores;
@@ -781,22 +1347,31 @@ void RenderingEngine::draw() {
     graphicsSubmitInfo.commandBufferCount = 1;
     graphicsSubmitInfo.pCommandBuffers = &_graphicscommandbuffers[_currentframe];
 
+    TraceZone graphicsSubmitZone("submit graphics");
     VkResult graphics_queue_submit_result = vkQueueSubmit(_graphicsqueue, 1, &graphicsSubmitInfo, _inFlightFences[_currentframe]);
     if (graphics_queue_submit_result != VK_SUCCESS) {
         throw vulkan_error("Failed to submit command buffer to graphics queue!", graphics_queue_submit_result);
     }
+    graphicsSubmitZone.end();
 
+    presentFrame(imageIndex);
+}
+
+// Presents once the frame's rendering has finished and moves on to the next frame
+void RenderingEngine::presentFrame(uint32_t imageIndex) {
     VkPresentInfoKHR presentInfo = {};
     presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
     presentInfo.waitSemaphoreCount = 1;
-    presentInfo.pWaitSemaphores = signalSemaphores;
+    presentInfo.pWaitSemaphores = &_renderFinishedSemaphores[_currentframe];
 
     VkSwapchainKHR swapchains[] = {_swapchain->swapchain};
     presentInfo.swapchainCount = 1;
     presentInfo.pSwapchains = swapchains;
     presentInfo.pImageIndices = &imageIndex;
 
+    TraceZone presentZone("present");
     VkResult present_queue_submit_result = vkQueuePresentKHR(_presentqueue, &presentInfo);
+    presentZone.end();
     if (present_queue_submit_result == VK_ERROR_OUT_OF_DATE_KHR || present_queue_submit_result == VK_SUBOPTIMAL_KHR || _framebufferResized) {
         _framebufferResized = false;
         recreateSwapChain();
@@ -805,47 +1380,971 @@ void RenderingEngine::draw() {
     }
 
     _currentframe = (_currentframe + 1) % MAX_FRAMES_IN_FLIGHT;
+    _framenumber++;
 
     double currentTime = _window->getWindowTime();
     _lastframetime = ((currentTime - _lasttime));
     _lasttime = currentTime;
 }
 
-void RenderingEngine::deduplicateVertices() {
-    std::unordered_map<Vertex, uint32_t> uniqueVertices = {};
+// Out-of-core frame: every chunk of the streamed particles is uploaded, simulated, drawn and written back in turn,
+// each in a command buffer of its own. Pass p goes through the storage buffers with compute descriptor set
+// (2p + 1) % 3, reading the chunk uploaded into buffer 2p % 3 and writing the next one. The buffer the following
+// pass uploads into is the third one, so its upload on the transfer queue overlaps this pass's compute and draw.
+void RenderingEngine::drawStreamed() {
+    // Every frame uses all compute uniform buffers and descriptor sets, and its chunks have to be back in host memory
+    // before the next frame uploads them again
+    TraceZone finishZone("stream finish");
+    _stream->finish();
+    finishZone.end();
+    TraceZone frameFenceZone("wait frame fence");
+    vkWaitForFences(_device, 1, &_inFlightFences[_currentframe], VK_TRUE, UINT64_MAX);
+    frameFenceZone.end();
+
+    TraceZone upkeepZone("frame upkeep");
+    releaseRetiredBuffers();
+    updateMesh();
+    defragmentMemory();
+    _readbackmanager->poll();
+    measureControlLatency();
+    upkeepZone.end();
+
+    uint32_t step = static_cast<uint32_t>(_simulationsteps % MAX_FRAMES_IN_FLIGHT);
+    bool simulate = advanceSimulationClock();
+    if (simulate) {
+        TraceZone uniformZone("update compute ubo");
+        updateComputeUniformBuffer(step);
+        for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+            if (i == step) {
+                continue;
+            }
+            memcpy(_computeuniformbuffers[i]->mapping, _computeuniformbuffers[step]->mapping, sizeof(ComputeUniformBufferObject));
+            if (_vectorfieldviews[i] != _vectorfieldviews[step]) {
+                writeVectorFieldDescriptor(i);
+            }
+        }
+        _simulationsteps++;
+    }
+    // Chunks are drawn as simulated, there is no previous step of them to interpolate from
+    _interpolation = 1.0f;
+
+    uint32_t imageIndex;
+    TraceZone acquireZone("acquire");
+    VkResult acquire_image_result = vkAcquireNextImageKHR(_device, _swapchain->swapchain, UINT64_MAX,
+                                                          _imageAvailableSemaphores[_currentframe],
+                                                          VK_NULL_HANDLE, &imageIndex);
+    acquireZone.end();
+
+    if (acquire_image_result == VK_ERROR_OUT_OF_DATE_KHR) {
+        recreateSwapChain();
+        return;
+    } else if (acquire_image_result != VK_SUCCESS && acquire_image_result != VK_SUBOPTIMAL_KHR) {
+        throw vulkan_error("Failed to acquire next swap chain image!", acquire_image_result);
+    }
+
+    vkResetFences(_device, 1, &_inFlightFences[_currentframe]);
+
+    TraceZone graphicsUniformZone("update graphics ubo");
+    updateGraphicsUniformBuffer(_currentframe);
+    prepareInstances();
+    graphicsUniformZone.end();
 
-    std::vector<Vertex> deduplicatedVertices;
-    std::vector<uint32_t> deduplicatedIndices;
+    VkExtent2D renderExtent = {};
+    for (uint32_t chunk = 0; chunk < _stream->chunkcount; chunk++) {
+        bool firstChunk = chunk == 0;
+        bool lastChunk = chunk + 1 == _stream->chunkcount;
 
-    for (const auto& index : _indices) {
-        const Vertex& vertex = _vertices[index];
+        uint64_t passIndex = _stream->getPassCount();
+        uint32_t set = static_cast<uint32_t>((2 * passIndex + 1) % MAX_FRAMES_IN_FLIGHT);
+        Buffer* input = _storagebuffers[(2 * passIndex) % MAX_FRAMES_IN_FLIGHT];
+        Buffer* output = _storagebuffers[set];
+
+        StreamPass pass = _stream->begin(chunk, input->buffer);
+        VkCommandBuffer commandBuffer = _streamcommandbuffers[pass.index % STREAM_SLOTS];
+
+        TraceZone recordZone("record stream chunk");
+        vkResetCommandBuffer(commandBuffer, 0);
+
+        VkCommandBufferBeginInfo beginInfo = {};
+        beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+
+        VkResult begin_command_buffer_result = vkBeginCommandBuffer(commandBuffer, &beginInfo);
+        if (begin_command_buffer_result != VK_SUCCESS) {
+            throw vulkan_error("Failed to start recording stream command buffer", begin_command_buffer_result);
+        }
+
+        if (firstChunk) {
+            _meshfield->record(commandBuffer, _currentframe);
+            if (simulate && _fluidcoupling > 0.0f) {
+                _fluid->record(commandBuffer, step);
+            }
+        }
 
-        if (uniqueVertices.count(vertex) == 0) {
-            uniqueVertices[vertex] = static_cast<uint32_t>(deduplicatedVertices.size());
-            deduplicatedVertices.push_back(vertex);
+        if (simulate) {
+            // The previous pass read the buffer this one writes
+            vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT
+                                 | VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0,
+                                 0, nullptr, 0, nullptr, 0, nullptr);
+
+            vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, _computepipeline->pipeline);
+            vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, _computepipeline->layout,
+                                    0, 1, &_computedescriptorsets[set],
+                                    0, nullptr);
+            vkCmdDispatch(commandBuffer, (pass.count + 255) / 256, 1, 1);
+
+            VkMemoryBarrier memoryBarrier = {};
+            memoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+            memoryBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+            memoryBarrier.dstAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT;
+            vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, 0,
+                                 1, &memoryBarrier, 0, nullptr, 0, nullptr);
         }
 
-        deduplicatedIndices.push_back(uniqueVertices[vertex]);
+        // The first pass clears the scene, the others draw on top of it, depth tested against the chunks before them
+        VkRenderPass renderPass = _graphicspipeline->continuerenderpass;
+        if (firstChunk) {
+            renderPass = lastChunk ? _graphicspipeline->renderpass : _graphicspipeline->openrenderpass;
+            // The chunks after the first are simulated in between their passes, that time is counted as well
+            _resolutiongovernor->begin(commandBuffer, _currentframe);
+            renderExtent = _resolutiongovernor->getRenderExtent(_swapchain->extent);
+        }
+        beginScenePass(commandBuffer, renderPass, renderExtent);
+        if (firstChunk) {
+            recordMeshes(commandBuffer);
+        }
+        VkBuffer drawn = simulate ? output->buffer : input->buffer;
+        recordParticles(commandBuffer, drawn, drawn, pass.count);
+        vkCmdEndRenderPass(commandBuffer);
+
+        if (simulate) {
+            _stream->recordDownload(commandBuffer, pass, output->buffer);
+        }
+
+        if (lastChunk) {
+            _resolutiongovernor->end(commandBuffer, _currentframe);
+            _swapchain->recordBlit(commandBuffer, imageIndex, renderExtent);
+        }
+
+        VkResult command_buffer_end_result = vkEndCommandBuffer(commandBuffer);
+        if (command_buffer_end_result != VK_SUCCESS) {
+            throw vulkan_error("Failed to finish recording stream command buffer!", command_buffer_end_result);
+        }
+        recordZone.end();
+
+        // The chunk's upload also covers every earlier one on the upload timeline, like the mesh's
+        std::vector<VkSemaphore> waitSemaphores = {_uploadmanager->timeline};
+        std::vector<VkPipelineStageFlags> waitStages = {VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT};
+        std::vector<uint64_t> waitValues = {std::max(pass.uploadvalue, _requireduploadvalue)};
+        std::vector<VkSemaphore> signalSemaphores = {_stream->timeline};
+        std::vector<uint64_t> signalValues = {pass.index + 1};
+        if (lastChunk) {
+            waitSemaphores.push_back(_imageAvailableSemaphores[_currentframe]);
+            waitStages.push_back(VK_PIPELINE_STAGE_TRANSFER_BIT);
+            waitValues.push_back(0);
+
+            // Control input applied to this frame counts as simulated once the last chunk has been
+            signalSemaphores.push_back(_readbackmanager->timeline);
+            signalValues.push_back(_computesubmissions + 1);
+            signalSemaphores.push_back(_renderFinishedSemaphores[_currentframe]);
+            signalValues.push_back(0);
+        }
+
+        VkTimelineSemaphoreSubmitInfo timelineSubmitInfo = {};
+        timelineSubmitInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+        timelineSubmitInfo.waitSemaphoreValueCount = static_cast<uint32_t>(waitValues.size());
+        timelineSubmitInfo.pWaitSemaphoreValues = waitValues.data();
+        timelineSubmitInfo.signalSemaphoreValueCount = static_cast<uint32_t>(signalValues.size());
+        timelineSubmitInfo.pSignalSemaphoreValues = signalValues.data();
+
+        VkSubmitInfo submitInfo = {};
+        submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+        submitInfo.pNext = &timelineSubmitInfo;
+        submitInfo.waitSemaphoreCount = static_cast<uint32_t>(waitSemaphores.size());
+        submitInfo.pWaitSemaphores = waitSemaphores.data();
+        submitInfo.pWaitDstStageMask = waitStages.data();
+        submitInfo.commandBufferCount = 1;
+        submitInfo.pCommandBuffers = &commandBuffer;
+        submitInfo.signalSemaphoreCount = static_cast<uint32_t>(signalSemaphores.size());
+        submitInfo.pSignalSemaphores = signalSemaphores.data();
+
+        VkFence fence = lastChunk ? _inFlightFences[_currentframe] : VK_NULL_HANDLE;
+        TraceZone submitZone("submit stream chunk");
+        VkResult stream_queue_submit_result = vkQueueSubmit(_graphicsqueue, 1, &submitInfo, fence);
+        if (stream_queue_submit_result != VK_SUCCESS) {
+            throw vulkan_error("Failed to submit stream command buffer to graphics queue!", stream_queue_submit_result);
+        }
     }
+    _computesubmissions++;
 
-    _vertices = std::move(deduplicatedVertices);
-    _indices = std::move(deduplicatedIndices);
+    presentFrame(imageIndex);
+}
+
+// Decides whether this frame simulates a step and how far the particles are drawn between the last two steps
+bool RenderingEngine::advanceSimulationClock() {
+    if (_replaysource) {
+        _interpolation = 1.0f;
+        return false;
+    }
+    if (_simulationrate <= 0.0f) {
+        _interpolation = 1.0f;
+        return true;
+    }
+
+    float stepLength = 1.0f / _simulationrate;
+    _simulationaccumulator += _lastframetime;
+    bool simulate = _simulationaccumulator >= stepLength;
+    if (simulate) {
+        // A display slower than the simulation slows it down rather than piling up steps it can never catch up on
+        _simulationaccumulator = std::min(_simulationaccumulator - stepLength, stepLength);
+    }
+    _interpolation = std::min(_simulationaccumulator / stepLength, 1.0f);
+    return simulate;
+}
+
+void RenderingEngine::deduplicateVertices() {
+    ::deduplicateVertices(_vertices, _indices, getThreadPool());
+}
+
+// Created on first use, most runs never need it
+ThreadPool* RenderingEngine::getThreadPool() {
+    if (!_threadpool) {
+        _threadpool = new ThreadPool();
+    }
+    return _threadpool;
 }
 
 void RenderingEngine::setMesh(std::vector<Vertex> vertices, std::vector<uint32_t> indices) {
+    // Rejected here rather than when the collision field takes the mesh over in the middle of a frame
+    if (indices.size() / 3 > SDF_MAX_TRIANGLES) {
+        throw std::runtime_error("Mesh has " + std::to_string(indices.size() / 3) + " triangles, collisions support at most "
+                                 + std::to_string(SDF_MAX_TRIANGLES) + "!");
+    }
     _vertices = vertices;
     _indices = indices;
+    delete _loadedmesh;
+    _loadedmesh = nullptr;
 
     deduplicateVertices();
 
+    // Before init the static mesh takes over right away, afterwards once it has been uploaded
+    if (!_initialized) {
+        _dynamicmeshactive = false;
+    }
+
     if (_initialized) {
-        // Not great, but I don't feel like caring about performance here too much
-        vkDeviceWaitIdle(_device);
-        delete _vertexbuffer;
-        delete _indexbuffer;
+        // A mesh that was set but never displayed is replaced right away
+        if (_pendingvertexbuffer) {
+            retireBuffer(_pendingvertexbuffer, _pendingmeshuploadvalue);
+            retireBuffer(_pendingindexbuffer, _pendingmeshuploadvalue);
+        }
+
+        // Uploaded in the background, the current mesh keeps rendering until the copies have completed
         createVertexBuffer();
         createIndexBuffer();
+        _uploadmanager->flush();
+    }
+}
+
+void RenderingEngine::loadMesh(const std::string& path) {
+    MeshData* mesh = new MeshData(::loadMesh(path, getThreadPool()));
+    if (mesh->indexcount / 3 > SDF_MAX_TRIANGLES) {
+        delete mesh;
+        throw std::runtime_error(path + " has more than " + std::to_string(SDF_MAX_TRIANGLES) + " triangles, the most collisions support!");
     }
+    delete _loadedmesh;
+    _loadedmesh = mesh;
+    _vertices.clear();
+    _indices.clear();
+
+    if (!_initialized) {
+        _dynamicmeshactive = false;
+        return;
+    }
+
+    if (_pendingvertexbuffer) {
+        retireBuffer(_pendingvertexbuffer, _pendingmeshuploadvalue);
+        retireBuffer(_pendingindexbuffer, _pendingmeshuploadvalue);
+    }
+
+    // The upload copies the data into the staging ring, the file can be unmapped right away
+    createVertexBuffer();
+    createIndexBuffer();
+    _uploadmanager->flush();
+
+    delete _loadedmesh;
+    _loadedmesh = nullptr;
+}
+
+void RenderingEngine::promotePendingMesh() {
+    _vertexbuffer = _pendingvertexbuffer;
+    _indexbuffer = _pendingindexbuffer;
+    _meshindexcount = _pendingmeshindexcount;
+    _meshindextype = _pendingmeshindextype;
+    _meshcompact = _pendingmeshcompact;
+
+    SdfMesh mesh = {};
+    mesh.vertexbuffer = _vertexbuffer;
+    mesh.vertexstride = _meshcompact ? sizeof(CompactVertex) : sizeof(Vertex);
+    mesh.indexbuffer = _indexbuffer;
+    mesh.indextype = _meshindextype;
+    mesh.indexcount = _meshindexcount;
+    mesh.model = getMeshModelMatrix();
+    mesh.boundsmin = _pendingmeshboundsmin;
+    mesh.boundsmax = _pendingmeshboundsmax;
+    _meshfield->setMesh(mesh);
+
+    _pendingvertexbuffer = nullptr;
+    _pendingindexbuffer = nullptr;
+}
+
+// Swaps in the mesh uploaded by setMesh once the transfer queue has finished copying it
+void RenderingEngine::updateMesh() {
+    if (!_pendingvertexbuffer || _uploadmanager->completedValue() < _pendingmeshuploadvalue) {
+        return;
+    }
+
+    retireBuffer(_vertexbuffer, 0);
+    retireBuffer(_indexbuffer, 0);
+    promotePendingMesh();
+    _dynamicmeshactive = false;
+}
+
+void RenderingEngine::initDynamicMesh() {
+    _dynamicvertexbuffer = new DynamicBuffer(_device, _physicaldevice, _memoryallocator, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+                                             MAX_FRAMES_IN_FLIGHT);
+    _dynamicindexbuffer = new DynamicBuffer(_device, _physicaldevice, _memoryallocator, VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
+                                            MAX_FRAMES_IN_FLIGHT);
+
+    if (_dynamicmeshactive) {
+        writeDynamicMesh(_vertices, _indices);
+    }
+}
+
+void RenderingEngine::writeDynamicMesh(const std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices) {
+    _dynamicvertexbuffer->resize(sizeof(Vertex) * vertices.size());
+    _dynamicvertexbuffer->write(0, vertices.data(), sizeof(Vertex) * vertices.size());
+
+    _dynamicindexbuffer->resize(sizeof(uint32_t) * indices.size());
+    _dynamicindexbuffer->write(0, indices.data(), sizeof(uint32_t) * indices.size());
+    _dynamicindexcount = static_cast<uint32_t>(indices.size());
+}
+
+void RenderingEngine::setDynamicMesh(const std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices) {
+    _dynamicmeshactive = true;
+
+    if (!_initialized) {
+        _vertices = vertices;
+        _indices = indices;
+        return;
+    }
+
+    // A static mesh still uploading would replace this one once done
+    if (_pendingvertexbuffer) {
+        retireBuffer(_pendingvertexbuffer, _pendingmeshuploadvalue);
+        retireBuffer(_pendingindexbuffer, _pendingmeshuploadvalue);
+        _pendingvertexbuffer = nullptr;
+        _pendingindexbuffer = nullptr;
+    }
+
+    writeDynamicMesh(vertices, indices);
+}
+
+void RenderingEngine::updateDynamicMeshVertices(uint32_t firstVertex, const std::vector<Vertex>& vertices) {
+    _dynamicvertexbuffer->write(sizeof(Vertex) * firstVertex, vertices.data(), sizeof(Vertex) * vertices.size());
+}
+
+void RenderingEngine::updateDynamicMeshIndices(uint32_t firstIndex, const std::vector<uint32_t>& indices) {
+    _dynamicindexbuffer->write(sizeof(uint32_t) * firstIndex, indices.data(), sizeof(uint32_t) * indices.size());
+}
+
+uint32_t RenderingEngine::addInstancedMesh(std::vector<Vertex> vertices, std::vector<uint32_t> indices) {
+    if (!_initialized) {
+        throw std::runtime_error("Instanced meshes can only be added after init()!");
+    }
+
+    ::deduplicateVertices(vertices, indices, getThreadPool());
+    return _instancedmeshes->addMesh(vertices, indices);
+}
+
+uint32_t RenderingEngine::addMeshInstance(uint32_t mesh, const MeshInstance& instance) {
+    if (!_initialized) {
+        throw std::runtime_error("Mesh instances can only be added after init()!");
+    }
+
+    return _instancedmeshes->addInstance(mesh, instance);
+}
+
+void RenderingEngine::updateMeshInstance(uint32_t instance, const MeshInstance& meshInstance) {
+    _instancedmeshes->updateInstance(instance, meshInstance);
+}
+
+void RenderingEngine::removeMeshInstance(uint32_t instance) {
+    _instancedmeshes->removeInstance(instance);
+}
+
+// Buffers may still be referenced by frames in flight, they are deleted once those frames have retired
+void RenderingEngine::retireBuffer(Buffer* buffer, uint64_t uploadValue) {
+    _retiredbuffers.push_back({buffer, _framenumber, uploadValue});
+}
+
+void RenderingEngine::releaseRetiredBuffers() {
+    uint64_t completedUploadValue = _uploadmanager->completedValue();
+
+    auto released = std::remove_if(_retiredbuffers.begin(), _retiredbuffers.end(), [&](const RetiredBuffer& retired) {
+        if (_framenumber < retired.retiredframe + MAX_FRAMES_IN_FLIGHT || completedUploadValue < retired.uploadvalue) {
+            return false;
+        }
+        delete retired.buffer;
+        return true;
+    });
+    _retiredbuffers.erase(released, _retiredbuffers.end());
+
+    auto releasedSwapChains = std::remove_if(_retiredswapchains.begin(), _retiredswapchains.end(), [&](const RetiredSwapChain& retired) {
+        if (_framenumber < retired.retiredframe + MAX_FRAMES_IN_FLIGHT) {
+            return false;
+        }
+        delete retired.swapchain;
+        return true;
+    });
+    _retiredswapchains.erase(releasedSwapChains, _retiredswapchains.end());
+
+    auto finished = std::remove_if(_pendingdefragmentations.begin(), _pendingdefragmentations.end(), [&](PendingDefragmentation& pending) {
+        if (_framenumber < pending.retiredframe + MAX_FRAMES_IN_FLIGHT || completedUploadValue < pending.uploadvalue) {
+            return false;
+        }
+        _memoryallocator->endDefragmentation(pending.result);
+        return true;
+    });
+    _pendingdefragmentations.erase(finished, _pendingdefragmentations.end());
+}
+
+// Mesh updates leave holes in the buffer memory blocks. Sparse blocks are emptied by moving the mesh buffers
+// on the transfer queue, frames wait for the copies on the device like they do for uploads.
+void RenderingEngine::defragmentMemory() {
+    if (!_memoryallocator->needsDefragmentation()) {
+        return;
+    }
+
+    DefragmentationResult result;
+    uint64_t defragmentationValue = _uploadmanager->submit([&](VkCommandBuffer commandBuffer) {
+        result = _memoryallocator->defragment(commandBuffer, MAX_DEFRAGMENTATION_BYTES);
+    });
+
+    if (result.bytesmoved > 0) {
+        _requireduploadvalue = defragmentationValue;
+        _pendingdefragmentations.push_back({result, _framenumber, defragmentationValue});
+    }
+}
+
+void RenderingEngine::readbackParticles(uint64_t frame, ReadbackRegion region, ReadbackCallback callback) {
+    // Streamed frames never read the storage buffers back, the requests would not complete
+    if (_streamingenabled) {
+        throw std::runtime_error("Particles cannot be read back while streaming!");
+    }
+    _readbackmanager->request(frame, region, std::move(callback));
+}
+
+uint64_t RenderingEngine::getFrameNumber() {
+    return _framenumber;
+}
+
+void RenderingEngine::saveCheckpoint(const std::string& path) {
+    // Finished writes are dropped, their errors have been reported already
+    _checkpointwrites.erase(std::remove_if(_checkpointwrites.begin(), _checkpointwrites.end(), [](std::future<void>& write) {
+        return write.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+    }), _checkpointwrites.end());
+
+    readbackParticles(_framenumber, ReadbackRegion::range(0, sizeof(Particle) * PARTICLE_COUNT),
+                      [this, path](std::shared_ptr<const ReadbackResult> result) {
+        // The readback may have been held back for frames, the field state has to be the one of the frame it ran in
+        const RecordedFieldState& recorded = _fieldhistory[result->frame % FIELD_STATE_HISTORY];
+        if (recorded.frame != result->frame) {
+            fprintf(stderr, "Failed to save checkpoint: the field state of frame %llu is no longer known\n",
+                    static_cast<unsigned long long>(result->frame));
+            return;
+        }
+        FieldState field = recorded.field;
+        _checkpointwrites.push_back(std::async(std::launch::async, [path, field, result]() {
+            try {
+                writeCheckpoint(path, field, result->data, PARTICLE_COUNT);
+            } catch (std::runtime_error& error) {
+                fprintf(stderr, "Failed to save checkpoint: %s\n", error.what());
+            }
+        }));
+    });
+}
+
+void RenderingEngine::loadCheckpoint(const std::string& path) {
+    if (_streamingenabled) {
+        throw std::runtime_error("Checkpoints cannot be loaded while streaming, stream the checkpoint file instead!");
+    }
+    if (!_initialized && _storagebuffers.empty()) {
+        _initialcheckpointpath = path;
+        return;
+    }
+
+    // Mapped, validated and streamed into the staging ring page by page
+    Checkpoint checkpoint(path);
+    if (checkpoint.header.particlecount != PARTICLE_COUNT) {
+        throw std::runtime_error(path + " holds " + std::to_string(checkpoint.header.particlecount) + " particles instead of "
+                                 + std::to_string(PARTICLE_COUNT) + "!");
+    }
+
+    // The storage buffers are overwritten, so nothing in flight may still use them
+    if (_initialized) {
+        waitForFramesInFlight();
+    }
+
+    uploadParticles(checkpoint.particles);
+    _requireduploadvalue = _uploadmanager->flush();
+
+    _fieldstate = checkpoint.header.field;
+    _lastframetime = _fieldstate.lastframetime;
+}
+
+void RenderingEngine::loadVectorField(const std::string& path, float strength) {
+    _vectorfieldstrength = strength;
+    if (!_initialized) {
+        _vectorfieldpath = path;
+        return;
+    }
+
+    // Opened first, so a broken file leaves the current field in place
+    VectorField* field = new VectorField(_device, _physicaldevice, _memoryallocator, _uploadmanager, path, MAX_FRAMES_IN_FLIGHT);
+
+    // The descriptor sets of the frames in flight still point to the old images
+    waitForFramesInFlight();
+    delete _vectorfield;
+    _vectorfield = field;
+    _requireduploadvalue = _uploadmanager->flush();
+
+    for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+        writeVectorFieldDescriptor(i);
+    }
+}
+
+void RenderingEngine::setParticleMeshGravity(float strength) {
+    _pmgravitystrength = strength;
+}
+
+void RenderingEngine::setFluid(uint32_t resolution, float coupling) {
+    _fluidcoupling = coupling;
+    if (!_initialized) {
+        _fluidresolution = resolution;
+        return;
+    }
+    if (resolution == _fluid->getResolution()) {
+        return;
+    }
+
+    FluidSolver* fluid = new FluidSolver(_device, _physicaldevice, _memoryallocator, resolution, MAX_FRAMES_IN_FLIGHT);
+
+    // The descriptor sets of the frames in flight still point to the old velocity
+    waitForFramesInFlight();
+    delete _fluid;
+    _fluid = fluid;
+    _fluidresolution = resolution;
+
+    for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+        writeFluidDescriptor(i);
+    }
+}
+
+FluidTimings RenderingEngine::getFluidTimings() {
+    return _fluid ? _fluid->getTimings() : FluidTimings{};
+}
+
+void RenderingEngine::setFrameTimeBudget(float milliseconds) {
+    _frametimebudget = milliseconds;
+    if (_resolutiongovernor) {
+        _resolutiongovernor->setBudget(milliseconds);
+    }
+}
+
+ResolutionStatistics RenderingEngine::getResolutionStatistics() {
+    return _resolutiongovernor ? _resolutiongovernor->getStatistics() : ResolutionStatistics{};
+}
+
+void RenderingEngine::enableStatistics(bool enabled) {
+    _statisticsenabled = enabled;
+}
+
+bool RenderingEngine::getSimulationStatistics(SimulationStatistics& statistics) {
+    return _statistics && _statistics->getLatest(statistics);
+}
+
+void RenderingEngine::enableDepthSort(bool enabled) {
+    _depthsortenabled = enabled;
+}
+
+void RenderingEngine::enableStreaming(const std::string& path, uint64_t particleCount) {
+    _streamingenabled = true;
+    _streamingpath = path;
+    _streamingcount = particleCount;
+}
+
+void RenderingEngine::startTracing(bool keepEvents) {
+    delete _tracecollector;
+    _tracecollector = new TraceCollector(keepEvents);
+}
+
+std::vector<TraceZoneSummary> RenderingEngine::getTraceSummary() {
+    if (!_tracecollector) {
+        return {};
+    }
+    return _tracecollector->getSummary();
+}
+
+void RenderingEngine::writeChromeTrace(const std::string& path) {
+    if (!_tracecollector) {
+        throw std::runtime_error("Tracing has not been started!");
+    }
+    _tracecollector->collect();
+    _tracecollector->writeChromeTrace(path);
+}
+
+void RenderingEngine::setSimulationRate(float stepsPerSecond) {
+    _simulationrate = std::max(stepsPerSecond, 0.0f);
+    _simulationaccumulator = 0.0f;
+}
+
+uint64_t RenderingEngine::getSimulationSteps() {
+    return _simulationsteps;
+}
+
+void RenderingEngine::openControlChannel(const std::string& name) {
+    // Closed first, it unlinks its name on the way out
+    delete _controlchannel;
+    _controlchannel = nullptr;
+    _controlchannel = new ControlChannel(name);
+    _pendingcontrolsamples.reserve(MAX_FRAMES_IN_FLIGHT * 4);
+}
+
+ControlLatency RenderingEngine::getControlLatency() {
+    ControlLatency latency;
+    if (_controlchannel) {
+        latency.ingest = _controlchannel->ingestlatency;
+    }
+    latency.gpu = _controlgpulatency;
+    return latency;
+}
+
+// Runs on the render thread right before the uniform buffer is written: atomics and copies only
+void RenderingEngine::applyControlInput() {
+    if (!_controlchannel || _controlchannel->drain(_controlstate) == 0) {
+        return;
+    }
+
+    if (_controlstate.fields & CONTROL_FIELD_STRENGTH) {
+        _vectorfieldstrength = _controlstate.fieldstrength;
+    }
+    if (_controlstate.fields & CONTROL_PM_GRAVITY_STRENGTH) {
+        _pmgravitystrength = _controlstate.pmgravitystrength;
+    }
+    if (_controlstate.fields & CONTROL_FLUID_COUPLING) {
+        _fluidcoupling = _controlstate.fluidcoupling;
+    }
+
+    // The step recorded next signals this value on the readback timeline
+    _pendingcontrolsamples.push_back({_computesubmissions + 1, _controlstate.timestamp});
+}
+
+// Checked once per frame, so the GPU latency is an upper bound within a frame
+void RenderingEngine::measureControlLatency() {
+    if (_pendingcontrolsamples.empty()) {
+        return;
+    }
+
+    uint64_t completedValue = 0;
+    vkGetSemaphoreCounterValue(_device, _readbackmanager->timeline, &completedValue);
+    uint64_t now = controlClock();
+
+    size_t remaining = 0;
+    for (PendingControlSample& sample: _pendingcontrolsamples) {
+        if (sample.submission <= completedValue) {
+            if (sample.timestamp <= now) {
+                _controlgpulatency.add(static_cast<double>(now - sample.timestamp) * 1e-6);
+            }
+        } else {
+            _pendingcontrolsamples[remaining++] = sample;
+        }
+    }
+    _pendingcontrolsamples.resize(remaining);
+}
+
+// Host side wait for the submitted frames, unlike vkDeviceWaitIdle this leaves the transfer queue running
+void RenderingEngine::waitForFramesInFlight() {
+    // Headless engines submit no frames
+    if (_headless) {
+        return;
+    }
+    vkWaitForFences(_device, MAX_FRAMES_IN_FLIGHT, _computeInFlightFences.data(), VK_TRUE, UINT64_MAX);
+    vkWaitForFences(_device, MAX_FRAMES_IN_FLIGHT, _inFlightFences.data(), VK_TRUE, UINT64_MAX);
+}
+
+void RenderingEngine::startRecording(const std::string& path, uint32_t frameInterval, uint32_t keyframeInterval) {
+    stopRecording();
+    if (_streamingenabled) {
+        throw std::runtime_error("Trajectories cannot be recorded while streaming!");
+    }
+
+    _recorder = std::make_shared<TrajectoryRecorder>(path, PARTICLE_COUNT, keyframeInterval, getThreadPool());
+    _recordinginterval = std::max<uint32_t>(frameInterval, 1);
+}
+
+// Frames still being read back when recording stops are dropped
+void RenderingEngine::stopRecording() {
+    if (!_recorder) {
+        return;
+    }
+    _recorder->close();
+    printf("Recorded trajectory: %.1f MB, %llu dropped frames\n", _recorder->writtenbytes / (1024.0 * 1024.0),
+           static_cast<unsigned long long>(_recorder->droppedframes));
+    _recorder.reset();
+}
+
+// Frames are skipped rather than queued when the readbacks or the encoder fall behind
+void RenderingEngine::recordTrajectoryFrame() {
+    if (!_recorder || _framenumber % _recordinginterval != 0) {
+        return;
+    }
+    if (_recorder->pendingreadbacks >= TRAJECTORY_MAX_PENDING_FRAMES || _recorder->busy()) {
+        _recorder->droppedframes++;
+        return;
+    }
+
+    _recorder->pendingreadbacks++;
+    std::shared_ptr<TrajectoryRecorder> recorder = _recorder;
+    readbackParticles(_framenumber, ReadbackRegion::range(0, sizeof(Particle) * PARTICLE_COUNT),
+                      [recorder](std::shared_ptr<const ReadbackResult> result) {
+        recorder->pendingreadbacks--;
+        recorder->addFrame(result->frame, std::move(result));
+    });
+}
+
+void RenderingEngine::startReplay(const std::string& path) {
+    stopReplay();
+    if (_streamingenabled) {
+        throw std::runtime_error("Trajectories cannot be replayed while streaming!");
+    }
+
+    ReplaySource* replaySource = new ReplaySource(path, getThreadPool(), _device, _physicaldevice, _memoryallocator,
+                                                  MAX_FRAMES_IN_FLIGHT);
+    uint64_t particleCount = replaySource->particlecount;
+    if (particleCount != PARTICLE_COUNT) {
+        delete replaySource;
+        throw std::runtime_error(path + " holds " + std::to_string(particleCount) + " particles instead of "
+                                 + std::to_string(PARTICLE_COUNT) + "!");
+    }
+
+    // Compute work still in flight writes the storage buffers the replay uploads into
+    waitForFramesInFlight();
+    _previousparticlebufferindices = _particlebufferindices;
+    _replayslots.assign(MAX_FRAMES_IN_FLIGHT, ReplaySource::NO_FRAME);
+    _replaysource = replaySource;
+}
+
+void RenderingEngine::seekReplay(uint64_t frame) {
+    if (_replaysource) {
+        _replaysource->seek(_replaysource->findFrame(frame));
+    }
+}
+
+void RenderingEngine::stopReplay() {
+    if (!_replaysource) {
+        return;
+    }
+    waitForFramesInFlight();
+    delete _replaysource;
+    _replaysource = nullptr;
+}
+
+// Picks the next decoded frame and a storage buffer none of the other frames in flight draws to copy it into
+void RenderingEngine::acquireReplayFrame() {
+    uint64_t frame;
+    size_t slot = _replaysource->acquireFrame(frame);
+    if (slot == ReplaySource::NO_FRAME) {
+        // The decoder is behind, the previous frame is shown again
+        _particlebufferindices[_currentframe] = _particlebufferindices[(_currentframe + MAX_FRAMES_IN_FLIGHT - 1) % MAX_FRAMES_IN_FLIGHT];
+        return;
+    }
+
+    size_t target = 0;
+    for (; target < MAX_FRAMES_IN_FLIGHT; target++) {
+        bool drawn = false;
+        for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+            drawn |= i != _currentframe && _particlebufferindices[i] == target;
+        }
+        if (!drawn) {
+            break;
+        }
+    }
+
+    _replayslots[_currentframe] = slot;
+    _particlebufferindices[_currentframe] = target;
+}
+
+// Replayed frames are copied straight from the decoder's host buffer instead of through the staging ring
+void RenderingEngine::recordReplayCopy(VkCommandBuffer commandBuffer) {
+    VkBuffer target = _storagebuffers[_particlebufferindices[_currentframe]]->buffer;
+
+    VkBufferCopy copyRegion = {0, 0, sizeof(Particle) * PARTICLE_COUNT};
+    vkCmdCopyBuffer(commandBuffer, _replaysource->getFrameBuffer(_replayslots[_currentframe]), target, 1, &copyRegion);
+
+    // Drawn as vertices, and read by the depth sort's compute pass
+    VkBufferMemoryBarrier copyBarrier = {};
+    copyBarrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+    copyBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    copyBarrier.dstAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_SHADER_READ_BIT;
+    copyBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    copyBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    copyBarrier.buffer = target;
+    copyBarrier.offset = 0;
+    copyBarrier.size = VK_WHOLE_SIZE;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         0, 0, nullptr, 1, &copyBarrier, 0, nullptr);
+}
+
+bool RenderingEngine::validateCompute(size_t steps, uint32_t seed) {
+    if (_streamingenabled) {
+        throw std::runtime_error("The compute shader cannot be validated while streaming!");
+    }
+    waitForFramesInFlight();
+
+    std::vector<Particle> particles(_particlecount);
+    Particle::initializeSphere(particles.data(), particles.size(), VELOCITY_FACTOR, seed);
+    uploadParticles(particles.data());
+    _uploadmanager->wait(_uploadmanager->flush());
+
+    CpuSimulation simulation(_particlecount, getThreadPool());
+    simulation.load(particles.data());
+    printf("Validating %zu steps of %u particles against the %s CPU backend\n", steps, _particlecount,
+           getSimdLevelName(simulation.simdlevel));
+
+    // Same fixed field for both sides, without mesh collisions which the CPU backend does not have
+    ComputeUniformBufferObject ubo{};
+    ubo.gravityPoint = glm::vec4(0.5f, 0.0f, 0.0f, 1.0f);
+    ubo.deltaTime = 2000.0f / 60.0f;
+    for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+        memcpy(_computeuniformbuffers[i]->mapping, &ubo, sizeof(ubo));
+    }
+
+    VkDeviceSize bufferSize = sizeof(Particle) * _particlecount;
+    Buffer readbackBuffer(_device, _physicaldevice, _memoryallocator);
+    readbackBuffer.createForReadback(bufferSize);
+
+    VkCommandBufferAllocateInfo allocationInfo = {};
+    allocationInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    allocationInfo.commandPool = _commandpool;
+    allocationInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    allocationInfo.commandBufferCount = 1;
+
+    VkCommandBuffer commandBuffer;
+    VkResult command_buffer_allocation_result = vkAllocateCommandBuffers(_device, &allocationInfo, &commandBuffer);
+    if (command_buffer_allocation_result != VK_SUCCESS) {
+        throw vulkan_error("Failed to allocate validation command buffer!", command_buffer_allocation_result);
+    }
+
+    VkFenceCreateInfo fenceCreateInfo = {};
+    fenceCreateInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+
+    VkFence fence;
+    VkResult fence_creation_result = vkCreateFence(_device, &fenceCreateInfo, nullptr, &fence);
+    if (fence_creation_result != VK_SUCCESS) {
+        throw vulkan_error("Failed to create validation fence!", fence_creation_result);
+    }
+
+    std::vector<Particle> reference(_particlecount);
+    bool passed = true;
+
+    for (size_t step = 1; step <= steps; step++) {
+        // Descriptor set i reads the storage buffer of set i - 1, so cycling through them chains the steps
+        size_t set = step % MAX_FRAMES_IN_FLIGHT;
+
+        VkCommandBufferBeginInfo beginInfo = {};
+        beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+        VkResult begin_command_buffer_result = vkBeginCommandBuffer(commandBuffer, &beginInfo);
+        if (begin_command_buffer_result != VK_SUCCESS) {
+            throw vulkan_error("Failed to start recording validation command buffer!", begin_command_buffer_result);
+        }
+
+        // Leaves the field ready to be bound, the zeroed placement in the uniform buffer keeps collisions off
+        _meshfield->record(commandBuffer, 0);
+
+        vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, _computepipeline->pipeline);
+        vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, _computepipeline->layout,
+                                0, 1, &_computedescriptorsets[set], 0, nullptr);
+        vkCmdDispatch(commandBuffer, _particlecount / 256, 1, 1);
+
+        VkBufferMemoryBarrier computeBarrier = {};
+        computeBarrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+        computeBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+        computeBarrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+        computeBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        computeBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        computeBarrier.buffer = _storagebuffers[set]->buffer;
+        computeBarrier.offset = 0;
+        computeBarrier.size = VK_WHOLE_SIZE;
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+                             0, nullptr, 1, &computeBarrier, 0, nullptr);
+
+        VkBufferCopy copyRegion = {0, 0, bufferSize};
+        vkCmdCopyBuffer(commandBuffer, _storagebuffers[set]->buffer, readbackBuffer.buffer, 1, &copyRegion);
+
+        VkBufferMemoryBarrier hostBarrier = computeBarrier;
+        hostBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        hostBarrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+        hostBarrier.buffer = readbackBuffer.buffer;
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0,
+                             0, nullptr, 1, &hostBarrier, 0, nullptr);
+
+        VkResult command_buffer_end_result = vkEndCommandBuffer(commandBuffer);
+        if (command_buffer_end_result != VK_SUCCESS) {
+            throw vulkan_error("Failed to finish recording validation command buffer!", command_buffer_end_result);
+        }
+
+        VkSubmitInfo submitInfo = {};
+        submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+        submitInfo.commandBufferCount = 1;
+        submitInfo.pCommandBuffers = &commandBuffer;
+
+        VkResult compute_queue_submit_result = vkQueueSubmit(_computequeue, 1, &submitInfo, fence);
+        if (compute_queue_submit_result != VK_SUCCESS) {
+            throw vulkan_error("Failed to submit validation command buffer!", compute_queue_submit_result);
+        }
+
+        // The CPU steps while the GPU does
+        simulation.step(ubo.gravityPoint, ubo.deltaTime);
+        simulation.store(reference.data());
+
+        vkWaitForFences(_device, 1, &fence, VK_TRUE, UINT64_MAX);
+        vkResetFences(_device, 1, &fence);
+        vkResetCommandBuffer(commandBuffer, 0);
+
+        readbackBuffer.invalidate(0, bufferSize);
+        ValidationStep result = compareParticles(step, static_cast<const Particle*>(readbackBuffer.mapping), reference.data(),
+                                                 _particlecount, getThreadPool());
+        printValidationStep(result);
+
+        // Later steps drift apart through accumulated rounding, only a single step has to match closely
+        if (step == 1 && (result.position.maxrelative > VALIDATION_TOLERANCE || result.velocity.maxrelative > VALIDATION_TOLERANCE)) {
+            passed = false;
+        }
+    }
+
+    vkDestroyFence(_device, fence, nullptr);
+    vkFreeCommandBuffers(_device, _commandpool, 1, &commandBuffer);
+
+    printf("Validation %s\n", passed ? "passed" : "failed");
+    return passed;
+}
+
+bool RenderingEngine::benchmarkSort(uint32_t maxCount) {
+    waitForFramesInFlight();
+    return ::benchmarkSort(_device, _physicaldevice, _memoryallocator, _computequeue, maxCount);
 }
 
 int RenderingEngine::windowShouldClose() {
@@ -853,6 +2352,17 @@ int RenderingEngine::windowShouldClose() {
 }
 
 RenderingEngine::~RenderingEngine() {
+    // The writes and the recorder reference readback memory
+    for (std::future<void>& write: _checkpointwrites) {
+        write.wait();
+    }
+    stopRecording();
+    delete _replaysource;
+    delete _threadpool;
+    delete _loadedmesh;
+    delete _controlchannel;
+    delete _tracecollector;
+
     if (_device) {
         vkDeviceWaitIdle(_device);
 
@@ -860,26 +2370,59 @@ RenderingEngine::~RenderingEngine() {
         vkDestroyDescriptorPool(_device, _graphicsdescriptorpool, nullptr);
         vkDestroyDescriptorPool(_device, _computedescriptorpool, nullptr);
 
+        // Waits on the upload manager for frames still streaming in
+        delete _vectorfield;
+        delete _stream;
+        delete _uploadmanager;
+        delete _readbackmanager;
+
         delete _vertexbuffer;
         delete _indexbuffer;
+        delete _pendingvertexbuffer;
+        delete _pendingindexbuffer;
+        delete _dynamicvertexbuffer;
+        delete _dynamicindexbuffer;
+        delete _instancedmeshes;
+        delete _meshfield;
+        delete _pmgravity;
+        delete _fluid;
+        delete _resolutiongovernor;
+        delete _statistics;
+        delete _depthsort;
+        for (RetiredBuffer& retired: _retiredbuffers) {
+            delete retired.buffer;
+        }
+        for (PendingDefragmentation& pending: _pendingdefragmentations) {
+            _memoryallocator->endDefragmentation(pending.result);
+        }
 
-        for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+        // Headless engines have no sync objects
+        for (size_t i = 0; i < _inFlightFences.size(); i++) {
             vkDestroySemaphore(_device, _imageAvailableSemaphores[i], nullptr);
             vkDestroySemaphore(_device, _renderFinishedSemaphores[i], nullptr);
             vkDestroyFence(_device, _inFlightFences[i], nullptr);
 
             vkDestroySemaphore(_device, _computeFinishedSemaphores[i], nullptr);
             vkDestroyFence(_device, _computeInFlightFences[i], nullptr);
+        }
 
+        for (size_t i = 0; i < _computeuniformbuffers.size(); i++) {
             delete _graphicsuniformbuffers[i];
             delete _computeuniformbuffers[i];
+        }
 
-            delete _storagebuffers[i];
+        for (Buffer* storageBuffer: _storagebuffers) {
+            delete storageBuffer;
         }
 
         delete _graphicspipeline;
         delete _computepipeline;
+        for (RetiredSwapChain& retired: _retiredswapchains) {
+            delete retired.swapchain;
+        }
         delete _swapchain;
+
+        delete _memoryallocator;
     }
 
     if (_instance && _surface) {
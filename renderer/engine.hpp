@@ -7,12 +7,46 @@
 #include "swapchain.hpp"
 #include "pipeline.hpp"
 #include "buffer.hpp"
+#include "memory.hpp"
+#include "upload.hpp"
+#include "readback.hpp"
+#include "checkpoint.hpp"
+#include "threadpool.hpp"
+#include "trajectory.hpp"
+#include "replay.hpp"
+#include "cpusimulation.hpp"
+#include "validation.hpp"
+#include "dynamicbuffer.hpp"
+#include "deduplicate.hpp"
+#include "instancing.hpp"
+#include "meshloader.hpp"
+#include "sdf.hpp"
+#include "vectorfield.hpp"
+#include "pmgravity.hpp"
+#include "fluid.hpp"
+#include "resolution.hpp"
+#include "statistics.hpp"
+#include "sort.hpp"
+#include "depthsort.hpp"
+#include "stream.hpp"
+#include "trace.hpp"
+#include "control.hpp"
+
+#include <future>
 
 const int MAX_FRAMES_IN_FLIGHT = 3;
+// A streamed chunk passes through the storage buffers of the frames in flight
+static_assert(MAX_FRAMES_IN_FLIGHT == STREAM_RESIDENT_BUFFERS, "Streaming needs a storage buffer per resident chunk buffer");
 
 const uint32_t PARTICLE_COUNT = (int) (10000000 / 256) * (256);
 const float VELOCITY_FACTOR = 0.0001f;
 
+// Frames of field state kept for checkpoints whose particle readback is still in flight
+const size_t FIELD_STATE_HISTORY = 2 * MAX_FRAMES_IN_FLIGHT;
+
+// Upper bound of memory copied per frame when compacting mesh buffers
+const VkDeviceSize MAX_DEFRAGMENTATION_BYTES = 32 * 1024 * 1024;
+
 class RenderingEngine {
 private:
     std::string _name;
@@ -30,12 +64,128 @@ private:
     VkQueue _graphicsqueue;
     VkQueue _computequeue;
     VkQueue _presentqueue;
+    VkQueue _transferqueue;
+
+    MemoryAllocator* _memoryallocator;
+    UploadManager* _uploadmanager;
+    ReadbackManager* _readbackmanager;
+    // Uploads every frame has to wait for (initial particle state)
+    uint64_t _requireduploadvalue = 0;
 
     Buffer* _vertexbuffer;
     Buffer* _indexbuffer;
+    uint32_t _meshindexcount = 0;
+    VkIndexType _meshindextype = VK_INDEX_TYPE_UINT32;
+    // Meshes loaded from files are in the CompactVertex format
+    bool _meshcompact = false;
+
+    // Mesh uploaded by setMesh that replaces the current one once its copies have completed
+    Buffer* _pendingvertexbuffer;
+    Buffer* _pendingindexbuffer;
+    uint32_t _pendingmeshindexcount = 0;
+    VkIndexType _pendingmeshindextype = VK_INDEX_TYPE_UINT32;
+    bool _pendingmeshcompact = false;
+    uint64_t _pendingmeshuploadvalue = 0;
+    glm::vec3 _pendingmeshboundsmin = glm::vec3(0.0f);
+    glm::vec3 _pendingmeshboundsmax = glm::vec3(0.0f);
+
+    // Particles collide with the static mesh, voxelized whenever a new one is promoted
+    SignedDistanceField* _meshfield;
+
+    VectorField* _vectorfield;
+    // Loaded in init() when set before
+    std::string _vectorfieldpath;
+    float _vectorfieldstrength = 1.0f;
+    // Frames of the vector field each compute descriptor set points to
+    std::vector<std::array<VkImageView, 2>> _vectorfieldviews;
+
+    ParticleMeshGravity* _pmgravity;
+    // Gravitational constant times the total particle mass, 0 skips the solve
+    float _pmgravitystrength = 0.0f;
+
+    FluidSolver* _fluid;
+    // Created with this resolution in init() when set before
+    uint32_t _fluidresolution = 64;
+    // Share of the flow's velocity particles take on per step, 0 skips the solver
+    float _fluidcoupling = 0.0f;
+    // The moving gravity point stirs the flow
+    glm::vec3 _fluidstirposition = glm::vec3(0.0f);
+    bool _fluidstirred = false;
+
+    ResolutionGovernor* _resolutiongovernor;
+    // GPU milliseconds per frame the governor keeps the rendering within, 0 renders at full resolution
+    float _frametimebudget = 0.0f;
+
+    // Created in init() when enabled before and the device has subgroup arithmetic
+    ParticleStatistics* _statistics;
+    bool _statisticsenabled = false;
+
+    // Created in init() when enabled before and supported, the particles are then drawn back to front
+    DepthSort* _depthsort;
+    bool _depthsortenabled = false;
+
+    // Created in init() when enabled before, the storage buffers then hold one chunk of the streamed particles
+    ParticleStream* _stream;
+    bool _streamingenabled = false;
+    std::string _streamingpath;
+    uint64_t _streamingcount = 0;
+    std::vector<VkCommandBuffer> _streamcommandbuffers;
+
+    // Drains the trace zones of every thread once per frame while tracing, see TraceZone
+    TraceCollector* _tracecollector;
+    // Particles in each storage buffer
+    uint32_t _particlecount = PARTICLE_COUNT;
+
+    // Parameters sent by external controllers, see ControlChannel
+    ControlChannel* _controlchannel;
+    ControlState _controlstate;
+    struct PendingControlSample {
+        uint64_t submission;
+        uint64_t timestamp;
+    };
+    // Compute submissions that carry new control input and have not been seen completing yet
+    std::vector<PendingControlSample> _pendingcontrolsamples;
+    LatencyStatistics _controlgpulatency;
+
+    // Mesh set by setDynamicMesh, drawn instead of the static mesh while active
+    DynamicBuffer* _dynamicvertexbuffer;
+    DynamicBuffer* _dynamicindexbuffer;
+    uint32_t _dynamicindexcount = 0;
+    bool _dynamicmeshactive = false;
+
+    InstancedMeshes* _instancedmeshes;
+    // Instance storage buffer each frame's descriptor set points to
+    std::vector<VkBuffer> _instancebufferhandles;
+
+    // Replaced swap chains, deleted once the frames that rendered into them have completed
+    struct RetiredSwapChain {
+        SwapChain* swapchain;
+        uint64_t retiredframe;
+    };
+    std::vector<RetiredSwapChain> _retiredswapchains;
+
+    struct RetiredBuffer {
+        Buffer* buffer;
+        uint64_t retiredframe;
+        uint64_t uploadvalue;
+    };
+    std::vector<RetiredBuffer> _retiredbuffers;
+
+    struct PendingDefragmentation {
+        DefragmentationResult result;
+        uint64_t retiredframe;
+        uint64_t uploadvalue;
+    };
+    std::vector<PendingDefragmentation> _pendingdefragmentations;
+
     std::vector<Buffer*> _graphicsuniformbuffers;
     std::vector<Buffer*> _computeuniformbuffers;
+    // Never relocated, so the passes that read the particles write their descriptor sets for them once
     std::vector<Buffer*> _storagebuffers;
+    // Storage buffers each frame in flight draws: the latest simulation step and the one before it, which the
+    // vertex shader interpolates from. Both are the same while replaying.
+    std::vector<size_t> _particlebufferindices;
+    std::vector<size_t> _previousparticlebufferindices;
 
     VkDescriptorPool _graphicsdescriptorpool;
     VkDescriptorPool _computedescriptorpool;
@@ -54,26 +204,66 @@ private:
     std::vector<VkFence> _computeInFlightFences;
 
     bool _initialized = false;
+    // Set by initHeadless(), there is no window, surface, swap chain or frame in flight
+    bool _headless = false;
     bool _framebufferResized = false;
     uint32_t _currentframe = 0;
+    uint64_t _framenumber = 0;
+    // Signalled on the readback timeline, a frame that is cut short still submits its compute work
+    uint64_t _computesubmissions = 0;
 
     float _lastframetime = 0.0f;
     double _lasttime = 0.0;
 
+    // Simulation steps per second, 0 steps once per frame with the frame time
+    float _simulationrate = 0.0f;
+    // Frame time not yet simulated, less than a step
+    float _simulationaccumulator = 0.0f;
+    // Step n writes storage buffer n % MAX_FRAMES_IN_FLIGHT
+    uint64_t _simulationsteps = 0;
+    // Pushed to the particle vertex shader, see ParticlePushConstants
+    float _interpolation = 1.0f;
+
+    FieldState _fieldstate = {};
+    // Field state of the frames whose compute pass recorded readbacks, slot frame % FIELD_STATE_HISTORY. Readbacks
+    // complete within MAX_FRAMES_IN_FLIGHT frames, so a checkpoint finds the state its particles were read back at.
+    struct RecordedFieldState {
+        uint64_t frame;
+        FieldState field;
+    };
+    std::array<RecordedFieldState, FIELD_STATE_HISTORY> _fieldhistory = {};
+    // Particles are initialized from this checkpoint instead of randomly when set before init()
+    std::string _initialcheckpointpath;
+    std::vector<std::future<void>> _checkpointwrites;
+
+    ThreadPool* _threadpool;
+    std::shared_ptr<TrajectoryRecorder> _recorder;
+    uint32_t _recordinginterval = 1;
+
+    // Stands in for the compute pass while set
+    ReplaySource* _replaysource;
+    // Replayed frame each frame in flight copies, released once the frame's fence has been waited for
+    std::vector<size_t> _replayslots;
+
     std::vector<Vertex> _vertices;
     std::vector<uint32_t> _indices;
+    // Mesh loaded by loadMesh, uploaded instead of _vertices and _indices and released afterwards
+    MeshData* _loadedmesh;
 
     std::optional<VkPresentModeKHR> _forcedpresentmode;
 
     void initVulkanInstance();
     void selectPhysicalDevice();
     void initLogicalDevice();
+    void initMemoryAllocator();
 
     void initGraphicsPipeline();
     void initComputePipeline();
     void initSwapchain();
 
     void initCommandPool();
+    void initUploadManager();
+    void initReadbackManager();
 
     void initGraphicsDescriptorPool();
     void initGraphicsDescriptorSets();
@@ -83,6 +273,7 @@ private:
 
     void initGraphicsCommandBuffers();
     void initComputeCommandBuffers();
+    void initStreamCommandBuffers();
 
     void initSyncObjects();
 
@@ -90,14 +281,43 @@ private:
     void createIndexBuffer();
     void createUniformBuffers();
     void createStorageBuffers();
-
-    void recordComputeCommandBuffer(VkCommandBuffer commandBuffer);
+    void initDynamicMesh();
+    void writeDynamicMesh(const std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices);
+    void writeInstanceDescriptor(uint32_t frame, VkBuffer instanceBuffer);
+    void writeVectorFieldDescriptor(uint32_t frame);
+    void writeFluidDescriptor(uint32_t frame);
+    void applyControlInput();
+    void measureControlLatency();
+    void uploadParticles(const Particle* particles);
+    void waitForFramesInFlight();
+    void recordTrajectoryFrame();
+    void acquireReplayFrame();
+    void recordReplayCopy(VkCommandBuffer commandBuffer);
+
+    void promotePendingMesh();
+    void updateMesh();
+    void retireBuffer(Buffer* buffer, uint64_t uploadValue);
+    void releaseRetiredBuffers();
+    void defragmentMemory();
+
+    bool advanceSimulationClock();
+    void recordComputeCommandBuffer(VkCommandBuffer commandBuffer, bool simulate);
     void recordGraphicsCommandBuffer(VkCommandBuffer commandBuffer, uint32_t imageIndex);
+    void prepareInstances();
+    void beginScenePass(VkCommandBuffer commandBuffer, VkRenderPass renderPass, VkExtent2D renderExtent);
+    void recordMeshes(VkCommandBuffer commandBuffer);
+    void recordParticles(VkCommandBuffer commandBuffer, VkBuffer current, VkBuffer previous, uint32_t count);
+    void drawResident();
+    void drawStreamed();
+    void presentFrame(uint32_t imageIndex);
     void updateGraphicsUniformBuffer(uint32_t currentImage);
     void updateComputeUniformBuffer(uint32_t currentImage);
+    glm::mat4 getMeshModelMatrix();
+    glm::mat4 getViewMatrix();
     void recreateSwapChain();
 
     void deduplicateVertices();
+    ThreadPool* getThreadPool();
 public:
     RenderingEngine(std::string name, int forcedPresentMode);
     RenderingEngine(std::string name);
@@ -105,9 +325,105 @@ public:
 
 
     void init();
+    // Only what validateCompute() needs, without a window or presentation support, e.g. for automated tests.
+    // The storage buffers hold particleCount particles, a multiple of 256. Nothing can be drawn afterwards.
+    void initHeadless(uint32_t particleCount = PARTICLE_COUNT);
     void draw();
 
     void setMesh(std::vector<Vertex> vertices, std::vector<uint32_t> indices);
+    // Replaces the mesh like setMesh with an OBJ or binary mesh file, see meshloader.hpp
+    void loadMesh(const std::string& path);
+    // For meshes that change every frame. Not deduplicated, so vertex and index ranges can be updated in place.
+    // Changes are drawn from the next frame on, without waiting for the frames in flight.
+    void setDynamicMesh(const std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices);
+    void updateDynamicMeshVertices(uint32_t firstVertex, const std::vector<Vertex>& vertices);
+    void updateDynamicMeshIndices(uint32_t firstIndex, const std::vector<uint32_t>& indices);
+
+    // Meshes drawn once per instance with the instance's transform and colour, see InstancedMeshes.
+    // Only after init(). Instances are handles, changes are drawn from the next frame on.
+    uint32_t addInstancedMesh(std::vector<Vertex> vertices, std::vector<uint32_t> indices);
+    uint32_t addMeshInstance(uint32_t mesh, const MeshInstance& instance);
+    void updateMeshInstance(uint32_t instance, const MeshInstance& meshInstance);
+    void removeMeshInstance(uint32_t instance);
+
+    // Adds the precomputed vector field of a field file (see VectorField) to the particle update, scaled by strength.
+    // Time-varying fields advance with the simulation time and loop.
+    void loadVectorField(const std::string& path, float strength);
+
+    // Mutual gravity between the particles inside the [-1, 1] box, see ParticleMeshGravity. Strength is the gravitational
+    // constant times the total mass, 0 turns it off. Applies from the next frame on.
+    void setParticleMeshGravity(float strength);
+
+    // Drags the particles along with an incompressible flow on a resolution^3 grid over [-1, 1], stirred by the gravity
+    // point, see FluidSolver. Coupling is the share of the flow's velocity the particles take on per step, 0 turns it off.
+    void setFluid(uint32_t resolution, float coupling);
+    // GPU time of the fluid solver's stages, averaged over the frames since the solver was created
+    FluidTimings getFluidTimings();
+
+    // Renders into a scaled down part of the scene image when the graphics GPU time exceeds the budget in milliseconds,
+    // upscaled into the swap chain image, see ResolutionGovernor. 0 (the default) always renders at full resolution.
+    void setFrameTimeBudget(float milliseconds);
+    ResolutionStatistics getResolutionStatistics();
+
+    // Reduces the particles to bounds, centre of mass, kinetic energy and a speed histogram on the GPU after every
+    // simulation step, see ParticleStatistics. Has to be enabled before init().
+    void enableStatistics(bool enabled);
+    // The newest statistics, a few frames behind the simulation. False until the first ones arrived or when disabled.
+    bool getSimulationStatistics(SimulationStatistics& statistics);
+
+    // Sorts the particles by view depth on the GPU every frame and draws them back to front without depth writes, so
+    // their blending is correct, see DepthSort. Has to be enabled before init().
+    void enableDepthSort(bool enabled);
+
+    // Simulates and draws more particles than fit into device memory by streaming them through it in chunks every
+    // frame, see ParticleStream. The particles of the checkpoint file at path are updated in place when it is set,
+    // otherwise particleCount particles start on a sphere in host memory. Has to be enabled before init(). Readbacks,
+    // checkpoints, trajectories, statistics, the depth sort and particle mesh gravity are unavailable while streaming.
+    void enableStreaming(const std::string& path, uint64_t particleCount);
+
+    // Times the phases of every frame (fence waits, uniform buffer updates, recording, acquire, submits, present)
+    // on the host, see TraceZone. keepEvents keeps the zones for writeChromeTrace(), otherwise only the rolling
+    // percentiles of getTraceSummary() are kept.
+    void startTracing(bool keepEvents);
+    std::vector<TraceZoneSummary> getTraceSummary();
+    void writeChromeTrace(const std::string& path);
+
+    // Runs the simulation at a fixed number of steps per second independent of the display, at most one per frame.
+    // The particles are drawn interpolated between the last two steps. 0 (the default) steps once per frame with the
+    // frame time instead.
+    void setSimulationRate(float stepsPerSecond);
+    uint64_t getSimulationSteps();
+
+    // Lets other local processes drive the gravity point and field parameters through a shared memory ring (see
+    // ControlProducer). It is drained once per frame, the latest values replace the built-in ones.
+    void openControlChannel(const std::string& name);
+    ControlLatency getControlLatency();
+
+    // Copies (part of) the particle state simulated in the given frame to the host, see ReadbackManager
+    void readbackParticles(uint64_t frame, ReadbackRegion region, ReadbackCallback callback);
+    uint64_t getFrameNumber();
+
+    // Written in the background from a readback of the current frame
+    void saveCheckpoint(const std::string& path);
+    // Before init() the initial particles are read from the checkpoint, afterwards the running state is replaced
+    void loadCheckpoint(const std::string& path);
+
+    // Records every n-th frame into a compressed trajectory file, see TrajectoryRecorder
+    void startRecording(const std::string& path, uint32_t frameInterval, uint32_t keyframeInterval);
+    void stopRecording();
+
+    // Plays a recording back instead of simulating, see ReplaySource. Readbacks are held back while replaying.
+    void startReplay(const std::string& path);
+    // Jumps to the recorded frame closest to the simulation frame
+    void seekReplay(uint64_t frame);
+    // The simulation continues from one of the last replayed frames
+    void stopReplay();
+
+    // Runs the compute shader and CpuSimulation side by side from the same seeded state and compares every step.
+    // Replaces the particle state, meant to run right after init(). Returns false if the first step is off.
+    bool validateCompute(size_t steps, uint32_t seed);
+    // ::benchmarkSort on the engine's device once the frames in flight have completed, see sort.hpp
+    bool benchmarkSort(uint32_t maxCount);
 
     int windowShouldClose();
 
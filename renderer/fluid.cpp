@@ -0,0 +1,286 @@
+#include "fluid.hpp"
+
+static const uint32_t PASS_ADVECT = 0;
+static const uint32_t PASS_DIVERGENCE = 1;
+static const uint32_t PASS_JACOBI = 2;
+static const uint32_t PASS_PROJECT = 3;
+static const uint32_t WORKGROUP_SIZE = 64;
+
+FluidSolver::FluidSolver(VkDevice device, PhysicalDevice* physicalDevice, MemoryAllocator* allocator, uint32_t resolution, uint32_t frameCount)
+: _device(device), _physicaldevice(physicalDevice), _allocator(allocator), _resolution(std::max(resolution, 2u)) {
+    float cellSize = FLUID_BOX_SIZE / static_cast<float>(_resolution);
+    fluidorigin = glm::vec4(glm::vec3(FLUID_BOX_MIN), 0.0f);
+    fluidscale = glm::vec4(glm::vec3(1.0f / cellSize), static_cast<float>(_resolution));
+
+    _pushconstants = {};
+    _pushconstants.origin = glm::vec4(glm::vec3(FLUID_BOX_MIN), cellSize);
+    _pushconstants.stir = glm::vec4(0.0f, 0.0f, 0.0f, FLUID_STIR_RADIUS);
+    _pushconstants.resolution = _resolution;
+    _pushconstants.dissipation = FLUID_DISSIPATION;
+
+    VkDeviceSize cellCount = static_cast<VkDeviceSize>(_resolution) * _resolution * _resolution;
+    for (uint32_t i = 0; i < 2; i++) {
+        _velocitybuffers[i] = new Buffer(_device, _physicaldevice, _allocator);
+        _velocitybuffers[i]->createOnDevice(sizeof(glm::vec4) * cellCount, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT);
+        _pressurebuffers[i] = new Buffer(_device, _physicaldevice, _allocator);
+        _pressurebuffers[i]->createOnDevice(sizeof(float) * cellCount, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT);
+    }
+    _divergencebuffer = new Buffer(_device, _physicaldevice, _allocator);
+    _divergencebuffer->createOnDevice(sizeof(float) * cellCount, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+    velocitybuffer = _velocitybuffers[0];
+
+    createPipeline();
+    createDescriptorSets();
+    createQueryPool(frameCount);
+}
+
+void FluidSolver::createPipeline() {
+    std::array<VkDescriptorSetLayoutBinding, 5> layoutBindings = {};
+    for (uint32_t i = 0; i < layoutBindings.size(); i++) {
+        layoutBindings[i].binding = i;
+        layoutBindings[i].descriptorCount = 1;
+        layoutBindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        layoutBindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    }
+
+    VkDescriptorSetLayoutCreateInfo layoutCreateInfo = {};
+    layoutCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    layoutCreateInfo.bindingCount = static_cast<uint32_t>(layoutBindings.size());
+    layoutCreateInfo.pBindings = layoutBindings.data();
+
+    VkResult descriptor_set_layout_creation_result = vkCreateDescriptorSetLayout(_device, &layoutCreateInfo, nullptr, &_descriptorsetlayout);
+    if (descriptor_set_layout_creation_result != VK_SUCCESS) {
+        throw vulkan_error("Failed to create fluid descriptor set layout!", descriptor_set_layout_creation_result);
+    }
+
+    VkPushConstantRange pushConstantRange = {};
+    pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    pushConstantRange.offset = 0;
+    pushConstantRange.size = sizeof(PushConstants);
+
+    VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo = {};
+    pipelineLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    pipelineLayoutCreateInfo.setLayoutCount = 1;
+    pipelineLayoutCreateInfo.pSetLayouts = &_descriptorsetlayout;
+    pipelineLayoutCreateInfo.pushConstantRangeCount = 1;
+    pipelineLayoutCreateInfo.pPushConstantRanges = &pushConstantRange;
+
+    VkResult layout_creation_result = vkCreatePipelineLayout(_device, &pipelineLayoutCreateInfo, nullptr, &_layout);
+    if (layout_creation_result != VK_SUCCESS) {
+        throw vulkan_error("Failed to create fluid pipeline layout!", layout_creation_result);
+    }
+
+    VkShaderModule computeShader = loadShader(_device, "fluid.comp");
+
+    VkPipelineShaderStageCreateInfo computeShaderStageInfo = {};
+    computeShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    computeShaderStageInfo.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+    computeShaderStageInfo.module = computeShader;
+    computeShaderStageInfo.pName = "main";
+
+    VkComputePipelineCreateInfo computePipelineCreateInfo = {};
+    computePipelineCreateInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+    computePipelineCreateInfo.layout = _layout;
+    computePipelineCreateInfo.stage = computeShaderStageInfo;
+
+    VkResult compute_pipeline_creation_result = vkCreateComputePipelines(_device, nullptr, 1, &computePipelineCreateInfo, nullptr, &_pipeline);
+    vkDestroyShaderModule(_device, computeShader, nullptr);
+    if (compute_pipeline_creation_result != VK_SUCCESS) {
+        throw vulkan_error("Failed to create fluid pipeline!", compute_pipeline_creation_result);
+    }
+}
+
+// Only the solver's own buffers are bound, the two sets serve every frame in flight
+void FluidSolver::createDescriptorSets() {
+    VkDescriptorPoolSize descriptorPoolSize = {};
+    descriptorPoolSize.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    descriptorPoolSize.descriptorCount = 5 * 2;
+
+    VkDescriptorPoolCreateInfo descriptorPoolCreateInfo = {};
+    descriptorPoolCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    descriptorPoolCreateInfo.poolSizeCount = 1;
+    descriptorPoolCreateInfo.pPoolSizes = &descriptorPoolSize;
+    descriptorPoolCreateInfo.maxSets = 2;
+
+    VkResult descriptor_pool_creation_result = vkCreateDescriptorPool(_device, &descriptorPoolCreateInfo, nullptr, &_descriptorpool);
+    if (descriptor_pool_creation_result != VK_SUCCESS) {
+        throw vulkan_error("Failed to create fluid descriptor pool!", descriptor_pool_creation_result);
+    }
+
+    VkDescriptorSetLayout descriptorSetLayouts[2] = {_descriptorsetlayout, _descriptorsetlayout};
+    VkDescriptorSetAllocateInfo descriptorSetAllocationInfo = {};
+    descriptorSetAllocationInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    descriptorSetAllocationInfo.descriptorPool = _descriptorpool;
+    descriptorSetAllocationInfo.descriptorSetCount = 2;
+    descriptorSetAllocationInfo.pSetLayouts = descriptorSetLayouts;
+
+    VkResult descriptor_sets_allocation_result = vkAllocateDescriptorSets(_device, &descriptorSetAllocationInfo, _descriptorsets);
+    if (descriptor_sets_allocation_result != VK_SUCCESS) {
+        throw vulkan_error("Failed to allocate fluid descriptor sets!", descriptor_sets_allocation_result);
+    }
+
+    for (uint32_t i = 0; i < 2; i++) {
+        std::array<VkDescriptorBufferInfo, 5> bufferInfos = {};
+        bufferInfos[0] = {_velocitybuffers[i]->buffer, 0, VK_WHOLE_SIZE};
+        bufferInfos[1] = {_velocitybuffers[1 - i]->buffer, 0, VK_WHOLE_SIZE};
+        bufferInfos[2] = {_divergencebuffer->buffer, 0, VK_WHOLE_SIZE};
+        bufferInfos[3] = {_pressurebuffers[i]->buffer, 0, VK_WHOLE_SIZE};
+        bufferInfos[4] = {_pressurebuffers[1 - i]->buffer, 0, VK_WHOLE_SIZE};
+
+        std::array<VkWriteDescriptorSet, 5> writeDescriptorSets = {};
+        for (uint32_t binding = 0; binding < writeDescriptorSets.size(); binding++) {
+            writeDescriptorSets[binding].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+            writeDescriptorSets[binding].dstSet = _descriptorsets[i];
+            writeDescriptorSets[binding].dstBinding = binding;
+            writeDescriptorSets[binding].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+            writeDescriptorSets[binding].descriptorCount = 1;
+            writeDescriptorSets[binding].pBufferInfo = &bufferInfos[binding];
+        }
+
+        vkUpdateDescriptorSets(_device, static_cast<uint32_t>(writeDescriptorSets.size()), writeDescriptorSets.data(), 0, nullptr);
+    }
+}
+
+void FluidSolver::createQueryPool(uint32_t frameCount) {
+    if (_physicaldevice->timestampmask == 0) {
+        printf("The compute queue does not support timestamps, fluid timings are unavailable\n");
+        return;
+    }
+
+    VkQueryPoolCreateInfo queryPoolCreateInfo = {};
+    queryPoolCreateInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+    queryPoolCreateInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+    queryPoolCreateInfo.queryCount = TIMESTAMPS_PER_FRAME * frameCount;
+
+    VkResult query_pool_creation_result = vkCreateQueryPool(_device, &queryPoolCreateInfo, nullptr, &_querypool);
+    if (query_pool_creation_result != VK_SUCCESS) {
+        throw vulkan_error("Failed to create fluid query pool!", query_pool_creation_result);
+    }
+    _querieswritten.resize(frameCount, false);
+}
+
+// The frame's previous step has completed, so its timestamps are read without waiting
+void FluidSolver::collectTimings(uint32_t frame) {
+    if (_querypool == VK_NULL_HANDLE || !_querieswritten[frame]) {
+        return;
+    }
+
+    std::array<uint64_t, TIMESTAMPS_PER_FRAME> timestamps;
+    VkResult query_result = vkGetQueryPoolResults(_device, _querypool, TIMESTAMPS_PER_FRAME * frame, TIMESTAMPS_PER_FRAME,
+                                                  sizeof(timestamps), timestamps.data(), sizeof(uint64_t), VK_QUERY_RESULT_64_BIT);
+    if (query_result != VK_SUCCESS) {
+        return;
+    }
+
+    std::array<double, TIMESTAMPS_PER_FRAME - 1> stages;
+    for (uint32_t i = 0; i < stages.size(); i++) {
+        stages[i] = _physicaldevice->getTimestampMilliseconds(timestamps[i], timestamps[i + 1]);
+    }
+    _timings.advection += stages[0];
+    _timings.pressure += stages[1];
+    _timings.projection += stages[2];
+    _timings.samples++;
+}
+
+void FluidSolver::writeTimestamp(VkCommandBuffer commandBuffer, uint32_t frame, uint32_t stage) {
+    if (_querypool != VK_NULL_HANDLE) {
+        vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, _querypool, TIMESTAMPS_PER_FRAME * frame + stage);
+    }
+}
+
+void FluidSolver::update(float deltaTime, const glm::vec3& stirPosition, const glm::vec3& stirVelocity) {
+    _pushconstants.deltatime = deltaTime;
+    _pushconstants.stir = glm::vec4(stirPosition, FLUID_STIR_RADIUS);
+    _pushconstants.stirvelocity = glm::vec4(stirVelocity, 0.0f);
+}
+
+void FluidSolver::dispatch(VkCommandBuffer commandBuffer, uint32_t set, uint32_t pass) {
+    _pushconstants.pass = pass;
+
+    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, _layout, 0, 1, &_descriptorsets[set], 0, nullptr);
+    vkCmdPushConstants(commandBuffer, _layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(PushConstants), &_pushconstants);
+    uint32_t cellCount = _resolution * _resolution * _resolution;
+    vkCmdDispatch(commandBuffer, (cellCount + WORKGROUP_SIZE - 1) / WORKGROUP_SIZE, 1, 1);
+
+    VkMemoryBarrier memoryBarrier = {};
+    memoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    memoryBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    memoryBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         0, 1, &memoryBarrier, 0, nullptr, 0, nullptr);
+}
+
+void FluidSolver::record(VkCommandBuffer commandBuffer, uint32_t frame) {
+    collectTimings(frame);
+    if (_querypool != VK_NULL_HANDLE) {
+        vkCmdResetQueryPool(commandBuffer, _querypool, TIMESTAMPS_PER_FRAME * frame, TIMESTAMPS_PER_FRAME);
+        _querieswritten[frame] = true;
+    }
+
+    // The previous step's velocity may still be read by the particle update
+    VkMemoryBarrier memoryBarrier = {};
+    memoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    memoryBarrier.srcAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+    memoryBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         0, 1, &memoryBarrier, 0, nullptr, 0, nullptr);
+
+    if (!_cleared) {
+        _cleared = true;
+        vkCmdFillBuffer(commandBuffer, _velocitybuffers[0]->buffer, 0, VK_WHOLE_SIZE, 0);
+        vkCmdFillBuffer(commandBuffer, _pressurebuffers[1]->buffer, 0, VK_WHOLE_SIZE, 0);
+
+        memoryBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        memoryBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                             0, 1, &memoryBarrier, 0, nullptr, 0, nullptr);
+    }
+
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, _pipeline);
+    writeTimestamp(commandBuffer, frame, 0);
+
+    dispatch(commandBuffer, 0, PASS_ADVECT);
+    writeTimestamp(commandBuffer, frame, 1);
+
+    dispatch(commandBuffer, 1, PASS_DIVERGENCE);
+    // Starts from the previous step's pressure in the second buffer and, with an even count, ends up there again
+    for (uint32_t i = 0; i < FLUID_PRESSURE_ITERATIONS; i++) {
+        dispatch(commandBuffer, (i + 1) % 2, PASS_JACOBI);
+    }
+    writeTimestamp(commandBuffer, frame, 2);
+
+    // Reads the advected velocity and the solved pressure, writes the first velocity buffer
+    dispatch(commandBuffer, 1, PASS_PROJECT);
+    writeTimestamp(commandBuffer, frame, 3);
+}
+
+FluidTimings FluidSolver::getTimings() {
+    FluidTimings averages = _timings;
+    if (averages.samples > 0) {
+        averages.advection /= averages.samples;
+        averages.pressure /= averages.samples;
+        averages.projection /= averages.samples;
+    }
+    return averages;
+}
+
+uint32_t FluidSolver::getResolution() {
+    return _resolution;
+}
+
+FluidSolver::~FluidSolver() {
+    if (_querypool != VK_NULL_HANDLE) {
+        vkDestroyQueryPool(_device, _querypool, nullptr);
+    }
+    vkDestroyDescriptorPool(_device, _descriptorpool, nullptr);
+    vkDestroyPipeline(_device, _pipeline, nullptr);
+    vkDestroyPipelineLayout(_device, _layout, nullptr);
+    vkDestroyDescriptorSetLayout(_device, _descriptorsetlayout, nullptr);
+
+    for (uint32_t i = 0; i < 2; i++) {
+        delete _velocitybuffers[i];
+        delete _pressurebuffers[i];
+    }
+    delete _divergencebuffer;
+}
@@ -0,0 +1,100 @@
+#pragma once
+
+#include "vulkan_tools.hpp"
+#include "pipeline.hpp"
+#include "buffer.hpp"
+
+// Jacobi iterations of the pressure solve per step, even so the pressure ends up where the next step starts from
+const uint32_t FLUID_PRESSURE_ITERATIONS = 40;
+// World space cube covered by the grid, the flow is still outside of it
+const float FLUID_BOX_MIN = -1.0f;
+const float FLUID_BOX_SIZE = 2.0f;
+// Velocity kept per step, the rest dissipates
+const float FLUID_DISSIPATION = 0.999f;
+// Radius around the stirring source that takes on its velocity
+const float FLUID_STIR_RADIUS = 0.15f;
+
+// GPU time per stage of a step, in milliseconds
+struct FluidTimings {
+    double advection;
+    double pressure;
+    double projection;
+    uint64_t samples;
+};
+
+// Incompressible flow on a resolution^3 grid with the stable fluids method, recorded into the compute command
+// buffer ahead of the particle update so it needs no host synchronization. A compute pipeline (fluid.comp)
+// advects the velocity semi-Lagrangian, stirs it around a moving source and projects it divergence free with
+// a Jacobi pressure solve warm started from the previous step. shader.comp drags the particles towards it.
+// Every stage is timed with timestamp queries, read back once the frame has completed.
+class FluidSolver {
+private:
+    struct PushConstants {
+        glm::vec4 origin;
+        glm::vec4 stir;
+        glm::vec4 stirvelocity;
+        uint32_t pass;
+        uint32_t resolution;
+        float deltatime;
+        float dissipation;
+    };
+
+    // Start, after advection, after the pressure solve, after projection
+    static const uint32_t TIMESTAMPS_PER_FRAME = 4;
+
+    VkDevice _device;
+    PhysicalDevice* _physicaldevice;
+    MemoryAllocator* _allocator;
+    uint32_t _resolution;
+
+    // Ping-pong, the projected velocity always ends up in the first one
+    Buffer* _velocitybuffers[2];
+    Buffer* _pressurebuffers[2];
+    Buffer* _divergencebuffer;
+
+    VkDescriptorSetLayout _descriptorsetlayout;
+    VkPipelineLayout _layout;
+    VkPipeline _pipeline;
+    VkDescriptorPool _descriptorpool;
+    // Set i reads velocity and pressure buffer i and writes the other ones
+    VkDescriptorSet _descriptorsets[2];
+
+    PushConstants _pushconstants;
+    // Device local buffers start out undefined, the first step clears them
+    bool _cleared = false;
+
+    VkQueryPool _querypool = VK_NULL_HANDLE;
+    std::vector<bool> _querieswritten;
+    FluidTimings _timings = {};
+
+    void createPipeline();
+    void createDescriptorSets();
+    void createQueryPool(uint32_t frameCount);
+    void collectTimings(uint32_t frame);
+    void writeTimestamp(VkCommandBuffer commandBuffer, uint32_t frame, uint32_t stage);
+    void dispatch(VkCommandBuffer commandBuffer, uint32_t set, uint32_t pass);
+public:
+    // Projected velocity per cell, read by shader.comp
+    Buffer* velocitybuffer;
+
+    // Placement for ComputeUniformBufferObject: fluidorigin.xyz is the corner of the grid, fluidscale.xyz maps world
+    // positions to cells and fluidscale.w is the resolution. fluidorigin.w is left for the engine to set the coupling.
+    glm::vec4 fluidorigin;
+    glm::vec4 fluidscale;
+
+    // Sets up the next step: the simulation time step and the source stirring the flow
+    void update(float deltaTime, const glm::vec3& stirPosition, const glm::vec3& stirVelocity);
+    // Records the step into a compute command buffer ahead of the particle update. The frame's previous work has to
+    // have completed, its timings are collected first.
+    void record(VkCommandBuffer commandBuffer, uint32_t frame);
+    // Averages over every step timed so far, all zero without timestamp support on the compute queue
+    FluidTimings getTimings();
+
+    uint32_t getResolution();
+
+    FluidSolver(VkDevice device, PhysicalDevice* physicalDevice, MemoryAllocator* allocator, uint32_t resolution, uint32_t frameCount);
+    ~FluidSolver();
+
+    FluidSolver(const FluidSolver&) = delete;
+    FluidSolver& operator=(const FluidSolver&) = delete;
+};
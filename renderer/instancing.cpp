@@ -0,0 +1,175 @@
+#include "instancing.hpp"
+
+static const uint32_t REMOVED = ~0u;
+static const MeshInstance IDENTITY_INSTANCE = {glm::mat4(1.0f), glm::vec4(1.0f)};
+
+InstancedMeshes::InstancedMeshes(VkDevice device, PhysicalDevice* physicalDevice, MemoryAllocator* allocator, uint32_t frameCount)
+: _multidrawindirect(physicalDevice->multidrawindirectsupported) {
+    _vertexbuffer = new DynamicBuffer(device, physicalDevice, allocator, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, frameCount);
+    _indexbuffer = new DynamicBuffer(device, physicalDevice, allocator, VK_BUFFER_USAGE_INDEX_BUFFER_BIT, frameCount);
+    _instancebuffer = new DynamicBuffer(device, physicalDevice, allocator, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, frameCount);
+    _indirectbuffer = new DynamicBuffer(device, physicalDevice, allocator, VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT, frameCount);
+
+    _instancebuffer->resize(sizeof(MeshInstance));
+    _instancebuffer->write(0, &IDENTITY_INSTANCE, sizeof(MeshInstance));
+}
+
+uint32_t InstancedMeshes::addMesh(const std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices) {
+    for (uint32_t index: indices) {
+        if (index >= vertices.size()) {
+            throw std::out_of_range("Mesh index " + std::to_string(index) + " is out of range!");
+        }
+    }
+
+    Mesh mesh = {};
+    mesh.firstindex = _indexcount;
+    mesh.indexcount = static_cast<uint32_t>(indices.size());
+    mesh.vertexoffset = static_cast<int32_t>(_vertexcount);
+    _meshes.push_back(mesh);
+
+    // Meshes are only ever appended, the geometry already on the device is not copied again
+    _vertexbuffer->resize(sizeof(Vertex) * (_vertexcount + vertices.size()));
+    _vertexbuffer->write(sizeof(Vertex) * _vertexcount, vertices.data(), sizeof(Vertex) * vertices.size());
+    _vertexcount += static_cast<uint32_t>(vertices.size());
+
+    _indexbuffer->resize(sizeof(uint32_t) * (_indexcount + indices.size()));
+    _indexbuffer->write(sizeof(uint32_t) * _indexcount, indices.data(), sizeof(uint32_t) * indices.size());
+    _indexcount += static_cast<uint32_t>(indices.size());
+
+    _layoutchanged = true;
+    return static_cast<uint32_t>(_meshes.size() - 1);
+}
+
+InstancedMeshes::Location& InstancedMeshes::getLocation(uint32_t handle) {
+    if (handle >= _locations.size() || _locations[handle].mesh == REMOVED) {
+        throw std::out_of_range("Mesh instance " + std::to_string(handle) + " does not exist!");
+    }
+    return _locations[handle];
+}
+
+uint32_t InstancedMeshes::addInstance(uint32_t mesh, const MeshInstance& instance) {
+    if (mesh >= _meshes.size()) {
+        throw std::out_of_range("Instanced mesh " + std::to_string(mesh) + " does not exist!");
+    }
+
+    uint32_t handle;
+    if (!_freehandles.empty()) {
+        handle = _freehandles.back();
+        _freehandles.pop_back();
+    } else {
+        handle = static_cast<uint32_t>(_locations.size());
+        _locations.emplace_back();
+    }
+
+    _locations[handle] = {mesh, static_cast<uint32_t>(_meshes[mesh].instances.size())};
+    _meshes[mesh].instances.push_back(instance);
+    _meshes[mesh].handles.push_back(handle);
+
+    _layoutchanged = true;
+    return handle;
+}
+
+void InstancedMeshes::updateInstance(uint32_t handle, const MeshInstance& instance) {
+    Location& location = getLocation(handle);
+    _meshes[location.mesh].instances[location.index] = instance;
+
+    // Written in place unless everything is rewritten anyway
+    if (!_layoutchanged) {
+        VkDeviceSize offset = sizeof(MeshInstance) * (_firstinstances[location.mesh] + location.index);
+        _instancebuffer->write(offset, &instance, sizeof(MeshInstance));
+    }
+}
+
+// The mesh's last instance takes the place of the removed one
+void InstancedMeshes::removeInstance(uint32_t handle) {
+    Location location = getLocation(handle);
+    Mesh& mesh = _meshes[location.mesh];
+
+    mesh.instances[location.index] = mesh.instances.back();
+    mesh.handles[location.index] = mesh.handles.back();
+    _locations[mesh.handles[location.index]].index = location.index;
+    mesh.instances.pop_back();
+    mesh.handles.pop_back();
+
+    _locations[handle].mesh = REMOVED;
+    _freehandles.push_back(handle);
+
+    _layoutchanged = true;
+}
+
+void InstancedMeshes::rebuildLayout() {
+    _firstinstances.resize(_meshes.size());
+    _draws.clear();
+
+    uint32_t instanceCount = 1;
+    for (const Mesh& mesh: _meshes) {
+        instanceCount += static_cast<uint32_t>(mesh.instances.size());
+    }
+    _instancebuffer->resize(sizeof(MeshInstance) * instanceCount);
+
+    uint32_t firstInstance = 1;
+    for (size_t i = 0; i < _meshes.size(); i++) {
+        const Mesh& mesh = _meshes[i];
+        _firstinstances[i] = firstInstance;
+
+        if (!mesh.instances.empty() && mesh.indexcount > 0) {
+            _instancebuffer->write(sizeof(MeshInstance) * firstInstance, mesh.instances.data(),
+                                   sizeof(MeshInstance) * mesh.instances.size());
+
+            VkDrawIndexedIndirectCommand draw = {};
+            draw.indexCount = mesh.indexcount;
+            draw.instanceCount = static_cast<uint32_t>(mesh.instances.size());
+            draw.firstIndex = mesh.firstindex;
+            draw.vertexOffset = mesh.vertexoffset;
+            draw.firstInstance = firstInstance;
+            _draws.push_back(draw);
+        }
+        firstInstance += static_cast<uint32_t>(mesh.instances.size());
+    }
+
+    if (_multidrawindirect) {
+        _indirectbuffer->resize(sizeof(VkDrawIndexedIndirectCommand) * _draws.size());
+        _indirectbuffer->write(0, _draws.data(), sizeof(VkDrawIndexedIndirectCommand) * _draws.size());
+    }
+
+    _layoutchanged = false;
+}
+
+VkBuffer InstancedMeshes::prepare(uint32_t frame) {
+    if (_layoutchanged) {
+        rebuildLayout();
+    }
+
+    _preparedvertexbuffer = _vertexbuffer->prepare(frame);
+    _preparedindexbuffer = _indexbuffer->prepare(frame);
+    _preparedindirectbuffer = _indirectbuffer->prepare(frame);
+    return _instancebuffer->prepare(frame);
+}
+
+void InstancedMeshes::draw(VkCommandBuffer commandBuffer) {
+    if (_draws.empty()) {
+        return;
+    }
+
+    VkDeviceSize offsets[] = {0};
+    vkCmdBindVertexBuffers(commandBuffer, 0, 1, &_preparedvertexbuffer, offsets);
+    vkCmdBindIndexBuffer(commandBuffer, _preparedindexbuffer, 0, VK_INDEX_TYPE_UINT32);
+
+    if (_multidrawindirect) {
+        vkCmdDrawIndexedIndirect(commandBuffer, _preparedindirectbuffer, 0, static_cast<uint32_t>(_draws.size()),
+                                 sizeof(VkDrawIndexedIndirectCommand));
+        return;
+    }
+
+    for (const VkDrawIndexedIndirectCommand& draw: _draws) {
+        vkCmdDrawIndexed(commandBuffer, draw.indexCount, draw.instanceCount, draw.firstIndex, draw.vertexOffset,
+                         draw.firstInstance);
+    }
+}
+
+InstancedMeshes::~InstancedMeshes() {
+    delete _vertexbuffer;
+    delete _indexbuffer;
+    delete _instancebuffer;
+    delete _indirectbuffer;
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include "pipeline.hpp"
+#include "dynamicbuffer.hpp"
+
+// Transform and colour of one mesh instance, as read by shaders/shader.vert from the instance storage buffer
+struct MeshInstance {
+    alignas(16) glm::mat4 model;
+    alignas(16) glm::vec4 color;
+};
+
+// Meshes drawn many times over, each time with its own transform and colour. The geometry of all meshes
+// shares one vertex and one index buffer and the instances are kept grouped by mesh in one storage buffer,
+// so every mesh is a single instanced draw (or all meshes a single indirect multi-draw where supported)
+// and nothing is rebound or rewritten per object.
+// Instance 0 of the storage buffer is an identity transform in white, for meshes drawn outside of this.
+class InstancedMeshes {
+private:
+    struct Mesh {
+        uint32_t firstindex;
+        uint32_t indexcount;
+        int32_t vertexoffset;
+        std::vector<MeshInstance> instances;
+        // Handle of every instance, in the same order
+        std::vector<uint32_t> handles;
+    };
+
+    struct Location {
+        uint32_t mesh;
+        uint32_t index;
+    };
+
+    bool _multidrawindirect;
+
+    DynamicBuffer* _vertexbuffer;
+    DynamicBuffer* _indexbuffer;
+    DynamicBuffer* _instancebuffer;
+    DynamicBuffer* _indirectbuffer;
+
+    std::vector<Mesh> _meshes;
+    uint32_t _vertexcount = 0;
+    uint32_t _indexcount = 0;
+
+    std::vector<Location> _locations;
+    std::vector<uint32_t> _freehandles;
+
+    // Offset of every mesh's instances in the storage buffer, and the draws built from them
+    std::vector<uint32_t> _firstinstances;
+    std::vector<VkDrawIndexedIndirectCommand> _draws;
+    // Adding or removing an instance moves the instances of all meshes after it
+    bool _layoutchanged = true;
+
+    VkBuffer _preparedvertexbuffer = VK_NULL_HANDLE;
+    VkBuffer _preparedindexbuffer = VK_NULL_HANDLE;
+    VkBuffer _preparedindirectbuffer = VK_NULL_HANDLE;
+
+    Location& getLocation(uint32_t handle);
+    void rebuildLayout();
+public:
+    // Indices are relative to the mesh's own vertices
+    uint32_t addMesh(const std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices);
+    size_t meshCount() const {
+        return _meshes.size();
+    }
+
+    // Returns a handle that stays valid until the instance is removed
+    uint32_t addInstance(uint32_t mesh, const MeshInstance& instance);
+    void updateInstance(uint32_t handle, const MeshInstance& instance);
+    void removeInstance(uint32_t handle);
+
+    // Brings the frame's copies up to date and returns its instance storage buffer, which changes when it grows.
+    // The frame's previous work has to have completed, see DynamicBuffer.
+    VkBuffer prepare(uint32_t frame);
+    // Records the draws of every mesh with instances, using the buffers of the last prepared frame
+    void draw(VkCommandBuffer commandBuffer);
+
+    InstancedMeshes(VkDevice device, PhysicalDevice* physicalDevice, MemoryAllocator* allocator, uint32_t frameCount);
+    ~InstancedMeshes();
+};
@@ -0,0 +1,103 @@
+#include "mappedfile.hpp"
+
+#include <stdexcept>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+
+MappedFile::MappedFile(const std::string& path, bool writable)
+: _file(nullptr), _mapping(nullptr), data(nullptr), writabledata(nullptr), size(0) {
+    _file = CreateFileA(path.c_str(), writable ? GENERIC_READ | GENERIC_WRITE : GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                        FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (_file == INVALID_HANDLE_VALUE) {
+        _file = nullptr;
+        throw std::runtime_error("Failed to open " + path + "!");
+    }
+
+    LARGE_INTEGER fileSize;
+    GetFileSizeEx(_file, &fileSize);
+    size = static_cast<size_t>(fileSize.QuadPart);
+    if (size == 0) {
+        return;
+    }
+
+    _mapping = CreateFileMappingA(_file, nullptr, writable ? PAGE_READWRITE : PAGE_READONLY, 0, 0, nullptr);
+    if (!_mapping) {
+        CloseHandle(_file);
+        throw std::runtime_error("Failed to map " + path + "!");
+    }
+
+    data = static_cast<const std::byte*>(MapViewOfFile(_mapping, writable ? FILE_MAP_WRITE : FILE_MAP_READ, 0, 0, 0));
+    if (!data) {
+        CloseHandle(_mapping);
+        CloseHandle(_file);
+        throw std::runtime_error("Failed to map " + path + "!");
+    }
+    if (writable) {
+        writabledata = const_cast<std::byte*>(data);
+    }
+}
+
+MappedFile::~MappedFile() {
+    if (data) {
+        UnmapViewOfFile(data);
+    }
+    if (_mapping) {
+        CloseHandle(_mapping);
+    }
+    if (_file) {
+        CloseHandle(_file);
+    }
+}
+
+#else
+
+MappedFile::MappedFile(const std::string& path, bool writable): _descriptor(-1), data(nullptr), writabledata(nullptr), size(0) {
+    _descriptor = open(path.c_str(), writable ? O_RDWR : O_RDONLY);
+    if (_descriptor < 0) {
+        throw std::runtime_error("Failed to open " + path + "!");
+    }
+
+    struct stat fileStatus;
+    fstat(_descriptor, &fileStatus);
+    size = static_cast<size_t>(fileStatus.st_size);
+    if (size == 0) {
+        return;
+    }
+
+    // Shared, so the changes of writable mappings reach the file
+    void* mapping = mmap(nullptr, size, writable ? PROT_READ | PROT_WRITE : PROT_READ, writable ? MAP_SHARED : MAP_PRIVATE,
+                         _descriptor, 0);
+    if (mapping == MAP_FAILED) {
+        close(_descriptor);
+        throw std::runtime_error("Failed to map " + path + "!");
+    }
+    // The file is consumed front to back, let the OS read ahead aggressively
+    madvise(mapping, size, MADV_SEQUENTIAL);
+
+    data = static_cast<const std::byte*>(mapping);
+    if (writable) {
+        writabledata = static_cast<std::byte*>(mapping);
+    }
+}
+
+MappedFile::~MappedFile() {
+    if (data) {
+        munmap(const_cast<std::byte*>(data), size);
+    }
+    if (_descriptor >= 0) {
+        close(_descriptor);
+    }
+}
+
+#endif
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+// Memory mapping of a whole file, the pages are read in by the OS on first access. Changes to writable mappings
+// go back into the file.
+class MappedFile {
+private:
+#ifdef _WIN32
+    void* _file;
+    void* _mapping;
+#else
+    int _descriptor;
+#endif
+public:
+    const std::byte* data;
+    // Same as data for writable mappings, nullptr otherwise
+    std::byte* writabledata;
+    size_t size;
+
+    MappedFile(const std::string& path, bool writable = false);
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+};
@@ -0,0 +1,594 @@
+#include "memory.hpp"
+
+#include <algorithm>
+#include <cstdio>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+using std::vector;
+
+static uint32_t findLastSet(uint64_t value) {
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanReverse64(&index, value);
+    return index;
+#else
+    return 63 - __builtin_clzll(value);
+#endif
+}
+
+static uint32_t findFirstSet(uint64_t value) {
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanForward64(&index, value);
+    return index;
+#else
+    return __builtin_ctzll(value);
+#endif
+}
+
+static VkDeviceSize alignUp(VkDeviceSize value, VkDeviceSize alignment) {
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+
+TlsfAllocator::TlsfAllocator(VkDeviceSize size): size(size) {
+    for (uint32_t fl = 0; fl < FL_COUNT; fl++) {
+        for (uint32_t sl = 0; sl < SL_COUNT; sl++) {
+            _freeheads[fl][sl] = NONE;
+        }
+    }
+
+    uint32_t node = newNode();
+    _nodes[node] = {0, size, NONE, NONE, NONE, NONE, true};
+    insertFree(node);
+}
+
+uint32_t TlsfAllocator::newNode() {
+    if (!_unusednodes.empty()) {
+        uint32_t node = _unusednodes.back();
+        _unusednodes.pop_back();
+        return node;
+    }
+    _nodes.push_back({});
+    return static_cast<uint32_t>(_nodes.size() - 1);
+}
+
+// Sizes below 2^SMALL_BLOCK_BITS share the first level, above that every power of two is
+// a first level class split linearly into SL_COUNT second level classes.
+void TlsfAllocator::mapping(VkDeviceSize size, uint32_t& fl, uint32_t& sl) {
+    if (size < (1ull << SMALL_BLOCK_BITS)) {
+        fl = 0;
+        sl = static_cast<uint32_t>(size / ((1ull << SMALL_BLOCK_BITS) / SL_COUNT));
+    } else {
+        uint32_t lastSet = findLastSet(size);
+        sl = static_cast<uint32_t>(size >> (lastSet - SL_BITS)) ^ SL_COUNT;
+        fl = lastSet - SMALL_BLOCK_BITS + 1;
+    }
+}
+
+void TlsfAllocator::insertFree(uint32_t node) {
+    uint32_t fl, sl;
+    mapping(_nodes[node].size, fl, sl);
+
+    uint32_t head = _freeheads[fl][sl];
+    _nodes[node].free = true;
+    _nodes[node].prevfree = NONE;
+    _nodes[node].nextfree = head;
+    if (head != NONE) {
+        _nodes[head].prevfree = node;
+    }
+    _freeheads[fl][sl] = node;
+
+    _flbitmap |= 1ull << fl;
+    _slbitmap[fl] |= 1u << sl;
+}
+
+void TlsfAllocator::removeFree(uint32_t node) {
+    uint32_t fl, sl;
+    mapping(_nodes[node].size, fl, sl);
+
+    uint32_t prev = _nodes[node].prevfree;
+    uint32_t next = _nodes[node].nextfree;
+    if (prev != NONE) {
+        _nodes[prev].nextfree = next;
+    }
+    if (next != NONE) {
+        _nodes[next].prevfree = prev;
+    }
+
+    if (_freeheads[fl][sl] == node) {
+        _freeheads[fl][sl] = next;
+        if (next == NONE) {
+            _slbitmap[fl] &= ~(1u << sl);
+            if (_slbitmap[fl] == 0) {
+                _flbitmap &= ~(1ull << fl);
+            }
+        }
+    }
+    _nodes[node].free = false;
+}
+
+// Finds a free node of at least the given size. The size is rounded up to the next class,
+// so any node of the class found is large enough and no list has to be searched.
+uint32_t TlsfAllocator::findFree(VkDeviceSize size) {
+    if (size >= (1ull << SMALL_BLOCK_BITS)) {
+        size += (1ull << (findLastSet(size) - SL_BITS)) - 1;
+    }
+
+    uint32_t fl, sl;
+    mapping(size, fl, sl);
+    if (fl >= FL_COUNT) {
+        return NONE;
+    }
+
+    uint32_t slMap = _slbitmap[fl] & (~0u << sl);
+    if (slMap == 0) {
+        uint64_t flMap = (fl + 1 < 64) ? _flbitmap & (~0ull << (fl + 1)) : 0;
+        if (flMap == 0) {
+            return NONE;
+        }
+        fl = findFirstSet(flMap);
+        slMap = _slbitmap[fl];
+    }
+    sl = findFirstSet(slMap);
+
+    return _freeheads[fl][sl];
+}
+
+// Shrinks the node to the given size, the remainder becomes a new node directly after it
+uint32_t TlsfAllocator::split(uint32_t node, VkDeviceSize size) {
+    uint32_t remainder = newNode();
+
+    _nodes[remainder].offset = _nodes[node].offset + size;
+    _nodes[remainder].size = _nodes[node].size - size;
+    _nodes[remainder].prevphysical = node;
+    _nodes[remainder].nextphysical = _nodes[node].nextphysical;
+    _nodes[remainder].free = false;
+
+    if (_nodes[node].nextphysical != NONE) {
+        _nodes[_nodes[node].nextphysical].prevphysical = remainder;
+    }
+    _nodes[node].nextphysical = remainder;
+    _nodes[node].size = size;
+
+    return remainder;
+}
+
+bool TlsfAllocator::allocate(VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize& offset, uint32_t& handle) {
+    size = alignUp(std::max(size, GRANULARITY), GRANULARITY);
+    alignment = std::max(alignment, GRANULARITY);
+
+    // Worst case padding needed to align the start of whichever node is found
+    uint32_t node = findFree(size + alignment - GRANULARITY);
+    if (node == NONE) {
+        return false;
+    }
+    removeFree(node);
+
+    VkDeviceSize padding = alignUp(_nodes[node].offset, alignment) - _nodes[node].offset;
+    if (padding > 0) {
+        uint32_t front = node;
+        node = split(front, padding);
+        insertFree(front);
+    }
+
+    if (_nodes[node].size - size >= GRANULARITY) {
+        uint32_t back = split(node, size);
+        insertFree(back);
+    }
+
+    usedbytes += _nodes[node].size;
+    allocationcount++;
+
+    offset = _nodes[node].offset;
+    handle = node;
+    return true;
+}
+
+void TlsfAllocator::free(uint32_t handle) {
+    uint32_t node = handle;
+
+    usedbytes -= _nodes[node].size;
+    allocationcount--;
+
+    // Merge with free physical neighbours, so no two free nodes are ever adjacent
+    uint32_t prev = _nodes[node].prevphysical;
+    if (prev != NONE && _nodes[prev].free) {
+        removeFree(prev);
+        _nodes[prev].size += _nodes[node].size;
+        _nodes[prev].nextphysical = _nodes[node].nextphysical;
+        if (_nodes[node].nextphysical != NONE) {
+            _nodes[_nodes[node].nextphysical].prevphysical = prev;
+        }
+        _unusednodes.push_back(node);
+        node = prev;
+    }
+
+    uint32_t next = _nodes[node].nextphysical;
+    if (next != NONE && _nodes[next].free) {
+        removeFree(next);
+        _nodes[node].size += _nodes[next].size;
+        _nodes[node].nextphysical = _nodes[next].nextphysical;
+        if (_nodes[next].nextphysical != NONE) {
+            _nodes[_nodes[next].nextphysical].prevphysical = node;
+        }
+        _unusednodes.push_back(next);
+    }
+
+    insertFree(node);
+}
+
+VkDeviceSize TlsfAllocator::largestFreeRange() {
+    if (_flbitmap == 0) {
+        return 0;
+    }
+    uint32_t fl = findLastSet(_flbitmap);
+    uint32_t sl = findLastSet(_slbitmap[fl]);
+
+    VkDeviceSize largest = 0;
+    for (uint32_t node = _freeheads[fl][sl]; node != NONE; node = _nodes[node].nextfree) {
+        largest = std::max(largest, _nodes[node].size);
+    }
+    return largest;
+}
+
+
+MemoryAllocator::MemoryAllocator(VkDevice device, PhysicalDevice* physicalDevice)
+: _device(device), physicaldevice(physicalDevice) {
+    vkGetPhysicalDeviceMemoryProperties(physicaldevice->physicaldevice, &_memoryproperties);
+
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(physicaldevice->physicaldevice, &properties);
+    _limits = properties.limits;
+
+    budgetsupported = physicaldevice->memorybudgetsupported;
+}
+
+VkDeviceMemory MemoryAllocator::allocateDeviceMemory(VkDeviceSize size, uint32_t memoryType, void** mapping) {
+    if (_devicememorycount >= _limits.maxMemoryAllocationCount) {
+        throw vulkan_error("Failed to allocate device memory, allocation count limit reached!", VK_ERROR_TOO_MANY_OBJECTS);
+    }
+
+    VkMemoryAllocateInfo memoryAllocationInfo = {};
+    memoryAllocationInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    memoryAllocationInfo.allocationSize = size;
+    memoryAllocationInfo.memoryTypeIndex = memoryType;
+
+    VkDeviceMemory memory;
+    VkResult memory_allocation_result = vkAllocateMemory(_device, &memoryAllocationInfo, nullptr, &memory);
+    if (memory_allocation_result != VK_SUCCESS) {
+        throw vulkan_error("Failed to allocate device memory!", memory_allocation_result);
+    }
+    _devicememorycount++;
+
+    // Host visible memory stays mapped for its whole lifetime
+    *mapping = nullptr;
+    if (_memoryproperties.memoryTypes[memoryType].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) {
+        VkResult map_memory_result = vkMapMemory(_device, memory, 0, VK_WHOLE_SIZE, 0, mapping);
+        if (map_memory_result != VK_SUCCESS) {
+            throw vulkan_error("Failed to map device memory!", map_memory_result);
+        }
+    }
+
+    return memory;
+}
+
+void MemoryAllocator::freeDeviceMemory(VkDeviceMemory memory, bool mapped) {
+    if (mapped) {
+        vkUnmapMemory(_device, memory);
+    }
+    vkFreeMemory(_device, memory, nullptr);
+    _devicememorycount--;
+}
+
+// Blocks are kept to a fraction of small heaps (e.g. the 256MB device local host visible heap)
+VkDeviceSize MemoryAllocator::blockSize(uint32_t memoryType) {
+    VkMemoryPropertyFlags flags = _memoryproperties.memoryTypes[memoryType].propertyFlags;
+    VkDeviceSize heapSize = _memoryproperties.memoryHeaps[_memoryproperties.memoryTypes[memoryType].heapIndex].size;
+
+    VkDeviceSize preferredSize = (flags & VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT) ? DEVICE_MEMORY_BLOCK_SIZE : HOST_MEMORY_BLOCK_SIZE;
+    return std::min(preferredSize, heapSize / 8);
+}
+
+bool MemoryAllocator::allocateFromBlocks(VkDeviceSize size, VkDeviceSize alignment, uint32_t memoryType,
+                                         ResourceKind kind, Allocation& allocation) {
+    for (const std::unique_ptr<MemoryBlock>& block: _blocks) {
+        if (block->memorytype != memoryType || block->kind != kind || block->evacuating) {
+            continue;
+        }
+
+        VkDeviceSize offset;
+        uint32_t handle;
+        if (block->allocator.allocate(size, alignment, offset, handle)) {
+            allocation.memory = block->memory;
+            allocation.offset = offset;
+            allocation.size = size;
+            allocation.alignment = alignment;
+            allocation.mapping = block->mapping ? static_cast<std::byte*>(block->mapping) + offset : nullptr;
+            allocation.memorytype = memoryType;
+            allocation.block = block.get();
+            allocation.handle = handle;
+            return true;
+        }
+    }
+    return false;
+}
+
+Allocation MemoryAllocator::allocate(const VkMemoryRequirements& requirements, VkMemoryPropertyFlags properties, ResourceKind kind) {
+    uint32_t memoryType = physicaldevice->findMemoryType(requirements.memoryTypeBits, properties);
+    VkDeviceSize size = blockSize(memoryType);
+
+    Allocation allocation;
+
+    // Resources larger than half a block would mostly waste the block, so they get their own memory
+    if (requirements.size > size / 2) {
+        allocation.memory = allocateDeviceMemory(requirements.size, memoryType, &allocation.mapping);
+        allocation.size = requirements.size;
+        allocation.alignment = requirements.alignment;
+        allocation.memorytype = memoryType;
+
+        _dedicatedbytes[_memoryproperties.memoryTypes[memoryType].heapIndex] += requirements.size;
+        return allocation;
+    }
+
+    if (allocateFromBlocks(requirements.size, requirements.alignment, memoryType, kind, allocation)) {
+        return allocation;
+    }
+
+    void* mapping;
+    VkDeviceMemory memory = allocateDeviceMemory(size, memoryType, &mapping);
+    _blocks.push_back(std::make_unique<MemoryBlock>(memory, mapping, memoryType, kind, size));
+
+    if (!allocateFromBlocks(requirements.size, requirements.alignment, memoryType, kind, allocation)) {
+        throw std::runtime_error("Failed to sub-allocate from a new memory block!");
+    }
+    return allocation;
+}
+
+void MemoryAllocator::free(Allocation& allocation) {
+    if (allocation.block == nullptr) {
+        if (allocation.memory) {
+            freeDeviceMemory(allocation.memory, allocation.mapping != nullptr);
+            _dedicatedbytes[_memoryproperties.memoryTypes[allocation.memorytype].heapIndex] -= allocation.size;
+        }
+        allocation = {};
+        return;
+    }
+
+    MemoryBlock* block = allocation.block;
+    block->allocator.free(allocation.handle);
+
+    std::vector<std::pair<Allocation*, Relocatable*>>& relocatables = block->relocatables;
+    relocatables.erase(std::remove_if(relocatables.begin(), relocatables.end(),
+                                      [&](const std::pair<Allocation*, Relocatable*>& relocatable) { return relocatable.first == &allocation; }),
+                       relocatables.end());
+
+    allocation = {};
+    _freedsincedefragmentation = true;
+
+    releaseEmptyBlocks();
+}
+
+// One empty block per memory type and kind is kept around, so a resource that is recreated
+// every now and then doesn't allocate and free a whole block each time
+void MemoryAllocator::releaseEmptyBlocks() {
+    vector<std::pair<uint32_t, ResourceKind>> keptEmptyBlocks;
+
+    for (size_t i = 0; i < _blocks.size();) {
+        MemoryBlock* block = _blocks[i].get();
+        if (block->allocator.allocationcount > 0) {
+            i++;
+            continue;
+        }
+
+        std::pair<uint32_t, ResourceKind> blockType = {block->memorytype, block->kind};
+        bool keep = !block->evacuating
+                    && std::find(keptEmptyBlocks.begin(), keptEmptyBlocks.end(), blockType) == keptEmptyBlocks.end();
+        if (keep) {
+            keptEmptyBlocks.push_back(blockType);
+            i++;
+            continue;
+        }
+
+        freeDeviceMemory(block->memory, block->mapping != nullptr);
+        _blocks.erase(_blocks.begin() + i);
+    }
+}
+
+// The allocation has to stay at the same address until it is freed
+void MemoryAllocator::setRelocatable(Allocation& allocation, Relocatable* owner) {
+    if (allocation.block) {
+        allocation.block->relocatables.push_back({&allocation, owner});
+    }
+}
+
+void MemoryAllocator::invalidate(const Allocation& allocation, VkDeviceSize offset, VkDeviceSize size) {
+    if (_memoryproperties.memoryTypes[allocation.memorytype].propertyFlags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT) {
+        return;
+    }
+
+    // The range has to be aligned to nonCoherentAtomSize, which may reach into neighbouring allocations
+    VkDeviceSize atomSize = _limits.nonCoherentAtomSize;
+    VkDeviceSize begin = (allocation.offset + offset) / atomSize * atomSize;
+    VkDeviceSize end = alignUp(allocation.offset + offset + size, atomSize);
+    VkDeviceSize memorySize = allocation.block ? allocation.block->allocator.size : allocation.size;
+
+    VkMappedMemoryRange mappedRange = {};
+    mappedRange.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
+    mappedRange.memory = allocation.memory;
+    mappedRange.offset = begin;
+    mappedRange.size = (end >= memorySize) ? VK_WHOLE_SIZE : end - begin;
+
+    VkResult invalidate_result = vkInvalidateMappedMemoryRanges(_device, 1, &mappedRange);
+    if (invalidate_result != VK_SUCCESS) {
+        throw vulkan_error("Failed to invalidate mapped memory range!", invalidate_result);
+    }
+}
+
+// Only sparsely used buffer blocks that hold nothing but relocatable allocations are evacuated,
+// so that the whole block can be released afterwards
+bool MemoryAllocator::isEvacuationCandidate(MemoryBlock* block) {
+    return block->kind == ResourceKind::Buffer && !block->evacuating
+           && block->allocator.allocationcount > 0
+           && block->allocator.allocationcount == block->relocatables.size()
+           && block->allocator.usedbytes < block->allocator.size / 4;
+}
+
+bool MemoryAllocator::needsDefragmentation() {
+    if (!_freedsincedefragmentation) {
+        return false;
+    }
+    for (const std::unique_ptr<MemoryBlock>& block: _blocks) {
+        if (isEvacuationCandidate(block.get())) {
+            return true;
+        }
+    }
+    _freedsincedefragmentation = false;
+    return false;
+}
+
+DefragmentationResult MemoryAllocator::defragment(VkCommandBuffer commandBuffer, VkDeviceSize maxBytesToMove) {
+    DefragmentationResult result;
+    _freedsincedefragmentation = false;
+
+    vector<MemoryBlock*> candidates;
+    for (const std::unique_ptr<MemoryBlock>& block: _blocks) {
+        if (isEvacuationCandidate(block.get())) {
+            candidates.push_back(block.get());
+        }
+    }
+    if (candidates.empty()) {
+        return result;
+    }
+
+    // Emptiest blocks first, they are the cheapest to release
+    std::sort(candidates.begin(), candidates.end(), [](MemoryBlock* a, MemoryBlock* b) {
+        return a->allocator.usedbytes < b->allocator.usedbytes;
+    });
+
+    // No candidate is a destination, so nothing copied in this command buffer is read by a later copy in it,
+    // or moved twice
+    for (MemoryBlock* block: candidates) {
+        block->evacuating = true;
+    }
+
+    // Earlier transfer writes to the moved resources have to be visible to the copies
+    VkMemoryBarrier memoryBarrier = {};
+    memoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    memoryBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    memoryBarrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+                         1, &memoryBarrier, 0, nullptr, 0, nullptr);
+
+    for (MemoryBlock* block: candidates) {
+        if (result.bytesmoved + block->allocator.usedbytes > maxBytesToMove) {
+            break;
+        }
+
+        // Everything has to fit into the other existing blocks, otherwise the block is left alone
+        vector<Allocation> destinations;
+        for (const std::pair<Allocation*, Relocatable*>& relocatable: block->relocatables) {
+            Allocation destination;
+            if (!allocateFromBlocks(relocatable.first->size, relocatable.first->alignment, block->memorytype, block->kind, destination)) {
+                break;
+            }
+            destinations.push_back(destination);
+        }
+
+        if (destinations.size() != block->relocatables.size()) {
+            for (Allocation& destination: destinations) {
+                destination.block->allocator.free(destination.handle);
+            }
+            continue;
+        }
+
+        for (size_t i = 0; i < destinations.size(); i++) {
+            Allocation* allocation = block->relocatables[i].first;
+            Relocatable* owner = block->relocatables[i].second;
+
+            result.retiredallocations.push_back(*allocation);
+            result.retiredbuffers.push_back(owner->relocate(destinations[i], commandBuffer));
+            result.bytesmoved += destinations[i].size;
+
+            destinations[i].block->relocatables.push_back({allocation, owner});
+        }
+        block->relocatables.clear();
+    }
+
+    // Blocks that were left alone stay in use
+    for (MemoryBlock* block: candidates) {
+        if (!block->relocatables.empty()) {
+            block->evacuating = false;
+        }
+    }
+
+    return result;
+}
+
+void MemoryAllocator::endDefragmentation(DefragmentationResult& result) {
+    for (VkBuffer buffer: result.retiredbuffers) {
+        vkDestroyBuffer(_device, buffer, nullptr);
+    }
+    for (Allocation& allocation: result.retiredallocations) {
+        free(allocation);
+    }
+    result = {};
+}
+
+vector<MemoryHeapBudget> MemoryAllocator::getBudget() {
+    vector<MemoryHeapBudget> heapBudgets(_memoryproperties.memoryHeapCount);
+
+    for (uint32_t heap = 0; heap < _memoryproperties.memoryHeapCount; heap++) {
+        heapBudgets[heap].blockbytes = _dedicatedbytes[heap];
+        heapBudgets[heap].usedbytes = _dedicatedbytes[heap];
+    }
+    for (const std::unique_ptr<MemoryBlock>& block: _blocks) {
+        uint32_t heap = _memoryproperties.memoryTypes[block->memorytype].heapIndex;
+        heapBudgets[heap].blockbytes += block->allocator.size;
+        heapBudgets[heap].usedbytes += block->allocator.usedbytes;
+    }
+
+    if (budgetsupported) {
+        VkPhysicalDeviceMemoryBudgetPropertiesEXT memoryBudgetProperties = {};
+        memoryBudgetProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT;
+
+        VkPhysicalDeviceMemoryProperties2 memoryProperties = {};
+        memoryProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PROPERTIES_2;
+        memoryProperties.pNext = &memoryBudgetProperties;
+        vkGetPhysicalDeviceMemoryProperties2(physicaldevice->physicaldevice, &memoryProperties);
+
+        for (uint32_t heap = 0; heap < _memoryproperties.memoryHeapCount; heap++) {
+            heapBudgets[heap].budget = memoryBudgetProperties.heapBudget[heap];
+            heapBudgets[heap].usage = memoryBudgetProperties.heapUsage[heap];
+        }
+    } else {
+        // Without the extension only our own usage is known, leave some of the heap to everything else
+        for (uint32_t heap = 0; heap < _memoryproperties.memoryHeapCount; heap++) {
+            heapBudgets[heap].budget = _memoryproperties.memoryHeaps[heap].size * 8 / 10;
+            heapBudgets[heap].usage = heapBudgets[heap].blockbytes;
+        }
+    }
+
+    return heapBudgets;
+}
+
+void MemoryAllocator::printBudget() {
+    vector<MemoryHeapBudget> heapBudgets = getBudget();
+    const double megabyte = 1024.0 * 1024.0;
+
+    for (size_t heap = 0; heap < heapBudgets.size(); heap++) {
+        printf("Memory heap %zu: %.1f/%.1f MB used by the process, %.1f MB in blocks, %.1f MB in resources\n", heap,
+               heapBudgets[heap].usage / megabyte, heapBudgets[heap].budget / megabyte,
+               heapBudgets[heap].blockbytes / megabyte, heapBudgets[heap].usedbytes / megabyte);
+    }
+    printf("Device memory allocations: %u/%u\n", _devicememorycount, _limits.maxMemoryAllocationCount);
+}
+
+MemoryAllocator::~MemoryAllocator() {
+    for (const std::unique_ptr<MemoryBlock>& block: _blocks) {
+        freeDeviceMemory(block->memory, block->mapping != nullptr);
+    }
+}
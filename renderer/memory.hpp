@@ -0,0 +1,156 @@
+#pragma once
+
+#include "vulkan_tools.hpp"
+#include "physicaldevice.hpp"
+
+#include <memory>
+
+const VkDeviceSize DEVICE_MEMORY_BLOCK_SIZE = 256 * 1024 * 1024;
+const VkDeviceSize HOST_MEMORY_BLOCK_SIZE = 64 * 1024 * 1024;
+
+// Two-level segregated fit allocator over a single range, O(1) allocation and free.
+// Only does the bookkeeping, offsets are handed out into a VkDeviceMemory owned by the caller.
+class TlsfAllocator {
+private:
+    static constexpr uint32_t SL_BITS = 4;
+    static constexpr uint32_t SL_COUNT = 1 << SL_BITS;
+    static constexpr uint32_t SMALL_BLOCK_BITS = 8;
+    static constexpr uint32_t FL_COUNT = 64 - SMALL_BLOCK_BITS + 1;
+    static constexpr VkDeviceSize GRANULARITY = 16;
+
+    static constexpr uint32_t NONE = UINT32_MAX;
+
+    struct Node {
+        VkDeviceSize offset;
+        VkDeviceSize size;
+        uint32_t prevphysical;
+        uint32_t nextphysical;
+        uint32_t prevfree;
+        uint32_t nextfree;
+        bool free;
+    };
+
+    std::vector<Node> _nodes;
+    std::vector<uint32_t> _unusednodes;
+
+    uint64_t _flbitmap = 0;
+    uint32_t _slbitmap[FL_COUNT] = {};
+    uint32_t _freeheads[FL_COUNT][SL_COUNT];
+
+    uint32_t newNode();
+    void mapping(VkDeviceSize size, uint32_t& fl, uint32_t& sl);
+    void insertFree(uint32_t node);
+    void removeFree(uint32_t node);
+    uint32_t findFree(VkDeviceSize size);
+    uint32_t split(uint32_t node, VkDeviceSize size);
+public:
+    VkDeviceSize size;
+    VkDeviceSize usedbytes = 0;
+    uint32_t allocationcount = 0;
+
+    // Returns false if there is no free range large enough
+    bool allocate(VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize& offset, uint32_t& handle);
+    void free(uint32_t handle);
+    VkDeviceSize largestFreeRange();
+
+    TlsfAllocator(VkDeviceSize size);
+};
+
+class MemoryBlock;
+
+// A sub-range of a VkDeviceMemory handed out by the MemoryAllocator
+struct Allocation {
+    VkDeviceMemory memory = nullptr;
+    VkDeviceSize offset = 0;
+    VkDeviceSize size = 0;
+    VkDeviceSize alignment = 0;
+    void* mapping = nullptr;
+
+    uint32_t memorytype = 0;
+    MemoryBlock* block = nullptr; // nullptr for dedicated allocations
+    uint32_t handle = 0;
+};
+
+// Resources that may have their memory moved by MemoryAllocator::defragment
+class Relocatable {
+public:
+    // Binds a new resource to the destination, records the copy and returns the old resource for later destruction
+    virtual VkBuffer relocate(const Allocation& destination, VkCommandBuffer commandBuffer) = 0;
+    virtual ~Relocatable() = default;
+};
+
+enum class ResourceKind {
+    Buffer,
+    Image
+};
+
+class MemoryBlock {
+public:
+    VkDeviceMemory memory;
+    void* mapping;
+    uint32_t memorytype;
+    ResourceKind kind;
+    TlsfAllocator allocator;
+    std::vector<std::pair<Allocation*, Relocatable*>> relocatables;
+    bool evacuating = false;
+
+    MemoryBlock(VkDeviceMemory memory, void* mapping, uint32_t memoryType, ResourceKind kind, VkDeviceSize size)
+    : memory(memory), mapping(mapping), memorytype(memoryType), kind(kind), allocator(size) {}
+};
+
+struct MemoryHeapBudget {
+    VkDeviceSize budget;       // How much the process can allocate from the heap (VK_EXT_memory_budget), or the heap size
+    VkDeviceSize usage;        // Heap usage of the whole process as reported by the driver, or our own block usage
+    VkDeviceSize blockbytes;   // Bytes allocated from the device by this allocator
+    VkDeviceSize usedbytes;    // Bytes handed out to resources
+};
+
+struct DefragmentationResult {
+    std::vector<VkBuffer> retiredbuffers;
+    std::vector<Allocation> retiredallocations;
+    VkDeviceSize bytesmoved = 0;
+};
+
+// Sub-allocates device memory out of large blocks, one set of blocks per memory type and resource kind.
+// Buffers and images are kept in separate blocks so bufferImageGranularity never has to be considered.
+class MemoryAllocator {
+private:
+    VkDevice _device;
+    VkPhysicalDeviceMemoryProperties _memoryproperties;
+    VkPhysicalDeviceLimits _limits;
+
+    std::vector<std::unique_ptr<MemoryBlock>> _blocks;
+    uint32_t _devicememorycount = 0;
+    VkDeviceSize _dedicatedbytes[VK_MAX_MEMORY_HEAPS] = {};
+    bool _freedsincedefragmentation = false;
+
+    VkDeviceMemory allocateDeviceMemory(VkDeviceSize size, uint32_t memoryType, void** mapping);
+    void freeDeviceMemory(VkDeviceMemory memory, bool mapped);
+    VkDeviceSize blockSize(uint32_t memoryType);
+    bool allocateFromBlocks(VkDeviceSize size, VkDeviceSize alignment, uint32_t memoryType, ResourceKind kind, Allocation& allocation);
+    bool isEvacuationCandidate(MemoryBlock* block);
+    void releaseEmptyBlocks();
+public:
+    PhysicalDevice* physicaldevice;
+    bool budgetsupported;
+
+    Allocation allocate(const VkMemoryRequirements& requirements, VkMemoryPropertyFlags properties, ResourceKind kind);
+    void free(Allocation& allocation);
+
+    void setRelocatable(Allocation& allocation, Relocatable* owner);
+
+    // Makes device writes visible to the host for memory that isn't host coherent
+    void invalidate(const Allocation& allocation, VkDeviceSize offset, VkDeviceSize size);
+
+    // Moves relocatable allocations out of sparsely used blocks. The copies are recorded into the command buffer,
+    // the returned resources have to be passed to endDefragmentation once it has finished executing.
+    bool needsDefragmentation();
+    DefragmentationResult defragment(VkCommandBuffer commandBuffer, VkDeviceSize maxBytesToMove);
+    void endDefragmentation(DefragmentationResult& result);
+
+    std::vector<MemoryHeapBudget> getBudget();
+    void printBudget();
+
+    MemoryAllocator(VkDevice device, PhysicalDevice* physicalDevice);
+    ~MemoryAllocator();
+};
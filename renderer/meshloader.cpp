@@ -0,0 +1,592 @@
+#include "meshloader.hpp"
+#include "deduplicate.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+#include <fstream>
+
+using std::string;
+using std::vector;
+
+static const uint32_t UNUSED = ~0u;
+
+// Forsyth's scoring, tuned for a cache of FORSYTH_CACHE_SIZE entries
+static const uint32_t FORSYTH_CACHE_SIZE = 32;
+static const float CACHE_DECAY_POWER = 1.5f;
+static const float LAST_TRIANGLE_SCORE = 0.75f;
+static const float VALENCE_BOOST_SCALE = 2.0f;
+static const float VALENCE_BOOST_POWER = 0.5f;
+
+MeshData::MeshData(vector<CompactVertex> vertices, const vector<uint32_t>& indices)
+: _vertexstorage(std::move(vertices)), vertices(nullptr), indices(nullptr) {
+    vertexcount = static_cast<uint32_t>(_vertexstorage.size());
+    indexcount = static_cast<uint32_t>(indices.size());
+    this->vertices = _vertexstorage.data();
+
+    // Without primitive restart every 16 bit value is a valid index
+    if (vertexcount <= 65536) {
+        indextype = VK_INDEX_TYPE_UINT16;
+        _indexstorage.resize(sizeof(uint16_t) * indexcount);
+        uint16_t* shortIndices = reinterpret_cast<uint16_t*>(_indexstorage.data());
+        for (size_t i = 0; i < indices.size(); i++) {
+            shortIndices[i] = static_cast<uint16_t>(indices[i]);
+        }
+    } else {
+        indextype = VK_INDEX_TYPE_UINT32;
+        _indexstorage.resize(sizeof(uint32_t) * indexcount);
+        memcpy(_indexstorage.data(), indices.data(), _indexstorage.size());
+    }
+    this->indices = _indexstorage.data();
+}
+
+MeshData::MeshData(const string& path): _file(new MappedFile(path)) {
+    MeshFileHeader header = {};
+    if (_file->size < sizeof(MeshFileHeader)) {
+        throw std::runtime_error(path + " is not a mesh!");
+    }
+    memcpy(&header, _file->data, sizeof(MeshFileHeader));
+
+    if (memcmp(header.magic, MESH_MAGIC, sizeof(MESH_MAGIC)) != 0) {
+        throw std::runtime_error(path + " is not a mesh!");
+    }
+    if (header.version > MESH_VERSION) {
+        throw std::runtime_error(path + " was written by a newer version (" + std::to_string(header.version) + ")!");
+    }
+    if (header.byteordermark != MESH_BYTE_ORDER_MARK) {
+        throw std::runtime_error(path + " was written on a machine with a different byte order!");
+    }
+    if (header.vertexsize != sizeof(CompactVertex) || (header.indexsize != 2 && header.indexsize != 4)) {
+        throw std::runtime_error(path + " stores vertices or indices of a different layout!");
+    }
+
+    // The counts are bounded before they are multiplied, and every part is compared with what is left of the file
+    if (header.indexcount > UINT32_MAX || header.payloadoffset < sizeof(MeshFileHeader)
+        || header.payloadoffset % MESH_PAYLOAD_ALIGNMENT != 0 || header.payloadoffset > _file->size) {
+        throw std::runtime_error(path + " is truncated or corrupt!");
+    }
+    uint64_t vertexBytes = static_cast<uint64_t>(header.vertexcount) * header.vertexsize;
+    uint64_t indexBytes = header.indexcount * header.indexsize;
+    if (vertexBytes > _file->size - header.payloadoffset || indexBytes > _file->size - header.payloadoffset - vertexBytes) {
+        throw std::runtime_error(path + " is truncated or corrupt!");
+    }
+
+    vertexcount = header.vertexcount;
+    indexcount = static_cast<uint32_t>(header.indexcount);
+    indextype = header.indexsize == 2 ? VK_INDEX_TYPE_UINT16 : VK_INDEX_TYPE_UINT32;
+    vertices = reinterpret_cast<const CompactVertex*>(_file->data + header.payloadoffset);
+    indices = _file->data + header.payloadoffset + vertexBytes;
+
+    // The indices go to the GPU as they are, one past the vertices would read beyond the vertex buffer
+    uint32_t maxIndex = 0;
+    for (uint32_t i = 0; i < indexcount; i++) {
+        uint32_t index;
+        if (indextype == VK_INDEX_TYPE_UINT16) {
+            uint16_t shortIndex;
+            memcpy(&shortIndex, static_cast<const std::byte*>(indices) + i * sizeof(uint16_t), sizeof(shortIndex));
+            index = shortIndex;
+        } else {
+            memcpy(&index, static_cast<const std::byte*>(indices) + i * sizeof(uint32_t), sizeof(index));
+        }
+        maxIndex = std::max(maxIndex, index);
+    }
+    if (indexcount > 0 && maxIndex >= vertexcount) {
+        throw std::runtime_error(path + " has indices beyond its vertices!");
+    }
+}
+
+void writeMesh(const string& path, const MeshData& mesh) {
+    MeshFileHeader header = {};
+    memcpy(header.magic, MESH_MAGIC, sizeof(MESH_MAGIC));
+    header.version = MESH_VERSION;
+    header.headersize = sizeof(MeshFileHeader);
+    header.byteordermark = MESH_BYTE_ORDER_MARK;
+    header.vertexsize = sizeof(CompactVertex);
+    header.indexsize = mesh.indextype == VK_INDEX_TYPE_UINT16 ? 2 : 4;
+    header.vertexcount = mesh.vertexcount;
+    header.indexcount = mesh.indexcount;
+    header.payloadoffset = (sizeof(MeshFileHeader) + MESH_PAYLOAD_ALIGNMENT - 1) / MESH_PAYLOAD_ALIGNMENT * MESH_PAYLOAD_ALIGNMENT;
+
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    if (!file.is_open()) {
+        throw std::runtime_error("Failed to open " + path + "!");
+    }
+
+    vector<char> headerBlock(header.payloadoffset, 0);
+    memcpy(headerBlock.data(), &header, sizeof(header));
+    file.write(headerBlock.data(), static_cast<std::streamsize>(headerBlock.size()));
+    file.write(reinterpret_cast<const char*>(mesh.vertices), static_cast<std::streamsize>(mesh.vertexSize()));
+    file.write(static_cast<const char*>(mesh.indices), static_cast<std::streamsize>(mesh.indexSize()));
+    file.close();
+
+    if (!file) {
+        throw std::runtime_error("Failed to write " + path + "!");
+    }
+}
+
+/// Index Order Optimization ///
+struct VertexScoreTable {
+    float cache[FORSYTH_CACHE_SIZE];
+    float valence[64];
+
+    VertexScoreTable() {
+        for (uint32_t i = 0; i < FORSYTH_CACHE_SIZE; i++) {
+            // The vertices of the last triangle get a fixed score, so the next triangle doesn't just reuse its edge
+            cache[i] = i < 3 ? LAST_TRIANGLE_SCORE
+                             : std::pow(1.0f - (float) (i - 3) / (FORSYTH_CACHE_SIZE - 3), CACHE_DECAY_POWER);
+        }
+        for (uint32_t i = 0; i < 64; i++) {
+            valence[i] = i == 0 ? 0.0f : VALENCE_BOOST_SCALE * std::pow((float) i, -VALENCE_BOOST_POWER);
+        }
+    }
+
+    // Vertices with few triangles left are preferred, so the last triangles of a vertex aren't left behind
+    float score(int32_t cachePosition, uint32_t remainingTriangles) const {
+        if (remainingTriangles == 0) {
+            return -1.0f;
+        }
+
+        float score = cachePosition >= 0 ? cache[cachePosition] : 0.0f;
+        score += remainingTriangles < 64 ? valence[remainingTriangles]
+                                         : VALENCE_BOOST_SCALE * std::pow((float) remainingTriangles, -VALENCE_BOOST_POWER);
+        return score;
+    }
+};
+
+void optimizeVertexCache(vector<uint32_t>& indices, size_t vertexCount) {
+    static const VertexScoreTable scores;
+    size_t triangleCount = indices.size() / 3;
+
+    // Triangles of every vertex, the ones still to be emitted are kept at the front
+    vector<uint32_t> offsets(vertexCount + 1, 0);
+    vector<uint32_t> remaining(vertexCount, 0);
+    for (uint32_t index: indices) {
+        remaining[index]++;
+    }
+    for (size_t v = 0; v < vertexCount; v++) {
+        offsets[v + 1] = offsets[v] + remaining[v];
+    }
+
+    vector<uint32_t> adjacency(indices.size());
+    vector<uint32_t> filled(offsets.begin(), offsets.end() - 1);
+    for (size_t i = 0; i < indices.size(); i++) {
+        adjacency[filled[indices[i]]++] = static_cast<uint32_t>(i / 3);
+    }
+
+    vector<float> vertexScores(vertexCount);
+    for (size_t v = 0; v < vertexCount; v++) {
+        vertexScores[v] = scores.score(-1, remaining[v]);
+    }
+
+    vector<float> triangleScores(triangleCount);
+    for (size_t t = 0; t < triangleCount; t++) {
+        triangleScores[t] = vertexScores[indices[3 * t]] + vertexScores[indices[3 * t + 1]] + vertexScores[indices[3 * t + 2]];
+    }
+
+    vector<bool> emitted(triangleCount, false);
+    vector<uint32_t> result;
+    result.reserve(indices.size());
+
+    uint32_t cache[FORSYTH_CACHE_SIZE + 3];
+    uint32_t newCache[FORSYTH_CACHE_SIZE + 3];
+    size_t cacheCount = 0;
+
+    size_t nextInputTriangle = 0;
+    int64_t bestTriangle = -1;
+    for (size_t emittedCount = 0; emittedCount < triangleCount; emittedCount++) {
+        // Nothing in the cache has triangles left, continue with the next one in the input order
+        if (bestTriangle < 0) {
+            while (emitted[nextInputTriangle]) {
+                nextInputTriangle++;
+            }
+            bestTriangle = static_cast<int64_t>(nextInputTriangle);
+        }
+
+        const uint32_t* triangle = &indices[3 * bestTriangle];
+        result.insert(result.end(), triangle, triangle + 3);
+        emitted[bestTriangle] = true;
+
+        for (int corner = 0; corner < 3; corner++) {
+            uint32_t vertex = triangle[corner];
+            uint32_t* triangles = &adjacency[offsets[vertex]];
+            uint32_t* last = triangles + remaining[vertex] - 1;
+            std::iter_swap(std::find(triangles, last, static_cast<uint32_t>(bestTriangle)), last);
+            remaining[vertex]--;
+        }
+
+        // The triangle's vertices move to the front of the cache, the others shift back
+        size_t newCacheCount = 0;
+        for (int corner = 0; corner < 3; corner++) {
+            if (std::find(newCache, newCache + newCacheCount, triangle[corner]) == newCache + newCacheCount) {
+                newCache[newCacheCount++] = triangle[corner];
+            }
+        }
+        size_t triangleVertexCount = newCacheCount;
+        for (size_t i = 0; i < cacheCount; i++) {
+            if (std::find(newCache, newCache + triangleVertexCount, cache[i]) == newCache + triangleVertexCount) {
+                newCache[newCacheCount++] = cache[i];
+            }
+        }
+
+        for (size_t i = 0; i < newCacheCount; i++) {
+            uint32_t vertex = newCache[i];
+            int32_t position = i < FORSYTH_CACHE_SIZE ? static_cast<int32_t>(i) : -1;
+
+            float score = scores.score(position, remaining[vertex]);
+            float difference = score - vertexScores[vertex];
+            vertexScores[vertex] = score;
+            for (uint32_t k = 0; k < remaining[vertex]; k++) {
+                triangleScores[adjacency[offsets[vertex] + k]] += difference;
+            }
+        }
+
+        cacheCount = std::min(newCacheCount, static_cast<size_t>(FORSYTH_CACHE_SIZE));
+        std::copy(newCache, newCache + cacheCount, cache);
+
+        bestTriangle = -1;
+        float bestScore = -1.0f;
+        for (size_t i = 0; i < cacheCount; i++) {
+            uint32_t vertex = cache[i];
+            for (uint32_t k = 0; k < remaining[vertex]; k++) {
+                uint32_t candidate = adjacency[offsets[vertex] + k];
+                if (triangleScores[candidate] > bestScore) {
+                    bestScore = triangleScores[candidate];
+                    bestTriangle = candidate;
+                }
+            }
+        }
+    }
+
+    indices = std::move(result);
+}
+
+// Calls back with the number of vertices every triangle misses in a FIFO cache of VERTEX_CACHE_SIZE
+template<typename Callback>
+static void simulateVertexCache(const vector<uint32_t>& indices, size_t vertexCount, Callback callback) {
+    // A vertex is cached if fewer than VERTEX_CACHE_SIZE misses happened since it was loaded
+    vector<uint64_t> loadedAt(vertexCount, 0);
+    uint64_t missCount = VERTEX_CACHE_SIZE + 1;
+
+    for (size_t t = 0; t < indices.size() / 3; t++) {
+        uint32_t misses = 0;
+        for (int corner = 0; corner < 3; corner++) {
+            uint32_t vertex = indices[3 * t + corner];
+            if (missCount - loadedAt[vertex] > VERTEX_CACHE_SIZE) {
+                loadedAt[vertex] = missCount++;
+                misses++;
+            }
+        }
+        callback(t, misses);
+    }
+}
+
+float getAverageCacheMissRatio(const vector<uint32_t>& indices, size_t vertexCount) {
+    if (indices.empty()) {
+        return 0.0f;
+    }
+
+    uint64_t totalMisses = 0;
+    simulateVertexCache(indices, vertexCount, [&](size_t, uint32_t misses) {
+        totalMisses += misses;
+    });
+    return static_cast<float>(totalMisses) / static_cast<float>(indices.size() / 3);
+}
+
+void optimizeOverdraw(vector<uint32_t>& indices, const vector<Vertex>& vertices) {
+    size_t triangleCount = indices.size() / 3;
+    if (triangleCount == 0) {
+        return;
+    }
+
+    // A triangle missing all of its vertices starts over with a cold cache anyway, moving the triangles
+    // from there on somewhere else costs (almost) no extra vertex shader invocations
+    vector<size_t> clusterStarts;
+    simulateVertexCache(indices, vertices.size(), [&](size_t triangle, uint32_t misses) {
+        if (triangle == 0 || misses == 3) {
+            clusterStarts.push_back(triangle);
+        }
+    });
+    clusterStarts.push_back(triangleCount);
+    size_t clusterCount = clusterStarts.size() - 1;
+
+    struct Cluster {
+        glm::vec3 centroid;
+        glm::vec3 normal;
+        float area;
+    };
+    vector<Cluster> clusters(clusterCount, {glm::vec3(0.0f), glm::vec3(0.0f), 0.0f});
+
+    glm::vec3 meshCentroid = glm::vec3(0.0f);
+    float meshArea = 0.0f;
+    for (size_t c = 0; c < clusterCount; c++) {
+        Cluster& cluster = clusters[c];
+        for (size_t t = clusterStarts[c]; t < clusterStarts[c + 1]; t++) {
+            const glm::vec3& a = vertices[indices[3 * t]].pos;
+            const glm::vec3& b = vertices[indices[3 * t + 1]].pos;
+            const glm::vec3& d = vertices[indices[3 * t + 2]].pos;
+
+            glm::vec3 normal = glm::cross(b - a, d - a);
+            float area = glm::length(normal);
+            cluster.centroid += (a + b + d) * (area / 3.0f);
+            cluster.normal += normal;
+            cluster.area += area;
+        }
+
+        meshCentroid += cluster.centroid;
+        meshArea += cluster.area;
+        if (cluster.area > 0.0f) {
+            cluster.centroid /= cluster.area;
+        }
+    }
+    if (meshArea > 0.0f) {
+        meshCentroid /= meshArea;
+    }
+
+    // Clusters facing away from the centre the most are drawn first
+    vector<float> sortKeys(clusterCount);
+    for (size_t c = 0; c < clusterCount; c++) {
+        float normalLength = glm::length(clusters[c].normal);
+        sortKeys[c] = normalLength > 0.0f ? glm::dot(clusters[c].centroid - meshCentroid, clusters[c].normal / normalLength) : 0.0f;
+    }
+
+    vector<uint32_t> order(clusterCount);
+    for (size_t c = 0; c < clusterCount; c++) {
+        order[c] = static_cast<uint32_t>(c);
+    }
+    std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+        return sortKeys[a] > sortKeys[b];
+    });
+
+    vector<uint32_t> result;
+    result.reserve(indices.size());
+    for (uint32_t c: order) {
+        result.insert(result.end(), indices.begin() + 3 * clusterStarts[c], indices.begin() + 3 * clusterStarts[c + 1]);
+    }
+    indices = std::move(result);
+}
+
+static uint32_t packColor(const glm::vec3& color) {
+    uint32_t packed = 0xff000000u;
+    for (int c = 0; c < 3; c++) {
+        float channel = std::min(std::max(color[c], 0.0f), 1.0f);
+        packed |= static_cast<uint32_t>(channel * 255.0f + 0.5f) << (8 * c);
+    }
+    return packed;
+}
+
+MeshData buildMesh(vector<Vertex> vertices, vector<uint32_t> indices, ThreadPool* threadPool) {
+    if (indices.size() % 3 != 0) {
+        throw std::runtime_error("Mesh index count is not a multiple of 3!");
+    }
+
+    deduplicateVertices(vertices, indices, threadPool);
+    optimizeVertexCache(indices, vertices.size());
+    optimizeOverdraw(indices, vertices);
+
+    // Vertices in the order the indices first use them, so vertex fetches move through memory in order
+    vector<uint32_t> remapped(vertices.size(), UNUSED);
+    vector<CompactVertex> compactVertices;
+    compactVertices.reserve(vertices.size());
+    for (uint32_t& index: indices) {
+        if (remapped[index] == UNUSED) {
+            remapped[index] = static_cast<uint32_t>(compactVertices.size());
+            compactVertices.push_back({vertices[index].pos, packColor(vertices[index].color)});
+        }
+        index = remapped[index];
+    }
+
+    return MeshData(std::move(compactVertices), indices);
+}
+
+/// OBJ Loading ///
+// Reads straight from the file mapping, which isn't null terminated
+struct ObjReader {
+    const char* cursor;
+    const char* end;
+    size_t line = 1;
+
+    void skipSpaces() {
+        while (cursor < end && (*cursor == ' ' || *cursor == '\t' || *cursor == '\r')) {
+            cursor++;
+        }
+    }
+
+    void skipLine() {
+        while (cursor < end && *cursor != '\n') {
+            cursor++;
+        }
+        if (cursor < end) {
+            cursor++;
+            line++;
+        }
+    }
+
+    bool atLineEnd() {
+        skipSpaces();
+        return cursor >= end || *cursor == '\n' || *cursor == '#';
+    }
+
+    bool isDigit() const {
+        return cursor < end && *cursor >= '0' && *cursor <= '9';
+    }
+
+    bool readInteger(int64_t& value) {
+        skipSpaces();
+        bool negative = cursor < end && *cursor == '-';
+        if (cursor < end && (*cursor == '-' || *cursor == '+')) {
+            cursor++;
+        }
+        if (!isDigit()) {
+            return false;
+        }
+
+        value = 0;
+        while (isDigit()) {
+            value = value * 10 + (*cursor++ - '0');
+        }
+        value = negative ? -value : value;
+        return true;
+    }
+
+    // Exact enough for mesh data, not correctly rounded in the last bit like strtof
+    bool readFloat(float& value) {
+        skipSpaces();
+        bool negative = cursor < end && *cursor == '-';
+        if (cursor < end && (*cursor == '-' || *cursor == '+')) {
+            cursor++;
+        }
+
+        uint64_t mantissa = 0;
+        int exponent = 0;
+        bool anyDigits = false;
+        while (isDigit()) {
+            if (mantissa < UINT64_MAX / 10 - 9) {
+                mantissa = mantissa * 10 + (*cursor - '0');
+            } else {
+                exponent++;
+            }
+            cursor++;
+            anyDigits = true;
+        }
+        if (cursor < end && *cursor == '.') {
+            cursor++;
+            while (isDigit()) {
+                if (mantissa < UINT64_MAX / 10 - 9) {
+                    mantissa = mantissa * 10 + (*cursor - '0');
+                    exponent--;
+                }
+                cursor++;
+                anyDigits = true;
+            }
+        }
+        if (!anyDigits) {
+            return false;
+        }
+
+        if (cursor < end && (*cursor == 'e' || *cursor == 'E')) {
+            cursor++;
+            int64_t exponentValue;
+            if (!readInteger(exponentValue)) {
+                return false;
+            }
+            exponent += static_cast<int>(std::max<int64_t>(std::min<int64_t>(exponentValue, 400), -400));
+        }
+
+        double result = static_cast<double>(mantissa);
+        result = exponent < 0 ? result / std::pow(10.0, -exponent) : result * std::pow(10.0, exponent);
+        value = static_cast<float>(negative ? -result : result);
+        return true;
+    }
+
+    // Only the position of "v", "v/vt", "v//vn" and "v/vt/vn" is used
+    bool readFaceIndex(int64_t& value) {
+        if (!readInteger(value)) {
+            return false;
+        }
+        while (cursor < end && *cursor != ' ' && *cursor != '\t' && *cursor != '\r' && *cursor != '\n') {
+            cursor++;
+        }
+        return true;
+    }
+};
+
+MeshData loadObj(const string& path, ThreadPool* threadPool) {
+    MappedFile file(path);
+    ObjReader reader = {reinterpret_cast<const char*>(file.data), reinterpret_cast<const char*>(file.data) + file.size};
+
+    vector<Vertex> vertices;
+    vector<uint32_t> indices;
+    vector<uint32_t> polygon;
+
+    auto parseError = [&](const char* message) {
+        return std::runtime_error(path + ":" + std::to_string(reader.line) + ": " + message);
+    };
+
+    while (reader.cursor < reader.end) {
+        reader.skipSpaces();
+        size_t remaining = reader.end - reader.cursor;
+
+        if (remaining >= 2 && reader.cursor[0] == 'v' && (reader.cursor[1] == ' ' || reader.cursor[1] == '\t')) {
+            reader.cursor++;
+            Vertex vertex = {glm::vec3(0.0f), glm::vec3(1.0f)};
+            if (!reader.readFloat(vertex.pos.x) || !reader.readFloat(vertex.pos.y) || !reader.readFloat(vertex.pos.z)) {
+                throw parseError("Invalid vertex position!");
+            }
+
+            // Vertex colours are an extension, a single extra value is the homogeneous w
+            glm::vec3 extra;
+            int extraCount = 0;
+            while (extraCount < 3 && !reader.atLineEnd() && reader.readFloat(extra[extraCount])) {
+                extraCount++;
+            }
+            if (extraCount == 3) {
+                vertex.color = extra;
+            }
+            vertices.push_back(vertex);
+        } else if (remaining >= 2 && reader.cursor[0] == 'f' && (reader.cursor[1] == ' ' || reader.cursor[1] == '\t')) {
+            reader.cursor++;
+            polygon.clear();
+            while (!reader.atLineEnd()) {
+                int64_t index;
+                if (!reader.readFaceIndex(index)) {
+                    throw parseError("Invalid face index!");
+                }
+
+                // Negative indices count back from the last vertex read so far
+                int64_t position = index < 0 ? static_cast<int64_t>(vertices.size()) + index : index - 1;
+                if (index == 0 || position < 0 || position >= static_cast<int64_t>(vertices.size())) {
+                    throw parseError("Face index out of range!");
+                }
+                polygon.push_back(static_cast<uint32_t>(position));
+            }
+
+            for (size_t i = 2; i < polygon.size(); i++) {
+                indices.push_back(polygon[0]);
+                indices.push_back(polygon[i - 1]);
+                indices.push_back(polygon[i]);
+            }
+        }
+
+        reader.skipLine();
+    }
+
+    return buildMesh(std::move(vertices), std::move(indices), threadPool);
+}
+
+static bool hasExtension(const string& path, const string& extension) {
+    if (path.size() < extension.size()) {
+        return false;
+    }
+    return std::equal(extension.begin(), extension.end(), path.end() - extension.size(), [](char a, char b) {
+        return std::tolower(static_cast<unsigned char>(a)) == std::tolower(static_cast<unsigned char>(b));
+    });
+}
+
+MeshData loadMesh(const string& path, ThreadPool* threadPool) {
+    if (hasExtension(path, ".obj")) {
+        return loadObj(path, threadPool);
+    }
+    return MeshData(path);
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include "vulkan_tools.hpp"
+#include "pipeline.hpp"
+#include "mappedfile.hpp"
+#include "threadpool.hpp"
+
+#include <memory>
+#include <type_traits>
+
+const char MESH_MAGIC[8] = {'A', 'F', 'C', 'M', 'E', 'S', 'H', '\0'};
+const uint32_t MESH_VERSION = 1;
+const uint32_t MESH_BYTE_ORDER_MARK = 0x01020304;
+const uint64_t MESH_PAYLOAD_ALIGNMENT = 64;
+
+// Size of the FIFO cache the index order is optimized for and analyzed with
+const uint32_t VERTEX_CACHE_SIZE = 16;
+
+// Vertices come first at payloadoffset, the indices (2 or 4 bytes each) right after them
+struct MeshFileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t headersize;
+    uint32_t byteordermark;
+    uint32_t vertexsize;
+    uint32_t indexsize;
+    uint32_t vertexcount;
+    uint64_t indexcount;
+    uint64_t payloadoffset;
+};
+
+static_assert(std::is_trivially_copyable<MeshFileHeader>::value, "Mesh header is written as raw bytes");
+
+// A mesh ready for upload, in the compact vertex format and with 16 bit indices when the vertices allow it.
+// Meshes read from binary files point straight into the file mapping.
+class MeshData {
+private:
+    std::vector<CompactVertex> _vertexstorage;
+    std::vector<std::byte> _indexstorage;
+    std::unique_ptr<MappedFile> _file;
+public:
+    const CompactVertex* vertices;
+    uint32_t vertexcount;
+    const void* indices;
+    uint32_t indexcount;
+    VkIndexType indextype;
+
+    VkDeviceSize vertexSize() const {
+        return sizeof(CompactVertex) * vertexcount;
+    }
+    VkDeviceSize indexSize() const {
+        return (indextype == VK_INDEX_TYPE_UINT16 ? sizeof(uint16_t) : sizeof(uint32_t)) * indexcount;
+    }
+
+    MeshData(std::vector<CompactVertex> vertices, const std::vector<uint32_t>& indices);
+    // Maps a binary mesh written by writeMesh
+    MeshData(const std::string& path);
+};
+
+// Reorders the triangles for the post-transform vertex cache (Forsyth's linear-speed optimizer)
+void optimizeVertexCache(std::vector<uint32_t>& indices, size_t vertexCount);
+// Splits the cache optimized order where the cache starts over and puts the outward facing clusters first,
+// so near surfaces tend to be drawn before the ones they hide. Keeps the cache efficiency.
+void optimizeOverdraw(std::vector<uint32_t>& indices, const std::vector<Vertex>& vertices);
+// Average number of vertex shader invocations per triangle with a FIFO cache of VERTEX_CACHE_SIZE
+float getAverageCacheMissRatio(const std::vector<uint32_t>& indices, size_t vertexCount);
+
+// Deduplicates, optimizes the index order for the vertex cache and overdraw, puts the vertices
+// in the order they are first used and converts them to the compact format
+MeshData buildMesh(std::vector<Vertex> vertices, std::vector<uint32_t> indices, ThreadPool* threadPool);
+// Positions with optional vertex colours ("v x y z r g b"), polygons are triangulated as fans
+MeshData loadObj(const std::string& path, ThreadPool* threadPool);
+// .obj files are optimized while loading, anything else is read as a binary mesh
+MeshData loadMesh(const std::string& path, ThreadPool* threadPool);
+void writeMesh(const std::string& path, const MeshData& mesh);
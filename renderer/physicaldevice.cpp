@@ -19,19 +19,27 @@ QueueFamilyIndices PhysicalDevice::findQueueFamilies(VkSurfaceKHR surface) {
     int i = 0;
     for (const VkQueueFamilyProperties& queueFamily: queueFamilies) {
         // graphics family
-        if ((queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT) && (queueFamily.queueFlags & VK_QUEUE_COMPUTE_BIT)) {
+        if (!indices.graphicsComputeFamily.has_value()
+            && (queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT) && (queueFamily.queueFlags & VK_QUEUE_COMPUTE_BIT)) {
             indices.graphicsComputeFamily = i;
         }
 
-        // presentation (windowing system) family
+        // presentation (windowing system) family, none without a surface
         VkBool32 presentSupport = false;
-        vkGetPhysicalDeviceSurfaceSupportKHR(physicaldevice, i, surface, &presentSupport);
-        if (presentSupport) {
+        if (surface != VK_NULL_HANDLE) {
+            vkGetPhysicalDeviceSurfaceSupportKHR(physicaldevice, i, surface, &presentSupport);
+        }
+        if (!indices.presentFamily.has_value() && presentSupport) {
             indices.presentFamily = i;
         }
 
+        // dedicated transfer family (usually backed by a DMA engine), optional
+        if (!indices.transferFamily.has_value() && (queueFamily.queueFlags & VK_QUEUE_TRANSFER_BIT)
+            && !(queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT) && !(queueFamily.queueFlags & VK_QUEUE_COMPUTE_BIT)) {
+            indices.transferFamily = i;
+        }
 
-        if (indices.isComplete()) {
+        if (indices.isComplete() && indices.transferFamily.has_value()) {
             break;
         }
 
@@ -60,6 +68,42 @@ bool PhysicalDevice::checkDeviceExtensionSupport() {
 }
 
 
+bool PhysicalDevice::isExtensionAvailable(const char* extensionName) {
+    uint32_t availableExtensionCount;
+    vkEnumerateDeviceExtensionProperties(physicaldevice, nullptr, &availableExtensionCount, nullptr);
+
+    vector<VkExtensionProperties> availableExtensions(availableExtensionCount);
+    vkEnumerateDeviceExtensionProperties(physicaldevice, nullptr, &availableExtensionCount, availableExtensions.data());
+
+    for (const VkExtensionProperties& extensionProperties: availableExtensions) {
+        if (strcmp(extensionProperties.extensionName, extensionName) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+
+// Timeline semaphores (core in Vulkan 1.2) are used to track uploads across queues.
+bool PhysicalDevice::checkTimelineSemaphoreSupport() {
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(physicaldevice, &properties);
+    if (properties.apiVersion < VK_API_VERSION_1_2) {
+        return false;
+    }
+
+    VkPhysicalDeviceVulkan12Features vulkan12Features = {};
+    vulkan12Features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+
+    VkPhysicalDeviceFeatures2 features = {};
+    features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+    features.pNext = &vulkan12Features;
+    vkGetPhysicalDeviceFeatures2(physicaldevice, &features);
+
+    return vulkan12Features.timelineSemaphore == VK_TRUE;
+}
+
+
 SwapChainSupportDetails PhysicalDevice::querySwapChainSupportDetails(VkSurfaceKHR surface) {
 
     SwapChainSupportDetails swapChainSupportDetails;
@@ -225,23 +269,73 @@ int PhysicalDevice::rateSuitability() {
             break;
     }
 
-    bool requiredQueuesSupported = queuefamilies.isComplete();
-    bool requiredExtensionsSupported = checkDeviceExtensionSupport();
-    bool requiredSwapChainSupported = isSwapChainAdequate();
+    // Without a surface nothing is presented, so only the compute and transfer work has to be supported
+    bool requiredQueuesSupported = _presenting ? queuefamilies.isComplete() : queuefamilies.graphicsComputeFamily.has_value();
+    bool requiredExtensionsSupported = !_presenting || checkDeviceExtensionSupport();
+    bool requiredSwapChainSupported = !_presenting || isSwapChainAdequate();
+    bool requiredFeaturesSupported = checkTimelineSemaphoreSupport();
 
-    if ( !(requiredQueuesSupported && requiredExtensionsSupported && requiredSwapChainSupported) ) {
+    if ( !(requiredQueuesSupported && requiredExtensionsSupported && requiredSwapChainSupported && requiredFeaturesSupported) ) {
         return -1;
     }
     return suitabilityScore;
 }
 
 void PhysicalDevice::evaluate(VkSurfaceKHR surface) {
+    _presenting = surface != VK_NULL_HANDLE;
     queuefamilies = findQueueFamilies(surface);
-    swapchainsupport = querySwapChainSupportDetails(surface);
+    if (_presenting) {
+        swapchainsupport = querySwapChainSupportDetails(surface);
+    }
 
     score = rateSuitability();
 
     swappresentmode = chooseSwapPresentMode();
-    swapsurfaceformat = chooseSwapSurfaceFormat();
+    if (_presenting) {
+        swapsurfaceformat = chooseSwapSurfaceFormat();
+    }
     msaasamples = getMaxUsableSampleCount();
+
+    enabledextensions = _presenting ? DEVICE_EXTENSIONS : vector<const char*>();
+    for (const char* extensionName: OPTIONAL_DEVICE_EXTENSIONS) {
+        if (isExtensionAvailable(extensionName)) {
+            enabledextensions.push_back(extensionName);
+        }
+    }
+    memorybudgetsupported = isExtensionAvailable(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+
+    VkPhysicalDeviceFeatures features;
+    vkGetPhysicalDeviceFeatures(physicaldevice, &features);
+    multidrawindirectsupported = features.multiDrawIndirect == VK_TRUE && features.drawIndirectFirstInstance == VK_TRUE;
+
+    VkPhysicalDeviceSubgroupProperties subgroupProperties = {};
+    subgroupProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SUBGROUP_PROPERTIES;
+    VkPhysicalDeviceProperties2 properties = {};
+    properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+    properties.pNext = &subgroupProperties;
+    vkGetPhysicalDeviceProperties2(physicaldevice, &properties);
+
+    bool computeSubgroups = subgroupProperties.supportedStages & VK_SHADER_STAGE_COMPUTE_BIT;
+    VkSubgroupFeatureFlags arithmeticOperations = VK_SUBGROUP_FEATURE_BASIC_BIT | VK_SUBGROUP_FEATURE_ARITHMETIC_BIT;
+    VkSubgroupFeatureFlags ballotOperations = VK_SUBGROUP_FEATURE_BASIC_BIT | VK_SUBGROUP_FEATURE_BALLOT_BIT;
+    subgrouparithmeticsupported = computeSubgroups && (subgroupProperties.supportedOperations & arithmeticOperations) == arithmeticOperations;
+    subgroupballotsupported = computeSubgroups && (subgroupProperties.supportedOperations & ballotOperations) == ballotOperations;
+    subgroupsize = subgroupProperties.subgroupSize;
+
+    timestampmask = 0;
+    timestampperiod = properties.properties.limits.timestampPeriod;
+    if (queuefamilies.graphicsComputeFamily.has_value()) {
+        uint32_t queueFamilyCount = 0;
+        vkGetPhysicalDeviceQueueFamilyProperties(physicaldevice, &queueFamilyCount, nullptr);
+        vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
+        vkGetPhysicalDeviceQueueFamilyProperties(physicaldevice, &queueFamilyCount, queueFamilies.data());
+
+        uint32_t validBits = queueFamilies[queuefamilies.graphicsComputeFamily.value()].timestampValidBits;
+        timestampmask = validBits >= 64 ? ~0ull : (1ull << validBits) - 1;
+    }
+}
+
+double PhysicalDevice::getTimestampMilliseconds(uint64_t start, uint64_t end) {
+    uint64_t ticks = ((end & timestampmask) - (start & timestampmask)) & timestampmask;
+    return static_cast<double>(ticks) * timestampperiod * 1e-6;
 }
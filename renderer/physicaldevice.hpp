@@ -7,6 +7,8 @@
 struct QueueFamilyIndices {
     std::optional<uint32_t> graphicsComputeFamily;
     std::optional<uint32_t> presentFamily;
+    // Only set when the device has a queue family dedicated to transfers
+    std::optional<uint32_t> transferFamily;
 
     bool isComplete() const {
         return graphicsComputeFamily.has_value() && presentFamily.has_value();
@@ -23,12 +25,19 @@ const std::vector<const char*> DEVICE_EXTENSIONS = {
         VK_KHR_SWAPCHAIN_EXTENSION_NAME
 };
 
+// Enabled when available, see PhysicalDevice::enabledextensions
+const std::vector<const char*> OPTIONAL_DEVICE_EXTENSIONS = {
+        VK_EXT_MEMORY_BUDGET_EXTENSION_NAME
+};
+
 class PhysicalDevice {
 private:
     QueueFamilyIndices findQueueFamilies(VkSurfaceKHR surface);
     SwapChainSupportDetails querySwapChainSupportDetails(VkSurfaceKHR surface);
 
     bool checkDeviceExtensionSupport();
+    bool isExtensionAvailable(const char* extensionName);
+    bool checkTimelineSemaphoreSupport();
     bool isSwapChainAdequate();
 
     int rateSuitability();
@@ -38,6 +47,8 @@ private:
     VkSampleCountFlagBits getMaxUsableSampleCount();
 
     std::optional<VkPresentModeKHR> _forcedpresentmode;
+    // False when evaluated without a surface, the swap chain is then neither required nor enabled
+    bool _presenting;
 public:
     VkPhysicalDevice physicaldevice;
     QueueFamilyIndices queuefamilies;
@@ -45,11 +56,26 @@ public:
     VkPresentModeKHR swappresentmode;
     VkSurfaceFormatKHR swapsurfaceformat;
     VkSampleCountFlagBits msaasamples;
+    std::vector<const char*> enabledextensions;
+    bool memorybudgetsupported;
+    // multiDrawIndirect together with drawIndirectFirstInstance, enabled when supported
+    bool multidrawindirectsupported;
+    // Subgroup arithmetic operations in compute shaders, Vulkan 1.1 core but optional
+    bool subgrouparithmeticsupported;
+    // Subgroup ballots in compute shaders
+    bool subgroupballotsupported;
+    // Invocations per subgroup the device reports, compute shaders may still run with smaller subgroups
+    uint32_t subgroupsize;
+    // Bits of the timestamps the graphics and compute queue writes, 0 when it does not support timestamps
+    uint64_t timestampmask;
+    // Nanoseconds per timestamp tick
+    float timestampperiod;
 
     int score;
 
     void forcePresentMode(std::optional<VkPresentModeKHR> presentMode);
 
+    // VK_NULL_HANDLE evaluates the device for headless compute work
     void evaluate(VkSurfaceKHR surface);
 
     VkExtent2D getSwapExtent(VkSurfaceKHR surface, int framebufferwidth, int framebufferheight);
@@ -57,6 +83,8 @@ public:
     uint32_t findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties);
     VkFormat findSupportedFormat(const std::vector<VkFormat>& candidates, VkImageTiling tiling, VkFormatFeatureFlags features);
     VkFormat findDepthFormat();
+    // Between two timestamps of the graphics and compute queue, also when the counter wrapped in between
+    double getTimestampMilliseconds(uint64_t start, uint64_t end);
 
     PhysicalDevice(VkPhysicalDevice vulkanPhysicalDevice): physicaldevice(vulkanPhysicalDevice) {};
 
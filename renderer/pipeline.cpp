@@ -1,6 +1,8 @@
 #include "pipeline.hpp"
 
+#include <cmath>
 #include <fstream>
+#include <random>
 
 using std::string, std::vector;
 
@@ -29,6 +31,32 @@ std::array<VkVertexInputAttributeDescription, 2> Vertex::getAttributeDescription
     return attributeDescriptions;
 }
 
+VkVertexInputBindingDescription CompactVertex::getBindingDescription() {
+    VkVertexInputBindingDescription bindingDescription{};
+    bindingDescription.binding = 0;
+    bindingDescription.stride = sizeof(CompactVertex);
+    bindingDescription.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+
+    return bindingDescription;
+}
+
+// The shader reads the colour as a vec3, the unused alpha channel is dropped
+std::array<VkVertexInputAttributeDescription, 2> CompactVertex::getAttributeDescriptions() {
+    std::array<VkVertexInputAttributeDescription, 2> attributeDescriptions{};
+
+    attributeDescriptions[0].binding = 0;
+    attributeDescriptions[0].location = 0;
+    attributeDescriptions[0].format = VK_FORMAT_R32G32B32_SFLOAT;
+    attributeDescriptions[0].offset = offsetof(CompactVertex, pos);
+
+    attributeDescriptions[1].binding = 0;
+    attributeDescriptions[1].location = 1;
+    attributeDescriptions[1].format = VK_FORMAT_R8G8B8A8_UNORM;
+    attributeDescriptions[1].offset = offsetof(CompactVertex, color);
+
+    return attributeDescriptions;
+}
+
 bool Vertex::operator==(const Vertex &other) const {
     return pos == other.pos && color == other.color;
 }
@@ -66,8 +94,7 @@ static VkShaderModule createShaderModule(VkDevice device, const vector<char>& sh
     return shaderModule;
 }
 
-
-static VkShaderModule loadShader(VkDevice device, const string& filename) {
+VkShaderModule loadShader(VkDevice device, const string& filename) {
     vector<char> shaderContent = readFile(SHADER_FOLDER_PATH + filename + SHADER_EXTENSION);
     return createShaderModule(device, shaderContent);
 }
@@ -91,14 +118,23 @@ void GraphicsPipeline::create() {
 }
 
 void GraphicsPipeline::initRenderPass() {
+    renderpass = createRenderPass(VK_ATTACHMENT_LOAD_OP_CLEAR, VK_ATTACHMENT_STORE_OP_DONT_CARE);
+    openrenderpass = createRenderPass(VK_ATTACHMENT_LOAD_OP_CLEAR, VK_ATTACHMENT_STORE_OP_STORE);
+    continuerenderpass = createRenderPass(VK_ATTACHMENT_LOAD_OP_LOAD, VK_ATTACHMENT_STORE_OP_STORE);
+}
+
+// Only the load and store operations differ, so the passes are compatible with the same pipelines and framebuffers
+VkRenderPass GraphicsPipeline::createRenderPass(VkAttachmentLoadOp loadOp, VkAttachmentStoreOp depthStoreOp) {
+    bool load = loadOp == VK_ATTACHMENT_LOAD_OP_LOAD;
+
     // Color Attachments
     VkAttachmentDescription colorAttachmentDescription = {};
     colorAttachmentDescription.format = _format;
     colorAttachmentDescription.samples = _msaasamples;
 
-    colorAttachmentDescription.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+    colorAttachmentDescription.loadOp = loadOp;
     colorAttachmentDescription.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
-    colorAttachmentDescription.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    colorAttachmentDescription.initialLayout = load ? VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL : VK_IMAGE_LAYOUT_UNDEFINED;
     colorAttachmentDescription.finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
 
     VkAttachmentReference colorAttachmentReference = {};
@@ -113,7 +149,8 @@ void GraphicsPipeline::initRenderPass() {
     colorAttachmentResolveDescription.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
     colorAttachmentResolveDescription.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
     colorAttachmentResolveDescription.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-    colorAttachmentResolveDescription.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+    // Resolves into the swap chain's scene image, which is then blitted into the presentable image
+    colorAttachmentResolveDescription.finalLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
 
     VkAttachmentReference colorAttachmentResolveReference{};
     colorAttachmentResolveReference.attachment = 2;
@@ -123,11 +160,11 @@ void GraphicsPipeline::initRenderPass() {
     VkAttachmentDescription depthAttachmentDescription = {};
     depthAttachmentDescription.format = _depthformat;
     depthAttachmentDescription.samples = _msaasamples;
-    depthAttachmentDescription.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-    depthAttachmentDescription.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    depthAttachmentDescription.loadOp = loadOp;
+    depthAttachmentDescription.storeOp = depthStoreOp;
     depthAttachmentDescription.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
     depthAttachmentDescription.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-    depthAttachmentDescription.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    depthAttachmentDescription.initialLayout = load ? VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL : VK_IMAGE_LAYOUT_UNDEFINED;
     depthAttachmentDescription.finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
 
     VkAttachmentReference depthAttachmentReference = {};
@@ -142,13 +179,29 @@ void GraphicsPipeline::initRenderPass() {
     subpassDescription.pDepthStencilAttachment = &depthAttachmentReference;
     subpassDescription.pResolveAttachments = &colorAttachmentResolveReference;
 
-    VkSubpassDependency subpassDependency = {};
-    subpassDependency.srcSubpass = VK_SUBPASS_EXTERNAL;
-    subpassDependency.dstSubpass = 0;
-    subpassDependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
-    subpassDependency.srcAccessMask = 0;
-    subpassDependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
-    subpassDependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+    // The previous frame's blit may still be reading the scene image
+    std::array<VkSubpassDependency, 2> subpassDependencies = {};
+    subpassDependencies[0].srcSubpass = VK_SUBPASS_EXTERNAL;
+    subpassDependencies[0].dstSubpass = 0;
+    subpassDependencies[0].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT
+                                          | VK_PIPELINE_STAGE_TRANSFER_BIT;
+    subpassDependencies[0].srcAccessMask = 0;
+    subpassDependencies[0].dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
+    subpassDependencies[0].dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+    // A continued pass also reads what the pass before it wrote
+    if (load) {
+        subpassDependencies[0].srcStageMask |= VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+        subpassDependencies[0].srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+        subpassDependencies[0].dstAccessMask |= VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT;
+    }
+
+    // The resolved scene is read by the blit after the render pass
+    subpassDependencies[1].srcSubpass = 0;
+    subpassDependencies[1].dstSubpass = VK_SUBPASS_EXTERNAL;
+    subpassDependencies[1].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+    subpassDependencies[1].srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+    subpassDependencies[1].dstStageMask = VK_PIPELINE_STAGE_TRANSFER_BIT;
+    subpassDependencies[1].dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
 
     // Renderpass
     std::array<VkAttachmentDescription, 3> renderPassAttachments = {colorAttachmentDescription, depthAttachmentDescription,
@@ -159,17 +212,19 @@ void GraphicsPipeline::initRenderPass() {
     renderPassCreateInfo.pAttachments = renderPassAttachments.data();
     renderPassCreateInfo.subpassCount = 1;
     renderPassCreateInfo.pSubpasses = &subpassDescription;
-    renderPassCreateInfo.dependencyCount = 1;
-    renderPassCreateInfo.pDependencies = &subpassDependency;
+    renderPassCreateInfo.dependencyCount = static_cast<uint32_t>(subpassDependencies.size());
+    renderPassCreateInfo.pDependencies = subpassDependencies.data();
 
-    VkResult render_pass_creation_result = vkCreateRenderPass(_device, &renderPassCreateInfo, nullptr, &renderpass);
+    VkRenderPass renderPass;
+    VkResult render_pass_creation_result = vkCreateRenderPass(_device, &renderPassCreateInfo, nullptr, &renderPass);
     if (render_pass_creation_result != VK_SUCCESS) {
         throw vulkan_error("Failed to create pipeline render pass, VkResult: %i\n", render_pass_creation_result);
     }
+    return renderPass;
 }
 
 void GraphicsPipeline::initDescriptorSetLayout() {
-    std::array<VkDescriptorSetLayoutBinding, 2> uboLayoutBindings = {};
+    std::array<VkDescriptorSetLayoutBinding, 3> uboLayoutBindings = {};
     uboLayoutBindings[0].binding = 0;
     uboLayoutBindings[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
     uboLayoutBindings[0].descriptorCount = 1;
@@ -180,6 +235,12 @@ void GraphicsPipeline::initDescriptorSetLayout() {
     uboLayoutBindings[1].descriptorCount = 1;
     uboLayoutBindings[1].stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
 
+    // Mesh instances, see InstancedMeshes
+    uboLayoutBindings[2].binding = 2;
+    uboLayoutBindings[2].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    uboLayoutBindings[2].descriptorCount = 1;
+    uboLayoutBindings[2].stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+
     VkDescriptorSetLayoutCreateInfo layoutCreateInfo = {};
     layoutCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
     layoutCreateInfo.bindingCount = static_cast<uint32_t>(uboLayoutBindings.size());
@@ -197,8 +258,13 @@ void GraphicsPipeline::initLayout() {
     pipelineLayoutCreateInfo.setLayoutCount = 1;
     pipelineLayoutCreateInfo.pSetLayouts = &descriptorsetlayout;
 
-    pipelineLayoutCreateInfo.pushConstantRangeCount = 0;
-    pipelineLayoutCreateInfo.pPushConstantRanges = nullptr;
+    VkPushConstantRange pushConstantRange = {};
+    pushConstantRange.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+    pushConstantRange.offset = 0;
+    pushConstantRange.size = sizeof(ParticlePushConstants);
+
+    pipelineLayoutCreateInfo.pushConstantRangeCount = 1;
+    pipelineLayoutCreateInfo.pPushConstantRanges = &pushConstantRange;
 
     VkResult layout_creation_result = vkCreatePipelineLayout(_device, &pipelineLayoutCreateInfo, nullptr, &layout);
     if (layout_creation_result != VK_SUCCESS) {
@@ -344,6 +410,20 @@ void GraphicsPipeline::initPipeline(VkShaderModule vertexShader, VkShaderModule
         throw vulkan_error("Failed to create graphics pipeline!", graphics_pipeline_creation_result);
     }
 
+    // Compact Vertex Input
+    auto compactBindingDescription = CompactVertex::getBindingDescription();
+    auto compactAttributeDescriptions = CompactVertex::getAttributeDescriptions();
+
+    vertexInputCreateInfo.pVertexBindingDescriptions = &compactBindingDescription;
+    vertexInputCreateInfo.pVertexAttributeDescriptions = compactAttributeDescriptions.data();
+
+    VkResult compact_pipeline_creation_result = vkCreateGraphicsPipelines(_device, VK_NULL_HANDLE,
+                                                                          1, &pipelineCreateInfo,
+                                                                          nullptr, &compactpipeline);
+    if (compact_pipeline_creation_result != VK_SUCCESS) {
+        throw vulkan_error("Failed to create compact vertex pipeline!", compact_pipeline_creation_result);
+    }
+
     // Particle Shader
     shaderStages[0].module = particleVertexShader;
     shaderStages[1].module = particleFragmentShader;
@@ -352,12 +432,12 @@ void GraphicsPipeline::initPipeline(VkShaderModule vertexShader, VkShaderModule
     // Particle Input
     VkPipelineVertexInputStateCreateInfo& particleInputCreateInfo = vertexInputCreateInfo;
 
-    auto particleBindingDescription = Particle::getBindingDescription();
+    auto particleBindingDescriptions = Particle::getBindingDescriptions();
     auto particleAttributeDescriptions = Particle::getAttributeDescriptions();
 
-    particleInputCreateInfo.vertexBindingDescriptionCount = 1;
+    particleInputCreateInfo.vertexBindingDescriptionCount = static_cast<uint32_t>(particleBindingDescriptions.size());
     particleInputCreateInfo.vertexAttributeDescriptionCount = static_cast<uint32_t>(particleAttributeDescriptions.size());
-    particleInputCreateInfo.pVertexBindingDescriptions = &particleBindingDescription;
+    particleInputCreateInfo.pVertexBindingDescriptions = particleBindingDescriptions.data();
     particleInputCreateInfo.pVertexAttributeDescriptions = particleAttributeDescriptions.data();
 
     // Particle Input Assembly
@@ -375,18 +455,40 @@ void GraphicsPipeline::initPipeline(VkShaderModule vertexShader, VkShaderModule
         throw vulkan_error("Failed to create particle pipeline!", graphics_pipeline_creation_result);
     }
 
+    // Sorted Particle Pipeline Creation, blended in order and still hidden behind meshes
+    depthStencilCreateInfo.depthWriteEnable = VK_FALSE;
+
+    VkResult sorted_particle_pipeline_creation_result = vkCreateGraphicsPipelines(_device, VK_NULL_HANDLE,
+                                                                                  1, &pipelineCreateInfo,
+                                                                                  nullptr, &sortedparticlepipeline);
+    if (sorted_particle_pipeline_creation_result != VK_SUCCESS) {
+        throw vulkan_error("Failed to create sorted particle pipeline!", sorted_particle_pipeline_creation_result);
+    }
+
 }
 
 GraphicsPipeline::~GraphicsPipeline() {
     if (pipeline) {
         vkDestroyPipeline(_device, pipeline, nullptr);
     }
+    if (compactpipeline) {
+        vkDestroyPipeline(_device, compactpipeline, nullptr);
+    }
     if (particlepipeline) {
         vkDestroyPipeline(_device, particlepipeline, nullptr);
     }
+    if (sortedparticlepipeline) {
+        vkDestroyPipeline(_device, sortedparticlepipeline, nullptr);
+    }
     if (renderpass) {
         vkDestroyRenderPass(_device, renderpass, nullptr);
     }
+    if (openrenderpass) {
+        vkDestroyRenderPass(_device, openrenderpass, nullptr);
+    }
+    if (continuerenderpass) {
+        vkDestroyRenderPass(_device, continuerenderpass, nullptr);
+    }
     if (descriptorsetlayout) {
         vkDestroyDescriptorSetLayout(_device, descriptorsetlayout, nullptr);
     }
@@ -401,20 +503,23 @@ GraphicsPipeline::GraphicsPipeline(VkDevice device, VkFormat swapchainFormat, Vk
 : _device(device), _format(swapchainFormat), _depthformat(depthFormat), _msaasamples(msaaSamples),
 _vertshadername(vertexShaderFilename), _fragshadername(fragmentShaderFilename),
 _vertparticleshadername(particleVertexShaderFilename), _fragparticleshadername(particleFragmentShaderFilename),
-pipeline(nullptr), renderpass(nullptr), layout(nullptr) {}
+pipeline(nullptr), compactpipeline(nullptr), particlepipeline(nullptr), sortedparticlepipeline(nullptr),
+renderpass(nullptr), openrenderpass(nullptr), continuerenderpass(nullptr), layout(nullptr) {}
 
 /// Compute Pipeline ///
-VkVertexInputBindingDescription Particle::getBindingDescription() {
-    VkVertexInputBindingDescription bindingDescription{};
-    bindingDescription.binding = 0;
-    bindingDescription.stride = sizeof(Particle);
-    bindingDescription.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+std::array<VkVertexInputBindingDescription, 2> Particle::getBindingDescriptions() {
+    std::array<VkVertexInputBindingDescription, 2> bindingDescriptions{};
+    for (uint32_t i = 0; i < bindingDescriptions.size(); i++) {
+        bindingDescriptions[i].binding = i;
+        bindingDescriptions[i].stride = sizeof(Particle);
+        bindingDescriptions[i].inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+    }
 
-    return bindingDescription;
+    return bindingDescriptions;
 }
 
-std::array<VkVertexInputAttributeDescription, 2> Particle::getAttributeDescriptions() {
-    std::array<VkVertexInputAttributeDescription, 2> attributeDescriptions{};
+std::array<VkVertexInputAttributeDescription, 3> Particle::getAttributeDescriptions() {
+    std::array<VkVertexInputAttributeDescription, 3> attributeDescriptions{};
 
     attributeDescriptions[0].binding = 0;
     attributeDescriptions[0].location = 0;
@@ -426,9 +531,54 @@ std::array<VkVertexInputAttributeDescription, 2> Particle::getAttributeDescripti
     attributeDescriptions[1].format = VK_FORMAT_R32G32B32_SFLOAT;
     attributeDescriptions[1].offset = offsetof(Particle, color);
 
+    attributeDescriptions[2].binding = 1;
+    attributeDescriptions[2].location = 2;
+    attributeDescriptions[2].format = VK_FORMAT_R32G32B32_SFLOAT;
+    attributeDescriptions[2].offset = offsetof(Particle, position);
+
     return attributeDescriptions;
 }
 
+glm::vec3 Particle::speedColor(const glm::vec3& velocity) {
+    float normalizedSpeed = glm::clamp((glm::length(velocity) - PARTICLE_MIN_SPEED) / (PARTICLE_MAX_SPEED - PARTICLE_MIN_SPEED),
+                                       0.0f, 1.0f);
+    float hue = glm::mix(0.5f, 0.08f, normalizedSpeed);
+
+    // hsv2rgb with full saturation and value
+    float h = hue * 6.0f;
+    float x = 1.0f - std::abs(std::fmod(h, 2.0f) - 1.0f);
+
+    if (h < 1.0f) return {1.0f, x, 0.0f};
+    if (h < 2.0f) return {x, 1.0f, 0.0f};
+    if (h < 3.0f) return {0.0f, 1.0f, x};
+    if (h < 4.0f) return {0.0f, x, 1.0f};
+    if (h < 5.0f) return {x, 0.0f, 1.0f};
+    return {1.0f, 0.0f, x};
+}
+
+void Particle::initializeSphere(Particle* particles, size_t count, float velocityFactor, uint32_t seed) {
+    std::default_random_engine rndEngine(seed);
+    std::uniform_real_distribution<float> rndDist(0.0f, 1.0f);
+
+    for (size_t i = 0; i < count; i++) {
+        float radius = 0.25f * sqrt(rndDist(rndEngine));
+
+        float u = rndDist(rndEngine);
+        float v = rndDist(rndEngine);
+
+        float theta = 2.0f * 3.14159265358979323846f * u;
+        float phi = acos(2 * v - 1);
+        float x = (radius * sin(phi) * cos(theta));
+        float y = (radius * sin(phi) * sin(theta));
+        float z = (radius * cos(phi));
+
+        particles[i].position = glm::vec3(x, y, z);
+        particles[i].velocity = glm::normalize(glm::vec3(x, y, z)) * velocityFactor;
+//        particles[i].color = glm::vec3(rndDist(rndEngine), rndDist(rndEngine), rndDist(rndEngine));
+        particles[i].color = glm::vec3(0.0f, 100, 100) / 255.0f;
+    }
+}
+
 void ComputePipeline::create() {
     VkShaderModule computeShader = loadShader(_device, _computeshadername);
 
@@ -440,7 +590,7 @@ void ComputePipeline::create() {
 }
 
 void ComputePipeline::initDescriptorSetLayout() {
-    std::array<VkDescriptorSetLayoutBinding, 3> layoutBindings = {};
+    std::array<VkDescriptorSetLayoutBinding, 7> layoutBindings = {};
     layoutBindings[0].binding = 0;
     layoutBindings[0].descriptorCount = 1;
     layoutBindings[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
@@ -459,9 +609,37 @@ void ComputePipeline::initDescriptorSetLayout() {
     layoutBindings[2].pImmutableSamplers = nullptr;
     layoutBindings[2].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
 
+    // Signed distance field of the mesh, see SignedDistanceField
+    layoutBindings[3].binding = 3;
+    layoutBindings[3].descriptorCount = 1;
+    layoutBindings[3].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    layoutBindings[3].pImmutableSamplers = nullptr;
+    layoutBindings[3].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+    // The two frames of the vector field interpolated in time, see VectorField
+    layoutBindings[4].binding = 4;
+    layoutBindings[4].descriptorCount = 2;
+    layoutBindings[4].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    layoutBindings[4].pImmutableSamplers = nullptr;
+    layoutBindings[4].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+    // Particle-mesh gravity per grid cell, see ParticleMeshGravity
+    layoutBindings[5].binding = 5;
+    layoutBindings[5].descriptorCount = 1;
+    layoutBindings[5].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    layoutBindings[5].pImmutableSamplers = nullptr;
+    layoutBindings[5].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+    // Velocity of the fluid simulation, see FluidSolver
+    layoutBindings[6].binding = 6;
+    layoutBindings[6].descriptorCount = 1;
+    layoutBindings[6].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    layoutBindings[6].pImmutableSamplers = nullptr;
+    layoutBindings[6].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
     VkDescriptorSetLayoutCreateInfo layoutCreateInfo = {};
     layoutCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
-    layoutCreateInfo.bindingCount = 3;
+    layoutCreateInfo.bindingCount = static_cast<uint32_t>(layoutBindings.size());
     layoutCreateInfo.pBindings = layoutBindings.data();
 
     VkResult descriptor_set_layout_creation_result = vkCreateDescriptorSetLayout(_device, &layoutCreateInfo,nullptr, &descriptorsetlayout);
@@ -513,4 +691,109 @@ ComputePipeline::~ComputePipeline() {
 }
 
 ComputePipeline::ComputePipeline(VkDevice device, std::string computeShaderFilename)
-: _device(device), _computeshadername(computeShaderFilename) {}
\ No newline at end of file
+: _device(device), _computeshadername(computeShaderFilename) {}
+
+void createStoragePipeline(VkDevice device, const std::string& shaderName, const std::string& name, uint32_t bindingCount,
+                           uint32_t pushConstantSize, VkDescriptorSetLayout& descriptorSetLayout, VkPipelineLayout& layout,
+                           VkPipeline& pipeline) {
+    std::vector<VkDescriptorSetLayoutBinding> layoutBindings(bindingCount);
+    for (uint32_t i = 0; i < bindingCount; i++) {
+        layoutBindings[i] = {};
+        layoutBindings[i].binding = i;
+        layoutBindings[i].descriptorCount = 1;
+        layoutBindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        layoutBindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    }
+
+    VkDescriptorSetLayoutCreateInfo layoutCreateInfo = {};
+    layoutCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    layoutCreateInfo.bindingCount = bindingCount;
+    layoutCreateInfo.pBindings = layoutBindings.data();
+
+    VkResult descriptor_set_layout_creation_result = vkCreateDescriptorSetLayout(device, &layoutCreateInfo, nullptr, &descriptorSetLayout);
+    if (descriptor_set_layout_creation_result != VK_SUCCESS) {
+        throw vulkan_error("Failed to create " + name + " descriptor set layout!", descriptor_set_layout_creation_result);
+    }
+
+    VkPushConstantRange pushConstantRange = {};
+    pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    pushConstantRange.offset = 0;
+    pushConstantRange.size = pushConstantSize;
+
+    VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo = {};
+    pipelineLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    pipelineLayoutCreateInfo.setLayoutCount = 1;
+    pipelineLayoutCreateInfo.pSetLayouts = &descriptorSetLayout;
+    pipelineLayoutCreateInfo.pushConstantRangeCount = 1;
+    pipelineLayoutCreateInfo.pPushConstantRanges = &pushConstantRange;
+
+    VkResult layout_creation_result = vkCreatePipelineLayout(device, &pipelineLayoutCreateInfo, nullptr, &layout);
+    if (layout_creation_result != VK_SUCCESS) {
+        throw vulkan_error("Failed to create " + name + " pipeline layout!", layout_creation_result);
+    }
+
+    VkShaderModule computeShader = loadShader(device, shaderName);
+
+    VkPipelineShaderStageCreateInfo computeShaderStageInfo = {};
+    computeShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    computeShaderStageInfo.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+    computeShaderStageInfo.module = computeShader;
+    computeShaderStageInfo.pName = "main";
+
+    VkComputePipelineCreateInfo computePipelineCreateInfo = {};
+    computePipelineCreateInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+    computePipelineCreateInfo.layout = layout;
+    computePipelineCreateInfo.stage = computeShaderStageInfo;
+
+    VkResult compute_pipeline_creation_result = vkCreateComputePipelines(device, nullptr, 1, &computePipelineCreateInfo, nullptr, &pipeline);
+    vkDestroyShaderModule(device, computeShader, nullptr);
+    if (compute_pipeline_creation_result != VK_SUCCESS) {
+        throw vulkan_error("Failed to create " + name + " pipeline!", compute_pipeline_creation_result);
+    }
+}
+
+void writeStorageDescriptors(VkDevice device, VkDescriptorSet descriptorSet, const std::vector<VkDescriptorBufferInfo>& bufferInfos) {
+    std::vector<VkWriteDescriptorSet> writeDescriptorSets(bufferInfos.size());
+    for (uint32_t binding = 0; binding < bufferInfos.size(); binding++) {
+        writeDescriptorSets[binding] = {};
+        writeDescriptorSets[binding].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        writeDescriptorSets[binding].dstSet = descriptorSet;
+        writeDescriptorSets[binding].dstBinding = binding;
+        writeDescriptorSets[binding].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        writeDescriptorSets[binding].descriptorCount = 1;
+        writeDescriptorSets[binding].pBufferInfo = &bufferInfos[binding];
+    }
+
+    vkUpdateDescriptorSets(device, static_cast<uint32_t>(writeDescriptorSets.size()), writeDescriptorSets.data(), 0, nullptr);
+}
+
+void allocateStorageDescriptorSets(VkDevice device, const std::string& name, VkDescriptorSetLayout descriptorSetLayout,
+                                   uint32_t bindingCount, uint32_t setCount, VkDescriptorPool& descriptorPool,
+                                   VkDescriptorSet* descriptorSets) {
+    VkDescriptorPoolSize descriptorPoolSize = {};
+    descriptorPoolSize.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    descriptorPoolSize.descriptorCount = bindingCount * setCount;
+
+    VkDescriptorPoolCreateInfo descriptorPoolCreateInfo = {};
+    descriptorPoolCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    descriptorPoolCreateInfo.poolSizeCount = 1;
+    descriptorPoolCreateInfo.pPoolSizes = &descriptorPoolSize;
+    descriptorPoolCreateInfo.maxSets = setCount;
+
+    VkResult descriptor_pool_creation_result = vkCreateDescriptorPool(device, &descriptorPoolCreateInfo, nullptr, &descriptorPool);
+    if (descriptor_pool_creation_result != VK_SUCCESS) {
+        throw vulkan_error("Failed to create " + name + " descriptor pool!", descriptor_pool_creation_result);
+    }
+
+    std::vector<VkDescriptorSetLayout> descriptorSetLayouts(setCount, descriptorSetLayout);
+    VkDescriptorSetAllocateInfo descriptorSetAllocationInfo = {};
+    descriptorSetAllocationInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    descriptorSetAllocationInfo.descriptorPool = descriptorPool;
+    descriptorSetAllocationInfo.descriptorSetCount = setCount;
+    descriptorSetAllocationInfo.pSetLayouts = descriptorSetLayouts.data();
+
+    VkResult descriptor_sets_allocation_result = vkAllocateDescriptorSets(device, &descriptorSetAllocationInfo, descriptorSets);
+    if (descriptor_sets_allocation_result != VK_SUCCESS) {
+        throw vulkan_error("Failed to allocate " + name + " descriptor sets!", descriptor_sets_allocation_result);
+    }
+}
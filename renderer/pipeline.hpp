@@ -5,11 +5,19 @@
 const std::string SHADER_FOLDER_PATH = "../shaders/compiled/";
 const std::string SHADER_EXTENSION = ".spv";
 
+// Loads shaders/compiled/<filename>.spv
+VkShaderModule loadShader(VkDevice device, const std::string& filename);
+
 struct PerspectiveUniformBufferObject {
     alignas(16) glm::mat4 view;
     alignas(16) glm::mat4 proj;
 };
 
+// Pushed for the particle draw. Interpolation blends from the previous simulation step (0) to the latest one (1).
+struct ParticlePushConstants {
+    float interpolation;
+};
+
 struct ModelUniformBufferObject {
     alignas(16) glm::mat4 model;
 };
@@ -23,6 +31,16 @@ struct Vertex {
     bool operator==(const Vertex& other) const;
 };
 
+// Vertex of meshes loaded from files, see meshloader.hpp. Position without padding and an 8 bit per channel
+// colour (red in the lowest byte), 16 bytes instead of 32. Drawn with the same shaders as Vertex.
+struct CompactVertex {
+    glm::vec3 pos;
+    uint32_t color;
+
+    static VkVertexInputBindingDescription getBindingDescription();
+    static std::array<VkVertexInputAttributeDescription, 2> getAttributeDescriptions();
+};
+
 namespace std {
     template<> struct hash<Vertex> {
         size_t operator()(Vertex const& vertex) const {
@@ -35,6 +53,7 @@ namespace std {
 class GraphicsPipeline {
 private:
     void initRenderPass();
+    VkRenderPass createRenderPass(VkAttachmentLoadOp loadOp, VkAttachmentStoreOp depthStoreOp);
     void initDescriptorSetLayout();
     void initLayout();
     void initPipeline(VkShaderModule vertexShader, VkShaderModule fragmentShader, VkShaderModule particleVertexShader, VkShaderModule particleFragmentShader);
@@ -49,8 +68,16 @@ private:
     std::string _fragparticleshadername;
 public:
     VkPipeline pipeline;
+    // Same as pipeline, for meshes in the CompactVertex format
+    VkPipeline compactpipeline;
     VkPipeline particlepipeline;
+    // Same as particlepipeline without depth writes, for particles drawn back to front
+    VkPipeline sortedparticlepipeline;
     VkRenderPass renderpass;
+    // Same as renderpass, but the scene is drawn over several passes: the open pass keeps its depth for the
+    // continue passes, which draw on top of what the passes before them left
+    VkRenderPass openrenderpass;
+    VkRenderPass continuerenderpass;
     VkPipelineLayout layout;
     VkDescriptorSetLayout descriptorsetlayout;
 
@@ -66,15 +93,41 @@ public:
 struct ComputeUniformBufferObject {
     alignas(16) glm::vec4 gravityPoint;
     alignas(16) float deltaTime;
+    // Placement of the collision field, see SignedDistanceField. Collisions are off while sdfOrigin.w is 0.
+    alignas(16) glm::vec4 sdfOrigin;
+    alignas(16) glm::vec4 sdfScale;
+    // Placement of the precomputed vector field, see VectorField. fieldOrigin.w scales the vectors (0 turns the field off),
+    // fieldScale.w blends from the first to the second sampled frame.
+    alignas(16) glm::vec4 fieldOrigin;
+    alignas(16) glm::vec4 fieldScale;
+    // Placement of the particle-mesh gravity grid, see ParticleMeshGravity. It is off while pmOrigin.w is 0.
+    alignas(16) glm::vec4 pmOrigin;
+    alignas(16) glm::vec4 pmScale;
+    // Placement of the fluid grid, see FluidSolver. fluidOrigin.w is the share of the flow's velocity particles take on.
+    alignas(16) glm::vec4 fluidOrigin;
+    alignas(16) glm::vec4 fluidScale;
 };
 
+// Constants of shaders/shader.comp, for the host side implementations of the particle update
+const float PARTICLE_ATTRACTION_STRENGTH = 0.0000001f;
+const float PARTICLE_MIN_ATTRACTION_DISTANCE = 0.01f;
+const float PARTICLE_MIN_SPEED = 0.0001f;
+const float PARTICLE_MAX_SPEED = 0.001f;
+
 struct Particle {
     alignas(16) glm::vec3 position;
     alignas(16) glm::vec3 velocity;
     alignas(16) glm::vec3 color;
 
-    static VkVertexInputBindingDescription getBindingDescription();
-    static std::array<VkVertexInputAttributeDescription, 2> getAttributeDescriptions();
+    // Binding 0 is the latest simulation step, binding 1 the one before it for the position the vertex shader
+    // interpolates from
+    static std::array<VkVertexInputBindingDescription, 2> getBindingDescriptions();
+    static std::array<VkVertexInputAttributeDescription, 3> getAttributeDescriptions();
+
+    // Same speed coloring as shader.comp, for particles produced on the host
+    static glm::vec3 speedColor(const glm::vec3& velocity);
+    // Random positions in a sphere moving outwards, the initial state of a simulation
+    static void initializeSphere(Particle* particles, size_t count, float velocityFactor, uint32_t seed);
 };
 
 class ComputePipeline {
@@ -95,4 +148,15 @@ public:
 
     ~ComputePipeline();
     ComputePipeline(VkDevice device, std::string computeShaderFilename);
-};
\ No newline at end of file
+};
+
+// Compute passes whose bindings are all storage buffers, e.g. the sort and the particle passes. The name goes into errors.
+void createStoragePipeline(VkDevice device, const std::string& shaderName, const std::string& name, uint32_t bindingCount,
+                           uint32_t pushConstantSize, VkDescriptorSetLayout& descriptorSetLayout, VkPipelineLayout& layout,
+                           VkPipeline& pipeline);
+// A pool with exactly setCount sets of the layout, allocated into descriptorSets
+void allocateStorageDescriptorSets(VkDevice device, const std::string& name, VkDescriptorSetLayout descriptorSetLayout,
+                                   uint32_t bindingCount, uint32_t setCount, VkDescriptorPool& descriptorPool,
+                                   VkDescriptorSet* descriptorSets);
+// One binding per buffer in order
+void writeStorageDescriptors(VkDevice device, VkDescriptorSet descriptorSet, const std::vector<VkDescriptorBufferInfo>& bufferInfos);
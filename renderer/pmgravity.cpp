@@ -0,0 +1,121 @@
+#include "pmgravity.hpp"
+
+static const uint32_t PASS_DEPOSIT = 0;
+static const uint32_t PASS_LOAD = 1;
+static const uint32_t PASS_FFT = 2;
+static const uint32_t PASS_SOLVE = 3;
+static const uint32_t PASS_GRADIENT = 4;
+// Workgroups of the deposit, which loops over the particles so the atomics contend less than with one per particle
+static const uint32_t DEPOSIT_GROUP_COUNT = 4096;
+
+static const uint32_t CELL_COUNT = PM_GRID_SIZE * PM_GRID_SIZE * PM_GRID_SIZE;
+
+ParticleMeshGravity::ParticleMeshGravity(VkDevice device, PhysicalDevice* physicalDevice, MemoryAllocator* allocator,
+                                         const std::vector<Buffer*>& particleBuffers, uint32_t particleCount)
+: _device(device), _physicaldevice(physicalDevice), _allocator(allocator), _particlecount(particleCount) {
+    float cellSize = PM_BOX_SIZE / static_cast<float>(PM_GRID_SIZE);
+    pmorigin = glm::vec4(glm::vec3(PM_BOX_MIN), 0.0f);
+    pmscale = glm::vec4(glm::vec3(1.0f / cellSize), static_cast<float>(PM_GRID_SIZE));
+
+    _densitybuffer = new Buffer(_device, _physicaldevice, _allocator);
+    _densitybuffer->createOnDevice(sizeof(uint32_t) * CELL_COUNT, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT);
+    _spectrumbuffer = new Buffer(_device, _physicaldevice, _allocator);
+    _spectrumbuffer->createOnDevice(sizeof(glm::vec2) * CELL_COUNT, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+    forcebuffer = new Buffer(_device, _physicaldevice, _allocator);
+    forcebuffer->createOnDevice(sizeof(glm::vec4) * CELL_COUNT, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+
+    createStoragePipeline(_device, "pmgravity.comp", "particle-mesh gravity", 4, sizeof(PushConstants),
+                          _descriptorsetlayout, _layout, _pipeline);
+    createDescriptorSets(particleBuffers);
+}
+
+void ParticleMeshGravity::createDescriptorSets(const std::vector<Buffer*>& particleBuffers) {
+    uint32_t setCount = static_cast<uint32_t>(particleBuffers.size());
+    _descriptorsets.resize(setCount);
+    allocateStorageDescriptorSets(_device, "particle-mesh gravity", _descriptorsetlayout, 4, setCount, _descriptorpool,
+                                  _descriptorsets.data());
+
+    for (uint32_t i = 0; i < setCount; i++) {
+        VkDescriptorBufferInfo particles = {particleBuffers[(i + setCount - 1) % setCount]->buffer, 0, sizeof(Particle) * _particlecount};
+        writeStorageDescriptors(_device, _descriptorsets[i], {particles, {_densitybuffer->buffer, 0, VK_WHOLE_SIZE},
+                                                              {_spectrumbuffer->buffer, 0, VK_WHOLE_SIZE},
+                                                              {forcebuffer->buffer, 0, VK_WHOLE_SIZE}});
+    }
+}
+
+void ParticleMeshGravity::dispatch(VkCommandBuffer commandBuffer, const PushConstants& pushConstants, uint32_t groupCount) {
+    vkCmdPushConstants(commandBuffer, _layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(PushConstants), &pushConstants);
+    vkCmdDispatch(commandBuffer, groupCount, 1, 1);
+
+    VkMemoryBarrier memoryBarrier = {};
+    memoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    memoryBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    memoryBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         0, 1, &memoryBarrier, 0, nullptr, 0, nullptr);
+}
+
+void ParticleMeshGravity::record(VkCommandBuffer commandBuffer, uint32_t frame, float strength) {
+    // The previous step may still read the forces, and the particles were written by the previous step
+    VkMemoryBarrier memoryBarrier = {};
+    memoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    memoryBarrier.srcAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+    memoryBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         0, 1, &memoryBarrier, 0, nullptr, 0, nullptr);
+
+    vkCmdFillBuffer(commandBuffer, _densitybuffer->buffer, 0, VK_WHOLE_SIZE, 0);
+
+    memoryBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    memoryBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         0, 1, &memoryBarrier, 0, nullptr, 0, nullptr);
+
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, _pipeline);
+    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, _layout, 0, 1, &_descriptorsets[frame], 0, nullptr);
+
+    // Every particle carries 1 / N of the total mass
+    PushConstants pushConstants = {};
+    pushConstants.origin = glm::vec4(glm::vec3(pmorigin), 1.0f / pmscale.x);
+    pushConstants.particlecount = _particlecount;
+    pushConstants.gravity = 4.0f * 3.14159265358979323846f * strength / static_cast<float>(_particlecount);
+
+    uint32_t cellGroups = CELL_COUNT / PM_GRID_SIZE;
+    uint32_t lineCount = PM_GRID_SIZE * PM_GRID_SIZE;
+
+    pushConstants.pass = PASS_DEPOSIT;
+    dispatch(commandBuffer, pushConstants, DEPOSIT_GROUP_COUNT);
+    pushConstants.pass = PASS_LOAD;
+    dispatch(commandBuffer, pushConstants, cellGroups);
+
+    pushConstants.pass = PASS_FFT;
+    for (uint32_t axis = 0; axis < 3; axis++) {
+        pushConstants.axis = axis;
+        dispatch(commandBuffer, pushConstants, lineCount);
+    }
+
+    pushConstants.pass = PASS_SOLVE;
+    dispatch(commandBuffer, pushConstants, cellGroups);
+
+    pushConstants.pass = PASS_FFT;
+    pushConstants.inverse = 1;
+    for (uint32_t axis = 0; axis < 3; axis++) {
+        pushConstants.axis = axis;
+        dispatch(commandBuffer, pushConstants, lineCount);
+    }
+
+    pushConstants.pass = PASS_GRADIENT;
+    dispatch(commandBuffer, pushConstants, cellGroups);
+}
+
+ParticleMeshGravity::~ParticleMeshGravity() {
+    vkDestroyDescriptorPool(_device, _descriptorpool, nullptr);
+    vkDestroyPipeline(_device, _pipeline, nullptr);
+    vkDestroyPipelineLayout(_device, _layout, nullptr);
+    vkDestroyDescriptorSetLayout(_device, _descriptorsetlayout, nullptr);
+
+    delete _densitybuffer;
+    delete _spectrumbuffer;
+    delete forcebuffer;
+}
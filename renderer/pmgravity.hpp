@@ -0,0 +1,68 @@
+#pragma once
+
+#include "vulkan_tools.hpp"
+#include "pipeline.hpp"
+#include "buffer.hpp"
+
+// Cells along every axis of the grid, a power of two for the radix-2 FFT and at most the largest workgroup
+const uint32_t PM_GRID_SIZE = 64;
+// Fixed point scale of the deposited density, the deposit uses integer atomics
+const uint32_t PM_DENSITY_SCALE = 256;
+// World space cube covered by the grid, particles outside of it neither attract nor feel the others
+const float PM_BOX_MIN = -1.0f;
+const float PM_BOX_SIZE = 2.0f;
+
+// Mutual gravity between all particles with the particle-mesh method, O(N + G^3 log G) instead of O(N^2).
+// A multi-pass compute pipeline (pmgravity.comp) deposits the particles of the frame's input storage buffer
+// onto a grid with cloud-in-cell weights, solves Poisson's equation with FFTs and writes the force per cell,
+// which shader.comp interpolates back to the particles with the same weights. The box is periodic.
+class ParticleMeshGravity {
+private:
+    struct PushConstants {
+        glm::vec4 origin;
+        uint32_t pass;
+        uint32_t axis;
+        uint32_t inverse;
+        uint32_t particlecount;
+        float gravity;
+    };
+
+    VkDevice _device;
+    PhysicalDevice* _physicaldevice;
+    MemoryAllocator* _allocator;
+    uint32_t _particlecount;
+
+    Buffer* _densitybuffer;
+    Buffer* _spectrumbuffer;
+
+    VkDescriptorSetLayout _descriptorsetlayout;
+    VkPipelineLayout _layout;
+    VkPipeline _pipeline;
+    VkDescriptorPool _descriptorpool;
+    // One per frame in flight, each reads the particles that frame's simulation step reads
+    std::vector<VkDescriptorSet> _descriptorsets;
+
+    void createDescriptorSets(const std::vector<Buffer*>& particleBuffers);
+    void dispatch(VkCommandBuffer commandBuffer, const PushConstants& pushConstants, uint32_t groupCount);
+public:
+    // Force per cell, read by shader.comp
+    Buffer* forcebuffer;
+
+    // Placement for ComputeUniformBufferObject: pmorigin.xyz is the corner of the grid, pmscale.xyz maps world
+    // positions to cells and pmscale.w is the grid size. pmorigin.w is left for the engine to turn the forces on.
+    glm::vec4 pmorigin;
+    glm::vec4 pmscale;
+
+    // Records the force computation into a compute command buffer ahead of the simulation step. Strength is the
+    // gravitational constant times the total mass, spread evenly over the particles. The frame's previous work
+    // has to have completed.
+    void record(VkCommandBuffer commandBuffer, uint32_t frame, float strength);
+
+    // Frame i's simulation step reads particleBuffers[(i + frames - 1) % frames], as the compute descriptor sets do
+    ParticleMeshGravity(VkDevice device, PhysicalDevice* physicalDevice, MemoryAllocator* allocator,
+                        const std::vector<Buffer*>& particleBuffers, uint32_t particleCount);
+    ~ParticleMeshGravity();
+
+    ParticleMeshGravity(const ParticleMeshGravity&) = delete;
+    ParticleMeshGravity& operator=(const ParticleMeshGravity&) = delete;
+};
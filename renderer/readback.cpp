@@ -0,0 +1,171 @@
+#include "readback.hpp"
+
+#include <algorithm>
+
+using std::vector;
+
+ReadbackManager::ReadbackManager(VkDevice device, PhysicalDevice* physicalDevice, MemoryAllocator* allocator)
+: _device(device), _physicaldevice(physicalDevice), _allocator(allocator), _ringbuffer(nullptr), timeline(nullptr) {
+    VkSemaphoreTypeCreateInfo semaphoreTypeCreateInfo = {};
+    semaphoreTypeCreateInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+    semaphoreTypeCreateInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+    semaphoreTypeCreateInfo.initialValue = 0;
+
+    VkSemaphoreCreateInfo semaphoreCreateInfo = {};
+    semaphoreCreateInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+    semaphoreCreateInfo.pNext = &semaphoreTypeCreateInfo;
+
+    VkResult semaphore_creation_result = vkCreateSemaphore(_device, &semaphoreCreateInfo, nullptr, &timeline);
+    if (semaphore_creation_result != VK_SUCCESS) {
+        throw vulkan_error("Failed to create readback timeline semaphore!", semaphore_creation_result);
+    }
+}
+
+void ReadbackManager::request(uint64_t frame, ReadbackRegion region, ReadbackCallback callback) {
+    _requests.push_back({frame, region, std::move(callback)});
+}
+
+// The ring is created on first use and only grows while nothing is using it
+bool ReadbackManager::ensureCapacity(VkDeviceSize size) {
+    if (_ringbuffer && size <= _ringsize) {
+        return true;
+    }
+    if (!_inflightreadbacks.empty()) {
+        return false;
+    }
+
+    delete _ringbuffer;
+    _ringsize = std::max(READBACK_RING_MIN_SIZE, 2 * size);
+    _ringbuffer = new Buffer(_device, _physicaldevice, _allocator);
+    _ringbuffer->createForReadback(_ringsize);
+    _ringhead = 0;
+    _ringtail = 0;
+
+    return true;
+}
+
+// Unlike the upload ring this never waits, the request is simply retried next frame
+bool ReadbackManager::reserve(VkDeviceSize size, VkDeviceSize& offset) {
+    size = (size + READBACK_RING_ALIGNMENT - 1) & ~(READBACK_RING_ALIGNMENT - 1);
+
+    VkDeviceSize ringOffset = _ringhead % _ringsize;
+    VkDeviceSize padding = (ringOffset + size > _ringsize) ? _ringsize - ringOffset : 0;
+
+    if (_ringhead + padding + size - _ringtail > _ringsize) {
+        return false;
+    }
+
+    _ringhead += padding;
+    offset = _ringhead % _ringsize;
+    _ringhead += size;
+
+    return true;
+}
+
+void ReadbackManager::record(VkCommandBuffer commandBuffer, VkBuffer source, uint64_t frame, uint64_t signalValue) {
+    vector<VkBufferCopy> copyRegions;
+
+    // Requests are served in order, a request that doesn't fit holds back the ones after it
+    while (!_requests.empty() && _requests.front().frame <= frame) {
+        Request& request = _requests.front();
+        VkDeviceSize size = request.region.size();
+
+        VkDeviceSize ringOffset;
+        if (!ensureCapacity(size) || !reserve(size, ringOffset)) {
+            break;
+        }
+
+        // Contiguous elements are a single copy, strided elements one copy each
+        if (request.region.stride == request.region.elementsize) {
+            copyRegions.push_back({request.region.offset, ringOffset, size});
+        } else {
+            for (uint32_t i = 0; i < request.region.count; i++) {
+                copyRegions.push_back({request.region.offset + i * request.region.stride,
+                                       ringOffset + i * request.region.elementsize,
+                                       request.region.elementsize});
+            }
+        }
+
+        _inflightreadbacks.push_back({signalValue, frame, ringOffset, _ringhead, request.region, std::move(request.callback),
+                                      std::make_shared<std::atomic<bool>>(false), false});
+        _requests.pop_front();
+    }
+
+    if (copyRegions.empty()) {
+        return;
+    }
+
+    VkBufferMemoryBarrier sourceBarrier = {};
+    sourceBarrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+    sourceBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    sourceBarrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+    sourceBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    sourceBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    sourceBarrier.buffer = source;
+    sourceBarrier.offset = 0;
+    sourceBarrier.size = VK_WHOLE_SIZE;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+                         0, nullptr, 1, &sourceBarrier, 0, nullptr);
+
+    vkCmdCopyBuffer(commandBuffer, source, _ringbuffer->buffer, static_cast<uint32_t>(copyRegions.size()), copyRegions.data());
+
+    VkBufferMemoryBarrier ringBarrier = {};
+    ringBarrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+    ringBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    ringBarrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+    ringBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    ringBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    ringBarrier.buffer = _ringbuffer->buffer;
+    ringBarrier.offset = 0;
+    ringBarrier.size = VK_WHOLE_SIZE;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0,
+                         0, nullptr, 1, &ringBarrier, 0, nullptr);
+}
+
+void ReadbackManager::poll() {
+    uint64_t completedValue = 0;
+    vkGetSemaphoreCounterValue(_device, timeline, &completedValue);
+
+    for (InFlightReadback& readback: _inflightreadbacks) {
+        if (readback.value > completedValue) {
+            break;
+        }
+        if (readback.delivered) {
+            continue;
+        }
+
+        VkDeviceSize size = readback.region.size();
+        _ringbuffer->invalidate(readback.ringoffset, size);
+
+        const std::byte* data = static_cast<const std::byte*>(_ringbuffer->mapping) + readback.ringoffset;
+        std::shared_ptr<std::atomic<bool>> released = readback.released;
+        std::shared_ptr<const ReadbackResult> result(new ReadbackResult{data, size, readback.frame, readback.region},
+                                                     [released](const ReadbackResult* result) {
+                                                         released->store(true, std::memory_order_release);
+                                                         delete result;
+                                                     });
+
+        readback.delivered = true;
+        ReadbackCallback callback = std::move(readback.callback);
+        callback(std::move(result));
+    }
+
+    reclaim();
+}
+
+// Ring space is returned in order, once the results before it have been released as well
+void ReadbackManager::reclaim() {
+    while (!_inflightreadbacks.empty() && _inflightreadbacks.front().delivered
+           && _inflightreadbacks.front().released->load(std::memory_order_acquire)) {
+        _ringtail = _inflightreadbacks.front().ringend;
+        _inflightreadbacks.pop_front();
+    }
+}
+
+// Results still referenced at this point point into freed memory
+ReadbackManager::~ReadbackManager() {
+    if (timeline) {
+        vkDestroySemaphore(_device, timeline, nullptr);
+    }
+    delete _ringbuffer;
+}
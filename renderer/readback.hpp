@@ -0,0 +1,101 @@
+#pragma once
+
+#include "vulkan_tools.hpp"
+#include "physicaldevice.hpp"
+#include "memory.hpp"
+#include "buffer.hpp"
+
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <memory>
+
+const VkDeviceSize READBACK_RING_MIN_SIZE = 64 * 1024 * 1024;
+const VkDeviceSize READBACK_RING_ALIGNMENT = 16;
+
+// Part of a buffer to read back, count elements of elementsize bytes that start stride bytes apart.
+// The elements are packed tightly in the result.
+struct ReadbackRegion {
+    VkDeviceSize offset;
+    VkDeviceSize elementsize;
+    VkDeviceSize stride;
+    uint32_t count;
+
+    static ReadbackRegion range(VkDeviceSize offset, VkDeviceSize size) {
+        return {offset, size, size, 1};
+    }
+    static ReadbackRegion strided(VkDeviceSize offset, VkDeviceSize elementSize, VkDeviceSize stride, uint32_t count) {
+        return {offset, elementSize, stride, count};
+    }
+
+    VkDeviceSize size() const {
+        return elementsize * count;
+    }
+};
+
+struct ReadbackResult {
+    const std::byte* data;
+    VkDeviceSize size;
+    uint64_t frame;
+    ReadbackRegion region;
+};
+
+// The data stays valid (and its part of the ring reserved) until the last reference is dropped, on any thread
+using ReadbackCallback = std::function<void(std::shared_ptr<const ReadbackResult> result)>;
+
+// Copies device buffers back to the host through a host cached ring without stalling the frame loop.
+// Copies are recorded into a command buffer that already uses the source, which signals the timeline
+// semaphore when it completes. poll() hands finished copies to their callbacks.
+class ReadbackManager {
+private:
+    struct Request {
+        uint64_t frame;
+        ReadbackRegion region;
+        ReadbackCallback callback;
+    };
+
+    struct InFlightReadback {
+        uint64_t value;
+        uint64_t frame;
+        VkDeviceSize ringoffset;
+        uint64_t ringend;
+        ReadbackRegion region;
+        ReadbackCallback callback;
+        std::shared_ptr<std::atomic<bool>> released;
+        bool delivered;
+    };
+
+    VkDevice _device;
+    PhysicalDevice* _physicaldevice;
+    MemoryAllocator* _allocator;
+
+    Buffer* _ringbuffer;
+    VkDeviceSize _ringsize = 0;
+
+    // Monotonic byte counters, ring offsets are taken modulo _ringsize
+    uint64_t _ringhead = 0;
+    uint64_t _ringtail = 0;
+
+    std::deque<Request> _requests;
+    std::deque<InFlightReadback> _inflightreadbacks;
+
+    bool ensureCapacity(VkDeviceSize size);
+    bool reserve(VkDeviceSize size, VkDeviceSize& offset);
+    void reclaim();
+public:
+    VkSemaphore timeline;
+
+    // Schedules a readback of the source passed to record() at the given frame. If the ring is full
+    // at that point the copy is taken at a later frame instead, ReadbackResult::frame tells which.
+    void request(uint64_t frame, ReadbackRegion region, ReadbackCallback callback);
+
+    // Records the copies of requests due at this frame. The submission of the command buffer has to
+    // signal the timeline semaphore with signalValue, and the source must have been written by a compute shader.
+    void record(VkCommandBuffer commandBuffer, VkBuffer source, uint64_t frame, uint64_t signalValue);
+
+    // Invokes the callbacks of completed readbacks, never waits on the device
+    void poll();
+
+    ReadbackManager(VkDevice device, PhysicalDevice* physicalDevice, MemoryAllocator* allocator);
+    ~ReadbackManager();
+};
@@ -0,0 +1,148 @@
+#include "replay.hpp"
+
+#include <cstdio>
+
+ReplaySource::ReplaySource(const std::string& path, ThreadPool* threadPool, VkDevice device, PhysicalDevice* physicalDevice,
+                           MemoryAllocator* allocator, size_t heldFrames)
+: _reader(path, threadPool), particlecount(_reader.header.particlecount) {
+    if (_reader.frameCount() == 0) {
+        throw std::runtime_error(path + " holds no complete frames!");
+    }
+
+    // Written by the decoder through the persistent mapping and only read once by a copy
+    _slots.resize(REPLAY_DECODE_AHEAD + heldFrames);
+    for (size_t slot = 0; slot < _slots.size(); slot++) {
+        _slots[slot].particles = new Buffer(device, physicalDevice, allocator);
+        _slots[slot].particles->createOnHost(sizeof(Particle) * particlecount, VK_BUFFER_USAGE_TRANSFER_SRC_BIT);
+        _freeslots.push_back(slot);
+    }
+
+    _decoder = std::thread(&ReplaySource::decode, this);
+}
+
+void ReplaySource::decode() {
+    size_t next = 0;
+    uint64_t generation = 0;
+    bool seeked = false;
+
+    try {
+        while (true) {
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                _changed.wait(lock, [this]() { return _stopping || _seekrequested || !_freeslots.empty(); });
+                if (_stopping) {
+                    return;
+                }
+                if (_seekrequested) {
+                    _seekrequested = false;
+                    next = _seektarget;
+                    generation = _generation;
+                    seeked = true;
+                }
+                if (_freeslots.empty()) {
+                    continue;
+                }
+            }
+
+            // After a seek the keyframe is shown first, unless the decoder is already on the way to the target
+            size_t index = next;
+            if (seeked) {
+                seeked = false;
+                size_t keyframe = _reader.findKeyframe(next);
+                int64_t current = _reader.currentIndex();
+                if (current < static_cast<int64_t>(keyframe) || current > static_cast<int64_t>(next)) {
+                    index = keyframe;
+                }
+            }
+
+            if (decodeFrame(index, generation) && index == next) {
+                next = (next + 1) % _reader.frameCount();
+            }
+        }
+    } catch (std::exception& error) {
+        fprintf(stderr, "Replay stopped: %s\n", error.what());
+    }
+}
+
+// Returns false if a newer seek superseded the frame
+bool ReplaySource::decodeFrame(size_t index, uint64_t generation) {
+    // Decoded one chunk at a time so a newer seek doesn't have to wait for this one
+    size_t keyframe = _reader.findKeyframe(index);
+    int64_t current = _reader.currentIndex();
+    size_t chunk = (current >= static_cast<int64_t>(keyframe) && current <= static_cast<int64_t>(index))
+                   ? static_cast<size_t>(current) : keyframe;
+    for (; chunk <= index; chunk++) {
+        if (_generation != generation) {
+            return false;
+        }
+        _reader.seek(chunk);
+    }
+
+    size_t slot;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        slot = _freeslots.back();
+        _freeslots.pop_back();
+    }
+
+    _reader.readParticles(static_cast<Particle*>(_slots[slot].particles->mapping));
+    _slots[slot].frame = _reader.index[index].frame;
+    _slots[slot].index = index;
+
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (_generation != generation) {
+        _freeslots.push_back(slot);
+        return false;
+    }
+    _readyslots.push_back(slot);
+    return true;
+}
+
+size_t ReplaySource::acquireFrame(uint64_t& frame) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (_readyslots.empty()) {
+        return NO_FRAME;
+    }
+
+    size_t slot = _readyslots.front();
+    _readyslots.pop_front();
+
+    frame = _slots[slot].frame;
+    return slot;
+}
+
+void ReplaySource::releaseFrame(size_t slot) {
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _freeslots.push_back(slot);
+    }
+    _changed.notify_one();
+}
+
+void ReplaySource::seek(size_t index) {
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _generation++;
+        _freeslots.insert(_freeslots.end(), _readyslots.begin(), _readyslots.end());
+        _readyslots.clear();
+
+        _seektarget = std::min(index, _reader.frameCount() - 1);
+        _seekrequested = true;
+    }
+    _changed.notify_one();
+}
+
+ReplaySource::~ReplaySource() {
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stopping = true;
+        _generation++;
+    }
+    _changed.notify_one();
+
+    _decoder.join();
+
+    for (DecodedFrame& slot: _slots) {
+        delete slot.particles;
+    }
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include "trajectory.hpp"
+#include "buffer.hpp"
+
+// Decoded frames kept ready ahead of the one being displayed
+const size_t REPLAY_DECODE_AHEAD = 3;
+
+// Plays a recorded trajectory back in place of the simulation. A decoder thread runs a few frames ahead
+// of the display and converts them into particles in host visible buffers, the render thread only picks up
+// finished frames and copies them on the device, so whole frames never pass through the staging ring.
+// A seek first shows the keyframe the target is decoded from, so scrubbing stays responsive even with
+// long keyframe intervals, and a newer seek abandons one that is still decoding. Playback loops.
+class ReplaySource {
+private:
+    struct DecodedFrame {
+        uint64_t frame;
+        size_t index;
+        Buffer* particles;
+    };
+
+    TrajectoryReader _reader;
+
+    std::vector<DecodedFrame> _slots;
+    std::deque<size_t> _readyslots;
+    std::vector<size_t> _freeslots;
+
+    std::thread _decoder;
+    std::mutex _mutex;
+    std::condition_variable _changed;
+    // Bumped by every seek, frames decoded for an older generation are discarded
+    std::atomic<uint64_t> _generation{0};
+    size_t _seektarget = 0;
+    bool _seekrequested = true;
+    bool _stopping = false;
+
+    void decode();
+    bool decodeFrame(size_t index, uint64_t generation);
+public:
+    static constexpr size_t NO_FRAME = ~size_t(0);
+
+    uint64_t particlecount;
+
+    size_t frameCount() const {
+        return _reader.frameCount();
+    }
+    // Recorded frame closest to the simulation frame
+    size_t findFrame(uint64_t frame) const {
+        return _reader.findFrame(frame);
+    }
+
+    // Slot of the next decoded frame in display order, NO_FRAME if none is ready yet. Its buffer is not
+    // written again until the slot is released, which has to wait for the copies reading it.
+    size_t acquireFrame(uint64_t& frame);
+    VkBuffer getFrameBuffer(size_t slot) const {
+        return _slots[slot].particles->buffer;
+    }
+    void releaseFrame(size_t slot);
+    void seek(size_t index);
+
+    // heldFrames is the number of acquired frames the caller may hold at once, the decoder keeps
+    // REPLAY_DECODE_AHEAD frames ready besides them
+    ReplaySource(const std::string& path, ThreadPool* threadPool, VkDevice device, PhysicalDevice* physicalDevice,
+                 MemoryAllocator* allocator, size_t heldFrames);
+    ~ReplaySource();
+};
@@ -0,0 +1,128 @@
+#include "resolution.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+ResolutionGovernor::ResolutionGovernor(VkDevice device, PhysicalDevice* physicalDevice, uint32_t frameCount, float budget)
+: _device(device), _physicaldevice(physicalDevice), _budget(std::max(budget, 0.0f)) {
+    _framescales.resize(frameCount, RESOLUTION_MAX_SCALE);
+    createQueryPool(frameCount);
+}
+
+ResolutionGovernor::~ResolutionGovernor() {
+    if (_querypool != VK_NULL_HANDLE) {
+        vkDestroyQueryPool(_device, _querypool, nullptr);
+    }
+}
+
+void ResolutionGovernor::createQueryPool(uint32_t frameCount) {
+    if (_physicaldevice->timestampmask == 0) {
+        printf("The graphics queue does not support timestamps, rendering at full resolution\n");
+        return;
+    }
+
+    VkQueryPoolCreateInfo queryPoolCreateInfo = {};
+    queryPoolCreateInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+    queryPoolCreateInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+    queryPoolCreateInfo.queryCount = TIMESTAMPS_PER_FRAME * frameCount;
+
+    VkResult query_pool_creation_result = vkCreateQueryPool(_device, &queryPoolCreateInfo, nullptr, &_querypool);
+    if (query_pool_creation_result != VK_SUCCESS) {
+        throw vulkan_error("Failed to create resolution query pool!", query_pool_creation_result);
+    }
+    _querieswritten.resize(frameCount, false);
+}
+
+// The frame's previous command buffer has completed, so its timestamps are read without waiting
+void ResolutionGovernor::collect(uint32_t frame) {
+    if (_querypool == VK_NULL_HANDLE || !_querieswritten[frame]) {
+        return;
+    }
+
+    std::array<uint64_t, TIMESTAMPS_PER_FRAME> timestamps;
+    VkResult query_result = vkGetQueryPoolResults(_device, _querypool, TIMESTAMPS_PER_FRAME * frame, TIMESTAMPS_PER_FRAME,
+                                                  sizeof(timestamps), timestamps.data(), sizeof(uint64_t), VK_QUERY_RESULT_64_BIT);
+    if (query_result != VK_SUCCESS) {
+        return;
+    }
+
+    double gpuTime = _physicaldevice->getTimestampMilliseconds(timestamps[0], timestamps[1]);
+
+    _statistics.gputime += gpuTime;
+    _statistics.scale += _framescales[frame];
+    _statistics.samples++;
+
+    if (_framescales[frame] == _scale) {
+        adjust(gpuTime);
+    }
+}
+
+void ResolutionGovernor::adjust(double gpuTime) {
+    if (_budget <= 0.0f) {
+        return;
+    }
+
+    _smoothedtime = _smoothedtime < 0.0 ? gpuTime : _smoothedtime + (gpuTime - _smoothedtime) * RESOLUTION_SMOOTHING;
+    bool over = _smoothedtime > _budget;
+    bool under = _smoothedtime < _budget * RESOLUTION_RAISE_THRESHOLD;
+    if (!over && !under) {
+        return;
+    }
+
+    // Aims at the middle of the band between the raise threshold and the budget
+    double target = _budget * (1.0 + RESOLUTION_RAISE_THRESHOLD) * 0.5;
+    float desired = _scale * static_cast<float>(std::sqrt(target / std::max(_smoothedtime, 1e-3)));
+    float scale = std::clamp(desired, _scale - RESOLUTION_MAX_STEP, _scale + RESOLUTION_MAX_STEP);
+    scale = std::clamp(scale, RESOLUTION_MIN_SCALE, RESOLUTION_MAX_SCALE);
+
+    if (scale != _scale) {
+        _scale = scale;
+        _smoothedtime = -1.0;
+    }
+}
+
+void ResolutionGovernor::begin(VkCommandBuffer commandBuffer, uint32_t frame) {
+    collect(frame);
+    _framescales[frame] = _scale;
+
+    if (_querypool != VK_NULL_HANDLE) {
+        vkCmdResetQueryPool(commandBuffer, _querypool, TIMESTAMPS_PER_FRAME * frame, TIMESTAMPS_PER_FRAME);
+        // Written once everything before has completed, so the sort and copies ahead of the scene are left out
+        vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, _querypool, TIMESTAMPS_PER_FRAME * frame);
+        _querieswritten[frame] = true;
+    }
+}
+
+void ResolutionGovernor::end(VkCommandBuffer commandBuffer, uint32_t frame) {
+    if (_querypool != VK_NULL_HANDLE) {
+        vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, _querypool, TIMESTAMPS_PER_FRAME * frame + 1);
+    }
+}
+
+VkExtent2D ResolutionGovernor::getRenderExtent(VkExtent2D fullExtent) {
+    VkExtent2D extent;
+    extent.width = std::max(std::min(static_cast<uint32_t>(std::lround(fullExtent.width * _scale)), fullExtent.width), 1u);
+    extent.height = std::max(std::min(static_cast<uint32_t>(std::lround(fullExtent.height * _scale)), fullExtent.height), 1u);
+    return extent;
+}
+
+float ResolutionGovernor::getScale() {
+    return _scale;
+}
+
+void ResolutionGovernor::setBudget(float milliseconds) {
+    _budget = std::max(milliseconds, 0.0f);
+    _smoothedtime = -1.0;
+    if (_budget <= 0.0f) {
+        _scale = RESOLUTION_MAX_SCALE;
+    }
+}
+
+ResolutionStatistics ResolutionGovernor::getStatistics() {
+    ResolutionStatistics statistics = _statistics;
+    if (statistics.samples > 0) {
+        statistics.gputime /= static_cast<double>(statistics.samples);
+        statistics.scale /= static_cast<double>(statistics.samples);
+    }
+    return statistics;
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include "vulkan_tools.hpp"
+#include "physicaldevice.hpp"
+
+// Bounds of the share of the swap chain extent rendered, per axis
+const float RESOLUTION_MIN_SCALE = 0.5f;
+const float RESOLUTION_MAX_SCALE = 1.0f;
+// Largest change of the scale per adjustment, larger jumps are visible
+const float RESOLUTION_MAX_STEP = 0.05f;
+// The scale only goes up again once the GPU time drops below this share of the budget, so it does not oscillate
+const float RESOLUTION_RAISE_THRESHOLD = 0.85f;
+// Weight of the newest GPU time in the running average the decisions are made on
+const float RESOLUTION_SMOOTHING = 0.2f;
+
+struct ResolutionStatistics {
+    // Averages over every frame timed so far
+    double gputime;
+    double scale;
+    uint64_t samples;
+};
+
+// Dynamic resolution: times the scene rendering of every frame with timestamp queries and scales the rendered area of
+// the scene image so the GPU time stays within a budget. The cost of the fragment work goes with the pixel count,
+// the square of the scale, which sets the size of each adjustment. Results are read once the frame has completed,
+// so decisions lag by the frames in flight and the frames rendered at an older scale are left out of the average.
+class ResolutionGovernor {
+private:
+    // Start and end of the scene rendering
+    static const uint32_t TIMESTAMPS_PER_FRAME = 2;
+
+    VkDevice _device;
+    PhysicalDevice* _physicaldevice;
+
+    // Milliseconds, 0 renders at full resolution
+    float _budget;
+    float _scale = RESOLUTION_MAX_SCALE;
+    // Running average of the GPU time at the current scale, negative until the first frame at it is measured
+    double _smoothedtime = -1.0;
+
+    VkQueryPool _querypool = VK_NULL_HANDLE;
+    std::vector<bool> _querieswritten;
+    // Scale each frame was rendered at
+    std::vector<float> _framescales;
+    ResolutionStatistics _statistics = {};
+
+    void createQueryPool(uint32_t frameCount);
+    void collect(uint32_t frame);
+    void adjust(double gpuTime);
+public:
+    // Starts timing the frame's scene rendering once the work recorded before it has completed, after the
+    // measurement of the frame's previous use has been taken into account. The frame's previous work has to have completed.
+    void begin(VkCommandBuffer commandBuffer, uint32_t frame);
+    // After the frame's last scene pass, before the blit
+    void end(VkCommandBuffer commandBuffer, uint32_t frame);
+
+    // Part of the full extent the frame renders into, decided in begin()
+    VkExtent2D getRenderExtent(VkExtent2D fullExtent);
+    float getScale();
+    void setBudget(float milliseconds);
+    ResolutionStatistics getStatistics();
+
+    ResolutionGovernor(VkDevice device, PhysicalDevice* physicalDevice, uint32_t frameCount, float budget);
+    ~ResolutionGovernor();
+
+    ResolutionGovernor(const ResolutionGovernor&) = delete;
+    ResolutionGovernor& operator=(const ResolutionGovernor&) = delete;
+};
@@ -0,0 +1,366 @@
+#include "sdf.hpp"
+
+static const uint32_t PASS_SEED = 0;
+static const uint32_t PASS_FLOOD = 1;
+static const uint32_t PASS_RESOLVE = 2;
+static const uint32_t WORKGROUP_SIZE = 64;
+
+static const uint32_t VOXEL_COUNT = SDF_RESOLUTION * SDF_RESOLUTION * SDF_RESOLUTION;
+
+SignedDistanceField::SignedDistanceField(VkDevice device, PhysicalDevice* physicalDevice, MemoryAllocator* allocator, uint32_t frameCount)
+: _device(device), _physicaldevice(physicalDevice), _allocator(allocator),
+  sdforigin(0.0f), sdfscale(1.0f) {
+    _mesh = {};
+
+    createImage();
+
+    for (Buffer*& seedBuffer: _seedbuffers) {
+        seedBuffer = new Buffer(_device, _physicaldevice, _allocator);
+        seedBuffer->createOnDevice(sizeof(uint32_t) * VOXEL_COUNT, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+    }
+    _distancebuffer = new Buffer(_device, _physicaldevice, _allocator);
+    _distancebuffer->createOnDevice(sizeof(uint16_t) * VOXEL_COUNT,
+                                    VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT);
+
+    createPipeline();
+    createDescriptorSets(frameCount);
+}
+
+void SignedDistanceField::createImage() {
+    VkImageCreateInfo imageCreateInfo = {};
+    imageCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+    imageCreateInfo.imageType = VK_IMAGE_TYPE_3D;
+    imageCreateInfo.extent.width = SDF_RESOLUTION;
+    imageCreateInfo.extent.height = SDF_RESOLUTION;
+    imageCreateInfo.extent.depth = SDF_RESOLUTION;
+    imageCreateInfo.mipLevels = 1;
+    imageCreateInfo.arrayLayers = 1;
+    imageCreateInfo.format = VK_FORMAT_R16_SFLOAT;
+    imageCreateInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+    imageCreateInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    imageCreateInfo.usage = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+    imageCreateInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+    imageCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+    VkResult create_image_result = vkCreateImage(_device, &imageCreateInfo, nullptr, &_image);
+    if (create_image_result != VK_SUCCESS) {
+        throw vulkan_error("Failed to create signed distance field image!", create_image_result);
+    }
+
+    VkMemoryRequirements imageMemoryRequirements;
+    vkGetImageMemoryRequirements(_device, _image, &imageMemoryRequirements);
+
+    _imageallocation = _allocator->allocate(imageMemoryRequirements, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, ResourceKind::Image);
+
+    VkResult image_memory_bind_result = vkBindImageMemory(_device, _image, _imageallocation.memory, _imageallocation.offset);
+    if (image_memory_bind_result != VK_SUCCESS) {
+        throw vulkan_error("Failed to bind signed distance field memory!", image_memory_bind_result);
+    }
+
+    VkImageViewCreateInfo imageViewCreateInfo = {};
+    imageViewCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+    imageViewCreateInfo.image = _image;
+    imageViewCreateInfo.viewType = VK_IMAGE_VIEW_TYPE_3D;
+    imageViewCreateInfo.format = VK_FORMAT_R16_SFLOAT;
+    imageViewCreateInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    imageViewCreateInfo.subresourceRange.levelCount = 1;
+    imageViewCreateInfo.subresourceRange.layerCount = 1;
+
+    VkResult image_view_creation_result = vkCreateImageView(_device, &imageViewCreateInfo, nullptr, &view);
+    if (image_view_creation_result != VK_SUCCESS) {
+        throw vulkan_error("Failed to create signed distance field image view!", image_view_creation_result);
+    }
+
+    // Trilinear filtering interpolates the distances between voxels, outside the field the edge voxels are repeated
+    VkSamplerCreateInfo samplerCreateInfo = {};
+    samplerCreateInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+    samplerCreateInfo.magFilter = VK_FILTER_LINEAR;
+    samplerCreateInfo.minFilter = VK_FILTER_LINEAR;
+    samplerCreateInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+    samplerCreateInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    samplerCreateInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    samplerCreateInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    samplerCreateInfo.maxLod = 0.0f;
+
+    VkResult sampler_creation_result = vkCreateSampler(_device, &samplerCreateInfo, nullptr, &sampler);
+    if (sampler_creation_result != VK_SUCCESS) {
+        throw vulkan_error("Failed to create signed distance field sampler!", sampler_creation_result);
+    }
+}
+
+void SignedDistanceField::createPipeline() {
+    std::array<VkDescriptorSetLayoutBinding, 5> layoutBindings = {};
+    for (uint32_t i = 0; i < layoutBindings.size(); i++) {
+        layoutBindings[i].binding = i;
+        layoutBindings[i].descriptorCount = 1;
+        layoutBindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        layoutBindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    }
+
+    VkDescriptorSetLayoutCreateInfo layoutCreateInfo = {};
+    layoutCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    layoutCreateInfo.bindingCount = static_cast<uint32_t>(layoutBindings.size());
+    layoutCreateInfo.pBindings = layoutBindings.data();
+
+    VkResult descriptor_set_layout_creation_result = vkCreateDescriptorSetLayout(_device, &layoutCreateInfo, nullptr, &_descriptorsetlayout);
+    if (descriptor_set_layout_creation_result != VK_SUCCESS) {
+        throw vulkan_error("Failed to create signed distance field descriptor set layout!", descriptor_set_layout_creation_result);
+    }
+
+    VkPushConstantRange pushConstantRange = {};
+    pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    pushConstantRange.offset = 0;
+    pushConstantRange.size = sizeof(PushConstants);
+
+    VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo = {};
+    pipelineLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    pipelineLayoutCreateInfo.setLayoutCount = 1;
+    pipelineLayoutCreateInfo.pSetLayouts = &_descriptorsetlayout;
+    pipelineLayoutCreateInfo.pushConstantRangeCount = 1;
+    pipelineLayoutCreateInfo.pPushConstantRanges = &pushConstantRange;
+
+    VkResult layout_creation_result = vkCreatePipelineLayout(_device, &pipelineLayoutCreateInfo, nullptr, &_layout);
+    if (layout_creation_result != VK_SUCCESS) {
+        throw vulkan_error("Failed to create signed distance field pipeline layout!", layout_creation_result);
+    }
+
+    VkShaderModule computeShader = loadShader(_device, "sdf.comp");
+
+    VkPipelineShaderStageCreateInfo computeShaderStageInfo = {};
+    computeShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    computeShaderStageInfo.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+    computeShaderStageInfo.module = computeShader;
+    computeShaderStageInfo.pName = "main";
+
+    VkComputePipelineCreateInfo computePipelineCreateInfo = {};
+    computePipelineCreateInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+    computePipelineCreateInfo.layout = _layout;
+    computePipelineCreateInfo.stage = computeShaderStageInfo;
+
+    VkResult compute_pipeline_creation_result = vkCreateComputePipelines(_device, nullptr, 1, &computePipelineCreateInfo, nullptr, &_pipeline);
+    vkDestroyShaderModule(_device, computeShader, nullptr);
+    if (compute_pipeline_creation_result != VK_SUCCESS) {
+        throw vulkan_error("Failed to create signed distance field pipeline!", compute_pipeline_creation_result);
+    }
+}
+
+void SignedDistanceField::createDescriptorSets(uint32_t frameCount) {
+    uint32_t setCount = 2 * frameCount;
+
+    VkDescriptorPoolSize descriptorPoolSize = {};
+    descriptorPoolSize.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    descriptorPoolSize.descriptorCount = 5 * setCount;
+
+    VkDescriptorPoolCreateInfo descriptorPoolCreateInfo = {};
+    descriptorPoolCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    descriptorPoolCreateInfo.poolSizeCount = 1;
+    descriptorPoolCreateInfo.pPoolSizes = &descriptorPoolSize;
+    descriptorPoolCreateInfo.maxSets = setCount;
+
+    VkResult descriptor_pool_creation_result = vkCreateDescriptorPool(_device, &descriptorPoolCreateInfo, nullptr, &_descriptorpool);
+    if (descriptor_pool_creation_result != VK_SUCCESS) {
+        throw vulkan_error("Failed to create signed distance field descriptor pool!", descriptor_pool_creation_result);
+    }
+
+    std::vector<VkDescriptorSetLayout> descriptorSetLayouts(setCount, _descriptorsetlayout);
+    VkDescriptorSetAllocateInfo descriptorSetAllocationInfo = {};
+    descriptorSetAllocationInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    descriptorSetAllocationInfo.descriptorPool = _descriptorpool;
+    descriptorSetAllocationInfo.descriptorSetCount = setCount;
+    descriptorSetAllocationInfo.pSetLayouts = descriptorSetLayouts.data();
+
+    _descriptorsets.resize(setCount);
+    VkResult descriptor_sets_allocation_result = vkAllocateDescriptorSets(_device, &descriptorSetAllocationInfo, _descriptorsets.data());
+    if (descriptor_sets_allocation_result != VK_SUCCESS) {
+        throw vulkan_error("Failed to allocate signed distance field descriptor sets!", descriptor_sets_allocation_result);
+    }
+}
+
+// The mesh buffers change with every new mesh, so the frame's sets are written right before they are used
+void SignedDistanceField::writeDescriptorSets(uint32_t frame) {
+    for (uint32_t i = 0; i < 2; i++) {
+        std::array<VkDescriptorBufferInfo, 5> bufferInfos = {};
+        bufferInfos[0] = {_mesh.vertexbuffer->buffer, 0, VK_WHOLE_SIZE};
+        bufferInfos[1] = {_mesh.indexbuffer->buffer, 0, VK_WHOLE_SIZE};
+        bufferInfos[2] = {_seedbuffers[1 - i]->buffer, 0, VK_WHOLE_SIZE};
+        bufferInfos[3] = {_seedbuffers[i]->buffer, 0, VK_WHOLE_SIZE};
+        bufferInfos[4] = {_distancebuffer->buffer, 0, VK_WHOLE_SIZE};
+
+        std::array<VkWriteDescriptorSet, 5> writeDescriptorSets = {};
+        for (uint32_t binding = 0; binding < writeDescriptorSets.size(); binding++) {
+            writeDescriptorSets[binding].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+            writeDescriptorSets[binding].dstSet = _descriptorsets[2 * frame + i];
+            writeDescriptorSets[binding].dstBinding = binding;
+            writeDescriptorSets[binding].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+            writeDescriptorSets[binding].descriptorCount = 1;
+            writeDescriptorSets[binding].pBufferInfo = &bufferInfos[binding];
+        }
+
+        vkUpdateDescriptorSets(_device, static_cast<uint32_t>(writeDescriptorSets.size()), writeDescriptorSets.data(), 0, nullptr);
+    }
+}
+
+void SignedDistanceField::setMesh(const SdfMesh& mesh) {
+    if (mesh.indexcount / 3 > SDF_MAX_TRIANGLES) {
+        throw std::runtime_error("Mesh has " + std::to_string(mesh.indexcount / 3) + " triangles, collisions support at most "
+                                 + std::to_string(SDF_MAX_TRIANGLES) + "!");
+    }
+    _mesh = mesh;
+    _trianglecount = mesh.indexcount / 3;
+    _dirty = true;
+
+    // World space bounds of the transformed object space box
+    glm::vec3 boundsMin(std::numeric_limits<float>::max());
+    glm::vec3 boundsMax(std::numeric_limits<float>::lowest());
+    for (uint32_t corner = 0; corner < 8; corner++) {
+        glm::vec3 point((corner & 1) ? mesh.boundsmax.x : mesh.boundsmin.x,
+                        (corner & 2) ? mesh.boundsmax.y : mesh.boundsmin.y,
+                        (corner & 4) ? mesh.boundsmax.z : mesh.boundsmin.z);
+        glm::vec3 transformed = glm::vec3(mesh.model * glm::vec4(point, 1.0f));
+        boundsMin = glm::min(boundsMin, transformed);
+        boundsMax = glm::max(boundsMax, transformed);
+    }
+    float extent = glm::max(glm::max(boundsMax.x - boundsMin.x, boundsMax.y - boundsMin.y), boundsMax.z - boundsMin.z);
+
+    bool enabled = _trianglecount > 0 && extent > 1e-6f;
+
+    // Cubic voxels, the longest axis of the mesh spans the field minus the padding on both sides
+    _voxelsize = enabled ? extent / static_cast<float>(SDF_RESOLUTION - 2 * SDF_PADDING_VOXELS - 1) : 1.0f;
+    glm::vec3 centre = enabled ? 0.5f * (boundsMin + boundsMax) : glm::vec3(0.0f);
+    _firstvoxel = centre - glm::vec3(_voxelsize * 0.5f * static_cast<float>(SDF_RESOLUTION - 1));
+    if (!enabled) {
+        _trianglecount = 0;
+    }
+
+    // Texture coordinate 0 is the outer corner of the first voxel, half a voxel before its centre
+    sdforigin = glm::vec4(_firstvoxel - glm::vec3(0.5f * _voxelsize), enabled ? 1.0f : 0.0f);
+    sdfscale = glm::vec4(glm::vec3(1.0f / (_voxelsize * static_cast<float>(SDF_RESOLUTION))),
+                         1.0f / static_cast<float>(SDF_RESOLUTION));
+}
+
+void SignedDistanceField::dispatch(VkCommandBuffer commandBuffer, VkDescriptorSet descriptorSet,
+                                   const PushConstants& pushConstants, uint32_t invocations) {
+    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, _layout, 0, 1, &descriptorSet, 0, nullptr);
+    vkCmdPushConstants(commandBuffer, _layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(PushConstants), &pushConstants);
+    vkCmdDispatch(commandBuffer, (invocations + WORKGROUP_SIZE - 1) / WORKGROUP_SIZE, 1, 1);
+
+    VkMemoryBarrier memoryBarrier = {};
+    memoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    memoryBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    memoryBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_TRANSFER_READ_BIT;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         0, 1, &memoryBarrier, 0, nullptr, 0, nullptr);
+}
+
+void SignedDistanceField::record(VkCommandBuffer commandBuffer, uint32_t frame) {
+    if (!_dirty) {
+        return;
+    }
+    _dirty = false;
+
+    // The previous build may still be read by earlier dispatches, and the mesh buffers were just uploaded
+    VkMemoryBarrier memoryBarrier = {};
+    memoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    memoryBarrier.srcAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+    memoryBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         0, 1, &memoryBarrier, 0, nullptr, 0, nullptr);
+
+    vkCmdFillBuffer(commandBuffer, _seedbuffers[0]->buffer, 0, VK_WHOLE_SIZE, 0xffffffff);
+
+    memoryBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    memoryBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         0, 1, &memoryBarrier, 0, nullptr, 0, nullptr);
+
+    if (_trianglecount > 0) {
+        writeDescriptorSets(frame);
+    }
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, _pipeline);
+
+    PushConstants pushConstants = {};
+    pushConstants.model = _mesh.model;
+    pushConstants.origin = glm::vec4(_firstvoxel, _voxelsize);
+    pushConstants.resolution = SDF_RESOLUTION;
+    pushConstants.trianglecount = _trianglecount;
+    pushConstants.vertexstride = _mesh.vertexstride / sizeof(float);
+    pushConstants.shortindices = _mesh.indextype == VK_INDEX_TYPE_UINT16;
+
+    // Without triangles every voxel stays empty and resolves to the largest distance
+    if (_trianglecount > 0) {
+        uint32_t set = 0;
+        pushConstants.pass = PASS_SEED;
+        dispatch(commandBuffer, _descriptorsets[2 * frame + set], pushConstants, _trianglecount);
+
+        // Jump flooding with halving steps and one more step of 1 (JFA+1), which fixes most of its errors
+        pushConstants.pass = PASS_FLOOD;
+        for (uint32_t jump = SDF_RESOLUTION / 2; ; jump /= 2) {
+            set ^= 1;
+            pushConstants.jump = jump;
+            dispatch(commandBuffer, _descriptorsets[2 * frame + set], pushConstants, VOXEL_COUNT);
+            if (jump == 1) {
+                break;
+            }
+        }
+        set ^= 1;
+        pushConstants.jump = 1;
+        dispatch(commandBuffer, _descriptorsets[2 * frame + set], pushConstants, VOXEL_COUNT);
+
+        set ^= 1;
+        pushConstants.pass = PASS_RESOLVE;
+        dispatch(commandBuffer, _descriptorsets[2 * frame + set], pushConstants, VOXEL_COUNT / 2);
+    } else {
+        vkCmdFillBuffer(commandBuffer, _distancebuffer->buffer, 0, VK_WHOLE_SIZE, 0x7bff7bff);
+
+        memoryBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        memoryBarrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                             0, 1, &memoryBarrier, 0, nullptr, 0, nullptr);
+    }
+
+    VkImageMemoryBarrier imageBarrier = {};
+    imageBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    imageBarrier.srcAccessMask = 0;
+    imageBarrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    imageBarrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    imageBarrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    imageBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    imageBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    imageBarrier.image = _image;
+    imageBarrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    imageBarrier.subresourceRange.levelCount = 1;
+    imageBarrier.subresourceRange.layerCount = 1;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         0, 0, nullptr, 0, nullptr, 1, &imageBarrier);
+
+    VkBufferImageCopy region = {};
+    region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    region.imageSubresource.layerCount = 1;
+    region.imageExtent = {SDF_RESOLUTION, SDF_RESOLUTION, SDF_RESOLUTION};
+    vkCmdCopyBufferToImage(commandBuffer, _distancebuffer->buffer, _image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+
+    imageBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    imageBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    imageBarrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    imageBarrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         0, 0, nullptr, 0, nullptr, 1, &imageBarrier);
+}
+
+SignedDistanceField::~SignedDistanceField() {
+    vkDestroyDescriptorPool(_device, _descriptorpool, nullptr);
+    vkDestroyPipeline(_device, _pipeline, nullptr);
+    vkDestroyPipelineLayout(_device, _layout, nullptr);
+    vkDestroyDescriptorSetLayout(_device, _descriptorsetlayout, nullptr);
+
+    delete _seedbuffers[0];
+    delete _seedbuffers[1];
+    delete _distancebuffer;
+
+    vkDestroySampler(_device, sampler, nullptr);
+    vkDestroyImageView(_device, view, nullptr);
+    vkDestroyImage(_device, _image, nullptr);
+    _allocator->free(_imageallocation);
+}
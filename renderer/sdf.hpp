@@ -0,0 +1,91 @@
+#pragma once
+
+#include "vulkan_tools.hpp"
+#include "pipeline.hpp"
+#include "buffer.hpp"
+
+// Voxels along every axis of the field, even so the distances pack into pairs of half floats
+const uint32_t SDF_RESOLUTION = 64;
+// Empty voxels kept between the mesh bounds and the edge of the field
+const uint32_t SDF_PADDING_VOXELS = 4;
+// Triangle indices share the 32 bit seed keys with the quantized distance
+const uint32_t SDF_MAX_TRIANGLES = 1 << 20;
+
+// Mesh geometry as the voxelization reads it, straight from the vertex and index buffers.
+// The buffers need VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, their handles are read when the field is built.
+struct SdfMesh {
+    Buffer* vertexbuffer;
+    uint32_t vertexstride;
+    Buffer* indexbuffer;
+    VkIndexType indextype;
+    uint32_t indexcount;
+    glm::mat4 model;
+    // Object space bounds of the vertices
+    glm::vec3 boundsmin;
+    glm::vec3 boundsmax;
+};
+
+// Signed distance to the mesh, sampled by shader.comp to keep particles out of it. A compute pass (sdf.comp)
+// voxelizes the mesh on the device whenever it changes: every triangle seeds the voxels around it,
+// jump flooding spreads the nearest triangle through the grid and the distances are resolved into a
+// R16_SFLOAT 3D texture, so a collision test is one filtered texture read however complex the mesh is.
+class SignedDistanceField {
+private:
+    struct PushConstants {
+        glm::mat4 model;
+        glm::vec4 origin;
+        uint32_t pass;
+        uint32_t jump;
+        uint32_t resolution;
+        uint32_t trianglecount;
+        uint32_t vertexstride;
+        uint32_t shortindices;
+    };
+
+    VkDevice _device;
+    PhysicalDevice* _physicaldevice;
+    MemoryAllocator* _allocator;
+
+    VkImage _image;
+    Allocation _imageallocation;
+
+    // Ping-pong buffers of the nearest triangle per voxel
+    Buffer* _seedbuffers[2];
+    Buffer* _distancebuffer;
+
+    VkDescriptorSetLayout _descriptorsetlayout;
+    VkPipelineLayout _layout;
+    VkPipeline _pipeline;
+    VkDescriptorPool _descriptorpool;
+    // Two per frame in flight, set 2 * frame + i writes seed buffer i and reads the other one
+    std::vector<VkDescriptorSet> _descriptorsets;
+
+    SdfMesh _mesh;
+    uint32_t _trianglecount = 0;
+    float _voxelsize = 1.0f;
+    glm::vec3 _firstvoxel = glm::vec3(0.0f);
+    bool _dirty = false;
+
+    void createImage();
+    void createPipeline();
+    void createDescriptorSets(uint32_t frameCount);
+    void writeDescriptorSets(uint32_t frame);
+    void dispatch(VkCommandBuffer commandBuffer, VkDescriptorSet descriptorSet, const PushConstants& pushConstants, uint32_t invocations);
+public:
+    VkImageView view;
+    VkSampler sampler;
+
+    // Placement for ComputeUniformBufferObject, sdforigin.w is 0 while there is no mesh to collide with
+    glm::vec4 sdforigin;
+    glm::vec4 sdfscale;
+
+    // Places the field around the mesh right away, the voxelization follows with the next record().
+    // Meshes without volume turn collisions off, meshes with more than SDF_MAX_TRIANGLES triangles throw.
+    void setMesh(const SdfMesh& mesh);
+    // Records the voxelization of a changed mesh into a compute command buffer, nothing otherwise. The frame's
+    // previous work has to have completed. Earlier reads of the field on the same queue finish first.
+    void record(VkCommandBuffer commandBuffer, uint32_t frame);
+
+    SignedDistanceField(VkDevice device, PhysicalDevice* physicalDevice, MemoryAllocator* allocator, uint32_t frameCount);
+    ~SignedDistanceField();
+};
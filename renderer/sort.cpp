@@ -0,0 +1,420 @@
+#include "sort.hpp"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstring>
+#include <random>
+#include <stdexcept>
+
+static const uint32_t PASS_HISTOGRAM = 0;
+static const uint32_t PASS_OFFSETS = 1;
+static const uint32_t PASS_SCATTER = 2;
+
+static const uint32_t RADIX = 1 << RADIX_DIGIT_BITS;
+static const uint32_t RADIX_DIGIT_PASSES = 32 / RADIX_DIGIT_BITS;
+// Workgroups of the histogram pass, each loops over the keys
+static const uint32_t HISTOGRAM_GROUP_COUNT = 512;
+// radixsort.comp counts the keys of up to 32 subgroups per workgroup
+static const uint32_t RADIX_MIN_SUBGROUP_SIZE = 8;
+
+static uint32_t getTileCount(uint32_t count) {
+    return (count + SORT_TILE_SIZE - 1) / SORT_TILE_SIZE;
+}
+
+static void checkCapacity(PhysicalDevice* physicalDevice, uint32_t capacity, const char* name) {
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(physicalDevice->physicaldevice, &properties);
+    if (getTileCount(capacity) > properties.limits.maxComputeWorkGroupCount[0]
+        || static_cast<VkDeviceSize>(capacity) * sizeof(uint32_t) > properties.limits.maxStorageBufferRange) {
+        throw std::runtime_error(std::string(name) + " capacity exceeds the device limits!");
+    }
+}
+
+// Orders everything before against compute shaders and transfers after, both ways
+static void recordComputeTransferBarrier(VkCommandBuffer commandBuffer) {
+    VkMemoryBarrier memoryBarrier = {};
+    memoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    memoryBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+    memoryBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT
+                                  | VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         0, 1, &memoryBarrier, 0, nullptr, 0, nullptr);
+}
+
+bool PrefixScan::isSupported(PhysicalDevice* physicalDevice) {
+    return physicalDevice->subgrouparithmeticsupported;
+}
+
+PrefixScan::PrefixScan(VkDevice device, PhysicalDevice* physicalDevice, MemoryAllocator* allocator,
+                       Buffer* input, Buffer* output, uint32_t capacity)
+: _device(device), _physicaldevice(physicalDevice), _allocator(allocator), _capacity(capacity) {
+    if (!isSupported(_physicaldevice)) {
+        throw std::runtime_error("Prefix scan needs subgroup arithmetic in compute shaders!");
+    }
+    checkCapacity(_physicaldevice, _capacity, "Prefix scan");
+
+    _tilestatusbuffer = new Buffer(_device, _physicaldevice, _allocator);
+    _tilestatusbuffer->createOnDevice(sizeof(uint32_t) * (1 + getTileCount(_capacity)), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+
+    createStoragePipeline(_device, "scan.comp", "prefix scan", 3, sizeof(PushConstants), _descriptorsetlayout, _layout, _pipeline);
+    createDescriptorSet(input, output);
+}
+
+void PrefixScan::createDescriptorSet(Buffer* input, Buffer* output) {
+    allocateStorageDescriptorSets(_device, "prefix scan", _descriptorsetlayout, 3, 1, _descriptorpool, &_descriptorset);
+    VkDeviceSize range = sizeof(uint32_t) * _capacity;
+    writeStorageDescriptors(_device, _descriptorset, {{input->buffer, 0, range}, {output->buffer, 0, range},
+                                                      {_tilestatusbuffer->buffer, 0, VK_WHOLE_SIZE}});
+}
+
+void PrefixScan::record(VkCommandBuffer commandBuffer, uint32_t count) {
+    if (count == 0) {
+        return;
+    }
+    uint32_t tileCount = getTileCount(std::min(count, _capacity));
+
+    recordComputeTransferBarrier(commandBuffer);
+    vkCmdFillBuffer(commandBuffer, _tilestatusbuffer->buffer, 0, sizeof(uint32_t) * (1 + tileCount), 0);
+    recordComputeTransferBarrier(commandBuffer);
+
+    PushConstants pushConstants = {};
+    pushConstants.count = std::min(count, _capacity);
+
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, _pipeline);
+    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, _layout, 0, 1, &_descriptorset, 0, nullptr);
+    vkCmdPushConstants(commandBuffer, _layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(PushConstants), &pushConstants);
+    vkCmdDispatch(commandBuffer, tileCount, 1, 1);
+
+    recordComputeTransferBarrier(commandBuffer);
+}
+
+PrefixScan::~PrefixScan() {
+    vkDestroyDescriptorPool(_device, _descriptorpool, nullptr);
+    vkDestroyPipeline(_device, _pipeline, nullptr);
+    vkDestroyPipelineLayout(_device, _layout, nullptr);
+    vkDestroyDescriptorSetLayout(_device, _descriptorsetlayout, nullptr);
+
+    delete _tilestatusbuffer;
+}
+
+bool RadixSort::isSupported(PhysicalDevice* physicalDevice) {
+    return physicalDevice->subgroupballotsupported && physicalDevice->subgroupsize >= RADIX_MIN_SUBGROUP_SIZE;
+}
+
+RadixSort::RadixSort(VkDevice device, PhysicalDevice* physicalDevice, MemoryAllocator* allocator,
+                     Buffer* keys, Buffer* values, uint32_t capacity)
+: _device(device), _physicaldevice(physicalDevice), _allocator(allocator), _capacity(capacity), _keys(keys), _values(values) {
+    if (!isSupported(_physicaldevice)) {
+        throw std::runtime_error("Radix sort needs subgroup ballots in compute shaders with subgroups of at least 8 invocations!");
+    }
+    checkCapacity(_physicaldevice, _capacity, "Radix sort");
+
+    VkDeviceSize bufferSize = sizeof(uint32_t) * _capacity;
+    VkBufferUsageFlags usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+    _alternatekeys = new Buffer(_device, _physicaldevice, _allocator);
+    _alternatekeys->createOnDevice(bufferSize, usage);
+    _alternatevalues = new Buffer(_device, _physicaldevice, _allocator);
+    _alternatevalues->createOnDevice(bufferSize, usage);
+    _digitoffsetbuffer = new Buffer(_device, _physicaldevice, _allocator);
+    _digitoffsetbuffer->createOnDevice(sizeof(uint32_t) * RADIX * RADIX_DIGIT_PASSES, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+    _tilestatusbuffer = new Buffer(_device, _physicaldevice, _allocator);
+    _tilestatusbuffer->createOnDevice(sizeof(uint32_t) * (1 + RADIX * getTileCount(_capacity)), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+
+    createStoragePipeline(_device, "radixsort.comp", "radix sort", 6, sizeof(PushConstants), _descriptorsetlayout, _layout, _pipeline);
+    createDescriptorSets();
+}
+
+void RadixSort::createDescriptorSets() {
+    allocateStorageDescriptorSets(_device, "radix sort", _descriptorsetlayout, 6, 2, _descriptorpool, _descriptorsets.data());
+    VkDeviceSize range = sizeof(uint32_t) * _capacity;
+    VkDescriptorBufferInfo keys = {_keys->buffer, 0, range};
+    VkDescriptorBufferInfo values = {_values->buffer, 0, range};
+    VkDescriptorBufferInfo alternateKeys = {_alternatekeys->buffer, 0, range};
+    VkDescriptorBufferInfo alternateValues = {_alternatevalues->buffer, 0, range};
+    VkDescriptorBufferInfo digitOffsets = {_digitoffsetbuffer->buffer, 0, VK_WHOLE_SIZE};
+    VkDescriptorBufferInfo tileStatus = {_tilestatusbuffer->buffer, 0, VK_WHOLE_SIZE};
+
+    writeStorageDescriptors(_device, _descriptorsets[0], {keys, values, alternateKeys, alternateValues, digitOffsets, tileStatus});
+    writeStorageDescriptors(_device, _descriptorsets[1], {alternateKeys, alternateValues, keys, values, digitOffsets, tileStatus});
+}
+
+void RadixSort::dispatch(VkCommandBuffer commandBuffer, const PushConstants& pushConstants, uint32_t groupCount) {
+    vkCmdPushConstants(commandBuffer, _layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(PushConstants), &pushConstants);
+    vkCmdDispatch(commandBuffer, groupCount, 1, 1);
+    recordComputeTransferBarrier(commandBuffer);
+}
+
+void RadixSort::record(VkCommandBuffer commandBuffer, uint32_t count, uint32_t keyBits) {
+    count = std::min(count, _capacity);
+    uint32_t digitPasses = std::min((keyBits + RADIX_DIGIT_BITS - 1) / RADIX_DIGIT_BITS, RADIX_DIGIT_PASSES);
+    if (count <= 1 || digitPasses == 0) {
+        return;
+    }
+    uint32_t tileCount = getTileCount(count);
+
+    recordComputeTransferBarrier(commandBuffer);
+    vkCmdFillBuffer(commandBuffer, _digitoffsetbuffer->buffer, 0, VK_WHOLE_SIZE, 0);
+    recordComputeTransferBarrier(commandBuffer);
+
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, _pipeline);
+
+    PushConstants pushConstants = {};
+    pushConstants.count = count;
+
+    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, _layout, 0, 1, &_descriptorsets[0], 0, nullptr);
+    pushConstants.pass = PASS_HISTOGRAM;
+    dispatch(commandBuffer, pushConstants, std::min(tileCount, HISTOGRAM_GROUP_COUNT));
+    pushConstants.pass = PASS_OFFSETS;
+    dispatch(commandBuffer, pushConstants, RADIX_DIGIT_PASSES);
+
+    pushConstants.pass = PASS_SCATTER;
+    for (uint32_t digitPass = 0; digitPass < digitPasses; digitPass++) {
+        // The tiles of every pass take their indices from a fresh counter
+        vkCmdFillBuffer(commandBuffer, _tilestatusbuffer->buffer, 0, sizeof(uint32_t) * (1 + RADIX * tileCount), 0);
+        recordComputeTransferBarrier(commandBuffer);
+
+        vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, _layout, 0, 1,
+                                &_descriptorsets[digitPass % 2], 0, nullptr);
+        pushConstants.digitpass = digitPass;
+        dispatch(commandBuffer, pushConstants, tileCount);
+    }
+
+    // An odd number of passes leaves the result in the alternate buffers
+    if (digitPasses % 2 == 1) {
+        VkBufferCopy copyRegion = {};
+        copyRegion.size = sizeof(uint32_t) * count;
+        vkCmdCopyBuffer(commandBuffer, _alternatekeys->buffer, _keys->buffer, 1, &copyRegion);
+        vkCmdCopyBuffer(commandBuffer, _alternatevalues->buffer, _values->buffer, 1, &copyRegion);
+        recordComputeTransferBarrier(commandBuffer);
+    }
+}
+
+RadixSort::~RadixSort() {
+    vkDestroyDescriptorPool(_device, _descriptorpool, nullptr);
+    vkDestroyPipeline(_device, _pipeline, nullptr);
+    vkDestroyPipelineLayout(_device, _layout, nullptr);
+    vkDestroyDescriptorSetLayout(_device, _descriptorsetlayout, nullptr);
+
+    delete _alternatekeys;
+    delete _alternatevalues;
+    delete _digitoffsetbuffer;
+    delete _tilestatusbuffer;
+}
+
+bool benchmarkSort(VkDevice device, PhysicalDevice* physicalDevice, MemoryAllocator* allocator, VkQueue queue, uint32_t maxCount) {
+    if (!RadixSort::isSupported(physicalDevice) || !PrefixScan::isSupported(physicalDevice)) {
+        printf("The device lacks the subgroup operations the sort and scan need\n");
+        return false;
+    }
+
+    VkCommandPoolCreateInfo commandPoolCreateInfo = {};
+    commandPoolCreateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    commandPoolCreateInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+    commandPoolCreateInfo.queueFamilyIndex = physicalDevice->queuefamilies.graphicsComputeFamily.value();
+
+    VkCommandPool commandPool;
+    VkResult command_pool_creation_result = vkCreateCommandPool(device, &commandPoolCreateInfo, nullptr, &commandPool);
+    if (command_pool_creation_result != VK_SUCCESS) {
+        throw vulkan_error("Failed to create benchmark command pool!", command_pool_creation_result);
+    }
+
+    VkCommandBufferAllocateInfo allocationInfo = {};
+    allocationInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    allocationInfo.commandPool = commandPool;
+    allocationInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    allocationInfo.commandBufferCount = 1;
+
+    VkCommandBuffer commandBuffer;
+    VkResult command_buffer_allocation_result = vkAllocateCommandBuffers(device, &allocationInfo, &commandBuffer);
+    if (command_buffer_allocation_result != VK_SUCCESS) {
+        throw vulkan_error("Failed to allocate benchmark command buffer!", command_buffer_allocation_result);
+    }
+
+    VkFenceCreateInfo fenceCreateInfo = {};
+    fenceCreateInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+
+    VkFence fence;
+    VkResult fence_creation_result = vkCreateFence(device, &fenceCreateInfo, nullptr, &fence);
+    if (fence_creation_result != VK_SUCCESS) {
+        throw vulkan_error("Failed to create benchmark fence!", fence_creation_result);
+    }
+
+    // Without timestamps the time of the whole submission is taken on the host
+    VkQueryPool queryPool = VK_NULL_HANDLE;
+    if (physicalDevice->timestampmask != 0) {
+        VkQueryPoolCreateInfo queryPoolCreateInfo = {};
+        queryPoolCreateInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+        queryPoolCreateInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+        queryPoolCreateInfo.queryCount = 2;
+
+        VkResult query_pool_creation_result = vkCreateQueryPool(device, &queryPoolCreateInfo, nullptr, &queryPool);
+        if (query_pool_creation_result != VK_SUCCESS) {
+            throw vulkan_error("Failed to create benchmark query pool!", query_pool_creation_result);
+        }
+    }
+
+    // Records setup, then the timed commands, and waits for them. Returns the milliseconds of the timed part.
+    auto run = [&](auto setup, auto timed) {
+        VkCommandBufferBeginInfo beginInfo = {};
+        beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+        VkResult begin_command_buffer_result = vkBeginCommandBuffer(commandBuffer, &beginInfo);
+        if (begin_command_buffer_result != VK_SUCCESS) {
+            throw vulkan_error("Failed to start recording benchmark command buffer!", begin_command_buffer_result);
+        }
+        setup(commandBuffer);
+        if (queryPool != VK_NULL_HANDLE) {
+            vkCmdResetQueryPool(commandBuffer, queryPool, 0, 2);
+            vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, queryPool, 0);
+        }
+        timed(commandBuffer);
+        if (queryPool != VK_NULL_HANDLE) {
+            vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, queryPool, 1);
+        }
+        VkResult command_buffer_end_result = vkEndCommandBuffer(commandBuffer);
+        if (command_buffer_end_result != VK_SUCCESS) {
+            throw vulkan_error("Failed to finish recording benchmark command buffer!", command_buffer_end_result);
+        }
+
+        VkSubmitInfo submitInfo = {};
+        submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+        submitInfo.commandBufferCount = 1;
+        submitInfo.pCommandBuffers = &commandBuffer;
+
+        auto submitted = std::chrono::steady_clock::now();
+        VkResult compute_queue_submit_result = vkQueueSubmit(queue, 1, &submitInfo, fence);
+        if (compute_queue_submit_result != VK_SUCCESS) {
+            throw vulkan_error("Failed to submit benchmark command buffer!", compute_queue_submit_result);
+        }
+        vkWaitForFences(device, 1, &fence, VK_TRUE, UINT64_MAX);
+        double milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - submitted).count();
+        vkResetFences(device, 1, &fence);
+        vkResetCommandBuffer(commandBuffer, 0);
+
+        std::array<uint64_t, 2> timestamps;
+        if (queryPool != VK_NULL_HANDLE
+            && vkGetQueryPoolResults(device, queryPool, 0, 2, sizeof(timestamps), timestamps.data(), sizeof(uint64_t),
+                                     VK_QUERY_RESULT_64_BIT) == VK_SUCCESS) {
+            milliseconds = physicalDevice->getTimestampMilliseconds(timestamps[0], timestamps[1]);
+        }
+        return milliseconds;
+    };
+    auto nothing = [](VkCommandBuffer) {};
+
+    const uint32_t BENCHMARK_ITERATIONS = 5;
+    printf("Sorting key/value pairs and scanning, %u runs each after a warm-up, %s\n", BENCHMARK_ITERATIONS,
+           queryPool != VK_NULL_HANDLE ? "GPU timestamps" : "host time around the submission");
+
+    std::mt19937 generator(1);
+    bool passed = true;
+    for (uint64_t count = 1000000; count <= maxCount; count *= 10) {
+        VkDeviceSize size = sizeof(uint32_t) * count;
+        try {
+            VkBufferUsageFlags usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+            Buffer keys(device, physicalDevice, allocator);
+            keys.createOnDevice(size, usage);
+            Buffer values(device, physicalDevice, allocator);
+            values.createOnDevice(size, usage);
+            Buffer upload(device, physicalDevice, allocator);
+            upload.createOnHost(2 * size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT);
+            Buffer readback(device, physicalDevice, allocator);
+            readback.createForReadback(2 * size);
+
+            RadixSort sort(device, physicalDevice, allocator, &keys, &values, static_cast<uint32_t>(count));
+            PrefixScan scan(device, physicalDevice, allocator, &values, &values, static_cast<uint32_t>(count));
+
+            // Values are the original positions, so the result shows where every key came from
+            std::vector<uint32_t> reference(count);
+            for (uint32_t& key: reference) {
+                key = generator();
+            }
+            uint32_t* uploadKeys = static_cast<uint32_t*>(upload.mapping);
+            memcpy(uploadKeys, reference.data(), size);
+            for (uint32_t i = 0; i < count; i++) {
+                uploadKeys[count + i] = i;
+            }
+
+            auto copyBack = [&](VkCommandBuffer commandBuffer) {
+                VkBufferCopy copyRegion = {0, 0, size};
+                vkCmdCopyBuffer(commandBuffer, keys.buffer, readback.buffer, 1, &copyRegion);
+                copyRegion.dstOffset = size;
+                vkCmdCopyBuffer(commandBuffer, values.buffer, readback.buffer, 1, &copyRegion);
+
+                VkMemoryBarrier memoryBarrier = {};
+                memoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+                memoryBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+                memoryBarrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+                vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT,
+                                     0, 1, &memoryBarrier, 0, nullptr, 0, nullptr);
+            };
+
+            double sortTime = 0.0;
+            for (uint32_t iteration = 0; iteration <= BENCHMARK_ITERATIONS; iteration++) {
+                double milliseconds = run([&](VkCommandBuffer commandBuffer) {
+                    VkBufferCopy copyRegion = {0, 0, size};
+                    vkCmdCopyBuffer(commandBuffer, upload.buffer, keys.buffer, 1, &copyRegion);
+                    copyRegion.srcOffset = size;
+                    vkCmdCopyBuffer(commandBuffer, upload.buffer, values.buffer, 1, &copyRegion);
+                }, [&](VkCommandBuffer commandBuffer) {
+                    sort.record(commandBuffer, static_cast<uint32_t>(count));
+                });
+                sortTime += iteration > 0 ? milliseconds : 0.0;
+            }
+            sortTime /= BENCHMARK_ITERATIONS;
+
+            // Ordered, every key from its original position, and equal keys still in their original order
+            run(copyBack, nothing);
+            readback.invalidate(0, 2 * size);
+            const uint32_t* sortedKeys = static_cast<const uint32_t*>(readback.mapping);
+            const uint32_t* sortedValues = sortedKeys + count;
+            std::vector<bool> seen(count, false);
+            bool sorted = true;
+            for (uint32_t i = 0; i < count && sorted; i++) {
+                uint32_t origin = sortedValues[i];
+                sorted = origin < count && !seen[origin] && reference[origin] == sortedKeys[i];
+                if (sorted && i > 0) {
+                    sorted = sortedKeys[i - 1] < sortedKeys[i] || (sortedKeys[i - 1] == sortedKeys[i] && sortedValues[i - 1] < origin);
+                }
+                if (sorted) {
+                    seen[origin] = true;
+                }
+            }
+
+            // Scanning ones gives every element its position
+            double scanTime = 0.0;
+            for (uint32_t iteration = 0; iteration <= BENCHMARK_ITERATIONS; iteration++) {
+                double milliseconds = run([&](VkCommandBuffer commandBuffer) {
+                    vkCmdFillBuffer(commandBuffer, values.buffer, 0, size, 1);
+                }, [&](VkCommandBuffer commandBuffer) {
+                    scan.record(commandBuffer, static_cast<uint32_t>(count));
+                });
+                scanTime += iteration > 0 ? milliseconds : 0.0;
+            }
+            scanTime /= BENCHMARK_ITERATIONS;
+
+            run(copyBack, nothing);
+            readback.invalidate(0, 2 * size);
+            bool scanned = true;
+            for (uint32_t i = 0; i < count && scanned; i++) {
+                scanned = sortedValues[i] == i;
+            }
+
+            printf("%10llu: sort %9.3f ms, %8.1f M keys/s, %s; scan %8.3f ms, %8.1f M elements/s, %s\n",
+                   static_cast<unsigned long long>(count), sortTime, count / (sortTime * 1e3), sorted ? "correct" : "WRONG",
+                   scanTime, count / (scanTime * 1e3), scanned ? "correct" : "WRONG");
+            passed = passed && sorted && scanned;
+        } catch (const std::exception& exception) {
+            printf("%10llu: skipped, %s\n", static_cast<unsigned long long>(count), exception.what());
+        }
+    }
+
+    if (queryPool != VK_NULL_HANDLE) {
+        vkDestroyQueryPool(device, queryPool, nullptr);
+    }
+    vkDestroyFence(device, fence, nullptr);
+    vkDestroyCommandPool(device, commandPool, nullptr);
+    return passed;
+}
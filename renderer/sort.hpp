@@ -0,0 +1,107 @@
+#pragma once
+
+#include "vulkan_tools.hpp"
+#include "pipeline.hpp"
+#include "buffer.hpp"
+
+// Elements per workgroup of scan.comp and radixsort.comp
+const uint32_t SORT_TILE_SIZE = 2048;
+// Key bits sorted per pass of the RadixSort
+const uint32_t RADIX_DIGIT_BITS = 8;
+
+// Exclusive prefix sum of uint32 elements in a single pass over the data (scan.comp). Tiles are scanned in
+// workgroups and chained by decoupled look-back: each tile publishes its sum, then adds up the published sums of
+// the tiles before it until one that already includes everything before it. The sums have to stay below 2^30,
+// the top bits of the published values hold their state. Input and output may be the same buffer.
+// Needs subgroup arithmetic in compute shaders.
+class PrefixScan {
+private:
+    struct PushConstants {
+        uint32_t count;
+    };
+
+    VkDevice _device;
+    PhysicalDevice* _physicaldevice;
+    MemoryAllocator* _allocator;
+    uint32_t _capacity;
+
+    // Tile counter followed by the state of every tile
+    Buffer* _tilestatusbuffer;
+
+    VkDescriptorSetLayout _descriptorsetlayout;
+    VkPipelineLayout _layout;
+    VkPipeline _pipeline;
+    VkDescriptorPool _descriptorpool;
+    VkDescriptorSet _descriptorset;
+
+    void createDescriptorSet(Buffer* input, Buffer* output);
+public:
+    static bool isSupported(PhysicalDevice* physicalDevice);
+
+    // Scans the first count elements. The inputs may have been written by earlier compute shaders or transfers,
+    // the results are visible to later ones.
+    void record(VkCommandBuffer commandBuffer, uint32_t count);
+
+    PrefixScan(VkDevice device, PhysicalDevice* physicalDevice, MemoryAllocator* allocator,
+               Buffer* input, Buffer* output, uint32_t capacity);
+    ~PrefixScan();
+
+    PrefixScan(const PrefixScan&) = delete;
+    PrefixScan& operator=(const PrefixScan&) = delete;
+};
+
+// Sorts uint32 keys with a uint32 value each, least significant digit first, 8 bits per pass (radixsort.comp).
+// One pass counts the digits of all passes at once, and each digit pass is then a single sweep over the keys
+// after the onesweep scheme: the tiles rank their keys stably in shared memory and find where each digit's keys
+// go by decoupled look-back over the tiles before them, as in the PrefixScan. The keys and values are sorted in
+// place, ping-ponging through internal buffers, and have to be storage buffers usable as transfer source and
+// destination. Needs subgroup ballots in compute shaders with subgroups of at least 8 invocations.
+class RadixSort {
+private:
+    struct PushConstants {
+        uint32_t pass;
+        uint32_t count;
+        uint32_t digitpass;
+    };
+
+    VkDevice _device;
+    PhysicalDevice* _physicaldevice;
+    MemoryAllocator* _allocator;
+    uint32_t _capacity;
+
+    Buffer* _keys;
+    Buffer* _values;
+    Buffer* _alternatekeys;
+    Buffer* _alternatevalues;
+    // Digit counts of every pass, then the position of each digit's first key
+    Buffer* _digitoffsetbuffer;
+    // Tile counter followed by the per-digit state of every tile
+    Buffer* _tilestatusbuffer;
+
+    VkDescriptorSetLayout _descriptorsetlayout;
+    VkPipelineLayout _layout;
+    VkPipeline _pipeline;
+    VkDescriptorPool _descriptorpool;
+    // Set 0 moves the keys into the alternate buffers, set 1 back
+    std::array<VkDescriptorSet, 2> _descriptorsets;
+
+    void createDescriptorSets();
+    void dispatch(VkCommandBuffer commandBuffer, const PushConstants& pushConstants, uint32_t groupCount);
+public:
+    static bool isSupported(PhysicalDevice* physicalDevice);
+
+    // Sorts the first count pairs by the lowest keyBits bits of the keys, rounded up to whole digits. The keys may
+    // have been written by earlier compute shaders or transfers, the results are visible to later ones.
+    void record(VkCommandBuffer commandBuffer, uint32_t count, uint32_t keyBits = 32);
+
+    RadixSort(VkDevice device, PhysicalDevice* physicalDevice, MemoryAllocator* allocator,
+              Buffer* keys, Buffer* values, uint32_t capacity);
+    ~RadixSort();
+
+    RadixSort(const RadixSort&) = delete;
+    RadixSort& operator=(const RadixSort&) = delete;
+};
+
+// Times the RadixSort and PrefixScan on 1M, 10M, ... elements up to maxCount on the queue and checks their results.
+// Sizes the device has no memory for are skipped. Returns false if a result is wrong.
+bool benchmarkSort(VkDevice device, PhysicalDevice* physicalDevice, MemoryAllocator* allocator, VkQueue queue, uint32_t maxCount);
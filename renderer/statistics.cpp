@@ -0,0 +1,138 @@
+#include "statistics.hpp"
+
+static const uint32_t PASS_REDUCE = 0;
+static const uint32_t PASS_FINISH = 1;
+// Workgroups of the first pass, each loops over the particles. The second pass folds one partial per workgroup.
+static const uint32_t REDUCE_GROUP_COUNT = 1024;
+
+ParticleStatistics::ParticleStatistics(VkDevice device, PhysicalDevice* physicalDevice, MemoryAllocator* allocator,
+                                       const std::vector<Buffer*>& particleBuffers, uint32_t particleCount, uint32_t frameCount)
+: _device(device), _physicaldevice(physicalDevice), _allocator(allocator), _particlecount(particleCount) {
+    _partialbuffer = new Buffer(_device, _physicaldevice, _allocator);
+    _partialbuffer->createOnDevice(sizeof(glm::vec4) * 3 * REDUCE_GROUP_COUNT, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+    _histogrambuffer = new Buffer(_device, _physicaldevice, _allocator);
+    _histogrambuffer->createOnDevice(sizeof(uint32_t) * STATISTICS_HISTOGRAM_BINS,
+                                     VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT);
+    _resultbuffer = new Buffer(_device, _physicaldevice, _allocator);
+    _resultbuffer->createOnDevice(sizeof(Result), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT);
+    _readbackbuffer = new Buffer(_device, _physicaldevice, _allocator);
+    _readbackbuffer->createForReadback(sizeof(Result) * frameCount);
+
+    _pendingframes.resize(frameCount, 0);
+
+    createStoragePipeline(_device, "statistics.comp", "statistics", 4, sizeof(PushConstants),
+                          _descriptorsetlayout, _layout, _pipeline);
+    createDescriptorSets(particleBuffers);
+}
+
+void ParticleStatistics::createDescriptorSets(const std::vector<Buffer*>& particleBuffers) {
+    uint32_t setCount = static_cast<uint32_t>(particleBuffers.size());
+    _descriptorsets.resize(setCount);
+    allocateStorageDescriptorSets(_device, "statistics", _descriptorsetlayout, 4, setCount, _descriptorpool,
+                                  _descriptorsets.data());
+
+    for (uint32_t i = 0; i < setCount; i++) {
+        VkDescriptorBufferInfo particles = {particleBuffers[i]->buffer, 0, sizeof(Particle) * _particlecount};
+        writeStorageDescriptors(_device, _descriptorsets[i], {particles, {_partialbuffer->buffer, 0, VK_WHOLE_SIZE},
+                                                              {_histogrambuffer->buffer, 0, VK_WHOLE_SIZE},
+                                                              {_resultbuffer->buffer, 0, VK_WHOLE_SIZE}});
+    }
+}
+
+void ParticleStatistics::dispatch(VkCommandBuffer commandBuffer, const PushConstants& pushConstants, uint32_t groupCount) {
+    vkCmdPushConstants(commandBuffer, _layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(PushConstants), &pushConstants);
+    vkCmdDispatch(commandBuffer, groupCount, 1, 1);
+
+    VkMemoryBarrier memoryBarrier = {};
+    memoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    memoryBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    memoryBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_TRANSFER_READ_BIT;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         0, 1, &memoryBarrier, 0, nullptr, 0, nullptr);
+}
+
+void ParticleStatistics::collect(uint32_t frame) {
+    if (_pendingframes[frame] == 0) {
+        return;
+    }
+
+    VkDeviceSize offset = sizeof(Result) * frame;
+    _readbackbuffer->invalidate(offset, sizeof(Result));
+    Result result;
+    memcpy(&result, static_cast<char*>(_readbackbuffer->mapping) + offset, sizeof(Result));
+
+    float particleCount = static_cast<float>(_particlecount);
+    _latest.frame = _pendingframes[frame] - 1;
+    _latest.boundsmin = glm::vec3(result.minimum);
+    _latest.boundsmax = glm::vec3(result.maximum);
+    _latest.centreofmass = glm::vec3(result.sums) / glm::vec3(particleCount);
+    _latest.kineticenergy = result.sums.w / particleCount;
+    _latest.maxspeed = result.maximum.w;
+    memcpy(_latest.histogram.data(), result.histogram, sizeof(result.histogram));
+    _available = true;
+    _pendingframes[frame] = 0;
+}
+
+void ParticleStatistics::record(VkCommandBuffer commandBuffer, uint32_t set, uint32_t frame, uint64_t frameNumber) {
+    // The simulation step has just written the particles, and the previous reduction may still read the histogram
+    // and copy the result
+    VkMemoryBarrier memoryBarrier = {};
+    memoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    memoryBarrier.srcAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+    memoryBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         0, 1, &memoryBarrier, 0, nullptr, 0, nullptr);
+
+    vkCmdFillBuffer(commandBuffer, _histogrambuffer->buffer, 0, VK_WHOLE_SIZE, 0);
+
+    memoryBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    memoryBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         0, 1, &memoryBarrier, 0, nullptr, 0, nullptr);
+
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, _pipeline);
+    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, _layout, 0, 1, &_descriptorsets[set], 0, nullptr);
+
+    PushConstants pushConstants = {};
+    pushConstants.particlecount = _particlecount;
+    pushConstants.partialcount = REDUCE_GROUP_COUNT;
+    pushConstants.histogramscale = static_cast<float>(STATISTICS_HISTOGRAM_BINS) / STATISTICS_HISTOGRAM_MAX_SPEED;
+
+    pushConstants.pass = PASS_REDUCE;
+    dispatch(commandBuffer, pushConstants, REDUCE_GROUP_COUNT);
+    pushConstants.pass = PASS_FINISH;
+    dispatch(commandBuffer, pushConstants, 1);
+
+    VkBufferCopy copyRegion = {};
+    copyRegion.dstOffset = sizeof(Result) * frame;
+    copyRegion.size = sizeof(Result);
+    vkCmdCopyBuffer(commandBuffer, _resultbuffer->buffer, _readbackbuffer->buffer, 1, &copyRegion);
+
+    memoryBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    memoryBarrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT,
+                         0, 1, &memoryBarrier, 0, nullptr, 0, nullptr);
+
+    _pendingframes[frame] = frameNumber + 1;
+}
+
+bool ParticleStatistics::getLatest(SimulationStatistics& statistics) {
+    if (_available) {
+        statistics = _latest;
+    }
+    return _available;
+}
+
+ParticleStatistics::~ParticleStatistics() {
+    vkDestroyDescriptorPool(_device, _descriptorpool, nullptr);
+    vkDestroyPipeline(_device, _pipeline, nullptr);
+    vkDestroyPipelineLayout(_device, _layout, nullptr);
+    vkDestroyDescriptorSetLayout(_device, _descriptorsetlayout, nullptr);
+
+    delete _partialbuffer;
+    delete _histogrambuffer;
+    delete _resultbuffer;
+    delete _readbackbuffer;
+}
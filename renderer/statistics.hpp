@@ -0,0 +1,89 @@
+#pragma once
+
+#include "vulkan_tools.hpp"
+#include "pipeline.hpp"
+#include "buffer.hpp"
+
+// Bins of the speed histogram, as in statistics.comp
+const uint32_t STATISTICS_HISTOGRAM_BINS = 64;
+// Upper end of the speed histogram, faster particles are counted in the last bin
+const float STATISTICS_HISTOGRAM_MAX_SPEED = 2.0f * PARTICLE_MAX_SPEED;
+
+// Aggregates over all particles after a simulation step. Every particle carries 1 / N of a unit total mass.
+struct SimulationStatistics {
+    // Frame whose simulation step they describe, see RenderingEngine::getFrameNumber()
+    uint64_t frame;
+    glm::vec3 boundsmin;
+    glm::vec3 boundsmax;
+    glm::vec3 centreofmass;
+    float kineticenergy;
+    float maxspeed;
+    // Particles per speed bin of STATISTICS_HISTOGRAM_MAX_SPEED / STATISTICS_HISTOGRAM_BINS
+    std::array<uint32_t, STATISTICS_HISTOGRAM_BINS> histogram;
+};
+
+// Reduces the particles to bounding box, centre of mass, kinetic energy, largest speed and a speed histogram on
+// the GPU, instead of reading all of them back. A compute pipeline (statistics.comp) reduces within subgroups and
+// then in shared memory into one partial per workgroup, and a second pass folds the partials. The few hundred
+// bytes of results are copied into a host buffer per frame in flight and read once the frame has completed.
+// Needs subgroup arithmetic in compute shaders, see PhysicalDevice::subgrouparithmeticsupported.
+class ParticleStatistics {
+private:
+    struct PushConstants {
+        uint32_t pass;
+        uint32_t particlecount;
+        uint32_t partialcount;
+        float histogramscale;
+    };
+
+    // Layout of the result statistics.comp writes
+    struct Result {
+        glm::vec4 minimum;
+        glm::vec4 maximum;
+        glm::vec4 sums;
+        uint32_t histogram[STATISTICS_HISTOGRAM_BINS];
+    };
+
+    VkDevice _device;
+    PhysicalDevice* _physicaldevice;
+    MemoryAllocator* _allocator;
+    uint32_t _particlecount;
+
+    Buffer* _partialbuffer;
+    Buffer* _histogrambuffer;
+    Buffer* _resultbuffer;
+    // One Result per frame in flight
+    Buffer* _readbackbuffer;
+
+    VkDescriptorSetLayout _descriptorsetlayout;
+    VkPipelineLayout _layout;
+    VkPipeline _pipeline;
+    VkDescriptorPool _descriptorpool;
+    // Set i reads particle storage buffer i
+    std::vector<VkDescriptorSet> _descriptorsets;
+
+    // Frame number + 1 of the result each frame in flight is waiting for, 0 while it has none
+    std::vector<uint64_t> _pendingframes;
+    SimulationStatistics _latest = {};
+    bool _available = false;
+
+    void createDescriptorSets(const std::vector<Buffer*>& particleBuffers);
+    void dispatch(VkCommandBuffer commandBuffer, const PushConstants& pushConstants, uint32_t groupCount);
+public:
+    // Takes over the result of the frame's previous reduction, if it had one. The frame's previous work has to
+    // have completed.
+    void collect(uint32_t frame);
+    // Records the reduction of particle storage buffer `set` after the simulation step that wrote it, with the
+    // result going to the frame's host buffer
+    void record(VkCommandBuffer commandBuffer, uint32_t set, uint32_t frame, uint64_t frameNumber);
+
+    // The newest statistics collected, false before the first ones arrived
+    bool getLatest(SimulationStatistics& statistics);
+
+    ParticleStatistics(VkDevice device, PhysicalDevice* physicalDevice, MemoryAllocator* allocator,
+                       const std::vector<Buffer*>& particleBuffers, uint32_t particleCount, uint32_t frameCount);
+    ~ParticleStatistics();
+
+    ParticleStatistics(const ParticleStatistics&) = delete;
+    ParticleStatistics& operator=(const ParticleStatistics&) = delete;
+};
@@ -0,0 +1,192 @@
+#include "stream.hpp"
+#include "trace.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+
+ParticleStream::ParticleStream(VkDevice device, PhysicalDevice* physicalDevice, MemoryAllocator* allocator,
+                               UploadManager* uploadManager, const std::string& path, uint64_t particleCount, float velocityFactor)
+: _device(device), _physicaldevice(physicalDevice), _allocator(allocator), _uploadmanager(uploadManager),
+  _checkpoint(nullptr), _particles(nullptr), _downloadbuffers(), _writebacks(), timeline(nullptr) {
+    if (!path.empty()) {
+        _checkpoint = new Checkpoint(path, true);
+        _particles = _checkpoint->writableparticles;
+        particlecount = _checkpoint->header.particlecount;
+    } else {
+        _hostparticles.resize(particleCount);
+        Particle::initializeSphere(_hostparticles.data(), _hostparticles.size(), velocityFactor, (uint32_t) time(nullptr));
+        _particles = _hostparticles.data();
+        particlecount = particleCount;
+    }
+    if (particlecount == 0) {
+        throw std::runtime_error("No particles to stream!");
+    }
+
+    chooseChunkCapacity();
+    chunkcount = static_cast<uint32_t>((particlecount + chunkcapacity - 1) / chunkcapacity);
+
+    for (uint32_t slot = 0; slot < STREAM_SLOTS; slot++) {
+        _downloadbuffers[slot] = new Buffer(_device, _physicaldevice, _allocator);
+        _downloadbuffers[slot]->createForReadback(sizeof(Particle) * chunkcapacity);
+    }
+
+    VkSemaphoreTypeCreateInfo semaphoreTypeCreateInfo = {};
+    semaphoreTypeCreateInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+    semaphoreTypeCreateInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+    semaphoreTypeCreateInfo.initialValue = 0;
+
+    VkSemaphoreCreateInfo semaphoreCreateInfo = {};
+    semaphoreCreateInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+    semaphoreCreateInfo.pNext = &semaphoreTypeCreateInfo;
+
+    VkResult semaphore_creation_result = vkCreateSemaphore(_device, &semaphoreCreateInfo, nullptr, &timeline);
+    if (semaphore_creation_result != VK_SUCCESS) {
+        throw vulkan_error("Failed to create stream timeline semaphore!", semaphore_creation_result);
+    }
+
+    printf("Streaming %llu particles in %u chunks of %u\n", static_cast<unsigned long long>(particlecount), chunkcount,
+           chunkcapacity);
+}
+
+// The resident buffers of a chunk take a share of what the device local heaps have left, the largest chunk that
+// fits is used, short of the descriptor range limit
+void ParticleStream::chooseChunkCapacity() {
+    VkPhysicalDeviceMemoryProperties memoryProperties;
+    vkGetPhysicalDeviceMemoryProperties(_physicaldevice->physicaldevice, &memoryProperties);
+    std::vector<MemoryHeapBudget> heapBudgets = _allocator->getBudget();
+
+    VkDeviceSize available = 0;
+    for (uint32_t heap = 0; heap < memoryProperties.memoryHeapCount; heap++) {
+        if ((memoryProperties.memoryHeaps[heap].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) == 0
+            || heapBudgets[heap].budget <= heapBudgets[heap].usage) {
+            continue;
+        }
+        available = std::max(available, heapBudgets[heap].budget - heapBudgets[heap].usage);
+    }
+
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(_physicaldevice->physicaldevice, &properties);
+
+    VkDeviceSize chunkSize = static_cast<VkDeviceSize>(static_cast<double>(available) * STREAM_BUDGET_SHARE) / STREAM_RESIDENT_BUFFERS;
+    chunkSize = std::min({chunkSize, STREAM_MAX_CHUNK_SIZE, static_cast<VkDeviceSize>(properties.limits.maxStorageBufferRange)});
+
+    uint64_t capacity = chunkSize / sizeof(Particle) / 256 * 256;
+    capacity = std::min(capacity, (particlecount + 255) / 256 * 256);
+    if (capacity == 0) {
+        throw std::runtime_error("Not enough device memory to stream particles!");
+    }
+    chunkcapacity = static_cast<uint32_t>(capacity);
+}
+
+uint64_t ParticleStream::getPassCount() {
+    return _passes;
+}
+
+void ParticleStream::wait(uint64_t value) {
+    TraceZone waitZone("wait stream pass");
+    VkSemaphoreWaitInfo waitInfo = {};
+    waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+    waitInfo.semaphoreCount = 1;
+    waitInfo.pSemaphores = &timeline;
+    waitInfo.pValues = &value;
+
+    VkResult semaphore_wait_result = vkWaitSemaphores(_device, &waitInfo, UINT64_MAX);
+    if (semaphore_wait_result != VK_SUCCESS) {
+        throw vulkan_error("Failed to wait for stream timeline semaphore!", semaphore_wait_result);
+    }
+}
+
+void ParticleStream::writeBack(uint32_t slot) {
+    WriteBack& writeBack = _writebacks[slot];
+    if (!writeBack.pending) {
+        return;
+    }
+
+    wait(writeBack.value);
+    TraceZone writeBackZone("stream write back");
+    VkDeviceSize size = sizeof(Particle) * writeBack.count;
+    _downloadbuffers[slot]->invalidate(0, size);
+    memcpy(_particles + writeBack.first, _downloadbuffers[slot]->mapping, size);
+    writeBack.pending = false;
+}
+
+StreamPass ParticleStream::begin(uint32_t chunk, VkBuffer target) {
+    uint32_t slot = static_cast<uint32_t>(_passes % STREAM_SLOTS);
+    if (_passes >= STREAM_SLOTS) {
+        wait(_passes - STREAM_SLOTS + 1);
+    }
+    // This pass downloads into the same buffer
+    writeBack(slot);
+
+    StreamPass pass = {};
+    pass.index = _passes;
+    pass.chunk = chunk;
+    pass.first = static_cast<uint64_t>(chunk) * chunkcapacity;
+    pass.count = static_cast<uint32_t>(std::min<uint64_t>(chunkcapacity, particlecount - pass.first));
+
+    TraceZone uploadZone("stream upload");
+    // Copied through the staging ring in pieces, the transfer queue starts on the first ones while the rest are copied
+    _uploadmanager->upload(target, 0, _particles + pass.first, sizeof(Particle) * pass.count);
+    pass.uploadvalue = _uploadmanager->flush();
+    uploadZone.end();
+
+    _passes++;
+    return pass;
+}
+
+void ParticleStream::recordDownload(VkCommandBuffer commandBuffer, const StreamPass& pass, VkBuffer source) {
+    uint32_t slot = static_cast<uint32_t>(pass.index % STREAM_SLOTS);
+    VkDeviceSize size = sizeof(Particle) * pass.count;
+
+    VkBufferMemoryBarrier sourceBarrier = {};
+    sourceBarrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+    sourceBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    sourceBarrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+    sourceBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    sourceBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    sourceBarrier.buffer = source;
+    sourceBarrier.offset = 0;
+    sourceBarrier.size = size;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+                         0, nullptr, 1, &sourceBarrier, 0, nullptr);
+
+    VkBufferCopy copyRegion = {};
+    copyRegion.size = size;
+    vkCmdCopyBuffer(commandBuffer, source, _downloadbuffers[slot]->buffer, 1, &copyRegion);
+
+    VkBufferMemoryBarrier downloadBarrier = {};
+    downloadBarrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+    downloadBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    downloadBarrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+    downloadBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    downloadBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    downloadBarrier.buffer = _downloadbuffers[slot]->buffer;
+    downloadBarrier.offset = 0;
+    downloadBarrier.size = size;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0,
+                         0, nullptr, 1, &downloadBarrier, 0, nullptr);
+
+    _writebacks[slot] = {pass.index + 1, pass.first, pass.count, true};
+}
+
+void ParticleStream::finish() {
+    if (_passes > 0) {
+        wait(_passes);
+    }
+    for (uint32_t slot = 0; slot < STREAM_SLOTS; slot++) {
+        writeBack(slot);
+    }
+}
+
+ParticleStream::~ParticleStream() {
+    if (timeline) {
+        finish();
+        vkDestroySemaphore(_device, timeline, nullptr);
+    }
+    for (Buffer* downloadBuffer: _downloadbuffers) {
+        delete downloadBuffer;
+    }
+    delete _checkpoint;
+}
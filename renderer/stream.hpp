@@ -0,0 +1,86 @@
+#pragma once
+
+#include "vulkan_tools.hpp"
+#include "pipeline.hpp"
+#include "buffer.hpp"
+#include "upload.hpp"
+#include "checkpoint.hpp"
+
+// Chunks in flight: one is simulated and drawn while the next one is uploaded
+const uint32_t STREAM_SLOTS = 2;
+// Device buffers a chunk passes through, the input and output of one chunk and the input of the next
+const uint32_t STREAM_RESIDENT_BUFFERS = 3;
+// Share of the free device local memory the chunk buffers may take, the rest is left to everything created after them
+const double STREAM_BUDGET_SHARE = 0.5;
+// The host keeps a download buffer per slot, larger chunks gain little once the copies are long
+const VkDeviceSize STREAM_MAX_CHUNK_SIZE = 256 * 1024 * 1024;
+
+// A chunk on its way through the device
+struct StreamPass {
+    // Passes begun before this one, its submission signals index + 1 on the stream's timeline
+    uint64_t index;
+    uint32_t chunk;
+    uint64_t first;
+    uint32_t count;
+    // Upload timeline value the pass's submission has to wait for
+    uint64_t uploadvalue;
+};
+
+// Out-of-core particle state for datasets larger than the device memory. The particles live in host memory, or in
+// the mapping of a checkpoint file that is updated in place, and pass through the device in fixed-size chunks every
+// frame: begin() uploads a chunk on the transfer queue through the UploadManager while the previous chunk is still
+// being simulated and drawn, and the simulated chunk is copied into a host cached download buffer and written back
+// once its slot comes round again. The chunk size follows from the device memory budget.
+class ParticleStream {
+private:
+    struct WriteBack {
+        uint64_t value;
+        uint64_t first;
+        uint32_t count;
+        bool pending;
+    };
+
+    VkDevice _device;
+    PhysicalDevice* _physicaldevice;
+    MemoryAllocator* _allocator;
+    UploadManager* _uploadmanager;
+
+    Checkpoint* _checkpoint;
+    std::vector<Particle> _hostparticles;
+    Particle* _particles;
+
+    std::array<Buffer*, STREAM_SLOTS> _downloadbuffers;
+    std::array<WriteBack, STREAM_SLOTS> _writebacks;
+    uint64_t _passes = 0;
+
+    void chooseChunkCapacity();
+    void wait(uint64_t value);
+    void writeBack(uint32_t slot);
+public:
+    uint64_t particlecount;
+    // Particles per chunk, a multiple of 256 so chunks dispatch whole workgroups
+    uint32_t chunkcapacity;
+    uint32_t chunkcount;
+    // Signalled by the submission of each pass, see StreamPass::index
+    VkSemaphore timeline;
+
+    uint64_t getPassCount();
+
+    // Uploads the chunk into target, which the pass STREAM_SLOTS before this one may have used. Waits for that
+    // pass and writes its simulated chunk back first. The pass uses the command buffer of slot index % STREAM_SLOTS.
+    StreamPass begin(uint32_t chunk, VkBuffer target);
+    // Copies the simulated chunk out of source, which was written by a compute shader. Passes without it leave
+    // the chunk in host memory as it was.
+    void recordDownload(VkCommandBuffer commandBuffer, const StreamPass& pass, VkBuffer source);
+    // Waits for every pass and writes the chunks back
+    void finish();
+
+    // Streams the particles of a checkpoint file when the path is set, otherwise particleCount particles initialized
+    // on a sphere like the resident ones
+    ParticleStream(VkDevice device, PhysicalDevice* physicalDevice, MemoryAllocator* allocator, UploadManager* uploadManager,
+                   const std::string& path, uint64_t particleCount, float velocityFactor);
+    ~ParticleStream();
+
+    ParticleStream(const ParticleStream&) = delete;
+    ParticleStream& operator=(const ParticleStream&) = delete;
+};
@@ -4,7 +4,7 @@ using std::string, std::vector;
 
 void SwapChain::createImage(uint32_t width, uint32_t height, VkSampleCountFlagBits numSamples,
                             VkFormat imageFormat, VkImageTiling tiling, VkImageUsageFlags usage,
-                            VkMemoryPropertyFlags properties, VkImage& image, VkDeviceMemory& imageMemory) {
+                            VkMemoryPropertyFlags properties, VkImage& image, Allocation& imageAllocation) {
     VkImageCreateInfo imageCreateInfo = {};
     imageCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
     imageCreateInfo.imageType = VK_IMAGE_TYPE_2D;
@@ -28,19 +28,9 @@ void SwapChain::createImage(uint32_t width, uint32_t height, VkSampleCountFlagBi
     VkMemoryRequirements imageMemoryRequirements;
     vkGetImageMemoryRequirements(_device, image, &imageMemoryRequirements);
 
-    VkMemoryAllocateInfo imageMemoryAllocationInfo = {};
-    imageMemoryAllocationInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-    imageMemoryAllocationInfo.allocationSize = imageMemoryRequirements.size;
+    imageAllocation = _allocator->allocate(imageMemoryRequirements, properties, ResourceKind::Image);
 
-
-    imageMemoryAllocationInfo.memoryTypeIndex = _physicaldevice->findMemoryType(imageMemoryRequirements.memoryTypeBits, properties);
-
-    VkResult image_memory_allocation_result = vkAllocateMemory(_device, &imageMemoryAllocationInfo, nullptr, &imageMemory);
-    if (image_memory_allocation_result != VK_SUCCESS) {
-        throw vulkan_error("Failed to allocate image memory!", image_memory_allocation_result);
-    }
-
-    vkBindImageMemory(_device, image, imageMemory, 0);
+    vkBindImageMemory(_device, image, imageAllocation.memory, imageAllocation.offset);
 }
 
 VkImageView SwapChain::createImageView(VkImage image, VkFormat imageFormat, VkImageAspectFlags aspectFlags) {
@@ -64,19 +54,41 @@ VkImageView SwapChain::createImageView(VkImage image, VkFormat imageFormat, VkIm
     return imageView;
 }
 
-void SwapChain::create(VkRenderPass renderpass, int framebufferwidth, int framebufferheight) {
+void SwapChain::create(VkRenderPass renderpass, int framebufferwidth, int framebufferheight, SwapChain* previous) {
     extent = _physicaldevice->getSwapExtent(_surface, framebufferwidth, framebufferheight);
     format = _physicaldevice->swapsurfaceformat.format;
     depthformat = _physicaldevice->findDepthFormat();
 
-    createSwapChain();
+    createSwapChain(previous ? previous->swapchain : VK_NULL_HANDLE);
     createImageViews();
-    createColorResources();
-    createDepthResources();
-    createFramebuffers(renderpass);
+
+    // Frames of the previous swap chain still in flight render into the same attachments, in submission order
+    bool sameAttachments = previous && previous->_ownsattachments && previous->extent.width == extent.width
+                           && previous->extent.height == extent.height && previous->format == format
+                           && previous->depthformat == depthformat;
+    if (sameAttachments) {
+        colorimage = previous->colorimage;
+        colorimageallocation = previous->colorimageallocation;
+        colorimageview = previous->colorimageview;
+        depthimage = previous->depthimage;
+        depthimageallocation = previous->depthimageallocation;
+        depthimageview = previous->depthimageview;
+        sceneimage = previous->sceneimage;
+        sceneimageallocation = previous->sceneimageallocation;
+        sceneimageview = previous->sceneimageview;
+        previous->_ownsattachments = false;
+    } else {
+        createColorResources();
+        createDepthResources();
+        createSceneResources();
+    }
+    _ownsattachments = true;
+    blitfilter = selectBlitFilter();
+
+    createFramebuffer(renderpass);
 }
 
-void SwapChain::createSwapChain() {
+void SwapChain::createSwapChain(VkSwapchainKHR oldSwapchain) {
     const SwapChainSupportDetails& swapChainSupportDetails = _physicaldevice->swapchainsupport;
 
     uint32_t imageCount = swapChainSupportDetails.capabilities.minImageCount + 1;
@@ -92,7 +104,11 @@ void SwapChain::createSwapChain() {
     swapChainCreateInfo.imageExtent = extent;
     swapChainCreateInfo.minImageCount = imageCount;
     swapChainCreateInfo.imageArrayLayers = 1;
-    swapChainCreateInfo.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+    // Written by the blit from the scene image only
+    if (!(swapChainSupportDetails.capabilities.supportedUsageFlags & VK_IMAGE_USAGE_TRANSFER_DST_BIT)) {
+        throw std::runtime_error("The surface does not support transfers into swap chain images!");
+    }
+    swapChainCreateInfo.imageUsage = VK_IMAGE_USAGE_TRANSFER_DST_BIT;
 
     const QueueFamilyIndices& queueFamilyIndices = _physicaldevice->queuefamilies;
     uint32_t queueFamilyIndexValues[] = {queueFamilyIndices.graphicsComputeFamily.value(), queueFamilyIndices.presentFamily.value()};
@@ -114,7 +130,8 @@ void SwapChain::createSwapChain() {
     swapChainCreateInfo.presentMode = _physicaldevice->swappresentmode;
     swapChainCreateInfo.clipped = VK_TRUE;
 
-    swapChainCreateInfo.oldSwapchain = VK_NULL_HANDLE;
+    // Lets the presentation engine reuse the old images, which also keeps presenting while the new ones are set up
+    swapChainCreateInfo.oldSwapchain = oldSwapchain;
 
     VkResult swapchain_creation_result = vkCreateSwapchainKHR(_device, &swapChainCreateInfo, nullptr, &swapchain);
     if (swapchain_creation_result != VK_SUCCESS) {
@@ -140,64 +157,120 @@ void SwapChain::createColorResources() {
 
     createImage(extent.width, extent.height, _physicaldevice->msaasamples, colorFormat,
                 VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT | VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT,
-                VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, colorimage, colorimagememory);
+                VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, colorimage, colorimageallocation);
     colorimageview = createImageView(colorimage, colorFormat, VK_IMAGE_ASPECT_COLOR_BIT);
 }
 
 void SwapChain::createDepthResources() {
     createImage(extent.width, extent.height, _physicaldevice->msaasamples, depthformat,
                 VK_IMAGE_TILING_OPTIMAL,VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT,
-                VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,depthimage, depthimagememory);
+                VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,depthimage, depthimageallocation);
     depthimageview = createImageView(depthimage, depthformat, VK_IMAGE_ASPECT_DEPTH_BIT);
 }
 
-void SwapChain::createFramebuffers(VkRenderPass renderpass) {
-    framebuffers.resize(imageviews.size());
+void SwapChain::createSceneResources() {
+    createImage(extent.width, extent.height, VK_SAMPLE_COUNT_1_BIT, format,
+                VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
+                VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, sceneimage, sceneimageallocation);
+    sceneimageview = createImageView(sceneimage, format, VK_IMAGE_ASPECT_COLOR_BIT);
+}
+
+void SwapChain::createFramebuffer(VkRenderPass renderpass) {
+    std::array<VkImageView, 3> framebufferAttachments = {
+            colorimageview,
+            depthimageview,
+            sceneimageview
+    };
+
+    VkFramebufferCreateInfo framebufferCreateInfo = {};
+    framebufferCreateInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+    framebufferCreateInfo.renderPass = renderpass;
+    framebufferCreateInfo.attachmentCount = static_cast<uint32_t>(framebufferAttachments.size());
+    framebufferCreateInfo.pAttachments = framebufferAttachments.data();
+    framebufferCreateInfo.width = extent.width;
+    framebufferCreateInfo.height = extent.height;
+    framebufferCreateInfo.layers = 1;
+
+    VkResult framebuffer_creation_result = vkCreateFramebuffer(_device, &framebufferCreateInfo, nullptr, &framebuffer);
+    if (framebuffer_creation_result != VK_SUCCESS) {
+        throw vulkan_error("Failed to create a framebuffer!", framebuffer_creation_result);
+    }
+}
 
-    for (size_t i = 0; i < imageviews.size(); i++) {
-        std::array<VkImageView, 3> framebufferAttachments = {
-                colorimageview,
-                depthimageview,
-                imageviews[i]
-        };
-
-        VkFramebufferCreateInfo framebufferCreateInfo = {};
-        framebufferCreateInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
-        framebufferCreateInfo.renderPass = renderpass;
-        framebufferCreateInfo.attachmentCount = static_cast<uint32_t>(framebufferAttachments.size());
-        framebufferCreateInfo.pAttachments = framebufferAttachments.data();
-        framebufferCreateInfo.width = extent.width;
-        framebufferCreateInfo.height = extent.height;
-        framebufferCreateInfo.layers = 1;
-
-        VkResult framebuffer_creation_result = vkCreateFramebuffer(_device, &framebufferCreateInfo, nullptr, &framebuffers[i]);
-        if (framebuffer_creation_result != VK_SUCCESS) {
-            throw vulkan_error("Failed to create a framebuffer!", framebuffer_creation_result);
-        }
+// Linear filtering when the format supports it, nearest neighbour otherwise
+VkFilter SwapChain::selectBlitFilter() {
+    VkFormatProperties formatProperties;
+    vkGetPhysicalDeviceFormatProperties(_physicaldevice->physicaldevice, format, &formatProperties);
+
+    VkFormatFeatureFlags blitFeatures = VK_FORMAT_FEATURE_BLIT_SRC_BIT | VK_FORMAT_FEATURE_BLIT_DST_BIT;
+    if ((formatProperties.optimalTilingFeatures & blitFeatures) != blitFeatures) {
+        throw std::runtime_error("The swap chain format does not support blits!");
     }
+    if (formatProperties.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT) {
+        return VK_FILTER_LINEAR;
+    }
+    return VK_FILTER_NEAREST;
+}
+
+void SwapChain::recordBlit(VkCommandBuffer commandBuffer, uint32_t imageIndex, VkExtent2D renderExtent) {
+    VkImageMemoryBarrier imageBarrier = {};
+    imageBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    imageBarrier.srcAccessMask = 0;
+    imageBarrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    imageBarrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    imageBarrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    imageBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    imageBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    imageBarrier.image = images[imageIndex];
+    imageBarrier.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1};
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         0, 0, nullptr, 0, nullptr, 1, &imageBarrier);
+
+    VkImageBlit blit = {};
+    blit.srcSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1};
+    blit.srcOffsets[1] = {static_cast<int32_t>(renderExtent.width), static_cast<int32_t>(renderExtent.height), 1};
+    blit.dstSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1};
+    blit.dstOffsets[1] = {static_cast<int32_t>(extent.width), static_cast<int32_t>(extent.height), 1};
+
+    VkFilter filter = renderExtent.width == extent.width && renderExtent.height == extent.height ? VK_FILTER_NEAREST : blitfilter;
+    vkCmdBlitImage(commandBuffer, sceneimage, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                   images[imageIndex], VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &blit, filter);
+
+    imageBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    imageBarrier.dstAccessMask = 0;
+    imageBarrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    imageBarrier.newLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+                         0, 0, nullptr, 0, nullptr, 1, &imageBarrier);
 }
 
 SwapChain::SwapChain()
-: _device(nullptr), _surface(nullptr), _physicaldevice(nullptr), swapchain(nullptr) {};
+: _device(nullptr), _surface(nullptr), _physicaldevice(nullptr), _allocator(nullptr), swapchain(nullptr), framebuffer(nullptr) {};
 
-SwapChain::SwapChain(VkDevice device, VkSurfaceKHR surface, PhysicalDevice* physicalDevice)
-: _device(device), _surface(surface), _physicaldevice(physicalDevice), swapchain(nullptr) {};
+SwapChain::SwapChain(VkDevice device, VkSurfaceKHR surface, PhysicalDevice* physicalDevice, MemoryAllocator* allocator)
+: _device(device), _surface(surface), _physicaldevice(physicalDevice), _allocator(allocator), swapchain(nullptr), framebuffer(nullptr) {};
 
 SwapChain::~SwapChain() {
-    for (VkFramebuffer& framebuffer: framebuffers) {
+    if (framebuffer) {
         vkDestroyFramebuffer(_device, framebuffer, nullptr);
     }
     for (VkImageView& imageView: imageviews) {
         vkDestroyImageView(_device, imageView, nullptr);
     }
 
-    vkDestroyImageView(_device, colorimageview, nullptr);
-    vkDestroyImage(_device, colorimage, nullptr);
-    vkFreeMemory(_device, colorimagememory, nullptr);
+    if (_ownsattachments) {
+        vkDestroyImageView(_device, colorimageview, nullptr);
+        vkDestroyImage(_device, colorimage, nullptr);
+        _allocator->free(colorimageallocation);
 
-    vkDestroyImageView(_device, depthimageview, nullptr);
-    vkDestroyImage(_device, depthimage, nullptr);
-    vkFreeMemory(_device, depthimagememory, nullptr);
+        vkDestroyImageView(_device, depthimageview, nullptr);
+        vkDestroyImage(_device, depthimage, nullptr);
+        _allocator->free(depthimageallocation);
+
+        vkDestroyImageView(_device, sceneimageview, nullptr);
+        vkDestroyImage(_device, sceneimage, nullptr);
+        _allocator->free(sceneimageallocation);
+    }
 
     vkDestroySwapchainKHR(_device, swapchain, nullptr);
 }
\ No newline at end of file
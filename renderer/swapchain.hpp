@@ -2,23 +2,30 @@
 
 #include "vulkan_tools.hpp"
 #include "physicaldevice.hpp"
+#include "memory.hpp"
 
 class SwapChain {
 private:
     VkDevice _device;
     VkSurfaceKHR _surface;
     PhysicalDevice* _physicaldevice;
+    MemoryAllocator* _allocator;
 
     void createImage(uint32_t width, uint32_t height, VkSampleCountFlagBits numSamples, VkFormat imageFormat,
                      VkImageTiling tiling, VkImageUsageFlags usage, VkMemoryPropertyFlags properties,
-                     VkImage& image, VkDeviceMemory& imageMemory);
+                     VkImage& image, Allocation& imageAllocation);
     VkImageView createImageView(VkImage image, VkFormat imageFormat, VkImageAspectFlags aspectFlags);
 
-    void createSwapChain();
+    // False once the colour, depth and scene attachments were handed on to a successor
+    bool _ownsattachments = false;
+
+    void createSwapChain(VkSwapchainKHR oldSwapchain);
     void createImageViews();
     void createColorResources();
     void createDepthResources();
-    void createFramebuffers(VkRenderPass renderpass);
+    void createSceneResources();
+    void createFramebuffer(VkRenderPass renderpass);
+    VkFilter selectBlitFilter();
 
 public:
     VkSwapchainKHR swapchain;
@@ -26,21 +33,36 @@ public:
     VkExtent2D extent;
     std::vector<VkImage> images;
     std::vector<VkImageView> imageviews;
-    std::vector<VkFramebuffer> framebuffers;
+    // Renders into the scene image rather than the presentable images, so one framebuffer serves all of them
+    VkFramebuffer framebuffer;
 
     VkFormat depthformat;
     VkImage depthimage;
     VkImageView depthimageview;
-    VkDeviceMemory depthimagememory;
+    Allocation depthimageallocation;
 
     VkImage colorimage;
-    VkDeviceMemory colorimagememory;
+    Allocation colorimageallocation;
     VkImageView colorimageview;
 
-    void create(VkRenderPass renderpass, int framebufferWidth, int framebufferHeight);
+    // Single sampled target the multisampled colour resolves into, at the full extent. Frames may render into a
+    // smaller part of it, which is scaled up into the presentable image.
+    VkImage sceneimage;
+    Allocation sceneimageallocation;
+    VkImageView sceneimageview;
+    VkFilter blitfilter;
+
+    // With a previous swap chain its presentable images are recycled through oldSwapchain, and its colour and depth
+    // attachments are taken over when the extent has not changed. The previous one stays valid for the frames
+    // still using it and is deleted once they have retired.
+    void create(VkRenderPass renderpass, int framebufferWidth, int framebufferHeight, SwapChain* previous = nullptr);
+
+    // Scales the rendered area of the scene image up into a presentable image and leaves it ready to present.
+    // Recorded after the render pass, the image's acquire semaphore has to be waited for at the transfer stage.
+    void recordBlit(VkCommandBuffer commandBuffer, uint32_t imageIndex, VkExtent2D renderExtent);
 
     SwapChain();
-    SwapChain(VkDevice device, VkSurfaceKHR surface, PhysicalDevice* physicalDevice);
+    SwapChain(VkDevice device, VkSurfaceKHR surface, PhysicalDevice* physicalDevice, MemoryAllocator* allocator);
 
     ~SwapChain();
 };
\ No newline at end of file
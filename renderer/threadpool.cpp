@@ -0,0 +1,150 @@
+#include "threadpool.hpp"
+
+#include <algorithm>
+
+ThreadPool::ThreadPool(size_t threadCount) {
+    threadCount = std::max<size_t>(threadCount, 1);
+    for (size_t i = 0; i < threadCount; i++) {
+        _workers.emplace_back(&ThreadPool::work, this);
+    }
+}
+
+void ThreadPool::work() {
+    while (true) {
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _taskavailable.wait(lock, [this]() { return _stopping || !_tasks.empty(); });
+            if (_tasks.empty()) {
+                return;
+            }
+            task = std::move(_tasks.front());
+            _tasks.pop_front();
+        }
+        task();
+    }
+}
+
+bool ParallelForState::next(size_t participant, size_t& first, size_t& last) {
+    Range& range = ranges[participant];
+    std::lock_guard<std::mutex> lock(range.mutex);
+    if (range.begin == range.end) {
+        return false;
+    }
+    first = range.begin;
+    last = std::min(range.end, range.begin + grain);
+    range.begin = last;
+    return true;
+}
+
+// Moves the back half of the fullest other range into the participant's own range
+bool ParallelForState::steal(size_t participant) {
+    size_t victim = participant;
+    size_t victimSize = 0;
+    for (size_t i = 0; i < participants; i++) {
+        std::lock_guard<std::mutex> lock(ranges[i].mutex);
+        if (ranges[i].end - ranges[i].begin > victimSize) {
+            victim = i;
+            victimSize = ranges[i].end - ranges[i].begin;
+        }
+    }
+    if (victimSize == 0) {
+        return false;
+    }
+
+    size_t first, last;
+    {
+        std::lock_guard<std::mutex> lock(ranges[victim].mutex);
+        size_t size = ranges[victim].end - ranges[victim].begin;
+        if (size == 0) {
+            return true;
+        }
+        // Larger ranges are split, a single chunk is taken whole. Its owner may be busy with another task and never
+        // get to it, and parallelFor must not wait for that.
+        size_t stolen = size > grain ? size / 2 : size;
+        last = ranges[victim].end;
+        first = last - stolen;
+        ranges[victim].end = first;
+    }
+
+    std::lock_guard<std::mutex> lock(ranges[participant].mutex);
+    ranges[participant].begin = first;
+    ranges[participant].end = last;
+    return true;
+}
+
+void ParallelForState::run(size_t participant) {
+    while (true) {
+        size_t first, last;
+        if (!next(participant, first, last)) {
+            if (!steal(participant)) {
+                return;
+            }
+            continue;
+        }
+
+        try {
+            body(first, last);
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!error) {
+                error = std::current_exception();
+            }
+        }
+
+        if (remaining.fetch_sub(last - first) == last - first) {
+            std::lock_guard<std::mutex> lock(mutex);
+            finished.notify_all();
+        }
+    }
+}
+
+void ThreadPool::parallelFor(size_t begin, size_t end, size_t grain, const std::function<void(size_t, size_t)>& body) {
+    if (begin >= end) {
+        return;
+    }
+
+    // Workers that only get to their task after everything is done find nothing left and return, the state
+    // is shared so they can still look at it after parallelFor has returned
+    auto state = std::make_shared<ParallelForState>();
+    state->participants = _workers.size() + 1;
+    state->ranges.reset(new ParallelForState::Range[state->participants]);
+    state->grain = std::max<size_t>(grain, 1);
+    state->body = body;
+    state->remaining = end - begin;
+
+    size_t count = end - begin;
+    for (size_t i = 0; i < state->participants; i++) {
+        state->ranges[i].begin = begin + count * i / state->participants;
+        state->ranges[i].end = begin + count * (i + 1) / state->participants;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        for (size_t i = 0; i < _workers.size(); i++) {
+            _tasks.push_back([state, i]() { state->run(i); });
+        }
+    }
+    _taskavailable.notify_all();
+
+    state->run(_workers.size());
+
+    std::unique_lock<std::mutex> lock(state->mutex);
+    state->finished.wait(lock, [&state]() { return state->remaining == 0; });
+    if (state->error) {
+        std::rethrow_exception(state->error);
+    }
+}
+
+// Tasks still queued are run before the workers exit
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stopping = true;
+    }
+    _taskavailable.notify_all();
+
+    for (std::thread& worker: _workers) {
+        worker.join();
+    }
+}
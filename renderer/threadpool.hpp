@@ -0,0 +1,74 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Shared by the participants of one parallelFor. Every participant owns a range it works through front
+// to back and steals the back half of another range once its own is empty.
+struct ParallelForState {
+    struct alignas(64) Range {
+        std::mutex mutex;
+        size_t begin;
+        size_t end;
+    };
+
+    std::unique_ptr<Range[]> ranges;
+    size_t participants;
+    size_t grain;
+    std::function<void(size_t, size_t)> body;
+
+    std::atomic<size_t> remaining;
+    std::mutex mutex;
+    std::condition_variable finished;
+    std::exception_ptr error;
+
+    bool next(size_t participant, size_t& first, size_t& last);
+    bool steal(size_t participant);
+    void run(size_t participant);
+};
+
+// Fixed set of worker threads running tasks in submission order
+class ThreadPool {
+private:
+    std::vector<std::thread> _workers;
+    std::deque<std::function<void()>> _tasks;
+    std::mutex _mutex;
+    std::condition_variable _taskavailable;
+    bool _stopping = false;
+
+    void work();
+public:
+    template<typename Task>
+    std::future<typename std::invoke_result<Task>::type> submit(Task task) {
+        using Result = typename std::invoke_result<Task>::type;
+
+        auto packagedTask = std::make_shared<std::packaged_task<Result()>>(std::move(task));
+        std::future<Result> result = packagedTask->get_future();
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _tasks.push_back([packagedTask]() { (*packagedTask)(); });
+        }
+        _taskavailable.notify_one();
+
+        return result;
+    }
+
+    // Calls body(first, last) on chunks of about grain elements covering [begin, end), on the workers and the
+    // calling thread. Workers that are busy with other tasks have their share stolen, so this never waits for them.
+    void parallelFor(size_t begin, size_t end, size_t grain, const std::function<void(size_t, size_t)>& body);
+
+    size_t size() const {
+        return _workers.size();
+    }
+
+    ThreadPool(size_t threadCount = std::thread::hardware_concurrency());
+    ~ThreadPool();
+};
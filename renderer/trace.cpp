@@ -0,0 +1,138 @@
+#include "trace.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+
+static_assert((TRACE_RING_CAPACITY & (TRACE_RING_CAPACITY - 1)) == 0, "The ring capacity has to be a power of two");
+
+// Rings stay registered after their thread exits, so its last events can still be collected. The mutex is only
+// taken when a thread records its first event and by the collector.
+static std::mutex traceRingsMutex;
+static std::vector<std::unique_ptr<TraceRing>> traceRings;
+static thread_local TraceRing* threadTraceRing = nullptr;
+
+uint64_t traceClock() {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+void setTracingEnabled(bool enabled) {
+    tracingenabled.store(enabled, std::memory_order_relaxed);
+}
+
+static TraceRing* registerTraceRing() {
+    std::lock_guard<std::mutex> lock(traceRingsMutex);
+    std::unique_ptr<TraceRing> ring = std::make_unique<TraceRing>();
+    ring->thread = static_cast<uint32_t>(traceRings.size());
+    ring->head.store(0, std::memory_order_relaxed);
+    ring->tail.store(0, std::memory_order_relaxed);
+    ring->droppedevents.store(0, std::memory_order_relaxed);
+    traceRings.push_back(std::move(ring));
+    return traceRings.back().get();
+}
+
+void recordTraceEvent(const char* name, uint64_t start, uint64_t end) {
+    TraceRing* ring = threadTraceRing;
+    if (!ring) {
+        ring = registerTraceRing();
+        threadTraceRing = ring;
+    }
+
+    uint64_t head = ring->head.load(std::memory_order_relaxed);
+    if (head - ring->tail.load(std::memory_order_acquire) >= TRACE_RING_CAPACITY) {
+        ring->droppedevents.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    ring->events[head & (TRACE_RING_CAPACITY - 1)] = {name, start, end};
+    ring->head.store(head + 1, std::memory_order_release);
+}
+
+TraceCollector::TraceCollector(bool keepEvents) : _keepevents(keepEvents), _origin(traceClock()) {
+    setTracingEnabled(true);
+}
+
+void TraceCollector::collect() {
+    std::lock_guard<std::mutex> lock(traceRingsMutex);
+    for (std::unique_ptr<TraceRing>& ring: traceRings) {
+        uint64_t tail = ring->tail.load(std::memory_order_relaxed);
+        uint64_t head = ring->head.load(std::memory_order_acquire);
+        for (; tail < head; tail++) {
+            const TraceEvent& event = ring->events[tail & (TRACE_RING_CAPACITY - 1)];
+
+            ZoneWindow& zone = _zones[event.name];
+            double milliseconds = static_cast<double>(event.end - event.start) * 1e-6;
+            if (zone.durations.size() < TRACE_SUMMARY_WINDOW) {
+                zone.durations.push_back(milliseconds);
+            } else {
+                zone.durations[zone.count % TRACE_SUMMARY_WINDOW] = milliseconds;
+            }
+            zone.count++;
+
+            if (_keepevents) {
+                if (_events.size() < TRACE_MAX_EXPORTED_EVENTS) {
+                    _events.emplace_back(ring->thread, event);
+                } else {
+                    droppedevents++;
+                }
+            }
+        }
+        ring->tail.store(head, std::memory_order_release);
+        droppedevents += ring->droppedevents.exchange(0, std::memory_order_relaxed);
+    }
+}
+
+std::vector<TraceZoneSummary> TraceCollector::getSummary() {
+    std::vector<TraceZoneSummary> summary;
+    for (const auto& [name, zone]: _zones) {
+        std::vector<double> durations = zone.durations;
+        if (durations.empty()) {
+            continue;
+        }
+
+        // Nearest rank percentiles of the window
+        auto percentile = [&durations](double fraction) {
+            size_t rank = static_cast<size_t>(fraction * static_cast<double>(durations.size() - 1) + 0.5);
+            std::nth_element(durations.begin(), durations.begin() + rank, durations.end());
+            return durations[rank];
+        };
+
+        TraceZoneSummary zoneSummary = {};
+        zoneSummary.name = name;
+        zoneSummary.count = zone.count;
+        zoneSummary.p50 = percentile(0.5);
+        zoneSummary.p99 = percentile(0.99);
+        zoneSummary.maximum = *std::max_element(durations.begin(), durations.end());
+        summary.push_back(zoneSummary);
+    }
+    return summary;
+}
+
+void TraceCollector::writeChromeTrace(const std::string& path) {
+    FILE* file = fopen(path.c_str(), "w");
+    if (!file) {
+        throw std::runtime_error("Failed to open trace file " + path + "!");
+    }
+
+    // The names are string literals of the engine, nothing in them needs escaping
+    fprintf(file, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+    for (size_t i = 0; i < _events.size(); i++) {
+        const auto& [thread, event] = _events[i];
+        fprintf(file, "{\"name\": \"%s\", \"ph\": \"X\", \"pid\": 0, \"tid\": %u, \"ts\": %.3f, \"dur\": %.3f}%s\n",
+                event.name, thread, static_cast<double>(event.start - _origin) * 1e-3,
+                static_cast<double>(event.end - event.start) * 1e-3, i + 1 < _events.size() ? "," : "");
+    }
+    fprintf(file, "]}\n");
+
+    bool failed = ferror(file) != 0;
+    if (fclose(file) != 0 || failed) {
+        throw std::runtime_error("Failed to write trace file " + path + "!");
+    }
+}
+
+TraceCollector::~TraceCollector() {
+    setTracingEnabled(false);
+}
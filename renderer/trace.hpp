@@ -0,0 +1,113 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+// Events each thread's ring holds, a power of two. A frame records a few dozen, so the ring covers seconds of frames
+// between two collections.
+const uint32_t TRACE_RING_CAPACITY = 16384;
+// Durations of each zone the rolling percentiles are taken over
+const uint32_t TRACE_SUMMARY_WINDOW = 512;
+// Events kept for the Chrome trace, about 24 MB. Later ones still go into the summary.
+const size_t TRACE_MAX_EXPORTED_EVENTS = 1 << 20;
+
+// One completed zone on one thread, traceClock() nanoseconds
+struct TraceEvent {
+    // A string literal, it outlives every ring
+    const char* name;
+    uint64_t start;
+    uint64_t end;
+};
+
+// Events of one thread. Only that thread writes events and stores head, only the collector stores tail, so neither
+// side locks. Head and tail sit on their own cache lines like the control ring's.
+struct TraceRing {
+    // Registration order, the Chrome trace's thread id
+    uint32_t thread;
+    alignas(64) std::atomic<uint64_t> head;
+    alignas(64) std::atomic<uint64_t> tail;
+    // Written when the collector fell behind, counted instead of blocking the thread
+    std::atomic<uint64_t> droppedevents;
+    std::array<TraceEvent, TRACE_RING_CAPACITY> events;
+};
+
+// Monotonic nanoseconds (steady_clock)
+uint64_t traceClock();
+
+// Zones only record while tracing is enabled, disabled zones cost an atomic load and a branch
+void setTracingEnabled(bool enabled);
+inline std::atomic<bool> tracingenabled(false);
+
+// Appends an event to the calling thread's ring, registering the ring on the thread's first event
+void recordTraceEvent(const char* name, uint64_t start, uint64_t end);
+
+// Times the scope it lives in, or up to end() for phases of a longer function. The name has to be a string literal.
+class TraceZone {
+private:
+    const char* _name;
+    // 0 when tracing was disabled at the start, or once ended
+    uint64_t _start;
+public:
+    explicit TraceZone(const char* name)
+    : _name(name), _start(tracingenabled.load(std::memory_order_relaxed) ? traceClock() : 0) {
+    }
+
+    void end() {
+        if (_start != 0) {
+            recordTraceEvent(_name, _start, traceClock());
+            _start = 0;
+        }
+    }
+
+    ~TraceZone() {
+        end();
+    }
+
+    TraceZone(const TraceZone&) = delete;
+    TraceZone& operator=(const TraceZone&) = delete;
+};
+
+// Rolling statistics of one zone, in milliseconds
+struct TraceZoneSummary {
+    std::string name;
+    // Events since tracing was enabled
+    uint64_t count;
+    // Over the last TRACE_SUMMARY_WINDOW events
+    double p50;
+    double p99;
+    double maximum;
+};
+
+// Drains the rings of every thread, on one thread at a time. Creating it enables tracing and destroying it disables it.
+class TraceCollector {
+private:
+    struct ZoneWindow {
+        uint64_t count = 0;
+        std::vector<double> durations;
+    };
+
+    std::map<std::string, ZoneWindow> _zones;
+    bool _keepevents;
+    std::vector<std::pair<uint32_t, TraceEvent>> _events;
+    uint64_t _origin;
+public:
+    // Events dropped by full rings or beyond TRACE_MAX_EXPORTED_EVENTS
+    uint64_t droppedevents = 0;
+
+    // Moves the events recorded since the last call into the summary, and into the Chrome trace when kept
+    void collect();
+    std::vector<TraceZoneSummary> getSummary();
+    // Complete events ("ph": "X") with microsecond timestamps, for chrome://tracing and Perfetto
+    void writeChromeTrace(const std::string& path);
+
+    // keepEvents keeps the collected events for writeChromeTrace()
+    explicit TraceCollector(bool keepEvents);
+    ~TraceCollector();
+
+    TraceCollector(const TraceCollector&) = delete;
+    TraceCollector& operator=(const TraceCollector&) = delete;
+};
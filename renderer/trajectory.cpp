@@ -0,0 +1,419 @@
+#include "trajectory.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstddef>
+#include <limits>
+
+using std::vector, std::string;
+
+static const size_t COMPONENTS_PER_PARTICLE = 6;
+
+static int32_t quantize(float value, double scale) {
+    double scaled = std::round(static_cast<double>(value) * scale);
+    scaled = std::clamp(scaled, static_cast<double>(std::numeric_limits<int32_t>::min()),
+                        static_cast<double>(std::numeric_limits<int32_t>::max()));
+    return static_cast<int32_t>(scaled);
+}
+
+// Small deltas of either sign become small unsigned numbers, which take few varint bytes
+static void writeVarint(vector<uint8_t>& output, int64_t value) {
+    uint64_t zigzag = (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63);
+    while (zigzag >= 0x80) {
+        output.push_back(static_cast<uint8_t>(zigzag | 0x80));
+        zigzag >>= 7;
+    }
+    output.push_back(static_cast<uint8_t>(zigzag));
+}
+
+static int64_t readVarint(const uint8_t*& input, const uint8_t* end) {
+    uint64_t zigzag = 0;
+    for (uint32_t shift = 0; shift < 64; shift += 7) {
+        if (input == end) {
+            throw std::runtime_error("Trajectory slice is truncated!");
+        }
+        uint8_t byte = *input++;
+        zigzag |= static_cast<uint64_t>(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            return static_cast<int64_t>(zigzag >> 1) ^ -static_cast<int64_t>(zigzag & 1);
+        }
+    }
+    throw std::runtime_error("Trajectory slice is corrupt!");
+}
+
+
+TrajectoryRecorder::TrajectoryRecorder(const string& path, uint64_t particleCount, uint32_t keyframeInterval, ThreadPool* threadPool)
+: _header(), _threadpool(threadPool) {
+    _file.open(path, std::ios::binary | std::ios::trunc);
+    if (!_file.is_open()) {
+        throw std::runtime_error("Failed to open " + path + "!");
+    }
+
+    memcpy(_header.magic, TRAJECTORY_MAGIC, sizeof(TRAJECTORY_MAGIC));
+    _header.version = TRAJECTORY_VERSION;
+    _header.headersize = sizeof(TrajectoryHeader);
+    _header.particlecount = particleCount;
+    _header.sliceparticles = TRAJECTORY_SLICE_PARTICLES;
+    _header.keyframeinterval = std::max<uint32_t>(keyframeInterval, 1);
+    _header.positionscale = TRAJECTORY_POSITION_SCALE;
+    _header.velocityscale = TRAJECTORY_VELOCITY_SCALE;
+    _file.write(reinterpret_cast<const char*>(&_header), sizeof(_header));
+
+    _previous.resize(particleCount * COMPONENTS_PER_PARTICLE);
+
+    _writer = std::thread(&TrajectoryRecorder::write, this);
+}
+
+bool TrajectoryRecorder::busy() {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _pendingframes.size() >= TRAJECTORY_MAX_PENDING_FRAMES;
+}
+
+void TrajectoryRecorder::addFrame(uint64_t frame, std::shared_ptr<const ReadbackResult> snapshot) {
+    if (snapshot->size < _header.particlecount * sizeof(Particle)) {
+        droppedframes++;
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (_closing || _pendingframes.size() >= TRAJECTORY_MAX_PENDING_FRAMES) {
+            droppedframes++;
+            return;
+        }
+        _pendingframes.push_back({frame, std::move(snapshot)});
+    }
+    _frameavailable.notify_one();
+}
+
+// Every slice only touches its own part of _previous, so the slices of a frame can be encoded in parallel.
+// Frames themselves are encoded one after another by the writer thread.
+vector<uint8_t> TrajectoryRecorder::encodeSlice(const std::byte* particles, uint64_t first, uint64_t count, bool keyframe) {
+    vector<uint8_t> output;
+    output.reserve(count * COMPONENTS_PER_PARTICLE * 2);
+
+    for (uint64_t i = first; i < first + count; i++) {
+        const std::byte* particle = particles + i * sizeof(Particle);
+        float components[COMPONENTS_PER_PARTICLE];
+        memcpy(&components[0], particle + offsetof(Particle, position), 3 * sizeof(float));
+        memcpy(&components[3], particle + offsetof(Particle, velocity), 3 * sizeof(float));
+
+        int32_t* previous = &_previous[i * COMPONENTS_PER_PARTICLE];
+        for (size_t c = 0; c < COMPONENTS_PER_PARTICLE; c++) {
+            int32_t quantized = quantize(components[c], c < 3 ? _header.positionscale : _header.velocityscale);
+            int64_t reference = keyframe ? 0 : previous[c];
+            writeVarint(output, static_cast<int64_t>(quantized) - reference);
+            previous[c] = quantized;
+        }
+    }
+
+    return output;
+}
+
+void TrajectoryRecorder::write() {
+    uint64_t sliceCount = (_header.particlecount + _header.sliceparticles - 1) / _header.sliceparticles;
+
+    while (true) {
+        PendingFrame pending;
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _frameavailable.wait(lock, [this]() { return _closing || !_pendingframes.empty(); });
+            if (_pendingframes.empty()) {
+                return;
+            }
+            pending = _pendingframes.front();
+        }
+
+        bool keyframe = _recordedframes % _header.keyframeinterval == 0;
+
+        vector<std::future<vector<uint8_t>>> encodedSlices;
+        for (uint64_t slice = 0; slice < sliceCount; slice++) {
+            uint64_t first = slice * _header.sliceparticles;
+            uint64_t count = std::min<uint64_t>(_header.sliceparticles, _header.particlecount - first);
+            const std::byte* particles = pending.snapshot->data;
+            encodedSlices.push_back(_threadpool->submit([this, particles, first, count, keyframe]() {
+                return encodeSlice(particles, first, count, keyframe);
+            }));
+        }
+
+        vector<vector<uint8_t>> slices;
+        for (std::future<vector<uint8_t>>& encodedSlice: encodedSlices) {
+            slices.push_back(encodedSlice.get());
+        }
+
+        // The readback memory is released before the disk write
+        pending.snapshot.reset();
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _pendingframes.pop_front();
+        }
+
+        TrajectoryChunkHeader chunkHeader = {};
+        chunkHeader.marker = TRAJECTORY_CHUNK_MARKER;
+        chunkHeader.keyframe = keyframe ? 1 : 0;
+        chunkHeader.frame = pending.frame;
+        chunkHeader.slicecount = static_cast<uint32_t>(sliceCount);
+
+        vector<uint64_t> sliceSizes;
+        for (const vector<uint8_t>& slice: slices) {
+            sliceSizes.push_back(slice.size());
+        }
+
+        uint64_t offset = static_cast<uint64_t>(_file.tellp());
+        _file.write(reinterpret_cast<const char*>(&chunkHeader), sizeof(chunkHeader));
+        _file.write(reinterpret_cast<const char*>(sliceSizes.data()), static_cast<std::streamsize>(sliceSizes.size() * sizeof(uint64_t)));
+        for (const vector<uint8_t>& slice: slices) {
+            _file.write(reinterpret_cast<const char*>(slice.data()), static_cast<std::streamsize>(slice.size()));
+        }
+
+        _index.push_back({pending.frame, offset, chunkHeader.keyframe, 0});
+        _recordedframes++;
+        writtenbytes = static_cast<uint64_t>(_file.tellp());
+    }
+}
+
+void TrajectoryRecorder::close() {
+    if (!_writer.joinable()) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _closing = true;
+    }
+    _frameavailable.notify_all();
+    _writer.join();
+
+    TrajectoryFooter footer = {};
+    footer.indexoffset = static_cast<uint64_t>(_file.tellp());
+    footer.framecount = _index.size();
+    memcpy(footer.magic, TRAJECTORY_MAGIC, sizeof(TRAJECTORY_MAGIC));
+
+    _file.write(reinterpret_cast<const char*>(_index.data()), static_cast<std::streamsize>(_index.size() * sizeof(TrajectoryIndexEntry)));
+    _file.write(reinterpret_cast<const char*>(&footer), sizeof(footer));
+    _file.close();
+
+    if (!_file) {
+        throw std::runtime_error("Failed to write trajectory!");
+    }
+}
+
+TrajectoryRecorder::~TrajectoryRecorder() {
+    try {
+        close();
+    } catch (std::runtime_error& error) {
+        fprintf(stderr, "%s\n", error.what());
+    }
+}
+
+
+TrajectoryReader::TrajectoryReader(const string& path, ThreadPool* threadPool): _file(path), _threadpool(threadPool), header() {
+    if (_file.size < sizeof(TrajectoryHeader)) {
+        throw std::runtime_error(path + " is not a trajectory!");
+    }
+    memcpy(&header, _file.data, sizeof(header));
+    if (memcmp(header.magic, TRAJECTORY_MAGIC, sizeof(TRAJECTORY_MAGIC)) != 0) {
+        throw std::runtime_error(path + " is not a trajectory!");
+    }
+    if (header.version > TRAJECTORY_VERSION) {
+        throw std::runtime_error(path + " was written by a newer version (" + std::to_string(header.version) + ")!");
+    }
+    if (header.headersize < sizeof(TrajectoryHeader) || header.headersize > _file.size || header.sliceparticles == 0) {
+        throw std::runtime_error(path + " is truncated or corrupt!");
+    }
+
+    TrajectoryFooter footer = {};
+    if (_file.size >= header.headersize + sizeof(TrajectoryFooter)) {
+        memcpy(&footer, _file.data + _file.size - sizeof(TrajectoryFooter), sizeof(footer));
+    }
+
+    // Compared without overflowing, the index has to end right at the footer
+    bool footerValid = memcmp(footer.magic, TRAJECTORY_MAGIC, sizeof(TRAJECTORY_MAGIC)) == 0
+                       && footer.indexoffset >= header.headersize && footer.indexoffset <= _file.size - sizeof(TrajectoryFooter)
+                       && footer.framecount <= _file.size / sizeof(TrajectoryIndexEntry)
+                       && footer.indexoffset + footer.framecount * sizeof(TrajectoryIndexEntry) == _file.size - sizeof(TrajectoryFooter);
+    if (footerValid) {
+        index.resize(footer.framecount);
+        memcpy(index.data(), _file.data + footer.indexoffset, footer.framecount * sizeof(TrajectoryIndexEntry));
+    } else {
+        buildIndexFromChunks();
+    }
+
+    // Whatever precedes the first keyframe can't be decoded
+    while (!index.empty() && !index.front().keyframe) {
+        index.erase(index.begin());
+    }
+
+    _current.resize(header.particlecount * COMPONENTS_PER_PARTICLE);
+}
+
+// Recovers the complete chunks of a recording that was never closed
+void TrajectoryReader::buildIndexFromChunks() {
+    uint64_t offset = header.headersize;
+
+    while (offset + sizeof(TrajectoryChunkHeader) <= _file.size) {
+        TrajectoryChunkHeader chunkHeader;
+        memcpy(&chunkHeader, _file.data + offset, sizeof(chunkHeader));
+        if (chunkHeader.marker != TRAJECTORY_CHUNK_MARKER) {
+            break;
+        }
+
+        uint64_t slicesOffset = offset + sizeof(chunkHeader) + chunkHeader.slicecount * sizeof(uint64_t);
+        if (slicesOffset > _file.size) {
+            break;
+        }
+
+        uint64_t chunkEnd = slicesOffset;
+        bool truncated = false;
+        for (uint32_t slice = 0; slice < chunkHeader.slicecount && !truncated; slice++) {
+            uint64_t sliceSize;
+            memcpy(&sliceSize, _file.data + offset + sizeof(chunkHeader) + slice * sizeof(uint64_t), sizeof(sliceSize));
+            truncated = sliceSize > _file.size - chunkEnd;
+            chunkEnd += truncated ? 0 : sliceSize;
+        }
+        if (truncated) {
+            break;
+        }
+
+        index.push_back({chunkHeader.frame, offset, chunkHeader.keyframe, 0});
+        offset = chunkEnd;
+    }
+}
+
+size_t TrajectoryReader::findFrame(uint64_t frame) const {
+    auto after = std::upper_bound(index.begin(), index.end(), frame, [](uint64_t frame, const TrajectoryIndexEntry& entry) {
+        return frame < entry.frame;
+    });
+    return after == index.begin() ? 0 : static_cast<size_t>(after - index.begin() - 1);
+}
+
+// Offsets and sizes come from the file, they are checked against it and the header before anything is read
+void TrajectoryReader::decodeChunk(size_t chunk) {
+    const uint8_t* data = reinterpret_cast<const uint8_t*>(_file.data);
+    uint64_t offset = index[chunk].offset;
+    if (offset < header.headersize || offset > _file.size - sizeof(TrajectoryChunkHeader)) {
+        throw std::runtime_error("Trajectory chunk " + std::to_string(chunk) + " is out of bounds!");
+    }
+
+    TrajectoryChunkHeader chunkHeader;
+    memcpy(&chunkHeader, data + offset, sizeof(chunkHeader));
+
+    // Every chunk holds all slices of a frame
+    uint64_t sliceCount = (header.particlecount + header.sliceparticles - 1) / header.sliceparticles;
+    uint64_t slicesOffset = offset + sizeof(chunkHeader);
+    if (chunkHeader.marker != TRAJECTORY_CHUNK_MARKER || chunkHeader.slicecount != sliceCount
+        || sliceCount * sizeof(uint64_t) > _file.size - slicesOffset) {
+        throw std::runtime_error("Trajectory chunk " + std::to_string(chunk) + " is truncated or corrupt!");
+    }
+
+    vector<uint64_t> sliceSizes(chunkHeader.slicecount);
+    memcpy(sliceSizes.data(), data + slicesOffset, sliceSizes.size() * sizeof(uint64_t));
+
+    uint64_t remaining = _file.size - slicesOffset - sliceSizes.size() * sizeof(uint64_t);
+    for (uint64_t sliceSize: sliceSizes) {
+        if (sliceSize > remaining) {
+            throw std::runtime_error("Trajectory chunk " + std::to_string(chunk) + " is truncated or corrupt!");
+        }
+        remaining -= sliceSize;
+    }
+
+    bool keyframe = chunkHeader.keyframe != 0;
+    auto decodeSlice = [this, keyframe](const uint8_t* input, const uint8_t* end, uint64_t first, uint64_t count) {
+        int32_t* current = &_current[first * COMPONENTS_PER_PARTICLE];
+        for (uint64_t i = 0; i < count * COMPONENTS_PER_PARTICLE; i++) {
+            int64_t reference = keyframe ? 0 : current[i];
+            current[i] = static_cast<int32_t>(reference + readVarint(input, end));
+        }
+    };
+
+    vector<std::future<void>> decodedSlices;
+    const uint8_t* slice = data + offset + sizeof(chunkHeader) + sliceSizes.size() * sizeof(uint64_t);
+    for (uint32_t s = 0; s < chunkHeader.slicecount; s++) {
+        uint64_t first = static_cast<uint64_t>(s) * header.sliceparticles;
+        uint64_t count = std::min<uint64_t>(header.sliceparticles, header.particlecount - first);
+        const uint8_t* end = slice + sliceSizes[s];
+
+        if (_threadpool) {
+            decodedSlices.push_back(_threadpool->submit([decodeSlice, slice, end, first, count]() {
+                decodeSlice(slice, end, first, count);
+            }));
+        } else {
+            decodeSlice(slice, end, first, count);
+        }
+        slice = end;
+    }
+
+    for (std::future<void>& decodedSlice: decodedSlices) {
+        decodedSlice.get();
+    }
+}
+
+size_t TrajectoryReader::findKeyframe(size_t index) const {
+    while (!this->index[index].keyframe) {
+        index--;
+    }
+    return index;
+}
+
+void TrajectoryReader::seek(size_t frameIndex) {
+    if (frameIndex >= index.size()) {
+        throw std::out_of_range("Trajectory frame " + std::to_string(frameIndex) + " does not exist!");
+    }
+
+    size_t start = findKeyframe(frameIndex);
+    // Continue from the frame decoded last if that is on the way
+    if (_currentindex >= static_cast<int64_t>(start) && _currentindex <= static_cast<int64_t>(frameIndex)) {
+        start = static_cast<size_t>(_currentindex + 1);
+    }
+
+    // A chunk that fails to decode leaves nothing to continue from
+    for (size_t chunk = start; chunk <= frameIndex; chunk++) {
+        _currentindex = -1;
+        decodeChunk(chunk);
+        _currentindex = static_cast<int64_t>(chunk);
+    }
+}
+
+void TrajectoryReader::readFrame(size_t frameIndex, TrajectoryFrame& frame) {
+    seek(frameIndex);
+
+    frame.frame = index[frameIndex].frame;
+    frame.positions.resize(header.particlecount * 3);
+    frame.velocities.resize(header.particlecount * 3);
+    for (uint64_t i = 0; i < header.particlecount; i++) {
+        for (size_t c = 0; c < 3; c++) {
+            frame.positions[i * 3 + c] = static_cast<float>(_current[i * COMPONENTS_PER_PARTICLE + c] / header.positionscale);
+            frame.velocities[i * 3 + c] = static_cast<float>(_current[i * COMPONENTS_PER_PARTICLE + 3 + c] / header.velocityscale);
+        }
+    }
+}
+
+void TrajectoryReader::readParticles(Particle* particles) {
+    const float positionStep = static_cast<float>(1.0 / header.positionscale);
+    const float velocityStep = static_cast<float>(1.0 / header.velocityscale);
+
+    auto convertSlice = [this, particles, positionStep, velocityStep](uint64_t first, uint64_t count) {
+        for (uint64_t i = first; i < first + count; i++) {
+            const int32_t* current = &_current[i * COMPONENTS_PER_PARTICLE];
+            Particle& particle = particles[i];
+            particle.position = glm::vec3(current[0], current[1], current[2]) * positionStep;
+            particle.velocity = glm::vec3(current[3], current[4], current[5]) * velocityStep;
+            particle.color = Particle::speedColor(particle.velocity);
+        }
+    };
+
+    vector<std::future<void>> convertedSlices;
+    for (uint64_t first = 0; first < header.particlecount; first += header.sliceparticles) {
+        uint64_t count = std::min<uint64_t>(header.sliceparticles, header.particlecount - first);
+        if (_threadpool) {
+            convertedSlices.push_back(_threadpool->submit([convertSlice, first, count]() {
+                convertSlice(first, count);
+            }));
+        } else {
+            convertSlice(first, count);
+        }
+    }
+
+    for (std::future<void>& convertedSlice: convertedSlices) {
+        convertedSlice.get();
+    }
+}
@@ -0,0 +1,147 @@
+#pragma once
+
+#include "vulkan_tools.hpp"
+#include "pipeline.hpp"
+#include "readback.hpp"
+#include "mappedfile.hpp"
+#include "threadpool.hpp"
+
+#include <atomic>
+#include <fstream>
+
+const char TRAJECTORY_MAGIC[8] = {'A', 'F', 'C', 'T', 'R', 'A', 'J', '\0'};
+const uint32_t TRAJECTORY_VERSION = 1;
+const uint32_t TRAJECTORY_CHUNK_MARKER = 0x4d415246; // "FRAM"
+
+// Particles are encoded in independent slices of this size, one worker task each
+const uint32_t TRAJECTORY_SLICE_PARTICLES = 1 << 18;
+// Frames waiting to be encoded, more are dropped instead of queued (their readbacks hold on to ring memory)
+const size_t TRAJECTORY_MAX_PENDING_FRAMES = 2;
+
+// Positions are stored as multiples of 1/2^20 and velocities of 1/2^30
+const double TRAJECTORY_POSITION_SCALE = 1048576.0;
+const double TRAJECTORY_VELOCITY_SCALE = 1073741824.0;
+
+// File layout:
+//  header | chunk ... chunk | index | footer
+// Every chunk holds one recorded frame: a chunk header followed by its slices. A slice is a zigzag varint
+// stream of the quantized position and velocity components, delta coded against the previous recorded
+// frame, or against zero for keyframes. The index lists every chunk, the footer points at the index.
+// Files without a footer (an interrupted recording) are indexed by walking the chunks instead.
+struct TrajectoryHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t headersize;
+    uint64_t particlecount;
+    uint32_t sliceparticles;
+    uint32_t keyframeinterval;
+    double positionscale;
+    double velocityscale;
+};
+
+struct TrajectoryChunkHeader {
+    uint32_t marker;
+    uint32_t keyframe;
+    uint64_t frame;
+    uint32_t slicecount;
+    uint32_t padding;
+    // followed by slicecount uint64_t slice sizes
+};
+
+struct TrajectoryIndexEntry {
+    uint64_t frame;
+    uint64_t offset;
+    uint32_t keyframe;
+    uint32_t padding;
+};
+
+struct TrajectoryFooter {
+    uint64_t indexoffset;
+    uint64_t framecount;
+    char magic[8];
+};
+
+struct TrajectoryFrame {
+    uint64_t frame;
+    std::vector<float> positions;  // xyz per particle
+    std::vector<float> velocities; // xyz per particle
+};
+
+// Encodes particle snapshots on a worker pool and writes them from a writer thread.
+// addFrame() only queues, so it can be called straight from a readback callback.
+class TrajectoryRecorder {
+private:
+    struct PendingFrame {
+        uint64_t frame;
+        std::shared_ptr<const ReadbackResult> snapshot;
+    };
+
+    std::ofstream _file;
+    TrajectoryHeader _header;
+    ThreadPool* _threadpool;
+
+    // Quantized components of the last recorded frame, delta coding reference of each slice
+    std::vector<int32_t> _previous;
+    uint64_t _recordedframes = 0;
+    std::vector<TrajectoryIndexEntry> _index;
+
+    std::thread _writer;
+    std::deque<PendingFrame> _pendingframes;
+    std::mutex _mutex;
+    std::condition_variable _frameavailable;
+    bool _closing = false;
+
+    void write();
+    std::vector<uint8_t> encodeSlice(const std::byte* particles, uint64_t first, uint64_t count, bool keyframe);
+public:
+    std::atomic<uint64_t> droppedframes{0};
+    std::atomic<uint64_t> writtenbytes{0};
+    // Frames read back for this recorder that have not arrived yet, only counted on the render thread. Readbacks
+    // dropped with the recorder never arrive, so the count lives and dies with it.
+    size_t pendingreadbacks = 0;
+
+    bool busy();
+    void addFrame(uint64_t frame, std::shared_ptr<const ReadbackResult> snapshot);
+    // Finishes the queued frames and writes the index
+    void close();
+
+    TrajectoryRecorder(const std::string& path, uint64_t particleCount, uint32_t keyframeInterval, ThreadPool* threadPool);
+    ~TrajectoryRecorder();
+};
+
+// Random access to the frames of a recording. Reading frames in increasing order only decodes the chunks
+// in between, anything else restarts from the closest keyframe before the requested frame.
+class TrajectoryReader {
+private:
+    MappedFile _file;
+    ThreadPool* _threadpool;
+
+    std::vector<int32_t> _current;
+    int64_t _currentindex = -1;
+
+    void decodeChunk(size_t index);
+    void buildIndexFromChunks();
+public:
+    TrajectoryHeader header;
+    std::vector<TrajectoryIndexEntry> index;
+
+    size_t frameCount() const {
+        return index.size();
+    }
+    // Index of the last recorded frame at or before the simulation frame
+    size_t findFrame(uint64_t frame) const;
+    // Index of the keyframe a frame is decoded from
+    size_t findKeyframe(size_t index) const;
+    // Index of the frame decoded last, -1 before the first read
+    int64_t currentIndex() const {
+        return _currentindex;
+    }
+
+    // Decodes up to the frame without converting it, readFrame and readParticles then return that frame
+    void seek(size_t index);
+    void readFrame(size_t index, TrajectoryFrame& frame);
+    // Converts the decoded frame into particleCount particles, colored by speed like the compute shader does
+    void readParticles(Particle* particles);
+
+    TrajectoryReader(const std::string& path, ThreadPool* threadPool = nullptr);
+};
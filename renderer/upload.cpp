@@ -0,0 +1,356 @@
+#include "upload.hpp"
+
+#include <algorithm>
+
+using std::vector;
+
+UploadManager::UploadManager(VkDevice device, PhysicalDevice* physicalDevice, MemoryAllocator* allocator, VkQueue transferQueue,
+                             uint32_t transferQueueFamily)
+: _device(device), _physicaldevice(physicalDevice), _allocator(allocator), _queue(transferQueue), _stagingbuffer(nullptr), _commandpool(nullptr), timeline(nullptr) {
+    _stagingbuffer = new Buffer(_device, _physicaldevice, _allocator);
+    _stagingbuffer->createOnHost(STAGING_RING_SIZE, VK_BUFFER_USAGE_TRANSFER_SRC_BIT);
+
+    uint32_t queueFamilyCount = 0;
+    vkGetPhysicalDeviceQueueFamilyProperties(_physicaldevice->physicaldevice, &queueFamilyCount, nullptr);
+    vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
+    vkGetPhysicalDeviceQueueFamilyProperties(_physicaldevice->physicaldevice, &queueFamilyCount, queueFamilies.data());
+    _imagegranularity = queueFamilies[transferQueueFamily].minImageTransferGranularity;
+
+    VkCommandPoolCreateInfo commandPoolCreateInfo = {};
+    commandPoolCreateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    commandPoolCreateInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT | VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+    commandPoolCreateInfo.queueFamilyIndex = transferQueueFamily;
+
+    VkResult command_pool_creation_result = vkCreateCommandPool(_device, &commandPoolCreateInfo, nullptr, &_commandpool);
+    if (command_pool_creation_result != VK_SUCCESS) {
+        throw vulkan_error("Failed to create upload command pool!", command_pool_creation_result);
+    }
+
+    VkSemaphoreTypeCreateInfo semaphoreTypeCreateInfo = {};
+    semaphoreTypeCreateInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+    semaphoreTypeCreateInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+    semaphoreTypeCreateInfo.initialValue = 0;
+
+    VkSemaphoreCreateInfo semaphoreCreateInfo = {};
+    semaphoreCreateInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+    semaphoreCreateInfo.pNext = &semaphoreTypeCreateInfo;
+
+    VkResult semaphore_creation_result = vkCreateSemaphore(_device, &semaphoreCreateInfo, nullptr, &timeline);
+    if (semaphore_creation_result != VK_SUCCESS) {
+        throw vulkan_error("Failed to create upload timeline semaphore!", semaphore_creation_result);
+    }
+}
+
+// Returns the offset of a free, aligned range of the staging ring.
+// Only blocks when the ring is full, by waiting for the oldest in-flight batch to retire.
+VkDeviceSize UploadManager::reserve(VkDeviceSize size) {
+    size = (size + STAGING_RING_ALIGNMENT - 1) & ~(STAGING_RING_ALIGNMENT - 1);
+    if (size > STAGING_RING_SIZE) {
+        throw std::runtime_error("Upload is too large to be copied at once through the staging ring!");
+    }
+
+    // Ranges never wrap around the end of the ring, the remainder is skipped instead
+    VkDeviceSize ringOffset = _ringhead % STAGING_RING_SIZE;
+    VkDeviceSize padding = (ringOffset + size > STAGING_RING_SIZE) ? STAGING_RING_SIZE - ringOffset : 0;
+
+    while (_ringhead + padding + size - _ringtail > STAGING_RING_SIZE) {
+        if (hasPendingCopies()) {
+            flush();
+        }
+        // Once everything has retired, the skipped remainder of the ring is free as well
+        if (_inflightbatches.empty()) {
+            _ringtail = _ringhead + padding;
+            break;
+        }
+        wait(_inflightbatches.front().value);
+    }
+
+    _ringhead += padding;
+    VkDeviceSize offset = _ringhead % STAGING_RING_SIZE;
+    _ringhead += size;
+
+    return offset;
+}
+
+void UploadManager::reclaim(uint64_t completedValue) {
+    while (!_inflightbatches.empty() && _inflightbatches.front().value <= completedValue) {
+        _ringtail = _inflightbatches.front().ringend;
+        _freecommandbuffers.push_back(_inflightbatches.front().commandbuffer);
+        _inflightbatches.pop_front();
+    }
+}
+
+VkCommandBuffer UploadManager::acquireCommandBuffer() {
+    reclaim(completedValue());
+
+    VkCommandBuffer commandBuffer;
+    if (!_freecommandbuffers.empty()) {
+        commandBuffer = _freecommandbuffers.back();
+        _freecommandbuffers.pop_back();
+        vkResetCommandBuffer(commandBuffer, 0);
+        return commandBuffer;
+    }
+
+    VkCommandBufferAllocateInfo allocationInfo = {};
+    allocationInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    allocationInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    allocationInfo.commandPool = _commandpool;
+    allocationInfo.commandBufferCount = 1;
+
+    VkResult command_buffer_allocation_result = vkAllocateCommandBuffers(_device, &allocationInfo, &commandBuffer);
+    if (command_buffer_allocation_result != VK_SUCCESS) {
+        throw vulkan_error("Failed to allocate upload command buffer!", command_buffer_allocation_result);
+    }
+    return commandBuffer;
+}
+
+// Copies data into the staging ring and queues a copy into the target buffer.
+// Returns the timeline value that is signalled once the copy has completed on the device.
+uint64_t UploadManager::upload(VkBuffer target, VkDeviceSize targetOffset, const void* data, VkDeviceSize size) {
+    const std::byte* source = static_cast<const std::byte*>(data);
+
+    // Large uploads are split so the ring can keep streaming while earlier chunks are still copying
+    const VkDeviceSize maxChunkSize = STAGING_RING_SIZE / 4;
+
+    while (size > 0) {
+        VkDeviceSize chunkSize = std::min(size, maxChunkSize);
+        VkDeviceSize stagingOffset = reserve(chunkSize);
+
+        memcpy(static_cast<std::byte*>(_stagingbuffer->mapping) + stagingOffset, source, (size_t) chunkSize);
+
+        VkBufferCopy copyRegion = {};
+        copyRegion.srcOffset = stagingOffset;
+        copyRegion.dstOffset = targetOffset;
+        copyRegion.size = chunkSize;
+        _pendingcopies.push_back({target, copyRegion});
+
+        source += chunkSize;
+        targetOffset += chunkSize;
+        size -= chunkSize;
+    }
+
+    return pendingValue();
+}
+
+// Images are copied in whole slices (rows for 2D images), a chunk holds as many as fit
+uint64_t UploadManager::uploadImage(VkImage target, VkExtent3D extent, VkDeviceSize texelSize, const void* data) {
+    const std::byte* source = static_cast<const std::byte*>(data);
+    const VkDeviceSize maxChunkSize = STAGING_RING_SIZE / 4;
+
+    bool rows = extent.depth == 1;
+    uint32_t sliceCount = rows ? extent.height : extent.depth;
+    VkDeviceSize sliceSize = texelSize * extent.width * (rows ? 1 : extent.height);
+    uint32_t slicesPerChunk = static_cast<uint32_t>(std::max<VkDeviceSize>(1, maxChunkSize / sliceSize));
+
+    uint32_t granularity = rows ? _imagegranularity.height : _imagegranularity.depth;
+    if (granularity == 0) {
+        if (sliceSize * sliceCount > STAGING_RING_SIZE) {
+            throw std::runtime_error("Image is too large to be copied at once through the staging ring!");
+        }
+        slicesPerChunk = sliceCount;
+    } else if (slicesPerChunk < sliceCount) {
+        slicesPerChunk = std::max(granularity, slicesPerChunk / granularity * granularity);
+    }
+
+    for (uint32_t firstSlice = 0; firstSlice < sliceCount; firstSlice += slicesPerChunk) {
+        uint32_t chunkSlices = std::min(slicesPerChunk, sliceCount - firstSlice);
+        VkDeviceSize chunkSize = sliceSize * chunkSlices;
+        VkDeviceSize stagingOffset = reserve(chunkSize);
+
+        memcpy(static_cast<std::byte*>(_stagingbuffer->mapping) + stagingOffset, source, (size_t) chunkSize);
+
+        VkBufferImageCopy copyRegion = {};
+        copyRegion.bufferOffset = stagingOffset;
+        copyRegion.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        copyRegion.imageSubresource.layerCount = 1;
+        if (rows) {
+            copyRegion.imageOffset = {0, static_cast<int32_t>(firstSlice), 0};
+            copyRegion.imageExtent = {extent.width, chunkSlices, 1};
+        } else {
+            copyRegion.imageOffset = {0, 0, static_cast<int32_t>(firstSlice)};
+            copyRegion.imageExtent = {extent.width, extent.height, chunkSlices};
+        }
+        _pendingimagecopies.push_back({target, copyRegion, firstSlice == 0, firstSlice + chunkSlices == sliceCount});
+
+        source += chunkSize;
+    }
+
+    return pendingValue();
+}
+
+bool UploadManager::hasPendingCopies() {
+    return !_pendingcopies.empty() || !_pendingimagecopies.empty();
+}
+
+// Every image is transitioned once for all of its copies in the batch. The previous contents are discarded by the
+// first chunk of an upload. Later batches of the same upload write other slices and continue from
+// TRANSFER_DST_OPTIMAL, only the batch with the last chunk makes the image readable.
+void UploadManager::recordImageCopies(VkCommandBuffer commandBuffer) {
+    VkImageMemoryBarrier imageBarrier = {};
+    imageBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    imageBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    imageBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    imageBarrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    imageBarrier.subresourceRange.levelCount = 1;
+    imageBarrier.subresourceRange.layerCount = 1;
+
+    vector<VkBufferImageCopy> copyRegions;
+    size_t firstForTarget = 0;
+    for (size_t i = 0; i < _pendingimagecopies.size(); i++) {
+        copyRegions.push_back(_pendingimagecopies[i].region);
+
+        bool lastForTarget = (i + 1 == _pendingimagecopies.size()) || (_pendingimagecopies[i + 1].target != _pendingimagecopies[i].target);
+        if (!lastForTarget) {
+            continue;
+        }
+
+        imageBarrier.image = _pendingimagecopies[i].target;
+        if (_pendingimagecopies[firstForTarget].first) {
+            imageBarrier.srcAccessMask = 0;
+            imageBarrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+            imageBarrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+            imageBarrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+            vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                                 0, 0, nullptr, 0, nullptr, 1, &imageBarrier);
+        }
+
+        vkCmdCopyBufferToImage(commandBuffer, _stagingbuffer->buffer, _pendingimagecopies[i].target,
+                               VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, static_cast<uint32_t>(copyRegions.size()), copyRegions.data());
+        copyRegions.clear();
+        firstForTarget = i + 1;
+
+        if (!_pendingimagecopies[i].last) {
+            continue;
+        }
+
+        // The transfer queue may not know the shader stages, the consumers wait on the timeline semaphore instead
+        imageBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        imageBarrier.dstAccessMask = 0;
+        imageBarrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+        imageBarrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+                             0, 0, nullptr, 0, nullptr, 1, &imageBarrier);
+    }
+}
+
+// Submits every queued copy as a single batch. Returns the timeline value the batch signals.
+uint64_t UploadManager::flush() {
+    if (!hasPendingCopies()) {
+        return _submittedvalue;
+    }
+    return submit(nullptr);
+}
+
+uint64_t UploadManager::submit(const std::function<void(VkCommandBuffer)>& commands) {
+    VkCommandBuffer commandBuffer = acquireCommandBuffer();
+
+    VkCommandBufferBeginInfo beginInfo = {};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+    VkResult begin_command_buffer_result = vkBeginCommandBuffer(commandBuffer, &beginInfo);
+    if (begin_command_buffer_result != VK_SUCCESS) {
+        throw vulkan_error("Failed to start recording upload command buffer!", begin_command_buffer_result);
+    }
+
+    // Consecutive copies into the same buffer are recorded as one command
+    vector<VkBufferCopy> copyRegions;
+    for (size_t i = 0; i < _pendingcopies.size(); i++) {
+        copyRegions.push_back(_pendingcopies[i].region);
+
+        bool lastForTarget = (i + 1 == _pendingcopies.size()) || (_pendingcopies[i + 1].target != _pendingcopies[i].target);
+        if (lastForTarget) {
+            vkCmdCopyBuffer(commandBuffer, _stagingbuffer->buffer, _pendingcopies[i].target,
+                            static_cast<uint32_t>(copyRegions.size()), copyRegions.data());
+            copyRegions.clear();
+        }
+    }
+
+    recordImageCopies(commandBuffer);
+
+    if (commands) {
+        commands(commandBuffer);
+    }
+
+    VkResult command_buffer_end_result = vkEndCommandBuffer(commandBuffer);
+    if (command_buffer_end_result != VK_SUCCESS) {
+        throw vulkan_error("Failed to finish recording upload command buffer!", command_buffer_end_result);
+    }
+
+    uint64_t signalValue = _submittedvalue + 1;
+
+    VkTimelineSemaphoreSubmitInfo timelineSubmitInfo = {};
+    timelineSubmitInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+    timelineSubmitInfo.signalSemaphoreValueCount = 1;
+    timelineSubmitInfo.pSignalSemaphoreValues = &signalValue;
+
+    VkSubmitInfo submitInfo = {};
+    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submitInfo.pNext = &timelineSubmitInfo;
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers = &commandBuffer;
+    submitInfo.signalSemaphoreCount = 1;
+    submitInfo.pSignalSemaphores = &timeline;
+
+    VkResult upload_queue_submit_result = vkQueueSubmit(_queue, 1, &submitInfo, VK_NULL_HANDLE);
+    if (upload_queue_submit_result != VK_SUCCESS) {
+        throw vulkan_error("Failed to submit upload command buffer!", upload_queue_submit_result);
+    }
+
+    _submittedvalue = signalValue;
+    _inflightbatches.push_back({commandBuffer, signalValue, _ringhead});
+    _pendingcopies.clear();
+    _pendingimagecopies.clear();
+
+    return signalValue;
+}
+
+// The value that will be signalled by the copies queued so far, including ones not yet flushed
+uint64_t UploadManager::pendingValue() {
+    return hasPendingCopies() ? _submittedvalue + 1 : _submittedvalue;
+}
+
+uint64_t UploadManager::completedValue() {
+    uint64_t value = 0;
+    vkGetSemaphoreCounterValue(_device, timeline, &value);
+    reclaim(value);
+    return value;
+}
+
+void UploadManager::wait(uint64_t value) {
+    if (value > _submittedvalue) {
+        flush();
+    }
+
+    VkSemaphoreWaitInfo waitInfo = {};
+    waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+    waitInfo.semaphoreCount = 1;
+    waitInfo.pSemaphores = &timeline;
+    waitInfo.pValues = &value;
+
+    VkResult semaphore_wait_result = vkWaitSemaphores(_device, &waitInfo, UINT64_MAX);
+    if (semaphore_wait_result != VK_SUCCESS) {
+        throw vulkan_error("Failed to wait for upload timeline semaphore!", semaphore_wait_result);
+    }
+
+    reclaim(value);
+}
+
+UploadManager::~UploadManager() {
+    if (timeline) {
+        uint64_t lastValue = _submittedvalue;
+
+        VkSemaphoreWaitInfo waitInfo = {};
+        waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+        waitInfo.semaphoreCount = 1;
+        waitInfo.pSemaphores = &timeline;
+        waitInfo.pValues = &lastValue;
+        vkWaitSemaphores(_device, &waitInfo, UINT64_MAX);
+
+        vkDestroySemaphore(_device, timeline, nullptr);
+    }
+    if (_commandpool) {
+        vkDestroyCommandPool(_device, _commandpool, nullptr);
+    }
+    delete _stagingbuffer;
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include "vulkan_tools.hpp"
+#include "physicaldevice.hpp"
+#include "buffer.hpp"
+
+#include <deque>
+#include <functional>
+
+const VkDeviceSize STAGING_RING_SIZE = 64 * 1024 * 1024;
+const VkDeviceSize STAGING_RING_ALIGNMENT = 16;
+
+// Streams host data into device local buffers through a persistently mapped staging ring.
+// Copies are batched until flush() and submitted together on the transfer queue. Every batch signals
+// the timeline semaphore with an increasing value, so other queue submissions can wait on exactly the
+// uploads they need instead of idling the queue.
+class UploadManager {
+private:
+    struct PendingCopy {
+        VkBuffer target;
+        VkBufferCopy region;
+    };
+
+    struct PendingImageCopy {
+        VkImage target;
+        VkBufferImageCopy region;
+        // An image split across batches is only transitioned from UNDEFINED by its first chunk, and only becomes
+        // readable with its last
+        bool first;
+        bool last;
+    };
+
+    struct Batch {
+        VkCommandBuffer commandbuffer;
+        uint64_t value;
+        uint64_t ringend;
+    };
+
+    VkDevice _device;
+    PhysicalDevice* _physicaldevice;
+    MemoryAllocator* _allocator;
+    VkQueue _queue;
+
+    Buffer* _stagingbuffer;
+    VkCommandPool _commandpool;
+
+    // Monotonic byte counters, ring offsets are taken modulo STAGING_RING_SIZE
+    uint64_t _ringhead = 0;
+    uint64_t _ringtail = 0;
+
+    uint64_t _submittedvalue = 0;
+
+    // Image copies on the transfer queue have to start at multiples of this, 0 allows whole images only
+    VkExtent3D _imagegranularity;
+
+    std::vector<PendingCopy> _pendingcopies;
+    std::vector<PendingImageCopy> _pendingimagecopies;
+    std::deque<Batch> _inflightbatches;
+    std::vector<VkCommandBuffer> _freecommandbuffers;
+
+    VkDeviceSize reserve(VkDeviceSize size);
+    void reclaim(uint64_t completedValue);
+    VkCommandBuffer acquireCommandBuffer();
+    void recordImageCopies(VkCommandBuffer commandBuffer);
+    bool hasPendingCopies();
+public:
+    VkSemaphore timeline;
+
+    uint64_t upload(VkBuffer target, VkDeviceSize targetOffset, const void* data, VkDeviceSize size);
+    // Replaces the whole contents of a single mip, single layer colour image with tightly packed texels.
+    // The image ends up in VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL and has to be shared with the transfer queue family.
+    uint64_t uploadImage(VkImage target, VkExtent3D extent, VkDeviceSize texelSize, const void* data);
+    uint64_t flush();
+    // Submits the queued copies followed by the commands recorded by the callback
+    uint64_t submit(const std::function<void(VkCommandBuffer)>& commands);
+
+    uint64_t pendingValue();
+    uint64_t completedValue();
+    void wait(uint64_t value);
+
+    UploadManager(VkDevice device, PhysicalDevice* physicalDevice, MemoryAllocator* allocator, VkQueue transferQueue, uint32_t transferQueueFamily);
+    ~UploadManager();
+};
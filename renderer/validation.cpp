@@ -0,0 +1,92 @@
+#include "validation.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+// Maps the float bit patterns onto integers that are ordered like the floats
+static int64_t orderedBits(float value) {
+    int32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return bits < 0 ? static_cast<int64_t>(INT32_MIN) - bits : bits;
+}
+
+uint64_t ulpDistance(float a, float b) {
+    if (std::isnan(a) || std::isnan(b)) {
+        return std::isnan(a) && std::isnan(b) ? 0 : UINT64_MAX;
+    }
+    int64_t difference = orderedBits(a) - orderedBits(b);
+    return static_cast<uint64_t>(difference < 0 ? -difference : difference);
+}
+
+struct PartialStatistics {
+    uint64_t maxulp = 0;
+    double sumulp = 0.0;
+    double maxrelative = 0.0;
+    double sumrelative = 0.0;
+    uint64_t diverged = 0;
+
+    void add(const glm::vec3& value, const glm::vec3& reference) {
+        for (int c = 0; c < 3; c++) {
+            uint64_t ulp = ulpDistance(value[c], reference[c]);
+            maxulp = std::max(maxulp, ulp);
+            sumulp += static_cast<double>(ulp);
+        }
+
+        double error = glm::length(value - reference);
+        double magnitude = glm::length(reference);
+        double relative = magnitude > 0.0 ? error / magnitude : (error > 0.0 ? 1.0 : 0.0);
+        // NaN on either side counts as fully diverged
+        if (!(relative == relative)) {
+            relative = 1.0;
+        }
+
+        maxrelative = std::max(maxrelative, relative);
+        sumrelative += relative;
+        diverged += relative > VALIDATION_DIVERGENCE ? 1 : 0;
+    }
+
+    void merge(const PartialStatistics& other) {
+        maxulp = std::max(maxulp, other.maxulp);
+        sumulp += other.sumulp;
+        maxrelative = std::max(maxrelative, other.maxrelative);
+        sumrelative += other.sumrelative;
+        diverged += other.diverged;
+    }
+
+    ErrorStatistics finish(size_t count) const {
+        return {maxulp, sumulp / (3.0 * count), maxrelative, sumrelative / count, diverged};
+    }
+};
+
+ValidationStep compareParticles(size_t step, const Particle* gpu, const Particle* cpu, size_t count, ThreadPool* threadPool) {
+    PartialStatistics position;
+    PartialStatistics velocity;
+    std::mutex mutex;
+
+    threadPool->parallelFor(0, count, 64 * 1024, [&](size_t first, size_t last) {
+        PartialStatistics chunkPosition;
+        PartialStatistics chunkVelocity;
+        for (size_t i = first; i < last; i++) {
+            chunkPosition.add(gpu[i].position, cpu[i].position);
+            chunkVelocity.add(gpu[i].velocity, cpu[i].velocity);
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+        position.merge(chunkPosition);
+        velocity.merge(chunkVelocity);
+    });
+
+    return {step, position.finish(count), velocity.finish(count)};
+}
+
+void printValidationStep(const ValidationStep& step) {
+    printf("step %4zu | position ulp max %8llu mean %8.2f rel max %.2e mean %.2e diverged %llu"
+           " | velocity ulp max %8llu mean %8.2f rel max %.2e mean %.2e diverged %llu\n",
+           step.step,
+           static_cast<unsigned long long>(step.position.maxulp), step.position.meanulp,
+           step.position.maxrelative, step.position.meanrelative, static_cast<unsigned long long>(step.position.diverged),
+           static_cast<unsigned long long>(step.velocity.maxulp), step.velocity.meanulp,
+           step.velocity.maxrelative, step.velocity.meanrelative, static_cast<unsigned long long>(step.velocity.diverged));
+}
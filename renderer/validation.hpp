@@ -0,0 +1,32 @@
+#pragma once
+
+#include "pipeline.hpp"
+#include "threadpool.hpp"
+
+// A single step of the GPU may differ from the CPU reference by at most this relative error
+const double VALIDATION_TOLERANCE = 1e-4;
+// Particles further apart than this relative error count as diverged
+const double VALIDATION_DIVERGENCE = 1e-2;
+
+struct ErrorStatistics {
+    // Per component distance in units in the last place
+    uint64_t maxulp;
+    double meanulp;
+    // Per particle |a - b| / |b| of the whole vector
+    double maxrelative;
+    double meanrelative;
+    uint64_t diverged;
+};
+
+struct ValidationStep {
+    size_t step;
+    ErrorStatistics position;
+    ErrorStatistics velocity;
+};
+
+// Distance of two floats in representable values between them
+uint64_t ulpDistance(float a, float b);
+
+// Compares the particles of a GPU readback with the CPU reference, b is taken as the exact value
+ValidationStep compareParticles(size_t step, const Particle* gpu, const Particle* cpu, size_t count, ThreadPool* threadPool);
+void printValidationStep(const ValidationStep& step);
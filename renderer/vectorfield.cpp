@@ -0,0 +1,342 @@
+#include "vectorfield.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+
+using std::string;
+using std::vector;
+
+// RGBA16F
+static const VkFormat FIELD_FORMAT = VK_FORMAT_R16G16B16A16_SFLOAT;
+static const VkDeviceSize FIELD_TEXEL_SIZE = 4 * sizeof(uint16_t);
+
+// Rounds to nearest even. Values out of range saturate to the largest half float and NaN becomes 0,
+// a single broken vector should not throw particles out of the simulation.
+static uint16_t floatToHalf(float value) {
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+
+    uint32_t sign = (bits >> 16) & 0x8000;
+    uint32_t exponent = (bits >> 23) & 0xff;
+    uint32_t mantissa = bits & 0x7fffff;
+
+    if (exponent == 0xff) {
+        return mantissa != 0 ? 0 : static_cast<uint16_t>(sign | 0x7bff);
+    }
+
+    int32_t halfExponent = static_cast<int32_t>(exponent) - 127 + 15;
+    if (halfExponent >= 31) {
+        return static_cast<uint16_t>(sign | 0x7bff);
+    }
+
+    uint32_t shift = 13;
+    if (halfExponent <= 0) {
+        // Subnormal, the implicit leading bit becomes part of the mantissa
+        if (halfExponent < -10) {
+            return static_cast<uint16_t>(sign);
+        }
+        mantissa |= 0x800000;
+        shift = static_cast<uint32_t>(14 - halfExponent);
+        halfExponent = 0;
+    }
+
+    uint32_t half = (static_cast<uint32_t>(halfExponent) << 10) | (mantissa >> shift);
+    uint32_t remainder = mantissa & ((1u << shift) - 1);
+    uint32_t halfway = 1u << (shift - 1);
+    // A carry out of the mantissa correctly moves on to the next exponent
+    if (remainder > halfway || (remainder == halfway && (half & 1))) {
+        half++;
+    }
+    return static_cast<uint16_t>(sign | std::min(half, 0x7bffu));
+}
+
+VectorField::VectorField(VkDevice device, PhysicalDevice* physicalDevice, MemoryAllocator* allocator, UploadManager* uploadManager,
+                         const string& path, uint32_t framesInFlight)
+: _device(device), _physicaldevice(physicalDevice), _allocator(allocator), _uploadmanager(uploadManager),
+  _framesinflight(framesInFlight), sampler(nullptr), fieldorigin(0.0f), fieldscale(1.0f, 1.0f, 1.0f, 0.0f) {
+    _header = {};
+
+    if (path.empty()) {
+        _header.width = 1;
+        _header.height = 1;
+        _header.depth = 1;
+        _header.framecount = 1;
+        _header.frameduration = 1.0f;
+        _placeholder.assign(1, 0);
+    } else {
+        _file.reset(new MappedFile(path));
+        if (_file->size < sizeof(FieldFileHeader)) {
+            throw std::runtime_error(path + " is not a vector field!");
+        }
+        memcpy(&_header, _file->data, sizeof(FieldFileHeader));
+
+        if (memcmp(_header.magic, FIELD_MAGIC, sizeof(FIELD_MAGIC)) != 0) {
+            throw std::runtime_error(path + " is not a vector field!");
+        }
+        if (_header.version > FIELD_VERSION) {
+            throw std::runtime_error(path + " was written by a newer version (" + std::to_string(_header.version) + ")!");
+        }
+        if (_header.byteordermark != FIELD_BYTE_ORDER_MARK) {
+            throw std::runtime_error(path + " was written on a machine with a different byte order!");
+        }
+
+        uint64_t frameBytes = FIELD_TEXEL_SIZE * _header.width * _header.height * _header.depth;
+        if (_header.width == 0 || _header.height == 0 || _header.depth == 0 || _header.framecount == 0
+            || _header.payloadoffset % FIELD_PAYLOAD_ALIGNMENT != 0
+            || _header.payloadoffset + frameBytes * _header.framecount > _file->size) {
+            throw std::runtime_error(path + " is truncated or corrupt!");
+        }
+
+        glm::vec3 boundsMin(_header.boundsmin[0], _header.boundsmin[1], _header.boundsmin[2]);
+        glm::vec3 boundsMax(_header.boundsmax[0], _header.boundsmax[1], _header.boundsmax[2]);
+        if (!(boundsMax.x > boundsMin.x && boundsMax.y > boundsMin.y && boundsMax.z > boundsMin.z)
+            || (_header.framecount > 1 && !(_header.frameduration > 0.0f))) {
+            throw std::runtime_error(path + " has empty bounds or frames without duration!");
+        }
+
+        VkPhysicalDeviceProperties properties;
+        vkGetPhysicalDeviceProperties(_physicaldevice->physicaldevice, &properties);
+        uint32_t maxDimension = properties.limits.maxImageDimension3D;
+        if (_header.width > maxDimension || _header.height > maxDimension || _header.depth > maxDimension) {
+            throw std::runtime_error(path + " is larger than the device's 3D images (" + std::to_string(maxDimension) + ")!");
+        }
+
+        fieldorigin = glm::vec4(boundsMin, 1.0f);
+        fieldscale = glm::vec4(glm::vec3(1.0f) / (boundsMax - boundsMin), 0.0f);
+    }
+
+    _slots.resize(std::min(_header.framecount, FIELD_SLOT_COUNT));
+    for (Slot& slot: _slots) {
+        createSlot(slot);
+    }
+
+    VkSamplerCreateInfo samplerCreateInfo = {};
+    samplerCreateInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+    samplerCreateInfo.magFilter = VK_FILTER_LINEAR;
+    samplerCreateInfo.minFilter = VK_FILTER_LINEAR;
+    samplerCreateInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+    samplerCreateInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    samplerCreateInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    samplerCreateInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    samplerCreateInfo.maxLod = 0.0f;
+
+    VkResult sampler_creation_result = vkCreateSampler(_device, &samplerCreateInfo, nullptr, &sampler);
+    if (sampler_creation_result != VK_SUCCESS) {
+        throw vulkan_error("Failed to create vector field sampler!", sampler_creation_result);
+    }
+
+    // Sampled from the first frame on, before update() has seen the upload complete
+    _slots[0].frame = 0;
+    _slots[0].uploadvalue = _uploadmanager->uploadImage(_slots[0].image, {_header.width, _header.height, _header.depth},
+                                                        FIELD_TEXEL_SIZE, getFrameData(0));
+}
+
+// Optimal tiling, so the driver lays the texels out in 3D tiles for the trilinear footprint
+void VectorField::createSlot(Slot& slot) {
+    VkImageCreateInfo imageCreateInfo = {};
+    imageCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+    imageCreateInfo.imageType = VK_IMAGE_TYPE_3D;
+    imageCreateInfo.extent = {_header.width, _header.height, _header.depth};
+    imageCreateInfo.mipLevels = 1;
+    imageCreateInfo.arrayLayers = 1;
+    imageCreateInfo.format = FIELD_FORMAT;
+    imageCreateInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+    imageCreateInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    imageCreateInfo.usage = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+    imageCreateInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+
+    // Filled on the dedicated transfer queue (if there is one), shared to avoid ownership transfers like the buffers
+    const QueueFamilyIndices& queueFamilyIndices = _physicaldevice->queuefamilies;
+    uint32_t queueFamilyIndexValues[] = {queueFamilyIndices.graphicsComputeFamily.value(), queueFamilyIndices.transferFamily.value_or(0)};
+    if (queueFamilyIndices.transferFamily.has_value()) {
+        imageCreateInfo.sharingMode = VK_SHARING_MODE_CONCURRENT;
+        imageCreateInfo.queueFamilyIndexCount = 2;
+        imageCreateInfo.pQueueFamilyIndices = queueFamilyIndexValues;
+    } else {
+        imageCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    }
+
+    VkResult create_image_result = vkCreateImage(_device, &imageCreateInfo, nullptr, &slot.image);
+    if (create_image_result != VK_SUCCESS) {
+        throw vulkan_error("Failed to create vector field image!", create_image_result);
+    }
+
+    VkMemoryRequirements imageMemoryRequirements;
+    vkGetImageMemoryRequirements(_device, slot.image, &imageMemoryRequirements);
+
+    slot.allocation = _allocator->allocate(imageMemoryRequirements, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, ResourceKind::Image);
+
+    VkResult image_memory_bind_result = vkBindImageMemory(_device, slot.image, slot.allocation.memory, slot.allocation.offset);
+    if (image_memory_bind_result != VK_SUCCESS) {
+        throw vulkan_error("Failed to bind vector field memory!", image_memory_bind_result);
+    }
+
+    VkImageViewCreateInfo imageViewCreateInfo = {};
+    imageViewCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+    imageViewCreateInfo.image = slot.image;
+    imageViewCreateInfo.viewType = VK_IMAGE_VIEW_TYPE_3D;
+    imageViewCreateInfo.format = FIELD_FORMAT;
+    imageViewCreateInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    imageViewCreateInfo.subresourceRange.levelCount = 1;
+    imageViewCreateInfo.subresourceRange.layerCount = 1;
+
+    VkResult image_view_creation_result = vkCreateImageView(_device, &imageViewCreateInfo, nullptr, &slot.view);
+    if (image_view_creation_result != VK_SUCCESS) {
+        throw vulkan_error("Failed to create vector field image view!", image_view_creation_result);
+    }
+}
+
+const void* VectorField::getFrameData(uint32_t frame) {
+    if (!_file) {
+        return _placeholder.data();
+    }
+    uint64_t frameBytes = FIELD_TEXEL_SIZE * _header.width * _header.height * _header.depth;
+    return _file->data + _header.payloadoffset + frameBytes * frame;
+}
+
+VectorField::Slot* VectorField::findSlot(uint32_t frame) {
+    for (Slot& slot: _slots) {
+        if (slot.frame == frame) {
+            return &slot;
+        }
+    }
+    return nullptr;
+}
+
+bool VectorField::isReady(const Slot* slot, uint64_t completedValue) {
+    return slot && slot->uploadvalue <= completedValue;
+}
+
+// Refills a slot that holds none of the wanted frames, is done uploading and no longer sampled by a frame in flight
+bool VectorField::request(uint32_t frame, const uint32_t* wanted, uint32_t wantedCount, uint64_t frameNumber, uint64_t completedValue) {
+    if (findSlot(frame)) {
+        return false;
+    }
+
+    for (Slot& slot: _slots) {
+        bool holdsWanted = std::find(wanted, wanted + wantedCount, slot.frame) != wanted + wantedCount;
+        bool idle = slot.frame < 0 || slot.lastused + _framesinflight <= frameNumber;
+        if (holdsWanted || !idle || slot.uploadvalue > completedValue) {
+            continue;
+        }
+
+        slot.frame = frame;
+        slot.uploadvalue = _uploadmanager->uploadImage(slot.image, {_header.width, _header.height, _header.depth},
+                                                       FIELD_TEXEL_SIZE, getFrameData(frame));
+        return true;
+    }
+    return false;
+}
+
+void VectorField::update(double simulationTime, uint64_t frameNumber) {
+    uint32_t frameCount = _header.framecount;
+    uint32_t first = 0;
+    float blend = 0.0f;
+    if (frameCount > 1) {
+        double position = std::fmod(simulationTime / _header.frameduration, static_cast<double>(frameCount));
+        if (position < 0.0) {
+            position += static_cast<double>(frameCount);
+        }
+        first = std::min(static_cast<uint32_t>(position), frameCount - 1);
+        blend = static_cast<float>(position - first);
+    }
+
+    // The frame after the interpolated pair is streamed in ahead of time
+    uint32_t wanted[FIELD_SLOT_COUNT];
+    uint32_t wantedCount = static_cast<uint32_t>(_slots.size());
+    for (uint32_t i = 0; i < wantedCount; i++) {
+        wanted[i] = (first + i) % frameCount;
+    }
+
+    uint64_t completedValue = _uploadmanager->completedValue();
+    bool requested = false;
+    for (uint32_t i = 0; i < wantedCount; i++) {
+        requested |= request(wanted[i], wanted, wantedCount, frameNumber, completedValue);
+    }
+    if (requested) {
+        _uploadmanager->flush();
+    }
+
+    Slot* current = findSlot(wanted[0]);
+    Slot* next = findSlot((first + 1) % frameCount);
+    if (isReady(current, completedValue) && isReady(next, completedValue)) {
+        _current[0] = static_cast<uint32_t>(current - _slots.data());
+        _current[1] = static_cast<uint32_t>(next - _slots.data());
+        fieldscale.w = blend;
+    } else if (isReady(current, completedValue)) {
+        _current[0] = static_cast<uint32_t>(current - _slots.data());
+        _current[1] = _current[0];
+        fieldscale.w = 0.0f;
+    }
+
+    _slots[_current[0]].lastused = frameNumber;
+    _slots[_current[1]].lastused = frameNumber;
+}
+
+VkImageView VectorField::getView(uint32_t index) {
+    return _slots[_current[index]].view;
+}
+
+VectorField::~VectorField() {
+    // Frames may still be streaming in
+    uint64_t lastUploadValue = 0;
+    for (const Slot& slot: _slots) {
+        lastUploadValue = std::max(lastUploadValue, slot.uploadvalue);
+    }
+    _uploadmanager->wait(lastUploadValue);
+
+    if (sampler) {
+        vkDestroySampler(_device, sampler, nullptr);
+    }
+    for (Slot& slot: _slots) {
+        vkDestroyImageView(_device, slot.view, nullptr);
+        vkDestroyImage(_device, slot.image, nullptr);
+        _allocator->free(slot.allocation);
+    }
+}
+
+void writeVectorField(const string& path, uint32_t width, uint32_t height, uint32_t depth, uint32_t frameCount,
+                      float frameDuration, const glm::vec3& boundsMin, const glm::vec3& boundsMax, const float* vectors) {
+    FieldFileHeader header = {};
+    memcpy(header.magic, FIELD_MAGIC, sizeof(FIELD_MAGIC));
+    header.version = FIELD_VERSION;
+    header.headersize = sizeof(FieldFileHeader);
+    header.byteordermark = FIELD_BYTE_ORDER_MARK;
+    header.width = width;
+    header.height = height;
+    header.depth = depth;
+    header.framecount = frameCount;
+    header.frameduration = frameDuration;
+    memcpy(header.boundsmin, &boundsMin, sizeof(header.boundsmin));
+    memcpy(header.boundsmax, &boundsMax, sizeof(header.boundsmax));
+    header.payloadoffset = (sizeof(FieldFileHeader) + FIELD_PAYLOAD_ALIGNMENT - 1) / FIELD_PAYLOAD_ALIGNMENT * FIELD_PAYLOAD_ALIGNMENT;
+
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    if (!file.is_open()) {
+        throw std::runtime_error("Failed to open " + path + "!");
+    }
+
+    vector<char> headerBlock(header.payloadoffset, 0);
+    memcpy(headerBlock.data(), &header, sizeof(header));
+    file.write(headerBlock.data(), static_cast<std::streamsize>(headerBlock.size()));
+
+    // One frame at a time, so converting long recordings does not need their half float copy in memory
+    size_t texelCount = static_cast<size_t>(width) * height * depth;
+    vector<uint16_t> texels(4 * texelCount, 0);
+    for (uint32_t frame = 0; frame < frameCount; frame++) {
+        const float* source = vectors + 3 * texelCount * frame;
+        for (size_t i = 0; i < texelCount; i++) {
+            texels[4 * i] = floatToHalf(source[3 * i]);
+            texels[4 * i + 1] = floatToHalf(source[3 * i + 1]);
+            texels[4 * i + 2] = floatToHalf(source[3 * i + 2]);
+        }
+        file.write(reinterpret_cast<const char*>(texels.data()), static_cast<std::streamsize>(sizeof(uint16_t) * texels.size()));
+    }
+    file.close();
+
+    if (!file) {
+        throw std::runtime_error("Failed to write " + path + "!");
+    }
+}
@@ -0,0 +1,100 @@
+#pragma once
+
+#include "vulkan_tools.hpp"
+#include "physicaldevice.hpp"
+#include "memory.hpp"
+#include "upload.hpp"
+#include "mappedfile.hpp"
+
+#include <memory>
+#include <type_traits>
+
+const char FIELD_MAGIC[8] = {'A', 'F', 'C', 'F', 'I', 'E', 'L', 'D'};
+const uint32_t FIELD_VERSION = 1;
+const uint32_t FIELD_BYTE_ORDER_MARK = 0x01020304;
+const uint64_t FIELD_PAYLOAD_ALIGNMENT = 64;
+
+// Frames kept on the device: the two being interpolated and the next one streaming in
+const uint32_t FIELD_SLOT_COUNT = 3;
+
+// Every frame is width * height * depth RGBA16F texels (x fastest, w unused), the frames follow each other
+// from payloadoffset on. The bounds enclose the whole grid, texel centres sit half a texel inside.
+struct FieldFileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t headersize;
+    uint32_t byteordermark;
+    uint32_t width;
+    uint32_t height;
+    uint32_t depth;
+    uint32_t framecount;
+    // Simulation time (the compute shader's deltaTime units) between two frames, the frames loop
+    float frameduration;
+    float boundsmin[3];
+    float boundsmax[3];
+    uint64_t payloadoffset;
+};
+
+static_assert(std::is_trivially_copyable<FieldFileHeader>::value, "Field header is written as raw bytes");
+
+// A precomputed 3D vector field (imported CFD or magnetic data) sampled by shader.comp with hardware trilinear
+// filtering instead of evaluating a field analytically. Frames are stored as half floats and memory mapped,
+// time-varying fields stream one frame at a time through the UploadManager into a few resident 3D images.
+// Without a file the field is a single zero texel and sampling is turned off.
+class VectorField {
+private:
+    struct Slot {
+        VkImage image;
+        Allocation allocation;
+        VkImageView view;
+        int64_t frame = -1;
+        uint64_t uploadvalue = 0;
+        // Last simulation frame that sampled the slot, it is only refilled once that frame has completed
+        uint64_t lastused = 0;
+    };
+
+    VkDevice _device;
+    PhysicalDevice* _physicaldevice;
+    MemoryAllocator* _allocator;
+    UploadManager* _uploadmanager;
+    uint32_t _framesinflight;
+
+    std::unique_ptr<MappedFile> _file;
+    FieldFileHeader _header;
+    std::vector<uint64_t> _placeholder;
+
+    std::vector<Slot> _slots;
+    // Slots sampled by the current simulation frame
+    uint32_t _current[2] = {0, 0};
+
+    const void* getFrameData(uint32_t frame);
+    void createSlot(Slot& slot);
+    Slot* findSlot(uint32_t frame);
+    bool isReady(const Slot* slot, uint64_t completedValue);
+    bool request(uint32_t frame, const uint32_t* wanted, uint32_t wantedCount, uint64_t frameNumber, uint64_t completedValue);
+public:
+    VkSampler sampler;
+
+    // Placement for ComputeUniformBufferObject: fieldorigin.xyz is the world position of texture coordinate 0 and
+    // w is 1 while a field is loaded, fieldscale.xyz maps world to texture coordinates and w blends the two frames
+    glm::vec4 fieldorigin;
+    glm::vec4 fieldscale;
+
+    // Picks the frames for the simulation time and streams in the ones coming up. Frames that have not finished
+    // uploading are not sampled yet, the previous ones stay in use meanwhile.
+    void update(double simulationTime, uint64_t frameNumber);
+    // The two frames to sample, valid after update()
+    VkImageView getView(uint32_t index);
+
+    // An empty path creates the placeholder. The first frame is uploaded right away, with the next flush.
+    VectorField(VkDevice device, PhysicalDevice* physicalDevice, MemoryAllocator* allocator, UploadManager* uploadManager,
+                const std::string& path, uint32_t framesInFlight);
+    ~VectorField();
+
+    VectorField(const VectorField&) = delete;
+    VectorField& operator=(const VectorField&) = delete;
+};
+
+// Converts a raw dump of float x, y, z vectors (x fastest, frame after frame) into a field file
+void writeVectorField(const std::string& path, uint32_t width, uint32_t height, uint32_t depth, uint32_t frameCount,
+                      float frameDuration, const glm::vec3& boundsMin, const glm::vec3& boundsMax, const float* vectors);
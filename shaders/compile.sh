@@ -1,8 +1,9 @@
+mkdir -p ./compiled
 
 for file in ./*.{vert,comp,frag,glsl}
 do
   if [ -e "$file" ]; then
     filename=$(basename "$file")
-    glslc "$file" -o "./compiled/$filename.spv"
+    glslc --target-env=vulkan1.2 "$file" -o "./compiled/$filename.spv"
   fi
 done
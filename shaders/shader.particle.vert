@@ -9,15 +9,22 @@ layout(binding = 0) uniform PerspectiveUniformBufferObject {
 //    mat4 model;
 //} modelUBO;
 
+// Blends from the previous simulation step to the latest one when the simulation runs at a fixed rate
+layout(push_constant) uniform ParticlePushConstants {
+    float interpolation;
+} pc;
+
 layout(location = 0) in vec3 inPosition;
 layout(location = 1) in vec3 inColor;
+layout(location = 2) in vec3 inPreviousPosition;
 
 layout(location = 0) out vec3 fragColor;
 
 const float particleSize = 4.0f;
 void main() {
 
-    gl_Position = perspectiveUBO.proj * perspectiveUBO.view * vec4(inPosition, 1.0);
+    vec3 position = mix(inPreviousPosition, inPosition, pc.interpolation);
+    gl_Position = perspectiveUBO.proj * perspectiveUBO.view * vec4(position, 1.0);
     gl_PointSize = particleSize / gl_Position.w;
     fragColor = inColor;
 
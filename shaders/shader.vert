@@ -9,12 +9,23 @@ layout(binding = 1) uniform ModelUniformBufferObject {
     mat4 model;
 } modelUBO;
 
+struct MeshInstance {
+    mat4 model;
+    vec4 color;
+};
+
+// Instance 0 is the identity in white, used by the single (non instanced) mesh
+layout(std430, binding = 2) readonly buffer MeshInstances {
+    MeshInstance instances[];
+};
+
 layout(location = 0) in vec3 inPosition;
 layout(location = 1) in vec3 inColor;
 
 layout(location = 0) out vec3 fragColor;
 
 void main() {
-    gl_Position = perspectiveUBO.proj * perspectiveUBO.view * modelUBO.model * vec4(inPosition, 1.0);
-    fragColor = inColor;
+    MeshInstance instance = instances[gl_InstanceIndex];
+    gl_Position = perspectiveUBO.proj * perspectiveUBO.view * modelUBO.model * instance.model * vec4(inPosition, 1.0);
+    fragColor = inColor * instance.color.rgb;
 }
\ No newline at end of file
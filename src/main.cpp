@@ -1,7 +1,9 @@
 #include "renderer/engine.hpp"
 
 #include <chrono>
+#include <cmath>
 #include <thread>
+#include <string>
 
 std::vector<Vertex> vertices = {
         {{-0.5f, -0.5f, 0.0f}, {1.0f, 0.0f, 0.0f}},
@@ -20,29 +22,458 @@ std::vector<uint32_t> indices = {
         4, 5, 6, 6, 7, 4
 };
 
-int main() {
+// Steps the CPU backend with every instruction set the machine supports, no window or GPU needed
+static void runCpuBenchmark(size_t steps) {
+    ThreadPool threadPool;
+    std::vector<Particle> particles(PARTICLE_COUNT);
+    Particle::initializeSphere(particles.data(), particles.size(), VELOCITY_FACTOR, 0);
+
+    const glm::vec4 gravityPoint = glm::vec4(0.5f, 0.0f, 0.0f, 1.0f);
+    const float deltaTime = 2000.0f / 60.0f;
+
+    printf("%u particles, %zu threads\n", PARTICLE_COUNT, threadPool.size() + 1);
+    for (SimdLevel level = SimdLevel::Scalar; level <= detectSimdLevel(); level = (SimdLevel) ((int) level + 1)) {
+        CpuSimulation simulation(PARTICLE_COUNT, &threadPool);
+        simulation.simdlevel = level;
+        simulation.load(particles.data());
+
+        auto timeStart = std::chrono::high_resolution_clock::now();
+        for (size_t step = 0; step < steps; step++) {
+            simulation.step(gravityPoint, deltaTime);
+        }
+        auto timeNow = std::chrono::high_resolution_clock::now();
+
+        double seconds = std::chrono::duration<double>(timeNow - timeStart).count();
+        printf("%s: %.1f million particles/s\n", getSimdLevelName(level), (double) PARTICLE_COUNT * steps / seconds / 1e6);
+    }
+}
+
+// The unordered_map deduplication setMesh used before, as the baseline of the benchmark
+static void deduplicateWithUnorderedMap(std::vector<Vertex>& vertices, std::vector<uint32_t>& indices) {
+    std::unordered_map<Vertex, uint32_t> uniqueVertices = {};
+
+    std::vector<Vertex> deduplicatedVertices;
+    std::vector<uint32_t> deduplicatedIndices;
+
+    for (const auto& index : indices) {
+        const Vertex& vertex = vertices[index];
+
+        if (uniqueVertices.count(vertex) == 0) {
+            uniqueVertices[vertex] = static_cast<uint32_t>(deduplicatedVertices.size());
+            deduplicatedVertices.push_back(vertex);
+        }
+
+        deduplicatedIndices.push_back(uniqueVertices[vertex]);
+    }
+
+    vertices = std::move(deduplicatedVertices);
+    indices = std::move(deduplicatedIndices);
+}
+
+// Deduplicates a triangle soup grid (three vertices per triangle, like an unindexed model file) both ways
+static void runDeduplicationBenchmark(size_t triangles) {
+    size_t side = std::max<size_t>(1, (size_t) std::sqrt(triangles / 2.0));
+
+    std::vector<Vertex> gridVertices;
+    gridVertices.reserve(side * side * 6);
+    for (size_t y = 0; y < side; y++) {
+        for (size_t x = 0; x < side; x++) {
+            auto corner = [side](size_t cornerX, size_t cornerY) {
+                glm::vec3 position((float) cornerX / side, (float) cornerY / side, 0.0f);
+                return Vertex{position, glm::vec3(position.x, position.y, 1.0f)};
+            };
+            for (Vertex vertex: {corner(x, y), corner(x + 1, y), corner(x + 1, y + 1),
+                                 corner(x + 1, y + 1), corner(x, y + 1), corner(x, y)}) {
+                gridVertices.push_back(vertex);
+            }
+        }
+    }
+    std::vector<uint32_t> gridIndices(gridVertices.size());
+    for (size_t i = 0; i < gridIndices.size(); i++) {
+        gridIndices[i] = (uint32_t) i;
+    }
+    printf("%zu triangles, %zu vertices\n", gridVertices.size() / 3, gridVertices.size());
+
+    ThreadPool threadPool;
+    double baselineSeconds = 0.0;
+    std::vector<Vertex> baselineVertices;
+    std::vector<uint32_t> baselineIndices;
+    for (bool baseline: {true, false}) {
+        std::vector<Vertex> vertices = gridVertices;
+        std::vector<uint32_t> indices = gridIndices;
+
+        auto timeStart = std::chrono::high_resolution_clock::now();
+        if (baseline) {
+            deduplicateWithUnorderedMap(vertices, indices);
+        } else {
+            deduplicateVertices(vertices, indices, &threadPool);
+        }
+        auto timeNow = std::chrono::high_resolution_clock::now();
+        double seconds = std::chrono::duration<double>(timeNow - timeStart).count();
+
+        printf("%s: %.1f ms, %.1f million vertices/s, %zu unique", baseline ? "unordered_map" : "open addressing",
+               seconds * 1000.0, gridVertices.size() / seconds / 1e6, vertices.size());
+        if (baseline) {
+            baselineSeconds = seconds;
+            baselineVertices = vertices;
+            baselineIndices = indices;
+            printf("\n");
+        } else {
+            printf(", %.1fx faster, %s\n", baselineSeconds / seconds,
+                   vertices == baselineVertices && indices == baselineIndices ? "same result" : "DIFFERENT RESULT");
+        }
+    }
+}
+
+static std::vector<uint32_t> getIndices(const MeshData& mesh) {
+    std::vector<uint32_t> indices(mesh.indexcount);
+    for (size_t i = 0; i < indices.size(); i++) {
+        indices[i] = mesh.indextype == VK_INDEX_TYPE_UINT16 ? static_cast<const uint16_t*>(mesh.indices)[i]
+                                                            : static_cast<const uint32_t*>(mesh.indices)[i];
+    }
+    return indices;
+}
+
+// Optimizes an OBJ (or re-reads a binary mesh) and writes it in the binary format, then times mapping it back
+static void runMeshConversion(const std::string& inputPath, const std::string& outputPath) {
+    ThreadPool threadPool;
+
+    auto timeStart = std::chrono::high_resolution_clock::now();
+    MeshData mesh = loadMesh(inputPath, &threadPool);
+    auto timeNow = std::chrono::high_resolution_clock::now();
+    printf("%s: %u vertices, %u triangles, loaded in %.1f ms\n", inputPath.c_str(), mesh.vertexcount, mesh.indexcount / 3,
+           std::chrono::duration<double, std::milli>(timeNow - timeStart).count());
+    printf("%.3f vertex shader invocations per triangle, %zu vertex and %zu index bytes (%zu bit indices)\n",
+           getAverageCacheMissRatio(getIndices(mesh), mesh.vertexcount),
+           (size_t) mesh.vertexSize(), (size_t) mesh.indexSize(), mesh.indextype == VK_INDEX_TYPE_UINT16 ? (size_t) 16 : (size_t) 32);
+
+    writeMesh(outputPath, mesh);
+
+    timeStart = std::chrono::high_resolution_clock::now();
+    MeshData mappedMesh(outputPath);
+    timeNow = std::chrono::high_resolution_clock::now();
+    printf("%s: mapped in %.3f ms\n", outputPath.c_str(), std::chrono::duration<double, std::milli>(timeNow - timeStart).count());
+}
+
+// Packs a raw float x, y, z dump into a half float field file spanning [-1, 1] on every axis
+static void runFieldConversion(const std::string& inputPath, uint32_t width, uint32_t height, uint32_t depth,
+                               uint32_t frameCount, float frameDuration, const std::string& outputPath) {
+    MappedFile input(inputPath);
+    size_t expectedSize = sizeof(float) * 3 * (size_t) width * height * depth * frameCount;
+    if (input.size != expectedSize) {
+        throw std::runtime_error(inputPath + " holds " + std::to_string(input.size) + " bytes instead of "
+                                 + std::to_string(expectedSize) + "!");
+    }
+
+    auto timeStart = std::chrono::high_resolution_clock::now();
+    writeVectorField(outputPath, width, height, depth, frameCount, frameDuration, glm::vec3(-1.0f), glm::vec3(1.0f),
+                     reinterpret_cast<const float*>(input.data));
+    auto timeNow = std::chrono::high_resolution_clock::now();
+
+    printf("%s: %u frames of %ux%ux%u, %zu bytes as float, %zu bytes as half float, written in %.1f ms\n",
+           outputPath.c_str(), frameCount, width, height, depth, expectedSize, expectedSize / 3 * 4 / 2,
+           std::chrono::duration<double, std::milli>(timeNow - timeStart).count());
+}
+
+// Moves the gravity point of a running engine in a circle at the given rate, like an external controller would
+static void runControlProducer(const std::string& name, double rate, double seconds) {
+    ControlProducer producer(name);
+    auto interval = std::chrono::duration<double>(1.0 / rate);
+    auto timeStart = std::chrono::steady_clock::now();
+    auto next = timeStart;
+
+    uint64_t sent = 0;
+    while (std::chrono::steady_clock::now() - timeStart < std::chrono::duration<double>(seconds)) {
+        float angle = static_cast<float>(sent) / static_cast<float>(rate) * 2.0f;
+        ControlMessage message = {};
+        message.fields = CONTROL_GRAVITY_POINT;
+        message.gravitypoint[0] = 0.5f * std::cos(angle);
+        message.gravitypoint[1] = 0.5f * std::sin(angle);
+        message.gravitypoint[3] = 1.0f;
+        if (producer.send(message)) {
+            sent++;
+        }
+
+        next += std::chrono::duration_cast<std::chrono::steady_clock::duration>(interval);
+        std::this_thread::sleep_until(next);
+    }
+
+    printf("Sent %llu control messages, %llu dropped\n", static_cast<unsigned long long>(sent),
+           static_cast<unsigned long long>(producer.droppedmessages));
+}
+
+// Speed percentiles are the upper edges of the histogram bins they fall into
+static void printStatistics(const SimulationStatistics& statistics) {
+    uint64_t total = 0;
+    for (uint32_t count: statistics.histogram) {
+        total += count;
+    }
+
+    const float PERCENTILES[] = {0.5f, 0.9f, 0.99f};
+    float speeds[3] = {};
+    float binWidth = STATISTICS_HISTOGRAM_MAX_SPEED / static_cast<float>(STATISTICS_HISTOGRAM_BINS);
+    uint64_t counted = 0;
+    size_t percentile = 0;
+    for (uint32_t bin = 0; bin < STATISTICS_HISTOGRAM_BINS && percentile < 3; bin++) {
+        counted += statistics.histogram[bin];
+        while (percentile < 3 && counted >= PERCENTILES[percentile] * static_cast<float>(total)) {
+            speeds[percentile++] = binWidth * static_cast<float>(bin + 1);
+        }
+    }
+
+    printf("Frame %llu: bounds (%.3f, %.3f, %.3f) - (%.3f, %.3f, %.3f), centre of mass (%.3f, %.3f, %.3f)\n",
+           static_cast<unsigned long long>(statistics.frame),
+           statistics.boundsmin.x, statistics.boundsmin.y, statistics.boundsmin.z,
+           statistics.boundsmax.x, statistics.boundsmax.y, statistics.boundsmax.z,
+           statistics.centreofmass.x, statistics.centreofmass.y, statistics.centreofmass.z);
+    printf("    kinetic energy %.6f, speed max %.4f, median < %.4f, 90%% < %.4f, 99%% < %.4f\n",
+           statistics.kineticenergy, statistics.maxspeed, speeds[0], speeds[1], speeds[2]);
+}
+
+static void printTraceSummary(const std::vector<TraceZoneSummary>& summary) {
+    printf("Frame trace, last %u events per zone:\n", TRACE_SUMMARY_WINDOW);
+    for (const TraceZoneSummary& zone: summary) {
+        printf("    %-22s p50 %8.3f ms  p99 %8.3f ms  max %8.3f ms  (%llu events)\n", zone.name.c_str(), zone.p50, zone.p99,
+               zone.maximum, static_cast<unsigned long long>(zone.count));
+    }
+}
+
+int main(int argc, char** argv) {
+    // --restore <file>                   start from a checkpoint
+    // --checkpoint <file> <frames>       save a checkpoint every n frames
+    // --record <file> <frames>           record every n-th frame into a trajectory file
+    // --replay <file>                    play a recorded trajectory back instead of simulating
+    // --cpu-benchmark <steps>            measure the CPU backend and exit
+    // --validate <steps>                 compare the compute shader with the CPU backend headless and exit
+    // --validate-particles <count>       particles the validation runs with, a multiple of 256 (all by default)
+    // --sort-benchmark <max elements>    time the GPU radix sort and prefix scan from 1M elements up and exit
+    // --dedup-benchmark <triangles>      measure vertex deduplication and exit
+    // --mesh <file>                      draw an OBJ or binary mesh file
+    // --convert-mesh <obj> <file>        optimize a mesh into the binary format and exit
+    // --field <file> <strength>          add a precomputed vector field to the particle update
+    // --convert-field <raw> <width> <height> <depth> <frames> <frame duration> <file>
+    //                                    pack raw float vectors into a field file and exit
+    // --pm-gravity <strength>            mutual gravity between the particles (G times the total mass, e.g. 1e-7)
+    // --fluid <resolution> <coupling>    drag the particles along with a fluid simulated on a resolution^3 grid
+    // --frame-budget <milliseconds>      lower the render resolution to keep the GPU time of a frame within the budget
+    // --sim-rate <steps per second>      simulate at a fixed rate and interpolate the drawn particles
+    // --stats <frames>                   print particle statistics reduced on the GPU every number of frames
+    // --depth-sort                       draw the particles back to front for correct blending
+    // --stream <particles>               stream more particles than fit into device memory through it in chunks
+    // --stream-file <checkpoint>         stream the particles of a checkpoint, updating the file in place
+    // --trace <file>                     time the phases of every frame and write them as a Chrome trace on exit
+    // --trace-summary <frames>           print p50/p99 of every frame phase every number of frames
+    // --control <name>                   accept parameters from other processes through shared memory
+    // --control-send <name> <rate> <seconds>
+    //                                    drive a running engine's gravity point at rate Hz and exit
+    std::string restorePath;
+    std::string checkpointPath;
+    size_t checkpointInterval = 0;
+    std::string recordPath;
+    uint32_t recordInterval = 1;
+    std::string replayPath;
+    size_t validationSteps = 0;
+    uint32_t validationParticles = PARTICLE_COUNT;
+    uint32_t sortBenchmarkCount = 0;
+    std::string meshPath;
+    std::string fieldPath;
+    float fieldStrength = 1.0f;
+    float pmGravityStrength = 0.0f;
+    uint32_t fluidResolution = 64;
+    float fluidCoupling = 0.0f;
+    float simulationRate = 0.0f;
+    float frameBudget = 0.0f;
+    size_t statisticsInterval = 0;
+    bool depthSort = false;
+    uint64_t streamCount = 0;
+    std::string streamPath;
+    std::string controlName;
+    std::string tracePath;
+    size_t traceSummaryInterval = 0;
+
+    for (int i = 1; i < argc; i++) {
+        std::string argument = argv[i];
+        if (argument == "--restore" && i + 1 < argc) {
+            restorePath = argv[++i];
+        } else if (argument == "--checkpoint" && i + 2 < argc) {
+            checkpointPath = argv[++i];
+            checkpointInterval = std::stoul(argv[++i]);
+        } else if (argument == "--record" && i + 2 < argc) {
+            recordPath = argv[++i];
+            recordInterval = static_cast<uint32_t>(std::stoul(argv[++i]));
+        } else if (argument == "--replay" && i + 1 < argc) {
+            replayPath = argv[++i];
+        } else if (argument == "--cpu-benchmark" && i + 1 < argc) {
+            runCpuBenchmark(std::stoul(argv[++i]));
+            return 0;
+        } else if (argument == "--dedup-benchmark" && i + 1 < argc) {
+            runDeduplicationBenchmark(std::stoul(argv[++i]));
+            return 0;
+        } else if (argument == "--mesh" && i + 1 < argc) {
+            meshPath = argv[++i];
+        } else if (argument == "--convert-mesh" && i + 2 < argc) {
+            runMeshConversion(argv[i + 1], argv[i + 2]);
+            return 0;
+        } else if (argument == "--field" && i + 2 < argc) {
+            fieldPath = argv[++i];
+            fieldStrength = std::stof(argv[++i]);
+        } else if (argument == "--convert-field" && i + 7 < argc) {
+            runFieldConversion(argv[i + 1], static_cast<uint32_t>(std::stoul(argv[i + 2])), static_cast<uint32_t>(std::stoul(argv[i + 3])),
+                               static_cast<uint32_t>(std::stoul(argv[i + 4])), static_cast<uint32_t>(std::stoul(argv[i + 5])),
+                               std::stof(argv[i + 6]), argv[i + 7]);
+            return 0;
+        } else if (argument == "--pm-gravity" && i + 1 < argc) {
+            pmGravityStrength = std::stof(argv[++i]);
+        } else if (argument == "--fluid" && i + 2 < argc) {
+            fluidResolution = static_cast<uint32_t>(std::stoul(argv[++i]));
+            fluidCoupling = std::stof(argv[++i]);
+        } else if (argument == "--frame-budget" && i + 1 < argc) {
+            frameBudget = std::stof(argv[++i]);
+        } else if (argument == "--sim-rate" && i + 1 < argc) {
+            simulationRate = std::stof(argv[++i]);
+        } else if (argument == "--depth-sort") {
+            depthSort = true;
+        } else if (argument == "--stream" && i + 1 < argc) {
+            streamCount = std::stoull(argv[++i]);
+        } else if (argument == "--stream-file" && i + 1 < argc) {
+            streamPath = argv[++i];
+        } else if (argument == "--stats" && i + 1 < argc) {
+            statisticsInterval = std::stoul(argv[++i]);
+        } else if (argument == "--trace" && i + 1 < argc) {
+            tracePath = argv[++i];
+        } else if (argument == "--trace-summary" && i + 1 < argc) {
+            traceSummaryInterval = std::stoul(argv[++i]);
+        } else if (argument == "--control" && i + 1 < argc) {
+            controlName = argv[++i];
+        } else if (argument == "--control-send" && i + 3 < argc) {
+            runControlProducer(argv[i + 1], std::stod(argv[i + 2]), std::stod(argv[i + 3]));
+            return 0;
+        } else if (argument == "--validate" && i + 1 < argc) {
+            validationSteps = std::stoul(argv[++i]);
+        } else if (argument == "--validate-particles" && i + 1 < argc) {
+            validationParticles = static_cast<uint32_t>(std::stoul(argv[++i]));
+        } else if (argument == "--sort-benchmark" && i + 1 < argc) {
+            sortBenchmarkCount = static_cast<uint32_t>(std::stoul(argv[++i]));
+        } else {
+            printf("Unknown argument: %s\n", argument.c_str());
+            return 1;
+        }
+    }
+
     // Forcing mailbox present mode due to nvidia linux driver bug
 //    const int MAILBOX_PRESENT_MODE = 1;
 
     RenderingEngine renderer = RenderingEngine("Arbitrary Field Control");
 //    renderer.setMesh(vertices, indices);
-    renderer.setMesh({{{0,0,0}, {0,0,0}}}, {0,1,2});
+    renderer.setMesh({{{0,0,0}, {0,0,0}}}, {0,0,0});
+    if (!meshPath.empty()) {
+        renderer.loadMesh(meshPath);
+    }
 
-    renderer.init();
+    if (!fieldPath.empty()) {
+        renderer.loadVectorField(fieldPath, fieldStrength);
+    }
+    renderer.setParticleMeshGravity(pmGravityStrength);
+    renderer.setFluid(fluidResolution, fluidCoupling);
+    renderer.setSimulationRate(simulationRate);
+    renderer.setFrameTimeBudget(frameBudget);
+    renderer.enableStatistics(statisticsInterval > 0);
+    renderer.enableDepthSort(depthSort);
+    if (streamCount > 0 || !streamPath.empty()) {
+        renderer.enableStreaming(streamPath, streamCount);
+    }
+    if (!controlName.empty()) {
+        renderer.openControlChannel(controlName);
+    }
+
+    if (!restorePath.empty()) {
+        renderer.loadCheckpoint(restorePath);
+    }
+
+    // The validation and the sort benchmark present nothing, so they also run without a display
+    if (validationSteps > 0) {
+        renderer.initHeadless(validationParticles);
+    } else if (sortBenchmarkCount > 0) {
+        // The benchmark needs no particles, the smallest count leaves the device memory to the sort
+        renderer.initHeadless(256);
+    } else {
+        renderer.init();
+    }
+    bool tracing = !tracePath.empty() || traceSummaryInterval > 0;
+    if (tracing) {
+        renderer.startTracing(!tracePath.empty());
+    }
+
+    if (validationSteps > 0) {
+        const uint32_t VALIDATION_SEED = 1;
+        return renderer.validateCompute(validationSteps, VALIDATION_SEED) ? 0 : 1;
+    }
+    if (sortBenchmarkCount > 0) {
+        return renderer.benchmarkSort(sortBenchmarkCount) ? 0 : 1;
+    }
+
+    if (!recordPath.empty()) {
+        const uint32_t KEYFRAME_INTERVAL = 30;
+        renderer.startRecording(recordPath, recordInterval, KEYFRAME_INTERVAL);
+    }
+    if (!replayPath.empty()) {
+        renderer.startReplay(replayPath);
+    }
 
     auto timeStart = std::chrono::high_resolution_clock::now();
 
     size_t frame = 0;
     while (!renderer.windowShouldClose()) {
         renderer.draw();
-//        renderer.setMesh(vertices, indices);
+//        renderer.updateDynamicMeshVertices(0, vertices);
 
         frame++;
+        if (checkpointInterval > 0 && frame % checkpointInterval == 0) {
+            renderer.saveCheckpoint(checkpointPath);
+        }
+        SimulationStatistics statistics;
+        if (statisticsInterval > 0 && frame % statisticsInterval == 0 && renderer.getSimulationStatistics(statistics)) {
+            printStatistics(statistics);
+        }
+        if (traceSummaryInterval > 0 && frame % traceSummaryInterval == 0) {
+            printTraceSummary(renderer.getTraceSummary());
+        }
     }
 
     auto timeNow = std::chrono::high_resolution_clock::now();
     double timeDifference = std::chrono::duration<double, std::milli>(timeNow - timeStart).count();
     printf("Average framerate: %f\n", frame / (timeDifference * 0.001));
+    if (frameBudget > 0.0f) {
+        ResolutionStatistics resolution = renderer.getResolutionStatistics();
+        printf("Rendering: %.3f ms GPU time per frame at %.0f%% resolution on average (%.3f ms budget, %llu frames timed)\n",
+               resolution.gputime, resolution.scale * 100.0, frameBudget, static_cast<unsigned long long>(resolution.samples));
+    }
+    if (simulationRate > 0.0f) {
+        printf("Average simulation rate: %f steps/s\n", renderer.getSimulationSteps() / (timeDifference * 0.001));
+    }
+
+    if (fluidCoupling > 0.0f) {
+        FluidTimings timings = renderer.getFluidTimings();
+        printf("Fluid solver at %u^3: advection %.3f ms, pressure %.3f ms, projection %.3f ms per frame (%llu frames timed)\n",
+               fluidResolution, timings.advection, timings.pressure, timings.projection,
+               static_cast<unsigned long long>(timings.samples));
+    }
+
+    if (!controlName.empty()) {
+        ControlLatency latency = renderer.getControlLatency();
+        printf("Control input: %llu messages, ingest to uniform buffer %.3f ms average / %.3f ms max, "
+               "ingest to simulated %.3f ms average / %.3f ms max\n",
+               static_cast<unsigned long long>(latency.ingest.samples), latency.ingest.average(), latency.ingest.maximum,
+               latency.gpu.average(), latency.gpu.maximum);
+    }
+
+    if (tracing) {
+        printTraceSummary(renderer.getTraceSummary());
+    }
+    if (!tracePath.empty()) {
+        renderer.writeChromeTrace(tracePath);
+        printf("Wrote frame trace to %s\n", tracePath.c_str());
+    }
 
     return 0;
 }